@@ -0,0 +1,145 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of submitting closures to ThreadPool.
+ *
+ * First, constructing, moving twice (as the pool does on enqueue and dequeue),
+ * invoking and destroying a closure on a single thread, for std::function,
+ * FixedFunction and SmallFunction, with a small (16 bytes) and a large
+ * (96 bytes) capture.
+ *
+ * Then, submission throughput from one outside thread of closures that each
+ * produce a value, consumed by:
+ *  - post:     the future returned by post, waited on by the submitter
+ *  - runThen:  a continuation called in place on the worker
+ *
+ * Usage: bench-closure [iterations] [submissions] [threads]
+ */
+
+#include "execution/threadpool/threadpool.h"
+#include "utils/fixed_function.hpp"
+#include "utils/smallfunction.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+std::atomic<uint64_t> g_sink{0};
+
+template<size_t N>
+struct Capture
+{
+    std::array<uint64_t, N / sizeof(uint64_t)> data{};
+};
+
+template<typename Function, size_t CaptureSize>
+double wrapperNsPerOp(size_t iterations)
+{
+    Capture<CaptureSize> cap;
+    auto start = Clock::now();
+    for (size_t i = 0; i != iterations; ++i) {
+        cap.data[0] = i;
+        Function f([cap]() { g_sink.fetch_add(cap.data[0], std::memory_order_relaxed); });
+        Function queued(std::move(f));
+        Function popped(std::move(queued));
+        popped();
+    }
+    auto dur = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return dur / iterations;
+}
+
+void printWrapper(const char *name, double small, double large)
+{
+    std::cout << std::setw(16) << name << std::setw(12) << std::fixed << std::setprecision(1) << small
+              << std::setw(12) << large << std::endl;
+}
+
+double postOpsPerSec(ThreadPool &pool, size_t submissions)
+{
+    std::vector<std::future<uint64_t>> futures;
+    futures.reserve(submissions);
+
+    auto start = Clock::now();
+    for (size_t i = 0; i != submissions; ++i) {
+        futures.emplace_back(pool.post([i]() { return i; }));
+    }
+    for (auto &fu : futures) {
+        g_sink.fetch_add(fu.get(), std::memory_order_relaxed);
+    }
+    return submissions / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double runThenOpsPerSec(ThreadPool &pool, size_t submissions)
+{
+    std::atomic<size_t> done{0};
+
+    auto start = Clock::now();
+    for (size_t i = 0; i != submissions; ++i) {
+        pool.runThen([i]() { return i; },
+                     [&done](uint64_t v) {
+                         g_sink.fetch_add(v, std::memory_order_relaxed);
+                         done.fetch_add(1, std::memory_order_release);
+                     });
+    }
+    while (done.load(std::memory_order_acquire) != submissions) {
+        std::this_thread::yield();
+    }
+    return submissions / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000000;
+    size_t submissions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    size_t numThreads = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+
+    std::cout << "ns per construct + 2 moves + invoke + destroy" << std::endl;
+    std::cout << std::setw(16) << "wrapper" << std::setw(12) << "16B" << std::setw(12) << "96B" << std::endl;
+    printWrapper("std::function", wrapperNsPerOp<std::function<void()>, 16>(iterations),
+                 wrapperNsPerOp<std::function<void()>, 96>(iterations));
+    printWrapper("FixedFunction", wrapperNsPerOp<sstl::FixedFunction<void()>, 16>(iterations),
+                 wrapperNsPerOp<sstl::FixedFunction<void()>, 96>(iterations));
+    printWrapper("SmallFunction", wrapperNsPerOp<sstl::SmallFunction<void()>, 16>(iterations),
+                 wrapperNsPerOp<sstl::SmallFunction<void()>, 96>(iterations));
+
+    std::cout << std::endl << "submissions per second, " << numThreads << " threads" << std::endl;
+    ThreadPool pool(ThreadPoolOptions().setNumThreads(numThreads));
+    // warm up the workers and the closure arena
+    runThenOpsPerSec(pool, submissions / 10);
+
+    std::cout << std::setw(16) << "post" << std::setw(14) << std::setprecision(0)
+              << postOpsPerSec(pool, submissions) << std::endl;
+    std::cout << std::setw(16) << "runThen" << std::setw(14) << std::setprecision(0)
+              << runThenOpsPerSec(pool, submissions) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost of finding and parsing the request body from the evenlop, per request:
+ *
+ *  - by name:  std::function map keyed by type name, body parsed with
+ *              createMessage looking up the prototype by type name, as
+ *              before method ids
+ *  - by id:    table indexed by evenlop.method, built from
+ *              CALL_ALL_SERVICE_NAME like RpcServerCore's, body parsed as
+ *              the concrete type
+ *  - fallback: same table scanned by evenlop.type, as for old clients
+ *
+ * Bodies are small RunRequests so the lookup is not hidden by parsing. The
+ * table is copied here to not link in the whole server core.
+ *
+ * Usage: bench-dispatch [iterations]
+ */
+
+#include "rpcserver/rpcservercore.h"
+#include "utils/protoutils.h"
+
+#include "protos.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+using Clock = std::chrono::steady_clock;
+using namespace executor;
+
+namespace {
+
+const std::unordered_map<std::string, std::function<size_t(const ::google::protobuf::Message &)>> &byNameTable()
+{
+    static const std::unordered_map<std::string, std::function<size_t(const ::google::protobuf::Message &)>> funcs{
+#define ITEM(name)                                                                                                     \
+    {"executor." #name "Request", [](const auto &msg) { return msg.ByteSizeLong(); }},
+
+        CALL_ALL_SERVICE_NAME(ITEM)
+
+#undef ITEM
+    };
+    return funcs;
+}
+
+struct ServiceEntry
+{
+    const char *typeName;
+    ProtoPtr (*parse)(const void *, size_t);
+};
+
+template<typename Request>
+ProtoPtr parseAs(const void *data, size_t len)
+{
+    return sstl::parseMessage<Request>(data, len);
+}
+
+#define ITEM(name) {"executor." #name "Request", &parseAs<name##Request>},
+
+constexpr ServiceEntry kServices[] = {
+    {"", nullptr},
+    CALL_ALL_SERVICE_NAME(ITEM)
+};
+
+#undef ITEM
+
+ProtoPtr parseRequest(const EvenlopDef &evenlop, const void *data, size_t len)
+{
+    auto method = evenlop.method();
+    if (method > UNKNOWN_SERVICE_METHOD && method < ServiceMethod_ARRAYSIZE) {
+        return kServices[method].parse(data, len);
+    }
+    for (size_t i = 1; i != std::size(kServices); ++i) {
+        if (evenlop.type() == kServices[i].typeName) {
+            return kServices[i].parse(data, len);
+        }
+    }
+    return nullptr;
+}
+
+template<typename Fn>
+void runMode(const char *name, size_t iterations, Fn &&fn)
+{
+    size_t sink = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i != iterations; ++i) {
+        sink += fn();
+    }
+    auto ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+    std::cout << std::setw(10) << name << std::setw(12) << std::fixed << std::setprecision(1) << ns
+              << std::setw(12) << sink / iterations << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    RunRequest req;
+    req.mutable_opkernel()->set_id("bench");
+    req.mutable_opkernel()->set_oplibrary(TENSORFLOW);
+    auto body = req.SerializeAsString();
+
+    EvenlopDef byType;
+    byType.set_type("executor.RunRequest");
+    EvenlopDef byId;
+    byId.set_method(RUN);
+
+    std::cout << std::setw(10) << "mode" << std::setw(12) << "ns/req" << std::setw(12) << "bytes" << std::endl;
+
+    runMode("by name", iterations, [&]() -> size_t {
+        auto &funcs = byNameTable();
+        auto it = funcs.find(byType.type());
+        auto msg = sstl::createMessage(byType.type(), body.data(), body.size());
+        return it == funcs.end() || !msg ? 0 : it->second(*msg);
+    });
+    runMode("by id", iterations, [&]() -> size_t {
+        auto msg = parseRequest(byId, body.data(), body.size());
+        return msg ? msg->ByteSizeLong() : 0;
+    });
+    runMode("fallback", iterations, [&]() -> size_t {
+        auto msg = parseRequest(byType, body.data(), body.size());
+        return msg ? msg->ByteSizeLong() : 0;
+    });
+
+    return 0;
+}
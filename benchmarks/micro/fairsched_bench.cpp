@@ -0,0 +1,202 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the cost of a scheduling iteration of TaskExecutor::scheduleLoop,
+ * with 1 to 1000 synthetic sessions whose GPU memory usage changes between
+ * iterations. Each round queues one no-op task to each of a few sessions and
+ * waits for all of them to run, so a round is about one iteration of the
+ * loop, which orders all sessions with the scheduler.
+ *
+ * Usage: bench-fairsched [rounds] [scheduler]
+ */
+
+#include "execution/engine/resourcecontext.h"
+#include "execution/engine/taskexecutor.h"
+#include "execution/operationtask.h"
+#include "execution/scheduler/basescheduler.h"
+#include "execution/scheduler/operationitem.h"
+#include "execution/scheduler/sessionitem.h"
+#include "execution/threadpool/threadpool.h"
+#include "resources/resources.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace salus;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Sessions touched per round
+constexpr size_t kTasksPerRound = 4;
+
+/**
+ * @brief Does nothing but count that it ran
+ */
+class BenchTask : public OperationTask
+{
+public:
+    explicit BenchTask(std::atomic<size_t> &done)
+        : m_done(done)
+    {
+    }
+
+    std::string DebugString() const override
+    {
+        return "BenchTask";
+    }
+
+    uint64_t graphId() const override
+    {
+        return 0;
+    }
+
+    Resources estimatedUsage(const DeviceSpec &) override
+    {
+        return {};
+    }
+
+    bool hasExactEstimation(const DeviceSpec &) override
+    {
+        return true;
+    }
+
+    DeviceTypes supportedDeviceTypes() const override
+    {
+        static std::vector<DeviceType> types{DeviceType::GPU};
+        return types;
+    }
+
+    int failedTimes() const override
+    {
+        return 0;
+    }
+
+    bool prepare(std::unique_ptr<ResourceContext> &&rctx) noexcept override
+    {
+        m_rctx = std::move(rctx);
+        return true;
+    }
+
+    ResourceContext &resourceContext() const override
+    {
+        return *m_rctx;
+    }
+
+    bool isAsync() const override
+    {
+        return false;
+    }
+
+    void run(Callbacks cbs) noexcept override
+    {
+        m_done.fetch_add(1, std::memory_order_release);
+        cbs.done();
+    }
+
+    void cancel() override
+    {
+    }
+
+private:
+    std::atomic<size_t> &m_done;
+    std::unique_ptr<ResourceContext> m_rctx;
+};
+
+/**
+ * @returns average nanoseconds per round
+ */
+uint64_t runRounds(size_t nSessions, size_t rounds, const std::string &scheduler)
+{
+    ThreadPool pool;
+    ResourceMonitor resMon;
+    resMon.initializeLimits();
+    SchedulingParam param;
+    param.scheduler = scheduler;
+    TaskExecutor taskExec(pool, resMon, param);
+    taskExec.startExecution();
+
+    std::vector<PSessionItem> sessions;
+    for (size_t i = 0; i != nSessions; ++i) {
+        auto sess = std::make_shared<SessionItem>("sess" + std::to_string(i));
+        sess->setExclusiveMode(false);
+        taskExec.insertSession(sess);
+        sessions.emplace_back(std::move(sess));
+    }
+
+    std::atomic<size_t> done{0};
+    size_t queued = 0;
+    std::mt19937_64 rng(42);
+    auto runRound = [&]() {
+        for (size_t k = 0; k != kTasksPerRound; ++k) {
+            auto &sess = sessions[rng() % nSessions];
+            // Allocating or freeing memory between iterations
+            sess->resourceUsage(resources::GPU0Memory) = rng() % (1ull << 30);
+
+            auto item = OperationItem::create();
+            item->sess = sess;
+            item->op = std::make_unique<BenchTask>(done);
+            taskExec.queueTask(std::move(item));
+            ++queued;
+        }
+        while (done.load(std::memory_order_acquire) != queued) {
+            std::this_thread::yield();
+        }
+    };
+
+    // Let all sessions be accepted first
+    runRound();
+
+    auto start = Clock::now();
+    for (size_t i = 0; i != rounds; ++i) {
+        runRound();
+    }
+    auto elapsed = Clock::now() - start;
+
+    for (auto &sess : sessions) {
+        taskExec.deleteSession(sess);
+    }
+    sessions.clear();
+    taskExec.stopExecution();
+
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / rounds;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t rounds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    std::string name = argc > 2 ? argv[2] : "fair";
+
+    std::cout << std::setw(10) << "sessions" << std::setw(16) << "ns/round" << std::endl;
+
+    for (size_t nSessions : {1, 10, 100, 1000}) {
+        std::cout << std::setw(10) << nSessions << std::setw(16) << runRounds(nSessions, rounds, name) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures how often work leaves its node in ThreadPool. Each session runs
+ * chains of ops that each sweep over a per-session buffer, submitting the
+ * next op from the finishing one like the executor does. Sessions are given
+ * a home node round robin.
+ *
+ *  - unaware: no placement, workers float over all CPUs
+ *  - numa:    NUMA aware pool, ops hinted with their session's home node
+ *
+ * Reports steals, steals crossing nodes, and the fraction of ops that ran on
+ * a CPU outside their session's home node.
+ *
+ * Usage: bench-numa [sessions] [ops per session] [buffer KB] [cpu list]
+ */
+
+#include "execution/threadpool/threadpool.h"
+#include "platform/topology.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace salus::threading;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Session
+{
+    std::vector<uint64_t> buffer;
+    int homeNode = ThreadPool::kAnyNode;
+    // node index in topology, for reporting
+    int reportNode = 0;
+
+    std::atomic<size_t> remaining{0};
+    std::atomic<size_t> offNode{0};
+    std::atomic<uint64_t> sink{0};
+};
+
+struct Result
+{
+    double seconds = 0;
+    size_t ops = 0;
+    size_t offNode = 0;
+    ThreadPool::Stats stats;
+};
+
+void runOp(ThreadPool &pool, const CpuTopology &topo, Session &sess, std::atomic<size_t> &chainsLeft)
+{
+    sess.sink += std::accumulate(sess.buffer.begin(), sess.buffer.end(), uint64_t{0});
+    if (topo.nodeOf(current_cpu()) != sess.reportNode) {
+        ++sess.offNode;
+    }
+
+    if (--sess.remaining == 0) {
+        --chainsLeft;
+        return;
+    }
+    pool.run([&pool, &topo, &sess, &chainsLeft]() { runOp(pool, topo, sess, chainsLeft); },
+             ThreadPool::Priority::Normal, sess.homeNode);
+}
+
+Result runConfig(const ThreadPoolOptions &opts, bool hint, size_t numSessions, size_t numOps, size_t bufferKB)
+{
+    ThreadPool pool(opts);
+    const auto &topo = CpuTopology::system();
+
+    std::vector<Session> sessions(numSessions);
+    for (size_t i = 0; i != numSessions; ++i) {
+        auto &sess = sessions[i];
+        sess.buffer.assign(bufferKB * 1024 / sizeof(uint64_t), i);
+        sess.remaining = numOps;
+        sess.reportNode = static_cast<int>(i % topo.nodes.size());
+        if (hint) {
+            sess.homeNode = static_cast<int>(i % pool.numNodes());
+        }
+    }
+
+    std::atomic<size_t> chainsLeft{numSessions};
+    auto start = Clock::now();
+    for (auto &sess : sessions) {
+        pool.run([&pool, &topo, &sess, &chainsLeft]() { runOp(pool, topo, sess, chainsLeft); },
+                 ThreadPool::Priority::Normal, sess.homeNode);
+    }
+    while (chainsLeft) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Result r;
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    r.ops = numSessions * numOps;
+    for (auto &sess : sessions) {
+        r.offNode += sess.offNode;
+    }
+    r.stats = pool.stats();
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t numSessions = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16;
+    size_t numOps = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+    size_t bufferKB = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 256;
+    auto cpus = parse_cpu_list(argc > 4 ? argv[4] : "");
+
+    const auto &topo = CpuTopology::system();
+    std::cout << "NUMA nodes:";
+    for (size_t i = 0; i != topo.nodes.size(); ++i) {
+        std::cout << " " << topo.nodeIds[i] << "(" << topo.nodes[i].size() << " cpus)";
+    }
+    std::cout << std::endl;
+    if (topo.nodes.size() < 2) {
+        std::cout << "Only one node, cross node numbers will be all zero" << std::endl;
+    }
+
+    ThreadPoolOptions base;
+    if (!cpus.empty()) {
+        base.setNumThreads(cpus.size()).setCpuAffinity(cpus);
+    }
+
+    std::cout << std::setw(10) << "config" << std::setw(14) << "ops/s" << std::setw(12) << "steals"
+              << std::setw(12) << "x-node" << std::setw(12) << "off-node %" << std::endl;
+
+    for (auto numa : {false, true}) {
+        auto opts = base;
+        opts.setNumaAware(numa);
+        auto r = runConfig(opts, numa, numSessions, numOps, bufferKB);
+
+        std::cout << std::setw(10) << (numa ? "numa" : "unaware") << std::setw(14) << std::fixed
+                  << std::setprecision(0) << r.ops / r.seconds << std::setw(12) << r.stats.steals
+                  << std::setw(12) << r.stats.crossNodeSteals << std::setw(12) << std::setprecision(1)
+                  << 100.0 * r.offNode / r.ops << std::endl;
+    }
+
+    return 0;
+}
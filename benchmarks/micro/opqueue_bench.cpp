@@ -0,0 +1,385 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures enqueue-to-dispatch latency of operations, with one producer
+ * thread per session queueing ops at a fixed rate (open loop):
+ *
+ *  - handoff-list: the old per-session queue, a std::list of shared_ptr
+ *                  guarded by a mutex, drained by one consumer thread
+ *  - handoff-mpsc: the intrusive MpscQueue of pooled OperationItem
+ *  - dispatch:     the full path through TaskExecutor and the scheduler,
+ *                  up to the op starting to run on the thread pool
+ *
+ * Usage: bench-opqueue [ops per session] [ops/s per session] [max sessions] [scheduler]
+ */
+
+#include "execution/engine/resourcecontext.h"
+#include "execution/engine/taskexecutor.h"
+#include "execution/operationtask.h"
+#include "execution/scheduler/basescheduler.h"
+#include "execution/scheduler/operationitem.h"
+#include "execution/scheduler/sessionitem.h"
+#include "execution/threadpool/threadpool.h"
+#include "resources/resources.h"
+#include "utils/mpscqueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace salus;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/**
+ * @brief Latencies of all ops in one run, recorded from any thread
+ */
+class Recorder
+{
+public:
+    explicit Recorder(size_t capacity)
+        : m_samples(capacity)
+    {
+    }
+
+    void record(Clock::time_point queued)
+    {
+        auto idx = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (idx < m_samples.size()) {
+            m_samples[idx] = static_cast<uint64_t>((Clock::now() - queued).count());
+        }
+    }
+
+    size_t count() const
+    {
+        return std::min(m_count.load(), m_samples.size());
+    }
+
+    // nanoseconds
+    uint64_t percentile(double p)
+    {
+        auto n = count();
+        if (!n) {
+            return 0;
+        }
+        std::sort(m_samples.begin(), m_samples.begin() + static_cast<long>(n));
+        auto idx = std::min(n - 1, static_cast<size_t>(p * n));
+        return m_samples[idx];
+    }
+
+private:
+    std::vector<uint64_t> m_samples;
+    std::atomic<size_t> m_count{0};
+};
+
+/**
+ * @brief Does nothing but record how long it waited since being queued
+ */
+class BenchTask : public OperationTask
+{
+public:
+    explicit BenchTask(Recorder &recorder)
+        : m_recorder(recorder)
+        , m_queued(Clock::now())
+    {
+    }
+
+    std::string DebugString() const override
+    {
+        return "BenchTask";
+    }
+
+    uint64_t graphId() const override
+    {
+        return 0;
+    }
+
+    Resources estimatedUsage(const DeviceSpec &) override
+    {
+        return {};
+    }
+
+    bool hasExactEstimation(const DeviceSpec &) override
+    {
+        return true;
+    }
+
+    DeviceTypes supportedDeviceTypes() const override
+    {
+        static std::vector<DeviceType> types{DeviceType::GPU};
+        return types;
+    }
+
+    int failedTimes() const override
+    {
+        return 0;
+    }
+
+    bool prepare(std::unique_ptr<ResourceContext> &&rctx) noexcept override
+    {
+        m_rctx = std::move(rctx);
+        return true;
+    }
+
+    ResourceContext &resourceContext() const override
+    {
+        return *m_rctx;
+    }
+
+    bool isAsync() const override
+    {
+        return false;
+    }
+
+    void run(Callbacks cbs) noexcept override
+    {
+        dispatched();
+        cbs.done();
+    }
+
+    void cancel() override
+    {
+    }
+
+    void dispatched()
+    {
+        m_recorder.record(m_queued);
+    }
+
+private:
+    Recorder &m_recorder;
+    Clock::time_point m_queued;
+    std::unique_ptr<ResourceContext> m_rctx;
+};
+
+// Same layout as OperationItem used to have
+struct LegacyItem
+{
+    std::weak_ptr<SessionItem> sess;
+    std::unique_ptr<OperationTask> op;
+    ResourceVector::Mask missingTags = 0;
+};
+
+struct LegacySession
+{
+    std::mutex mu;
+    std::list<std::shared_ptr<LegacyItem>> queue;
+    std::atomic_bool hasNewTasks{false};
+};
+
+struct MpscSession
+{
+    sstl::MpscQueue<OperationItem> queue;
+    std::atomic_bool hasNewTasks{false};
+};
+
+/**
+ * @brief Call `fn(i)` numOps times, spaced evenly to reach `rate` per second
+ */
+template<typename Fn>
+void produceAtRate(size_t numOps, double rate, Fn &&fn)
+{
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    auto next = Clock::now();
+    for (size_t i = 0; i != numOps; ++i) {
+        while (Clock::now() < next) {
+            std::this_thread::yield();
+        }
+        fn(i);
+        next += period;
+    }
+}
+
+void runHandoffList(size_t nSessions, size_t numOps, double rate, Recorder &recorder)
+{
+    std::vector<LegacySession> sessions(nSessions);
+    std::atomic<size_t> nProducing{nSessions};
+
+    std::vector<std::thread> producers;
+    for (auto &sess : sessions) {
+        producers.emplace_back([&]() {
+            produceAtRate(numOps, rate, [&](size_t) {
+                auto item = std::make_shared<LegacyItem>();
+                item->op = std::make_unique<BenchTask>(recorder);
+                auto g = std::lock_guard(sess.mu);
+                sess.queue.emplace_back(std::move(item));
+                sess.hasNewTasks.store(true, std::memory_order_release);
+            });
+            --nProducing;
+        });
+    }
+
+    std::list<std::shared_ptr<LegacyItem>> bgQueue;
+    while (nProducing || recorder.count() != nSessions * numOps) {
+        bool any = false;
+        for (auto &sess : sessions) {
+            if (sess.hasNewTasks.exchange(false, std::memory_order_acq_rel)) {
+                auto g = std::lock_guard(sess.mu);
+                bgQueue.splice(bgQueue.end(), sess.queue);
+            }
+            for (auto &item : bgQueue) {
+                static_cast<BenchTask &>(*item->op).dispatched();
+            }
+            any |= !bgQueue.empty();
+            bgQueue.clear();
+        }
+        if (!any) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto &t : producers) {
+        t.join();
+    }
+}
+
+void runHandoffMpsc(size_t nSessions, size_t numOps, double rate, Recorder &recorder)
+{
+    std::vector<MpscSession> sessions(nSessions);
+    std::atomic<size_t> nProducing{nSessions};
+
+    std::vector<std::thread> producers;
+    for (auto &sess : sessions) {
+        producers.emplace_back([&]() {
+            produceAtRate(numOps, rate, [&](size_t) {
+                auto item = OperationItem::create();
+                item->op = std::make_unique<BenchTask>(recorder);
+                sess.queue.push(item.detach());
+                sess.hasNewTasks.store(true, std::memory_order_release);
+            });
+            --nProducing;
+        });
+    }
+
+    std::vector<POpItem> bgQueue;
+    while (nProducing || recorder.count() != nSessions * numOps) {
+        bool any = false;
+        for (auto &sess : sessions) {
+            if (sess.hasNewTasks.exchange(false, std::memory_order_acq_rel)) {
+                while (auto item = sess.queue.pop()) {
+                    bgQueue.emplace_back(item, /*add_ref=*/false);
+                }
+            }
+            for (auto &item : bgQueue) {
+                static_cast<BenchTask &>(*item->op).dispatched();
+            }
+            any |= !bgQueue.empty();
+            bgQueue.clear();
+        }
+        if (!any) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto &t : producers) {
+        t.join();
+    }
+}
+
+void runDispatch(size_t nSessions, size_t numOps, double rate, const std::string &scheduler,
+                 Recorder &recorder)
+{
+    ThreadPool pool;
+    ResourceMonitor resMon;
+    resMon.initializeLimits();
+    SchedulingParam param;
+    param.scheduler = scheduler;
+    TaskExecutor taskExec(pool, resMon, param);
+    taskExec.startExecution();
+
+    std::vector<PSessionItem> sessions;
+    for (size_t i = 0; i != nSessions; ++i) {
+        auto sess = std::make_shared<SessionItem>("sess" + std::to_string(i));
+        sess->setExclusiveMode(false);
+        taskExec.insertSession(sess);
+        sessions.emplace_back(std::move(sess));
+    }
+
+    std::vector<std::thread> producers;
+    for (auto &sess : sessions) {
+        producers.emplace_back([&]() {
+            produceAtRate(numOps, rate, [&](size_t) {
+                auto item = OperationItem::create();
+                item->sess = sess;
+                item->op = std::make_unique<BenchTask>(recorder);
+                taskExec.queueTask(std::move(item));
+            });
+        });
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+
+    while (recorder.count() != nSessions * numOps) {
+        std::this_thread::yield();
+    }
+
+    for (auto &sess : sessions) {
+        taskExec.deleteSession(sess);
+    }
+    sessions.clear();
+    taskExec.stopExecution();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t numOps = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    double rate = argc > 2 ? std::atof(argv[2]) : 100000;
+    size_t maxSessions = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 4;
+    std::string scheduler = argc > 4 ? argv[4] : "fair";
+
+    std::cout << std::setw(14) << "mode" << std::setw(10) << "sessions" << std::setw(14) << "ops/s/sess"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(12) << "p99.9 us"
+              << std::setw(10) << "max us" << std::endl;
+
+    for (size_t nSessions = 1; nSessions <= maxSessions; nSessions *= 2) {
+        for (const std::string mode : {"handoff-list", "handoff-mpsc", "dispatch"}) {
+            Recorder recorder(nSessions * numOps);
+
+            auto start = Clock::now();
+            if (mode == "handoff-list") {
+                runHandoffList(nSessions, numOps, rate, recorder);
+            } else if (mode == "handoff-mpsc") {
+                runHandoffMpsc(nSessions, numOps, rate, recorder);
+            } else {
+                runDispatch(nSessions, numOps, rate, scheduler, recorder);
+            }
+            auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+            std::cout << std::setw(14) << mode << std::setw(10) << nSessions << std::setw(14) << std::fixed
+                      << std::setprecision(0) << numOps / elapsed << std::setprecision(1) << std::setw(10)
+                      << recorder.percentile(0.5) / 1e3 << std::setw(10) << recorder.percentile(0.99) / 1e3
+                      << std::setw(12) << recorder.percentile(0.999) / 1e3 << std::setw(10)
+                      << recorder.percentile(1.0) / 1e3 << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Heap allocations and time per RunStep worth of protobuf work on the
+ * server: parse the request, build the response with one entry per fetch,
+ * and serialize it, with the messages
+ *
+ *  - heap:  allocated on heap, as before
+ *  - arena: allocated on a pooled arena from sstl::ScopedArena
+ *
+ * TensorFlow protos are not available here, so google.protobuf.Struct stands
+ * in: the request has a name per feed and fetch, and each fetch in the
+ * response is a nested struct with name, dtype, shape and content, like a
+ * NamedTensorProto. Allocations are counted by replacing operator new.
+ *
+ * Usage: bench-protoarena [steps] [fetches] [content bytes]
+ */
+
+#include "utils/protoutils.h"
+
+#include <google/protobuf/struct.pb.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+using google::protobuf::Struct;
+using google::protobuf::Value;
+
+namespace {
+std::atomic<uint64_t> numAllocs{0};
+} // namespace
+
+void *operator new(size_t size)
+{
+    numAllocs.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+std::string makeRequest(size_t numFetches)
+{
+    Struct req;
+    auto &fields = *req.mutable_fields();
+    fields["session_handle"].set_string_value("bench");
+    auto fetches = fields["fetch"].mutable_list_value();
+    for (size_t i = 0; i != numFetches; ++i) {
+        fetches->add_values()->set_string_value("layer_" + std::to_string(i) + "/output:0");
+    }
+    return req.SerializeAsString();
+}
+
+void fillResponse(const Struct &req, Struct &resp, const std::string &content)
+{
+    auto tensors = (*resp.mutable_fields())["tensor"].mutable_list_value();
+    for (const auto &fetch : req.fields().at("fetch").list_value().values()) {
+        auto &named = *tensors->add_values()->mutable_struct_value()->mutable_fields();
+        named["name"].set_string_value(fetch.string_value());
+        named["dtype"].set_number_value(1);
+        auto shape = named["shape"].mutable_list_value();
+        shape->add_values()->set_number_value(32);
+        shape->add_values()->set_number_value(static_cast<double>(content.size() / 32));
+        named["content"].set_string_value(content);
+    }
+}
+
+template<typename Fn>
+void runMode(const char *name, size_t steps, Fn &&fn)
+{
+    // Warm up pools
+    fn();
+
+    size_t bytes = 0;
+    auto allocsBefore = numAllocs.load();
+    auto start = Clock::now();
+    for (size_t i = 0; i != steps; ++i) {
+        bytes += fn();
+    }
+    auto us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / steps;
+    auto allocs = static_cast<double>(numAllocs.load() - allocsBefore) / steps;
+
+    std::cout << std::setw(8) << name << std::setw(14) << std::fixed << std::setprecision(1) << allocs
+              << std::setw(12) << us << std::setw(12) << bytes / steps << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t steps = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+    size_t numFetches = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500;
+    size_t contentBytes = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64;
+
+    const auto body = makeRequest(numFetches);
+    const std::string content(contentBytes, 'x');
+
+    std::cout << std::setw(8) << "mode" << std::setw(14) << "allocs/step" << std::setw(12) << "us/step"
+              << std::setw(12) << "resp bytes" << std::endl;
+
+    runMode("heap", steps, [&]() -> size_t {
+        auto req = sstl::parseMessage<Struct>(body.data(), body.size());
+        auto resp = std::make_unique<Struct>();
+        fillResponse(*req, *resp, content);
+        return resp->SerializeAsString().size();
+    });
+    runMode("arena", steps, [&]() -> size_t {
+        auto arena = sstl::ScopedArena::acquire();
+        auto req = sstl::parseMessage<Struct>(arena.get(), body.data(), body.size());
+        auto resp = sstl::newMessage<Struct>(arena.get());
+        fillResponse(*req, *resp, content);
+        return resp->SerializeAsString().size();
+    });
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures ResourceMonitor throughput under contention. Every thread runs
+ * the same lifecycle an iteration goes through in the engine:
+ *
+ *      preAllocate -> allocate -> free -> freeStaging
+ *
+ * Usage: bench-resmon [iterations per thread] [max threads]
+ */
+
+#include "resources/resources.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace salus;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Result
+{
+    size_t ops = 0;
+    size_t failed = 0;
+};
+
+Result runWorker(ResourceMonitor &resMon, size_t iterations)
+{
+    const ResourceTag memTag{ResourceType::MEMORY, devices::GPU0};
+    const ResourceTag streamTag{ResourceType::GPU_STREAM, devices::GPU0};
+
+    const Resources req{{memTag, 4096}, {streamTag, 1}};
+    const Resources use{{memTag, 1024}};
+
+    Result r;
+    for (size_t i = 0; i != iterations; ++i) {
+        auto ticket = resMon.preAllocate(req, nullptr);
+        if (!ticket) {
+            ++r.failed;
+            continue;
+        }
+        if (resMon.allocate(*ticket, use)) {
+            resMon.free(*ticket, use);
+        } else {
+            ++r.failed;
+        }
+        resMon.freeStaging(*ticket);
+        r.ops += 4;
+    }
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    size_t maxThreads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "ops/s" << std::setw(16) << "ns/op"
+              << std::setw(10) << "failed" << std::endl;
+
+    for (size_t nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        ResourceMonitor resMon;
+        resMon.initializeLimits();
+
+        std::vector<Result> results(nThreads);
+        std::vector<std::thread> threads;
+        threads.reserve(nThreads);
+
+        auto start = Clock::now();
+        for (size_t i = 0; i != nThreads; ++i) {
+            threads.emplace_back([&, i]() { results[i] = runWorker(resMon, iterations); });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        Result total;
+        for (auto &r : results) {
+            total.ops += r.ops;
+            total.failed += r.failed;
+        }
+
+        std::cout << std::setw(8) << nThreads << std::setw(16) << std::fixed << std::setprecision(0)
+                  << total.ops / elapsed << std::setw(16) << std::setprecision(1)
+                  << elapsed * 1e9 / total.ops * nThreads << std::setw(10) << total.failed << std::endl;
+    }
+
+    return 0;
+}
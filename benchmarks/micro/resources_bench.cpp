@@ -0,0 +1,200 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares the dense ResourceVector against the previous unordered_map based
+ * representation on the operations a scheduling decision performs:
+ *
+ *      contains -> subtract -> merge -> subtractBounded -> removeInvalid
+ *
+ * Usage: bench-resources [iterations]
+ */
+
+#include "resources/resources.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+using namespace salus;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/**
+ * @brief The map based implementation Resources used to have, kept as baseline.
+ */
+namespace legacy {
+using ResourceMap = std::unordered_map<ResourceTag, size_t>;
+
+bool contains(const ResourceMap &avail, const ResourceMap &req)
+{
+    auto aend = avail.end();
+    for (auto [tag, val] : req) {
+        auto it = avail.find(tag);
+        if (it == aend && val != 0) {
+            return false;
+        }
+        if (it == aend) {
+            continue;
+        }
+        if (val > it->second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ResourceMap &merge(ResourceMap &lhs, const ResourceMap &rhs)
+{
+    for (auto p : rhs) {
+        lhs[p.first] += p.second;
+    }
+    return lhs;
+}
+
+ResourceMap &subtract(ResourceMap &lhs, const ResourceMap &rhs)
+{
+    for (auto p : rhs) {
+        lhs[p.first] -= p.second;
+    }
+    return lhs;
+}
+
+ResourceMap subtractBounded(ResourceMap &lhs, const ResourceMap &rhs)
+{
+    const auto lend = lhs.end();
+    ResourceMap res;
+    for (auto [tag, val] : rhs) {
+        auto it = lhs.find(tag);
+        if (it == lend) {
+            continue;
+        }
+        auto v = std::min(val, it->second);
+        it->second -= v;
+        res[tag] = v;
+    }
+    return res;
+}
+
+ResourceMap &removeInvalid(ResourceMap &lhs)
+{
+    for (auto it = lhs.begin(); it != lhs.end();) {
+        if (it->second == 0) {
+            it = lhs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return lhs;
+}
+} // namespace legacy
+
+template<typename Res>
+Res makeLimits()
+{
+    Res res;
+    res[{ResourceType::MEMORY, devices::CPU0}] = 100ull * 1024 * 1024 * 1024;
+    res[{ResourceType::MEMORY, devices::GPU0}] = 14ull * 1024 * 1024 * 1024;
+    res[{ResourceType::GPU_STREAM, devices::GPU0}] = 128;
+    res[{ResourceType::EXCLUSIVE, devices::GPU0}] = 1;
+    return res;
+}
+
+template<typename Res>
+Res makeRequest(size_t i)
+{
+    Res res;
+    res[{ResourceType::MEMORY, devices::GPU0}] = 1024 + (i & 0xff);
+    res[{ResourceType::GPU_STREAM, devices::GPU0}] = 1;
+    return res;
+}
+
+/**
+ * @brief One scheduling decision: check, take, give back part, release the rest.
+ */
+template<typename Res, typename Ops>
+double run(size_t iterations, Ops ops)
+{
+    auto avail = makeLimits<Res>();
+    Res inuse;
+    size_t sink = 0;
+
+    auto start = Clock::now();
+    for (size_t i = 0; i != iterations; ++i) {
+        auto req = makeRequest<Res>(i);
+        if (!ops.contains(avail, req)) {
+            continue;
+        }
+        ops.subtract(avail, req);
+        ops.merge(inuse, req);
+
+        auto released = ops.subtractBounded(inuse, req);
+        ops.removeInvalid(inuse);
+        ops.merge(avail, released);
+        sink += released.size();
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    if (sink != iterations * 2) {
+        std::cerr << "Unexpected result: " << sink << std::endl;
+    }
+    return elapsed / iterations;
+}
+
+struct LegacyOps
+{
+    bool contains(const legacy::ResourceMap &a, const legacy::ResourceMap &b) { return legacy::contains(a, b); }
+    void merge(legacy::ResourceMap &a, const legacy::ResourceMap &b) { legacy::merge(a, b); }
+    void subtract(legacy::ResourceMap &a, const legacy::ResourceMap &b) { legacy::subtract(a, b); }
+    legacy::ResourceMap subtractBounded(legacy::ResourceMap &a, const legacy::ResourceMap &b)
+    {
+        return legacy::subtractBounded(a, b);
+    }
+    void removeInvalid(legacy::ResourceMap &a) { legacy::removeInvalid(a); }
+};
+
+struct DenseOps
+{
+    bool contains(const Resources &a, const Resources &b) { return resources::contains(a, b); }
+    void merge(Resources &a, const Resources &b) { resources::merge(a, b); }
+    void subtract(Resources &a, const Resources &b) { resources::subtract(a, b); }
+    Resources subtractBounded(Resources &a, const Resources &b) { return resources::subtractBounded(a, b); }
+    void removeInvalid(Resources &a) { resources::removeInvalid(a); }
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    auto mapNs = run<legacy::ResourceMap>(iterations, LegacyOps{});
+    auto denseNs = run<Resources>(iterations, DenseOps{});
+
+    std::cout << std::setw(16) << "representation" << std::setw(16) << "ns/decision" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(16) << "unordered_map" << std::setw(16) << mapNs << std::endl;
+    std::cout << std::setw(16) << "ResourceVector" << std::setw(16) << denseNs << std::endl;
+    std::cout << "speedup: " << std::setprecision(2) << mapNs / denseNs << "x" << std::endl;
+
+    return 0;
+}
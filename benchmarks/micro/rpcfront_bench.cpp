@@ -0,0 +1,241 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Load generator for the server front end. Stand-in clients, one session
+ * each, send CustomRequests over a DEALER socket to a ROUTER socket, framed
+ * like the real client. Each client keeps a window of requests in flight.
+ * The handler parses the body and then burns a fixed amount of CPU in place
+ * of the op library parsing the inner RunStepRequest.
+ *
+ *  - single:    one message received per poll, parsed and handled on the
+ *               receiving thread, as before the pipeline
+ *  - pipelined: all readable messages received per poll, parsed and handled
+ *               on RequestPipeline workers
+ *
+ * Reports requests/s, p50/p99 latency from send to handled, and requests
+ * handled out of order within a session (should be 0).
+ *
+ * Usage: bench-rpcfront [clients] [requests per client] [body KB] [handler us] [workers]
+ */
+
+#include "rpcserver/requestpipeline.h"
+#include "utils/protoutils.h"
+
+#include "protos.h"
+
+#include <zmq.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr const char kAddr[] = "inproc://bench-rpcfront";
+constexpr size_t kWindow = 16;
+
+struct Client
+{
+    std::atomic<uint64_t> handled{0};
+    // only touched by the worker handling this session
+    uint64_t lastSeq = 0;
+    uint64_t outOfOrder = 0;
+    std::vector<double> latency;
+};
+
+struct Config
+{
+    size_t numClients;
+    size_t numRequests;
+    size_t bodyKB;
+    std::chrono::microseconds handlerWork;
+};
+
+void spinFor(std::chrono::microseconds d)
+{
+    auto until = Clock::now() + d;
+    while (Clock::now() < until) {
+    }
+}
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void clientLoop(zmq::context_t &ctx, const Config &cfg, size_t idx, Client &client)
+{
+    zmq::socket_t sock(ctx, zmq::socket_type::dealer);
+    sock.connect(kAddr);
+
+    executor::EvenlopDef evenlop;
+    evenlop.set_type("executor.CustomRequest");
+    evenlop.set_sessionid(std::to_string(idx));
+
+    executor::CustomRequest req;
+    req.set_type("tensorflow.RunStepRequest");
+    std::string extra(cfg.bodyKB * 1024 + sizeof(int64_t), 'x');
+
+    for (uint64_t seq = 1; seq <= cfg.numRequests; ++seq) {
+        while (seq - client.handled.load(std::memory_order_acquire) > kWindow) {
+            std::this_thread::yield();
+        }
+
+        evenlop.set_seq(seq);
+        auto ts = nowNs();
+        std::memcpy(&extra[0], &ts, sizeof(ts));
+        req.set_extra(extra);
+
+        zmq::message_t delim;
+        zmq::message_t ev(evenlop.ByteSizeLong());
+        evenlop.SerializeToArray(ev.data(), static_cast<int>(ev.size()));
+        zmq::message_t body(req.ByteSizeLong());
+        req.SerializeToArray(body.data(), static_cast<int>(body.size()));
+
+        sock.send(delim, ZMQ_SNDMORE);
+        sock.send(ev, ZMQ_SNDMORE);
+        sock.send(body);
+    }
+}
+
+void handle(const Config &cfg, std::vector<Client> &clients, RawRequest &&raw)
+{
+    auto req = sstl::createMessage<executor::CustomRequest>(raw.evenlop->type(), raw.body.data(),
+                                                           raw.body.size());
+    if (!req) {
+        return;
+    }
+    spinFor(cfg.handlerWork);
+
+    auto &client = clients[std::stoul(raw.evenlop->sessionid())];
+    int64_t ts = 0;
+    std::memcpy(&ts, req->extra().data(), sizeof(ts));
+    client.latency.push_back((nowNs() - ts) / 1e3);
+
+    auto seq = raw.evenlop->seq();
+    if (seq < client.lastSeq) {
+        ++client.outOfOrder;
+    }
+    client.lastSeq = seq;
+    client.handled.fetch_add(1, std::memory_order_release);
+}
+
+void runConfig(const char *name, const Config &cfg, size_t numWorkers)
+{
+    zmq::context_t ctx(1);
+    zmq::socket_t sock(ctx, zmq::socket_type::router);
+    sock.bind(kAddr);
+
+    std::vector<Client> clients(cfg.numClients);
+    for (auto &c : clients) {
+        c.latency.reserve(cfg.numRequests);
+    }
+    const auto total = cfg.numClients * cfg.numRequests;
+    auto allHandled = [&]() {
+        size_t n = 0;
+        for (auto &c : clients) {
+            n += c.handled.load(std::memory_order_acquire);
+        }
+        return n == total;
+    };
+
+    std::unique_ptr<RequestPipeline> pipeline;
+    if (numWorkers > 0) {
+        pipeline = std::make_unique<RequestPipeline>(
+            numWorkers, [&cfg, &clients](RawRequest &&req) { handle(cfg, clients, std::move(req)); });
+    }
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != cfg.numClients; ++i) {
+        threads.emplace_back([&ctx, &cfg, &clients, i]() { clientLoop(ctx, cfg, i, clients[i]); });
+    }
+
+    std::vector<zmq::pollitem_t> items{{sock, 0, ZMQ_POLLIN, 0}};
+    std::vector<RawRequest> batch;
+    while (!allHandled()) {
+        zmq::poll(items, 10);
+        if (!(items[0].revents & ZMQ_POLLIN)) {
+            continue;
+        }
+        if (pipeline) {
+            RequestPipeline::recvAvailable(sock, batch, 64);
+            pipeline->submit(batch);
+        } else {
+            RequestPipeline::recvAvailable(sock, batch, 1);
+            for (auto &req : batch) {
+                handle(cfg, clients, std::move(req));
+            }
+            batch.clear();
+        }
+    }
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+    if (pipeline) {
+        pipeline->stop();
+    }
+
+    std::vector<double> latency;
+    uint64_t outOfOrder = 0;
+    for (auto &c : clients) {
+        latency.insert(latency.end(), c.latency.begin(), c.latency.end());
+        outOfOrder += c.outOfOrder;
+    }
+    std::sort(latency.begin(), latency.end());
+
+    std::cout << std::setw(10) << name << std::setw(9) << numWorkers << std::setw(12) << std::fixed
+              << std::setprecision(0) << total / seconds << std::setw(12) << latency[latency.size() / 2]
+              << std::setw(12) << latency[latency.size() * 99 / 100] << std::setw(14) << outOfOrder
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Config cfg;
+    cfg.numClients = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8;
+    cfg.numRequests = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000;
+    cfg.bodyKB = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 256;
+    cfg.handlerWork = std::chrono::microseconds(argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 50);
+    size_t numWorkers = argc > 5 ? std::strtoull(argv[5], nullptr, 10)
+                                 : std::max<size_t>(std::thread::hardware_concurrency() / 2, 2);
+
+    std::cout << std::setw(10) << "mode" << std::setw(9) << "workers" << std::setw(12) << "req/s"
+              << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(14) << "out of order"
+              << std::endl;
+
+    runConfig("single", cfg, 0);
+    runConfig("pipelined", cfg, numWorkers);
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput of the server send path for small responses. Producer threads,
+ * standing in for handlers finishing requests, each send a response of
+ * identity, evenlop and a 32 byte body to one DEALER client through a ROUTER
+ * socket owned by a single thread.
+ *
+ *  - legacy:    responses as heap allocated vectors in a boost::lockfree::queue,
+ *               popped by a send thread sleeping 1ms when empty, written to an
+ *               inproc pair and forwarded one message per poll, as before
+ *  - sendqueue: responses moved into SendQueue, the ROUTER thread polls its
+ *               eventfd and flushes all queued responses in one go
+ *
+ * Reports responses/s and p50/p99 latency from push to received by client.
+ *
+ * Usage: bench-sendpath [producers] [responses per producer]
+ */
+
+#include "rpcserver/sendqueue.h"
+
+#include <zmq.hpp>
+
+#include <boost/lockfree/queue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using sstl::MultiPartMessage;
+
+namespace {
+
+constexpr const char kFeAddr[] = "inproc://bench-sendpath";
+constexpr const char kBeAddr[] = "inproc://bench-sendpath-backend";
+constexpr const char kClientId[] = "client";
+constexpr size_t kBodySize = 32;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+MultiPartMessage makeResponse()
+{
+    MultiPartMessage parts;
+    parts->emplace_back(kClientId, sizeof(kClientId) - 1);
+    parts->emplace_back("evenlop", 7);
+    parts->emplace_back(kBodySize);
+    auto ts = nowNs();
+    std::memcpy(parts->back().data(), &ts, sizeof(ts));
+    return parts;
+}
+
+void sendParts(zmq::socket_t &sock, MultiPartMessage &parts)
+{
+    for (size_t i = 0; i != parts->size(); ++i) {
+        sock.send(parts->at(i), i + 1 != parts->size() ? ZMQ_SNDMORE : 0);
+    }
+}
+
+/**
+ * Receives all responses on a DEALER socket, after saying hello so the ROUTER knows the route.
+ */
+class Client
+{
+public:
+    Client(zmq::context_t &ctx, size_t total)
+        : m_sock(ctx, zmq::socket_type::dealer)
+        , m_total(total)
+    {
+        m_sock.setsockopt(ZMQ_IDENTITY, kClientId, sizeof(kClientId) - 1);
+        m_sock.connect(kFeAddr);
+        zmq::message_t hello(5);
+        m_sock.send(hello);
+        m_latency.reserve(total);
+        m_thread = std::thread([this]() { loop(); });
+    }
+
+    void join()
+    {
+        m_thread.join();
+    }
+
+    std::vector<double> &latency()
+    {
+        return m_latency;
+    }
+
+private:
+    void loop()
+    {
+        zmq::message_t msg;
+        while (m_latency.size() != m_total) {
+            // evenlop then body
+            m_sock.recv(&msg);
+            m_sock.recv(&msg);
+            int64_t ts = 0;
+            std::memcpy(&ts, msg.data(), sizeof(ts));
+            m_latency.push_back((nowNs() - ts) / 1e3);
+        }
+    }
+
+    zmq::socket_t m_sock;
+    size_t m_total;
+    std::vector<double> m_latency;
+    std::thread m_thread;
+};
+
+zmq::socket_t bindFrontend(zmq::context_t &ctx)
+{
+    zmq::socket_t sock(ctx, zmq::socket_type::router);
+    sock.setsockopt(ZMQ_ROUTER_MANDATORY, 1);
+    sock.bind(kFeAddr);
+    return sock;
+}
+
+void waitHello(zmq::socket_t &sock)
+{
+    zmq::message_t msg;
+    sock.recv(&msg);
+    sock.recv(&msg);
+}
+
+void runLegacy(zmq::context_t &ctx, size_t numProducers, size_t perProducer, std::unique_ptr<Client> &client)
+{
+    const auto total = numProducers * perProducer;
+    auto fe = bindFrontend(ctx);
+    zmq::socket_t be(ctx, zmq::socket_type::pair);
+    be.bind(kBeAddr);
+
+    client = std::make_unique<Client>(ctx, total);
+    waitHello(fe);
+
+    boost::lockfree::queue<std::vector<zmq::message_t> *> queue(128);
+    std::atomic_bool running{true};
+    std::thread sender([&]() {
+        zmq::socket_t sock(ctx, zmq::socket_type::pair);
+        sock.connect(kBeAddr);
+        std::vector<zmq::message_t> *ptr;
+        while (running) {
+            if (!queue.pop(ptr)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            MultiPartMessage parts(ptr);
+            delete ptr;
+            sendParts(sock, parts);
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i != numProducers; ++i) {
+        producers.emplace_back([&]() {
+            for (size_t j = 0; j != perProducer; ++j) {
+                while (!queue.push(makeResponse().release())) {
+                }
+            }
+        });
+    }
+
+    // Forward one message per poll
+    std::vector<zmq::pollitem_t> items{{be, 0, ZMQ_POLLIN, 0}};
+    zmq::message_t msg;
+    for (size_t forwarded = 0; forwarded != total; ++forwarded) {
+        zmq::poll(items, -1);
+        do {
+            be.recv(&msg);
+            auto more = be.getsockopt<int64_t>(ZMQ_RCVMORE);
+            fe.send(msg, more ? ZMQ_SNDMORE : 0);
+            if (!more) {
+                break;
+            }
+        } while (true);
+    }
+
+    for (auto &t : producers) {
+        t.join();
+    }
+    client->join();
+    running = false;
+    sender.join();
+}
+
+void runSendQueue(zmq::context_t &ctx, size_t numProducers, size_t perProducer, std::unique_ptr<Client> &client)
+{
+    const auto total = numProducers * perProducer;
+    auto fe = bindFrontend(ctx);
+
+    client = std::make_unique<Client>(ctx, total);
+    waitHello(fe);
+
+    SendQueue queue;
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i != numProducers; ++i) {
+        producers.emplace_back([&]() {
+            for (size_t j = 0; j != perProducer; ++j) {
+                queue.push(makeResponse());
+            }
+        });
+    }
+
+    std::vector<zmq::pollitem_t> items{{nullptr, queue.fd(), ZMQ_POLLIN, 0}};
+    std::vector<MultiPartMessage> outgoing;
+    for (size_t sent = 0; sent != total;) {
+        zmq::poll(items, -1);
+        queue.drain(outgoing, 256);
+        for (auto &parts : outgoing) {
+            sendParts(fe, parts);
+        }
+        sent += outgoing.size();
+        outgoing.clear();
+    }
+
+    for (auto &t : producers) {
+        t.join();
+    }
+    client->join();
+}
+
+void report(const char *name, size_t total, double seconds, std::vector<double> &latency)
+{
+    std::sort(latency.begin(), latency.end());
+    std::cout << std::setw(10) << name << std::setw(12) << std::fixed << std::setprecision(0) << total / seconds
+              << std::setw(12) << std::setprecision(1) << latency[latency.size() / 2] << std::setw(12)
+              << latency[latency.size() * 99 / 100] << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t numProducers = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4;
+    size_t perProducer = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+    const auto total = numProducers * perProducer;
+
+    std::cout << std::setw(10) << "path" << std::setw(12) << "resp/s" << std::setw(12) << "p50 us"
+              << std::setw(12) << "p99 us" << std::endl;
+
+    using Runner = void (*)(zmq::context_t &, size_t, size_t, std::unique_ptr<Client> &);
+    for (auto [name, run] : {std::make_pair("legacy", Runner(runLegacy)),
+                             std::make_pair("sendqueue", Runner(runSendQueue))}) {
+        zmq::context_t ctx(1);
+        std::unique_ptr<Client> client;
+        auto start = Clock::now();
+        run(ctx, numProducers, perProducer, client);
+        auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        report(name, total, seconds, client->latency());
+    }
+
+    return 0;
+}
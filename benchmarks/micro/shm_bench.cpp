@@ -0,0 +1,269 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Round trips between clients and an echo server on the same host, over the
+ * shared memory transport and over ZeroMQ ipc:// and tcp:// endpoints. Both
+ * server sides use RequestPipeline and SendQueue like salus-server, only the
+ * handler echoes the body back instead of running anything.
+ *
+ * Each client keeps one request in flight. Reports round trips/s, p50/p99
+ * round trip latency, and payload MB/s in both directions, per body size.
+ *
+ * Usage: bench-shm [transports] [clients] [round trips per client]
+ *        transports is a comma separated subset of shm,ipc,tcp
+ */
+
+#include "rpcserver/requestpipeline.h"
+#include "rpcserver/sendqueue.h"
+#include "rpcserver/shmtransport.h"
+
+#include "protos.h"
+
+#include <zmq.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using sstl::MultiPartMessage;
+
+namespace {
+
+constexpr const char kShmName[] = "salus-bench-shm";
+constexpr const char kIpcAddr[] = "ipc:///tmp/salus-bench-shm";
+constexpr const char kTcpAddr[] = "tcp://127.0.0.1:5599";
+
+MultiPartMessage makeRequest(size_t idx, uint64_t seq, size_t bodySize)
+{
+    executor::EvenlopDef evenlop;
+    evenlop.set_type("executor.CustomRequest");
+    evenlop.set_sessionid(std::to_string(idx));
+    evenlop.set_seq(seq);
+
+    MultiPartMessage parts;
+    parts->emplace_back(evenlop.ByteSizeLong());
+    evenlop.SerializeToArray(parts->back().data(), static_cast<int>(parts->back().size()));
+    parts->emplace_back(bodySize);
+    std::memset(parts->back().data(), 'x', bodySize);
+    return parts;
+}
+
+// Echo handler shared by both servers
+RequestPipeline::Handler echoTo(SendQueue &queue)
+{
+    return [&queue](RawRequest &&req) {
+        auto parts = std::move(req.identities);
+        parts->emplace_back(req.evenlop->ByteSizeLong());
+        req.evenlop->SerializeToArray(parts->back().data(), static_cast<int>(parts->back().size()));
+        parts->emplace_back(std::move(req.body));
+        queue.push(std::move(parts));
+    };
+}
+
+/**
+ * Stand-in of ZmqServer's proxy&recv loop
+ */
+class ZmqEchoServer
+{
+public:
+    ZmqEchoServer(zmq::context_t &ctx, const std::string &addr, size_t numWorkers)
+        : m_sock(ctx, zmq::socket_type::router)
+        , m_pipeline(numWorkers, echoTo(m_queue))
+    {
+        m_sock.bind(addr);
+        m_thread = std::thread([this]() { loop(); });
+    }
+
+    ~ZmqEchoServer()
+    {
+        m_running = false;
+        m_thread.join();
+        m_pipeline.stop();
+    }
+
+private:
+    void loop()
+    {
+        std::vector<zmq::pollitem_t> items{{m_sock, 0, ZMQ_POLLIN, 0}, {nullptr, m_queue.fd(), ZMQ_POLLIN, 0}};
+        std::vector<RawRequest> batch;
+        std::vector<MultiPartMessage> outgoing;
+        while (m_running) {
+            zmq::poll(items, 100);
+            if (items[0].revents & ZMQ_POLLIN) {
+                RequestPipeline::recvAvailable(m_sock, batch, 64);
+                m_pipeline.submit(batch);
+            }
+            if (items[1].revents & ZMQ_POLLIN) {
+                m_queue.drain(outgoing, 256);
+                for (auto &parts : outgoing) {
+                    for (size_t i = 0; i != parts->size(); ++i) {
+                        m_sock.send(parts->at(i), i + 1 != parts->size() ? ZMQ_SNDMORE : 0);
+                    }
+                }
+                outgoing.clear();
+            }
+        }
+    }
+
+    SendQueue m_queue;
+    zmq::socket_t m_sock;
+    RequestPipeline m_pipeline;
+    std::atomic_bool m_running{true};
+    std::thread m_thread;
+};
+
+std::vector<double> zmqClient(zmq::context_t &ctx, const std::string &addr, size_t idx, size_t rounds,
+                              size_t bodySize)
+{
+    zmq::socket_t sock(ctx, zmq::socket_type::dealer);
+    sock.connect(addr);
+
+    std::vector<double> latency;
+    latency.reserve(rounds);
+    zmq::message_t msg;
+    for (uint64_t seq = 1; seq <= rounds; ++seq) {
+        auto parts = makeRequest(idx, seq, bodySize);
+        auto start = Clock::now();
+        zmq::message_t delim;
+        sock.send(delim, ZMQ_SNDMORE);
+        sock.send(parts->at(0), ZMQ_SNDMORE);
+        sock.send(parts->at(1));
+        // delimiter, evenlop, body
+        do {
+            sock.recv(&msg);
+        } while (sock.getsockopt<int64_t>(ZMQ_RCVMORE));
+        latency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return latency;
+}
+
+std::vector<double> shmClient(size_t idx, size_t rounds, size_t bodySize)
+{
+    ShmClient client(kShmName);
+    if (!client.connected()) {
+        std::cerr << "Failed to connect to shared memory server" << std::endl;
+        std::exit(1);
+    }
+
+    std::vector<double> latency;
+    latency.reserve(rounds);
+    for (uint64_t seq = 1; seq <= rounds; ++seq) {
+        auto parts = makeRequest(idx, seq, bodySize);
+        auto start = Clock::now();
+        client.send(std::move(parts));
+        auto reply = client.recv();
+        if (reply->size() != 2 || reply->back().size() != bodySize) {
+            std::cerr << "Bad reply" << std::endl;
+            std::exit(1);
+        }
+        latency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    return latency;
+}
+
+void runTransport(const std::string &transport, size_t numClients, size_t rounds, size_t bodySize)
+{
+    zmq::context_t ctx(1);
+    SendQueue shmQueue;
+    std::unique_ptr<RequestPipeline> shmPipeline;
+    std::unique_ptr<ShmServer> shmServer;
+    std::unique_ptr<ZmqEchoServer> zmqServer;
+    std::string addr;
+    auto numWorkers = std::max<size_t>(numClients / 2, 1);
+
+    if (transport == "shm") {
+        shmPipeline = std::make_unique<RequestPipeline>(numWorkers, echoTo(shmQueue));
+        shmServer = std::make_unique<ShmServer>(kShmName, *shmPipeline, shmQueue);
+        if (!shmServer->start()) {
+            std::cerr << "Failed to start shared memory server" << std::endl;
+            std::exit(1);
+        }
+    } else {
+        addr = transport == "ipc" ? kIpcAddr : kTcpAddr;
+        zmqServer = std::make_unique<ZmqEchoServer>(ctx, addr, numWorkers);
+    }
+
+    std::vector<std::vector<double>> results(numClients);
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != numClients; ++i) {
+        threads.emplace_back([&, i]() {
+            results[i] = transport == "shm" ? shmClient(i, rounds, bodySize)
+                                            : zmqClient(ctx, addr, i, rounds, bodySize);
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latency;
+    for (auto &r : results) {
+        latency.insert(latency.end(), r.begin(), r.end());
+    }
+    std::sort(latency.begin(), latency.end());
+    auto total = numClients * rounds;
+
+    std::cout << std::setw(6) << transport << std::setw(10) << bodySize << std::setw(12) << std::fixed
+              << std::setprecision(0) << total / seconds << std::setw(10) << std::setprecision(1)
+              << latency[latency.size() / 2] << std::setw(10) << latency[latency.size() * 99 / 100]
+              << std::setw(10) << std::setprecision(0) << 2.0 * total * bodySize / seconds / 1e6 << std::endl;
+
+    if (shmServer) {
+        shmServer->stop();
+        shmPipeline->stop();
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> transports;
+    std::stringstream ss(argc > 1 ? argv[1] : "shm,ipc,tcp");
+    for (std::string t; std::getline(ss, t, ',');) {
+        transports.push_back(t);
+    }
+    size_t numClients = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2;
+    size_t rounds = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 5000;
+
+    std::cout << std::setw(6) << "via" << std::setw(10) << "bytes" << std::setw(12) << "rt/s" << std::setw(10)
+              << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "MB/s" << std::endl;
+
+    for (size_t bodySize : {64ul, 64ul << 10, 4ul << 20}) {
+        // Fewer round trips for large bodies
+        auto n = std::max<size_t>(rounds * 64 / std::max<size_t>(bodySize >> 10, 64), 10);
+        for (const auto &t : transports) {
+            runTransport(t, numClients, n, bodySize);
+        }
+    }
+
+    return 0;
+}
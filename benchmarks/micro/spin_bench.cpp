@@ -0,0 +1,183 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trades CPU burnt by idle ThreadPool workers against the latency of picking
+ * up new work, for how workers wait:
+ *
+ *  - park:     never spin
+ *  - fixed:    spin the default spinCount before parking
+ *  - adaptive: spin budget adapted to observed idle gaps
+ *
+ * under three arrival patterns from an outside thread, each closure doing
+ * a few microseconds of work:
+ *
+ *  - steady:  one closure every 50us
+ *  - bursty:  bursts of 64 closures 5us apart, every 5ms
+ *  - sparse:  one closure every 2ms
+ *
+ * Reports worker CPU in cores (process CPU minus the submitting thread),
+ * p50/p99 time from submission to start, and the pool's wait counters.
+ *
+ * Usage: bench-spin [closures per pattern] [threads]
+ */
+
+#include "execution/threadpool/threadpool.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+namespace {
+
+struct Pattern
+{
+    std::string name;
+    size_t burst;
+    microseconds inBurst;
+    microseconds betweenBursts;
+};
+
+double cpuSeconds(clockid_t clock)
+{
+    timespec ts{};
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void spinFor(std::chrono::nanoseconds d)
+{
+    auto until = Clock::now() + d;
+    while (Clock::now() < until) {
+    }
+}
+
+// Sleep for long waits, busy wait for short ones so the pace stays accurate
+void waitUntil(Clock::time_point t)
+{
+    if (t - Clock::now() > microseconds(200)) {
+        std::this_thread::sleep_until(t - microseconds(100));
+    }
+    while (Clock::now() < t) {
+    }
+}
+
+struct Result
+{
+    double cores = 0;
+    double p50us = 0;
+    double p99us = 0;
+    ThreadPool::Stats stats;
+};
+
+Result runPattern(const ThreadPoolOptions &opts, const Pattern &pat, size_t total)
+{
+    ThreadPool pool(opts);
+    std::vector<double> latency(total);
+    std::atomic<size_t> done{0};
+
+    auto cpuStart = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    auto selfStart = cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+    auto start = Clock::now();
+
+    auto next = start;
+    for (size_t i = 0; i != total;) {
+        for (size_t j = 0; j != pat.burst && i != total; ++j, ++i) {
+            waitUntil(next);
+            auto submitted = Clock::now();
+            pool.run([&latency, &done, i, submitted]() {
+                latency[i] = std::chrono::duration<double, std::micro>(Clock::now() - submitted).count();
+                spinFor(microseconds(3));
+                done.fetch_add(1, std::memory_order_release);
+            });
+            next += pat.inBurst;
+        }
+        next += pat.betweenBursts;
+    }
+    while (done.load(std::memory_order_acquire) != total) {
+        std::this_thread::sleep_for(microseconds(100));
+    }
+
+    auto wall = std::chrono::duration<double>(Clock::now() - start).count();
+    auto self = cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - selfStart;
+    auto cpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+    Result r;
+    r.cores = (cpu - self) / wall;
+    std::sort(latency.begin(), latency.end());
+    r.p50us = latency[total / 2];
+    r.p99us = latency[total * 99 / 100];
+    r.stats = pool.stats();
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t total = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+    size_t numThreads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+
+    const std::vector<Pattern> patterns{
+        {"steady", 1, microseconds(0), microseconds(50)},
+        {"bursty", 64, microseconds(5), microseconds(5000)},
+        {"sparse", 1, microseconds(0), microseconds(2000)},
+    };
+
+    ThreadPoolOptions base;
+    base.setNumThreads(numThreads);
+
+    std::cout << std::setw(8) << "pattern" << std::setw(10) << "waiting" << std::setw(8) << "cores"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "spins"
+              << std::setw(10) << "hits" << std::setw(10) << "parks" << std::setw(10) << "wakeups"
+              << std::endl;
+
+    for (const auto &pat : patterns) {
+        for (auto mode : {"park", "fixed", "adaptive"}) {
+            auto opts = base;
+            if (mode == std::string("park")) {
+                opts.setAllowSpinning(false).setSpinCount(0);
+            } else if (mode == std::string("adaptive")) {
+                opts.setAdaptiveSpinning(true);
+            }
+            // Sparse arrivals are slow, don't wait for all of them
+            auto n = pat.betweenBursts >= microseconds(1000) ? std::min<size_t>(total, 2000) : total;
+            auto r = runPattern(opts, pat, n);
+
+            std::cout << std::setw(8) << pat.name << std::setw(10) << mode << std::setw(8) << std::fixed
+                      << std::setprecision(2) << r.cores << std::setw(10) << std::setprecision(1) << r.p50us
+                      << std::setw(10) << r.p99us << std::setw(10) << r.stats.spins << std::setw(10)
+                      << r.stats.spinHits << std::setw(10) << r.stats.parks << std::setw(10)
+                      << r.stats.wakeups << std::endl;
+        }
+    }
+
+    return 0;
+}
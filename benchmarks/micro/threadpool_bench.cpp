@@ -0,0 +1,149 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures how long short probe closures wait in ThreadPool before starting,
+ * while every worker is kept busy by long background closures that keep
+ * resubmitting themselves, like training kernels do. Probes are submitted
+ * from an outside thread at the same priority as the background load, and
+ * then at a higher one.
+ *
+ * Usage: bench-threadpool [probes] [background closure us] [threads]
+ */
+
+#include "execution/threadpool/threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using Priority = ThreadPool::Priority;
+
+namespace {
+
+void spinFor(std::chrono::microseconds d)
+{
+    auto until = Clock::now() + d;
+    while (Clock::now() < until) {
+    }
+}
+
+struct Background
+{
+    ThreadPool &pool;
+    std::chrono::microseconds duration;
+    Priority prio;
+
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> outstanding{0};
+
+    void submit()
+    {
+        ++outstanding;
+        pool.run(
+            [this]() {
+                spinFor(duration);
+                if (!stopping) {
+                    submit();
+                }
+                --outstanding;
+            },
+            prio);
+    }
+
+    void drain()
+    {
+        stopping = true;
+        while (outstanding) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+std::vector<uint64_t> runProbes(ThreadPool &pool, Background &bg, size_t numProbes, Priority prio)
+{
+    std::vector<uint64_t> latencies(numProbes);
+    std::atomic<size_t> done{0};
+
+    for (size_t i = 0; i != numProbes; ++i) {
+        auto queued = Clock::now();
+        pool.run(
+            [&latencies, &done, queued, i]() {
+                latencies[i] = static_cast<uint64_t>((Clock::now() - queued).count());
+                ++done;
+            },
+            prio);
+        // roughly one probe in flight per background closure length
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    // probes at the background's priority may be starved until it stops
+    bg.drain();
+    while (done != numProbes) {
+        std::this_thread::yield();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+double percentileUs(const std::vector<uint64_t> &sorted, double p)
+{
+    auto idx = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[idx] / 1e3;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t numProbes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000;
+    auto bgDuration = std::chrono::microseconds(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500);
+    size_t numThreads = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+
+    ThreadPool pool(ThreadPoolOptions().setNumThreads(numThreads));
+
+    std::cout << "threads: " << pool.numThreads() << ", background closure: " << bgDuration.count() << "us"
+              << std::endl;
+    std::cout << std::setw(12) << "probe prio" << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+              << std::setw(12) << "p99.9 us" << std::setw(10) << "max us" << std::endl;
+
+    for (auto [name, prio] : {std::pair{"normal", Priority::Normal}, std::pair{"high", Priority::High}}) {
+        // keep a backlog of several closures per worker
+        Background bg{pool, bgDuration, Priority::Normal};
+        for (size_t i = 0; i != pool.numThreads() * 4; ++i) {
+            bg.submit();
+        }
+
+        auto latencies = runProbes(pool, bg, numProbes, prio);
+
+        std::cout << std::setw(12) << name << std::fixed << std::setprecision(1) << std::setw(10)
+                  << percentileUs(latencies, 0.5) << std::setw(10) << percentileUs(latencies, 0.99)
+                  << std::setw(12) << percentileUs(latencies, 0.999) << std::setw(10)
+                  << percentileUs(latencies, 1.0) << std::endl;
+    }
+
+    return 0;
+}
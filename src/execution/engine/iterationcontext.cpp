@@ -28,7 +28,7 @@ namespace salus {
 
 void IterationContext::scheduleTask(std::unique_ptr<OperationTask> &&task)
 {
-    auto opItem = std::make_shared<OperationItem>();
+    auto opItem = OperationItem::create();
     opItem->sess = m_item;
     opItem->op = std::move(task);
     LogOpTracing() << "OpItem Event " << opItem->op << " event: queued";
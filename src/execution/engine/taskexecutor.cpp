@@ -56,6 +56,9 @@ inline void logScheduleFailure(const Resources &usage, const ResourceMonitor &re
 #endif
 }
 
+// How long to wait before rechecking when all pending tasks are blocked
+constexpr auto kBlockedRecheckInterval = 1ms;
+
 void reportNoProgress(bool noProgress)
 {
     static auto lastProgress = system_clock::now();
@@ -83,6 +86,9 @@ TaskExecutor::TaskExecutor(ThreadPool &pool, ResourceMonitor &resMonitor, Schedu
 
 void TaskExecutor::startExecution()
 {
+    // Wake up when resources are freed, as tasks waiting for them may now proceed
+    m_resMonitor.setReleaseListener([this]() { m_note_has_work.notify(); });
+
     // Start scheduling thread
     m_schedThread = std::make_unique<std::thread>(std::bind(&TaskExecutor::scheduleLoop, this));
 }
@@ -105,6 +111,11 @@ void TaskExecutor::insertSession(PSessionItem sess)
         return;
     }
 
+    // Keep each session's ops on one node, so they reuse what's in that node's caches
+    if (m_pool.numNodes() > 1) {
+        sess->homeNode = static_cast<int>(m_nextHomeNode++ % m_pool.numNodes());
+    }
+
     {
         auto g = sstl::with_guard(m_newMu);
         m_newSessions.emplace_back(std::move(sess));
@@ -225,17 +236,21 @@ void TaskExecutor::scheduleLoop()
             }
         }
 
+        // Tasks blocked on anything else are skipped in this iter
+        m_freedTags = m_resMonitor.takeFreedTags();
+
         // Prepare session ready for this iter of schedule:
-        // - move from front end queue to backing storage
+        // - move from front end queue to backing storage, if there's any new task
         // - reset lastScheduled
         size_t totalRemainingCount = 0;
 
         // since iteration based execution, we can enable this
         const bool enableOOMProtect = true;
         for (auto &item : m_sessions) {
-            {
-                auto g = sstl::with_guard(item->mu);
-                item->bgQueue.splice(item->bgQueue.end(), item->queue);
+            if (item->hasNewTasks.exchange(false, std::memory_order_acq_rel)) {
+                while (auto opItem = item->queue.pop()) {
+                    item->bgQueue.emplace_back(opItem, /*add_ref=*/false);
+                }
             }
 
             if (item->forceEvicted) {
@@ -335,6 +350,11 @@ void TaskExecutor::scheduleLoop()
         if (!totalRemainingCount) {
             VLOG(2) << "TaskExecutor wait on m_note_has_work";
             m_note_has_work.wait();
+        } else if (scheduled == 0 && !scheduler->hasRetryableTasks()) {
+            // Everything pending is waiting for resources, new tasks or sessions, all of which
+            // notify us. Still recheck periodically as policies may change their mind over time.
+            VLOG(2) << "TaskExecutor wait on m_note_has_work with pending tasks: " << totalRemainingCount;
+            m_note_has_work.wait_for(kBlockedRecheckInterval);
         }
     }
 
@@ -373,6 +393,8 @@ POpItem TaskExecutor::runTask(POpItem &&opItem)
     // opItem as not scheduled.
 
     // opItem has to be captured by value, we need it in case the thread pool is full
+    auto prio = item->poolPriority.load(std::memory_order_relaxed);
+    auto node = item->homeNode.load(std::memory_order_relaxed);
     auto c = m_pool.tryRun([opItem, this]() mutable {
         DCHECK(opItem);
 
@@ -408,7 +430,7 @@ POpItem TaskExecutor::runTask(POpItem &&opItem)
             taskRunning(*opItem);
             opItem->op->run(std::move(cbs));
         }
-    });
+    }, prio, node);
     if (!c) {
         // successfully sent to thread pool, we can reset opItem
         opItem.reset();
@@ -24,6 +24,8 @@
 #include "resources/resources.h"
 #include "utils/threadutils.h"
 
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+
 #include <atomic>
 #include <thread>
 #include <list>
@@ -34,7 +36,7 @@ class ThreadPool;
 struct SessionItem;
 using PSessionItem = std::shared_ptr<SessionItem>;
 struct OperationItem;
-using POpItem = std::shared_ptr<OperationItem>;
+using POpItem = boost::intrusive_ptr<OperationItem>;
 namespace salus {
 
 class ResourceContext;
@@ -84,6 +86,15 @@ public:
 
     void deleteSession(PSessionItem item);
 
+    /**
+     * @brief Resource tags freed since the previous scheduling iteration.
+     * Only tasks missing any of these are retried in the current iteration.
+     */
+    ResourceVector::Mask freedTags() const
+    {
+        return m_freedTags;
+    }
+
 private:
     friend class BaseScheduler;
 
@@ -100,6 +111,11 @@ private:
     void scheduleLoop();
     bool maybeWaitForAWhile(size_t scheduled);
 
+    ResourceVector::Mask m_freedTags = 0;
+
+    // Round robin home node for new sessions
+    std::atomic<size_t> m_nextHomeNode{0};
+
     // Sessions
     std::list<PSessionItem> m_newSessions GUARDED_BY(m_newMu);
     std::mutex m_newMu;
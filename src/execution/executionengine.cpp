@@ -17,8 +17,6 @@
  * limitations under the License.
  */
 
-#include "oplibraries/tensorflow/device/gpu/lane/lanemgr.h"
-
 #include "execution/executionengine.h"
 
 #include "execution/engine/iterationcontext.h"
@@ -26,6 +24,7 @@
 #include "execution/iterationtask.h"
 #include "platform/logging.h"
 #include "platform/thread_annotations.h"
+#include "platform/topology.h"
 #include "utils/containerutils.h"
 #include "utils/date.h"
 #include "utils/debugging.h"
@@ -51,6 +50,29 @@ using namespace date;
 
 namespace salus {
 
+namespace {
+
+/**
+ * @brief Thread pool placement can be tuned with
+ *  - SALUS_POOL_CPUS: CPUs workers may run on, e.g. "0-15,32-47". One worker per CPU.
+ *  - SALUS_POOL_NUMA_AWARE: group workers by NUMA node. Default on.
+ */
+ThreadPoolOptions enginePoolOptions()
+{
+    ThreadPoolOptions opts;
+    opts.setNumaAware(sstl::fromEnvVar("SALUS_POOL_NUMA_AWARE", false));
+    opts.setAdaptiveSpinning(sstl::fromEnvVar("SALUS_POOL_ADAPTIVE_SPIN", false));
+
+    auto cpus = threading::parse_cpu_list(sstl::fromEnvVarStr("SALUS_POOL_CPUS", ""));
+    if (!cpus.empty()) {
+        opts.setNumThreads(cpus.size());
+        opts.setCpuAffinity(std::move(cpus));
+    }
+    return opts;
+}
+
+} // namespace
+
 ExecutionEngine &ExecutionEngine::instance()
 {
     static ExecutionEngine eng;
@@ -58,7 +80,8 @@ ExecutionEngine &ExecutionEngine::instance()
 }
 
 ExecutionEngine::ExecutionEngine()
-    : m_taskExecutor(m_pool, m_resMonitor, m_schedParam)
+    : m_pool(enginePoolOptions())
+    , m_taskExecutor(m_pool, m_resMonitor, m_schedParam)
 {
 }
 
@@ -428,6 +451,10 @@ bool ExecutionEngine::runIter(IterationItem &iterItem, ExecutionContext &ectx, L
                 << nlohmann::json({{"sess", ectx.m_item->sessHandle},
                                    {"graphId", iterItem.iter->graphId()},
                                    {"reason", "failed prepare"}});
+        if (iterItem.iter->isExpensive()) {
+            // give back the slot taken in checkIter, so the iteration can be retried
+            lctx.numExpensiveIterRunning--;
+        }
         return false;
     }
 
@@ -545,7 +572,36 @@ void ExecutionContext::setSessionHandle(const std::string &h)
 
 void ExecutionContext::scheduleIteartion(std::unique_ptr<IterationTask> &&iterTask)
 {
+    auto expensive = iterTask->isExpensive();
     m_engine.scheduleIteration({shared_from_this(), std::move(iterTask)});
+    if (expensive) {
+        {
+            auto g = sstl::with_guard(m_schedMu);
+            ++m_numExpensiveScheduled;
+        }
+        m_schedCv.notify_all();
+    }
+}
+
+uint64_t ExecutionContext::numExpensiveScheduled()
+{
+    auto g = sstl::with_guard(m_schedMu);
+    return m_numExpensiveScheduled;
+}
+
+void ExecutionContext::waitExpensiveScheduled(uint64_t n, const std::function<bool()> &stop)
+{
+    std::unique_lock<std::mutex> ul(m_schedMu);
+    m_schedCv.wait(ul, [&]() { return m_numExpensiveScheduled >= n || stop(); });
+}
+
+void ExecutionContext::wakeScheduleWaiters()
+{
+    // Taking the lock so the waiter either sees stop or is already waiting
+    {
+        auto g = sstl::with_guard(m_schedMu);
+    }
+    m_schedCv.notify_all();
 }
 
 void ExecutionContext::dropExlusiveMode()
@@ -560,4 +616,10 @@ void ExecutionContext::setExpectedRunningTime(uint64_t time)
     DCHECK(m_item);
     m_item->totalRunningTime = time;
 }
+
+void ExecutionContext::setPoolPriority(ThreadPool::Priority prio)
+{
+    DCHECK(m_item);
+    m_item->poolPriority = prio;
+}
 } // namespace salus
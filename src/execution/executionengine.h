@@ -37,9 +37,12 @@
 #include <atomic>
 #include <any>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <future>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <set>
 
@@ -140,6 +143,11 @@ class ExecutionContext : public std::enable_shared_from_this<ExecutionContext>
     std::any m_userData;
     uint64_t m_laneId;
 
+    // Expensive iterations scheduled so far, see waitExpensiveScheduled
+    std::mutex m_schedMu;
+    std::condition_variable m_schedCv;
+    uint64_t m_numExpensiveScheduled GUARDED_BY(m_schedMu) = 0;
+
     friend class ExecutionEngine;
     /**
      * @brief remove from engine and give up our reference of session item
@@ -159,6 +167,19 @@ public:
 
     void scheduleIteartion(std::unique_ptr<IterationTask> &&iterTask);
 
+    /**
+     * @brief Number of expensive, i.e. main, iterations scheduled on this context so far
+     */
+    uint64_t numExpensiveScheduled();
+
+    /**
+     * @brief Block until at least n expensive iterations have been scheduled on this context, or stop
+     * returns true. Whoever makes stop true must call wakeScheduleWaiters afterwards.
+     */
+    void waitExpensiveScheduled(uint64_t n, const std::function<bool()> &stop);
+
+    void wakeScheduleWaiters();
+
     void registerPagingCallbacks(PagingCallbacks &&pcb);
     void setInterruptCallback(std::function<void()> cb);
 
@@ -188,6 +209,11 @@ public:
 
     void setExpectedRunningTime(uint64_t time);
 
+    /**
+     * @brief Ops from sessions with higher priority are picked up first by the thread pool
+     */
+    void setPoolPriority(ThreadPool::Priority prio);
+
     /**
      * @brief Make a resource context that first allocate from session's resources
      * @param spec
@@ -78,6 +78,18 @@ std::unique_ptr<BaseScheduler> SchedulerRegistary::create(std::string_view name,
     return iter->second.factory(engine);
 }
 
+std::vector<std::string> SchedulerRegistary::names() const
+{
+    auto guard = sstl::with_guard(m_mu);
+    std::vector<std::string> res;
+    res.reserve(m_schedulers.size());
+    for (const auto &[name, item] : m_schedulers) {
+        UNUSED(item);
+        res.emplace_back(name);
+    }
+    return res;
+}
+
 BaseScheduler::BaseScheduler(TaskExecutor &engine)
     : m_taskExec(engine)
 {
@@ -93,6 +105,8 @@ void BaseScheduler::notifyPreSchedulingIteration(const SessionList &sessions,
     UNUSED(changeset);
     UNUSED(candidates);
 
+    m_numRetryable = 0;
+
     auto g = sstl::with_guard(m_muRes);
     m_missingRes.clear();
 }
@@ -110,6 +124,7 @@ bool BaseScheduler::maybePreAllocateFor(OperationItem &opItem, const DeviceSpec
     auto rctx = m_taskExec.makeResourceContext(item, opItem.op->graphId(), spec, usage, &missing);
     if (!rctx) {
         // Failed to pre allocate resources
+        opItem.missingTags |= missing.presentMask();
         auto g = sstl::with_guard(m_muRes);
         m_missingRes.emplace(&opItem, std::move(missing));
         return false;
@@ -133,16 +148,15 @@ bool BaseScheduler::insufficientMemory(const DeviceSpec &spec)
         return false;
     }
 
+    const auto memSlot = ResourceVector::slotOf({ResourceType::MEMORY, spec});
+    const ResourceVector::Mask memMask = memSlot == ResourceVector::kInvalidSlot ? 0 : ResourceVector::bit(memSlot);
+
     // we need paging if all not scheduled opItems in this iteration
     // are missing memory resource on the device
     for (const auto &[pOpItem, missing] : m_missingRes) {
         UNUSED(pOpItem);
-        for (const auto &[tag, amount] : missing) {
-            UNUSED(amount);
-            auto insufficientMemory = tag.type == ResourceType::MEMORY && tag.device == spec;
-            if (!insufficientMemory) {
-                return false;
-            }
+        if (missing.presentMask() & ~memMask) {
+            return false;
         }
     }
     return true;
@@ -167,9 +181,15 @@ POpItem BaseScheduler::submitTask(POpItem &&opItem)
         return nullptr;
     }
 
+    // Nothing it was missing has been freed since last time, no way it could succeed now
+    if (opItem->missingTags && !(opItem->missingTags & m_taskExec.freedTags())) {
+        return std::move(opItem);
+    }
+
     VLOG(3) << "Scheduling opItem in session " << item->sessHandle << ": " << opItem->op;
 
     LogOpTracing() << "OpItem Event " << opItem->op << " event: inspected";
+    opItem->missingTags = 0;
     bool scheduled = false;
     DeviceSpec spec{};
     for (auto dt : opItem->op->supportedDeviceTypes()) {
@@ -189,11 +209,15 @@ POpItem BaseScheduler::submitTask(POpItem &&opItem)
 
     // Send to thread pool
     if (scheduled) {
+        opItem->missingTags = 0;
         opItem = m_taskExec.runTask(std::move(opItem));
     } else {
         VLOG(2) << "Failed to schedule opItem in session " << item->sessHandle << ": "
                 << opItem->op->DebugString();
     }
+    if (opItem && !opItem->missingTags) {
+        m_numRetryable.fetch_add(1, std::memory_order_relaxed);
+    }
     return opItem;
 }
 
@@ -224,7 +248,7 @@ size_t BaseScheduler::submitAllTaskFromQueue(const PSessionItem &item)
 
 #if defined(SALUS_ENABLE_PARALLEL_SCHED)
         // Do all schedule in queue in parallel
-        std::vector<std::future<std::shared_ptr<OperationItem>>> futures;
+        std::vector<std::future<POpItem>> futures;
         futures.reserve(stage.size());
         for (auto &opItem : stage) {
             auto fu = m_taskExec.pool().post([opItem = std::move(opItem), this]() mutable {
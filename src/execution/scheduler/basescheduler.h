@@ -33,6 +33,7 @@
 #include <map>
 #include <utility>
 #include <functional>
+#include <vector>
 
 struct SessionChangeSet
 {
@@ -88,6 +89,15 @@ public:
      */
     virtual bool insufficientMemory(const salus::DeviceSpec &spec);
 
+    /**
+     * @brief Whether any task failed to submit in this iteration for reasons other than
+     * missing resources, e.g. a full thread pool, thus may succeed if retried right away.
+     */
+    bool hasRetryableTasks() const
+    {
+        return m_numRetryable.load(std::memory_order_relaxed) > 0;
+    }
+
     /**
      * @brief Per session debug information.
      * @param item pointer to the session
@@ -115,6 +125,10 @@ protected:
 
     /**
      * @brief submit task for execution.
+     *
+     * Tasks that failed pre-allocation before are skipped, unless some of the resources
+     * they were missing has been freed since then.
+     *
      * @param opItem the task to execute
      * @returns the task itself is submission failed, otherwise nullptr
      */
@@ -138,6 +152,11 @@ protected:
     std::mutex m_muRes;
     std::unordered_map<sstl::not_null<OperationItem*>, Resources> m_missingRes GUARDED_BY(m_muRes);
 
+    /**
+     * @brief Number of tasks failed to submit in this iteration but not blocked on resources.
+     */
+    std::atomic<size_t> m_numRetryable{0};
+
     salus::TaskExecutor &m_taskExec;
 };
 
@@ -166,6 +185,11 @@ public:
 
     std::unique_ptr<BaseScheduler> create(std::string_view name, salus::TaskExecutor &engine) const;
 
+    /**
+     * @brief Names of all registered schedulers, in sorted order
+     */
+    std::vector<std::string> names() const;
+
     static SchedulerRegistary &instance();
 
 private:
@@ -45,8 +45,19 @@ SchedulerRegistary::Register reg("fair", [](auto &engine) {
     return std::make_unique<FairScheduler>(engine);
 });
 
+// How often all counters are brought up to date. In between, only sessions whose usage
+// changed are, so the order of the others lags by at most this.
+constexpr auto kSnapshotInterval = 10ms;
+
 } // namespace
 
+void FairScheduler::Usage::settle(size_t newMem, system_clock::time_point now)
+{
+    counter += mem * FpSeconds(now - since).count();
+    mem = newMem;
+    since = now;
+}
+
 FairScheduler::FairScheduler(TaskExecutor &engine) : BaseScheduler(engine) {}
 
 FairScheduler::~FairScheduler() = default;
@@ -60,37 +71,19 @@ void FairScheduler::notifyPreSchedulingIteration(const SessionList &sessions,
                                                  const SessionChangeSet &changeset,
                                                  sstl::not_null<CandidateList *> candidates)
 {
-    static auto lastSnapshotTime = system_clock::now();
-
     BaseScheduler::notifyPreSchedulingIteration(sessions, changeset, candidates);
 
     candidates->clear();
 
     // Remove old sessions
     for (auto &sess : changeset.deletedSessions) {
-        aggResUsages.erase(sess->sessHandle);
+        aggResUsages.erase(sess);
     }
 
-    // Sort sessions if needed. When there is addition, counters are reset thus no need to sort.
-    // Snapshot resource usage counter first, or reset them
-    if (changeset.numAddedSessions == 0) {
-        auto now = system_clock::now();
-        auto sSinceLastSnapshot = FpSeconds(now - lastSnapshotTime).count();
-        lastSnapshotTime = now;
-        for (auto &sess : sessions) {
-            candidates->emplace_back(sess);
-            // calculate progress counter increase since last snapshot
-            size_t mem = sess->resourceUsage(resources::GPU0Memory);
-            aggResUsages[sess->sessHandle] += mem * sSinceLastSnapshot;
-        }
+    auto now = system_clock::now();
 
-        // We assume m_sessions.size() is always no more than a few,
-        // therefore sorting in every iteration is acceptable.
-        using std::sort;
-        sort(candidates->begin(), candidates->end(), [this](const auto &lhs, const auto &rhs) {
-            return aggResUsages.at(lhs->sessHandle) < aggResUsages.at(rhs->sessHandle);
-        });
-    } else {
+    // When there is addition, counters are reset.
+    if (changeset.numAddedSessions != 0) {
         for (auto it = changeset.addedSessionBegin; it != changeset.addedSessionEnd; ++it) {
             LOG(DEBUG) << "Adding session " << (*it)->sessHandle;
         }
@@ -99,10 +92,36 @@ void FairScheduler::notifyPreSchedulingIteration(const SessionList &sessions,
         aggResUsages.reserve(sessions.size());
         for (auto &sess : sessions) {
             candidates->emplace_back(sess);
-            // touch each item once to ensure it's in the map
-            aggResUsages[sess->sessHandle] = 0;
+            aggResUsages.push(sess, {0, sess->resourceUsage(resources::GPU0Memory), now});
         }
+        m_lastSnapshot = now;
+        return;
+    }
+
+    // Otherwise, update counters of sessions whose usage changed, or of all sessions once in a while
+    auto settleAll = now - m_lastSnapshot >= kSnapshotInterval;
+    if (settleAll) {
+        m_lastSnapshot = now;
     }
+    for (auto &sess : sessions) {
+        size_t mem = sess->resourceUsage(resources::GPU0Memory);
+        if (!aggResUsages.contains(sess)) {
+            aggResUsages.push(sess, {0, mem, now});
+        } else if (settleAll || aggResUsages.priority(sess).mem != mem) {
+            aggResUsages.modify(sess, [mem, now](auto &usage) { usage.settle(mem, now); });
+        }
+    }
+
+    // Heap is kept ordered incrementally, just read out as many as may be tried,
+    // which is only the first one unless work conservative
+    static auto workConservative = m_taskExec.schedulingParam().workConservative;
+    candidates->reserve(workConservative ? aggResUsages.size() : 1);
+    aggResUsages.visitInOrder(
+        [&candidates](const auto &entry) {
+            candidates->emplace_back(entry.key);
+            return workConservative;
+        },
+        m_frontier);
 }
 
 std::pair<size_t, bool> FairScheduler::maybeScheduleFrom(PSessionItem item)
@@ -124,6 +143,6 @@ std::pair<size_t, bool> FairScheduler::reportScheduleResult(size_t scheduled) co
 std::string FairScheduler::debugString(const PSessionItem &item) const
 {
     std::ostringstream oss;
-    oss << "counter: " << aggResUsages.at(item->sessHandle);
+    oss << "counter: " << aggResUsages.priority(item).counter;
     return oss.str();
 }
@@ -21,9 +21,10 @@
 #define SALUS_EXEC_SCHED_FAIR_H
 
 #include "execution/scheduler/basescheduler.h"
+#include "utils/indexedheap.h"
 
 #include <chrono>
-#include <unordered_map>
+#include <vector>
 
 /**
  * @todo write docs
@@ -47,7 +48,40 @@ public:
 private:
     std::pair<size_t, bool> reportScheduleResult(size_t scheduled) const;
 
-    std::unordered_map<std::string, double> aggResUsages;
+    struct Usage
+    {
+        // Aggregated GPU memory usage over time, up to since
+        double counter = 0;
+        // GPU memory in use from since on
+        size_t mem = 0;
+        std::chrono::system_clock::time_point since;
+
+        void settle(size_t newMem, std::chrono::system_clock::time_point now);
+    };
+
+    struct ByCounter
+    {
+        bool operator()(const Usage &lhs, const Usage &rhs) const
+        {
+            return lhs.counter < rhs.counter;
+        }
+    };
+
+    /**
+     * @brief Aggregated resource usage of each session, the session with least usage on top.
+     * Counters only grow, so each update is a single sift down.
+     */
+    sstl::IndexedHeap<PSessionItem, Usage, ByCounter> aggResUsages;
+
+    /**
+     * @brief When all counters were last settled
+     */
+    std::chrono::system_clock::time_point m_lastSnapshot;
+
+    /**
+     * @brief Scratch space for reading out aggResUsages in order, kept to avoid allocating every iteration
+     */
+    std::vector<size_t> m_frontier;
 };
 
 #endif // SALUS_EXEC_SCHED_FAIR_H
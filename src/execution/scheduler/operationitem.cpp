@@ -19,3 +19,44 @@
 
 #include "execution/scheduler/operationitem.h"
 
+#include "execution/operationtask.h"
+
+#include <concurrentqueue.h>
+
+namespace {
+
+// Items are created on the executor threads and recycled wherever the last reference is dropped,
+// so the free list must be safe for any number of producers and consumers.
+constexpr size_t kMaxFreeItems = 16 * 1024;
+
+moodycamel::ConcurrentQueue<OperationItem *> &freeItems()
+{
+    // Intentionally leaked, items may still be released during static destruction
+    static auto items = new moodycamel::ConcurrentQueue<OperationItem *>;
+    return *items;
+}
+
+std::atomic<uint64_t> nextSeq{1};
+
+} // namespace
+
+/*static*/ POpItem OperationItem::create()
+{
+    OperationItem *item = nullptr;
+    if (!freeItems().try_dequeue(item)) {
+        item = new OperationItem;
+    }
+    item->m_seq = nextSeq.fetch_add(1, std::memory_order_relaxed);
+    return POpItem(item);
+}
+
+/*static*/ void OperationItem::recycle(OperationItem *item) noexcept
+{
+    item->op.reset();
+    item->sess.reset();
+    item->missingTags = 0;
+
+    if (freeItems().size_approx() >= kMaxFreeItems || !freeItems().enqueue(item)) {
+        delete item;
+    }
+}
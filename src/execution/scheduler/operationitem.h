@@ -20,7 +20,15 @@
 #ifndef SALUS_EXEC_OPERATIONITEM_H
 #define SALUS_EXEC_OPERATIONITEM_H
 
+#include "resources/resources.h"
+#include "utils/macros.h"
+#include "utils/mpscqueue.h"
+
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 
 namespace salus {
@@ -28,16 +36,59 @@ class OperationTask;
 } // namespace salus
 
 struct SessionItem;
-struct OperationItem
+struct OperationItem;
+using POpItem = boost::intrusive_ptr<OperationItem>;
+
+/**
+ * @brief An operation waiting to be scheduled.
+ *
+ * Items are reference counted intrusively and recycled through a process wide free list once the
+ * last reference goes away, so queueing an op doesn't allocate in steady state. Always create
+ * them with OperationItem::create.
+ */
+struct OperationItem : public sstl::MpscQueueHook
 {
     std::weak_ptr<SessionItem> sess;
     std::unique_ptr<salus::OperationTask> op;
 
+    /**
+     * @brief Tags the last pre-allocation failed on, 0 if it hasn't failed on any.
+     * Only accessed in the scheduling thread.
+     */
+    ResourceVector::Mask missingTags = 0;
+
+    static POpItem create();
+
+    /**
+     * @brief Unique among all items ever created, unlike the address, which is reused by the pool
+     */
     size_t hash() const
     {
-        return reinterpret_cast<size_t>(this);
+        return m_seq;
+    }
+
+private:
+    OperationItem() = default;
+    ~OperationItem() = default;
+
+    static void recycle(OperationItem *item) noexcept;
+
+    friend void intrusive_ptr_add_ref(OperationItem *item) noexcept
+    {
+        item->m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(OperationItem *item) noexcept
+    {
+        if (item->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            recycle(item);
+        }
     }
+
+    std::atomic<uint32_t> m_refs{0};
+    uint64_t m_seq = 0;
+
+    SALUS_DISALLOW_COPY_AND_ASSIGN(OperationItem);
 };
-using POpItem = std::shared_ptr<OperationItem>;
 
 #endif // SALUS_EXEC_OPERATIONITEM_H
@@ -24,7 +24,9 @@ using namespace salus;
 SessionItem::~SessionItem()
 {
     bgQueue.clear();
-    queue.clear();
+    while (auto opItem = queue.pop()) {
+        intrusive_ptr_release(opItem);
+    }
 
     // output stats
     VLOG(2) << "Stats for Session " << sessHandle << ": totalExecutedOp=" << totalExecutedOp;
@@ -69,8 +71,8 @@ void SessionItem::interrupt()
 
 void SessionItem::queueTask(POpItem &&opItem)
 {
-    auto g = sstl::with_guard(mu);
-    queue.emplace_back(std::move(opItem));
+    queue.push(opItem.detach());
+    hasNewTasks.store(true, std::memory_order_release);
 }
 
 void SessionItem::notifyAlloc(const uint64_t graphId, uint64_t ticket, const ResourceTag &tag, size_t num)
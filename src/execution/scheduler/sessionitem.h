@@ -26,8 +26,12 @@
 #include "execution/devices.h"
 #include "execution/engine/taskexecutor.h"
 #include "execution/engine/allocationlistener.h"
+#include "execution/scheduler/operationitem.h"
+#include "execution/threadpool/threadpool.h"
 #include "platform/thread_annotations.h"
+#include "utils/mpscqueue.h"
 
+#include <deque>
 #include <list>
 #include <string>
 #include <functional>
@@ -38,9 +42,6 @@
 #include <any>
 #include <utility>
 
-struct OperationItem;
-using POpItem = std::shared_ptr<OperationItem>;
-
 namespace salus {
 class ExecutionEngine;
 }
@@ -49,8 +50,9 @@ class ExecutionEngine;
  */
 struct SessionItem : public salus::AllocationListener
 {
-    using KernelQueue = std::list<POpItem>;
-    using UnsafeQueue = std::list<POpItem>;
+    // Holds one reference to each queued item, taken over by whoever pops it
+    using KernelQueue = sstl::MpscQueue<OperationItem>;
+    using UnsafeQueue = std::deque<POpItem>;
 private:
     // protected by mu (may be accessed both in schedule thread and close session thread)
     salus::PagingCallbacks pagingCb GUARDED_BY(mu);
@@ -59,7 +61,10 @@ private:
     // called if the execution engine requires to interrupt the session
     std::function<void()> interruptCb GUARDED_BY(mu);
 
-    KernelQueue queue GUARDED_BY(mu);
+    // pushed to by any thread, only popped by the scheduling thread
+    KernelQueue queue;
+    // set after pushing to queue, so the scheduling thread only visits sessions with new tasks
+    std::atomic_bool hasNewTasks{false};
     // total number of executed op in this session
     uint64_t totalExecutedOp = 0 GUARDED_BY(mu);
 
@@ -96,6 +101,11 @@ public:
     UnsafeQueue bgQueue;
     bool forceEvicted{false};
 
+    // priority of this session's ops in the thread pool
+    std::atomic<ThreadPool::Priority> poolPriority{ThreadPool::Priority::Normal};
+    // thread pool node this session's ops prefer, assigned round robin when inserted
+    std::atomic<int> homeNode{ThreadPool::kAnyNode};
+
     // target runnimg time
     uint64_t totalRunningTime {0};
     std::atomic_uint_fast64_t usedRunningTime {0};
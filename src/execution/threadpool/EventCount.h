@@ -138,14 +138,15 @@ public:
 
     // Notify wakes one or all waiting threads.
     // Must be called after changing the associated wait predicate.
-    void Notify(bool all)
+    // Returns true if a parked thread was woken up.
+    bool Notify(bool all)
     {
         std::atomic_thread_fence(std::memory_order_seq_cst);
         uint64_t state = state_.load(std::memory_order_acquire);
         for (;;) {
             // Easy case: no waiters.
             if ((state & kStackMask) == kStackMask && (state & kWaiterMask) == 0)
-                return;
+                return false;
             uint64_t waiters = (state & kWaiterMask) >> kWaiterShift;
             uint64_t newstate;
             if (all) {
@@ -169,14 +170,14 @@ public:
             }
             if (state_.compare_exchange_weak(state, newstate, std::memory_order_acquire)) {
                 if (!all && waiters)
-                    return; // unblocked pre-wait thread
+                    return false; // unblocked pre-wait thread
                 if ((state & kStackMask) == kStackMask)
-                    return;
+                    return false;
                 Waiter *w = &waiters_[state & kStackMask];
                 if (!all)
                     w->next.store(nullptr, std::memory_order_relaxed);
                 Unpark(w);
-                return;
+                return true;
             }
         }
     }
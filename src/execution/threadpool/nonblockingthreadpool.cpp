@@ -24,11 +24,16 @@
 #include "threadpool.h"
 
 #include "EventCount.h"
-#include "utils/fixed_function.hpp"
 #include "RunQueue.h"
+#include "spinbudget.h"
+#include "platform/logging.h"
 #include "platform/thread_annotations.h"
+#include "platform/topology.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -56,7 +61,7 @@ struct Task
 
     operator bool() const
     {
-        return c;
+        return static_cast<bool>(c);
     }
 };
 
@@ -78,6 +83,8 @@ class ThreadPoolPrivate
     ThreadPool *const q; // NOLINT
 
     using Queue = RunQueue<Task, 1024>;
+    using Priority = ThreadPool::Priority;
+    static constexpr auto kNumPriorities = ThreadPool::kNumPriorities;
 
     ThreadPoolPrivate(const ThreadPoolPrivate &) = delete;
     ThreadPoolPrivate &operator =(const ThreadPoolPrivate &) = delete;
@@ -88,11 +95,13 @@ public:
     ThreadPoolPrivate(ThreadPool *q, const ThreadPoolOptions &options);
     ~ThreadPoolPrivate();
 
-    Task tryRun(Task c);
+    Task tryRun(Task c, Priority prio, int node);
     void stop();
     void join();
     size_t numThreads() const;
     int currentThreadId() const;
+    size_t numNodes() const;
+    ThreadPool::Stats stats() const;
 
 private:
     struct PerThread
@@ -113,10 +122,35 @@ private:
      */
     void workerLoop(int thread_id);
 
+    /**
+     * Highest priority task available to the thread, from its own queues or
+     * stolen from others. With allowSteal false, only its own queues are used.
+     */
+    Task nextTask(int thread_id, bool allowSteal);
+
     /**
      * Steal tries to steal work from other worker threads in best-effort manner.
+     * Workers of the same node are tried before others.
      */
-    Task steal();
+    Task steal(size_t prio);
+
+    /**
+     * Try to steal from workers in group, starting at a random one.
+     */
+    Task stealFrom(const vector<unsigned> &group, size_t prio, unsigned r);
+
+    /**
+     * Split workers into groups by NUMA node according to options.
+     */
+    void assignNodes();
+
+    void countSteal(unsigned victim);
+
+    /**
+     * Spin looking for work before blocking, for spinCount tries or the worker's adaptive
+     * spin budget. Returns false if the pool is cancelled meanwhile.
+     */
+    bool spinForTask(int thread_id, bool allowSteal, Task *t);
 
     /**
      * waitForWork blocks until new work is available (returns true), or if it is
@@ -127,6 +161,22 @@ private:
 
     int nonEmptyQueueIndex();
 
+    /**
+     * Queues are laid out by priority first, then by thread.
+     */
+    Queue &queue(size_t thread_id, size_t prio)
+    {
+        return m_queues[prio * m_options.numThreads + thread_id];
+    }
+
+    Task popped(Task t, size_t prio)
+    {
+        if (t) {
+            m_pending[prio].count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
     static inline PerThread *getPerThread()
     {
         static thread_local PerThread per_thread;
@@ -145,7 +195,35 @@ private:
     ThreadPoolOptions m_options;
     vector<std::thread> m_threads;
     vector<Queue> m_queues;
+    // Number of queued tasks of each priority across all queues, so workers
+    // with lower priority work at hand know when to look elsewhere first.
+    // May be transiently larger than the actual number.
+    struct alignas(64) PendingCount
+    {
+        std::atomic<int> count{0};
+    };
+    std::array<PendingCount, kNumPriorities> m_pending;
     vector<unsigned> m_coprimes;
+    // Workers of each node group, and the CPUs the group is pinned to (empty for no pinning)
+    vector<vector<unsigned>> m_nodeWorkers;
+    vector<salus::threading::CpuSet> m_nodeCpus;
+    vector<int> m_workerNode;
+    // Only written by the owning worker
+    struct alignas(64) WorkerCounters
+    {
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> crossNode{0};
+        std::atomic<uint64_t> spins{0};
+        std::atomic<uint64_t> spinHits{0};
+        std::atomic<uint64_t> parks{0};
+    };
+    vector<WorkerCounters> m_counters;
+    // Only used with adaptiveSpinning
+    vector<SpinBudget> m_spinBudgets;
+    struct alignas(64) WakeupCount
+    {
+        std::atomic<uint64_t> count{0};
+    } m_wakeups;
     vector<EventCount::Waiter> m_waiters;
     std::atomic<unsigned> m_blocked;
     std::atomic<bool> m_spinning;
@@ -161,10 +239,10 @@ ThreadPool::ThreadPool(const ThreadPoolOptions &options)
 
 ThreadPool::~ThreadPool() = default;
 
-ThreadPool::Closure ThreadPool::tryRun(Closure c)
+ThreadPool::Closure ThreadPool::tryRun(Closure c, Priority prio, int node)
 {
     Task t(std::move(c));
-    t = d->tryRun(std::move(t));
+    t = d->tryRun(std::move(t), prio, node);
     return std::move(t.c);
 }
 void ThreadPool::stop()
@@ -183,12 +261,22 @@ int ThreadPool::currentThreadId() const
 {
     return d->currentThreadId();
 }
+size_t ThreadPool::numNodes() const
+{
+    return d->numNodes();
+}
+ThreadPool::Stats ThreadPool::stats() const
+{
+    return d->stats();
+}
 
 ThreadPoolPrivate::ThreadPoolPrivate(ThreadPool *q, const ThreadPoolOptions &options)
     : q(q)
     , m_options(options)
     // Queue is not movable or copyable, thus can only be constructed this way
-    , m_queues(options.numThreads)
+    , m_queues(options.numThreads * kNumPriorities)
+    , m_workerNode(options.numThreads, 0)
+    , m_counters(options.numThreads)
     // Waiter is not movable or copyable, thus can only be constructed this way
     , m_waiters(options.numThreads)
     , m_blocked(0)
@@ -223,21 +311,46 @@ ThreadPoolPrivate::ThreadPoolPrivate(ThreadPool *q, const ThreadPoolOptions &opt
         }
     }
 
+    assignNodes();
+
+    if (m_options.adaptiveSpinning) {
+        m_spinBudgets.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; i++) {
+            m_spinBudgets.emplace_back(std::chrono::microseconds(m_options.parkCostUs),
+                                       std::chrono::microseconds(m_options.maxSpinUs));
+        }
+    }
+
     for (size_t i = 0; i < numThreads; i++) {
         m_threads.emplace_back([this, i]() { workerLoop(i); });
     }
 }
 
-Task ThreadPoolPrivate::tryRun(Task t)
+Task ThreadPoolPrivate::tryRun(Task t, Priority prio, int node)
 {
+    auto p = static_cast<size_t>(prio);
+    // Count before pushing, so the task can't be popped with the count still 0
+    m_pending[p].count.fetch_add(1, std::memory_order_relaxed);
+
+    if (node < 0 || static_cast<size_t>(node) >= m_nodeWorkers.size()) {
+        node = ThreadPool::kAnyNode;
+    }
+
     auto pt = getPerThread();
-    if (pt->pool == this) {
+    if (pt->pool == this && (node == ThreadPool::kAnyNode || node == m_workerNode[pt->thread_id])) {
         // Worker thread of this pool, push onto the thread's queue.
-        t = m_queues[pt->thread_id].PushFront(std::move(t));
+        t = queue(pt->thread_id, p).PushFront(std::move(t));
+    } else if (node != ThreadPool::kAnyNode) {
+        // Push onto a random queue on the requested node.
+        const auto &group = m_nodeWorkers[node];
+        t = queue(group[rand(&pt->rand) % group.size()], p).PushBack(std::move(t));
     } else {
         // A free-standing thread (or worker of another pool), push onto a random
         // queue.
-        t = m_queues[rand(&pt->rand) % m_queues.size()].PushBack(std::move(t));
+        t = queue(rand(&pt->rand) % m_options.numThreads, p).PushBack(std::move(t));
+    }
+    if (t) {
+        m_pending[p].count.fetch_sub(1, std::memory_order_relaxed);
     }
     // Note: below we touch this after making w available to worker threads.
     // Strictly speaking, this can lead to a racy-use-after-free. Consider that
@@ -246,8 +359,8 @@ Task ThreadPoolPrivate::tryRun(Task t)
     // completes overall computations, which in turn leads to destruction of
     // this. We expect that such scenario is prevented by program, that is,
     // this is kept alive while any threads can potentially be in Schedule.
-    if (!t) {
-        m_ec.Notify(false);
+    if (!t && m_ec.Notify(false)) {
+        m_wakeups.count.fetch_add(1, std::memory_order_relaxed);
     }
     return t;
 }
@@ -275,6 +388,72 @@ size_t ThreadPoolPrivate::numThreads() const
     return m_options.numThreads;
 }
 
+size_t ThreadPoolPrivate::numNodes() const
+{
+    return m_nodeWorkers.size();
+}
+
+ThreadPool::Stats ThreadPoolPrivate::stats() const
+{
+    ThreadPool::Stats st;
+    for (const auto &c : m_counters) {
+        st.steals += c.steals.load(std::memory_order_relaxed);
+        st.crossNodeSteals += c.crossNode.load(std::memory_order_relaxed);
+        st.spins += c.spins.load(std::memory_order_relaxed);
+        st.spinHits += c.spinHits.load(std::memory_order_relaxed);
+        st.parks += c.parks.load(std::memory_order_relaxed);
+    }
+    st.wakeups = m_wakeups.count.load(std::memory_order_relaxed);
+    return st;
+}
+
+void ThreadPoolPrivate::assignNodes()
+{
+    using namespace salus::threading;
+
+    const auto numThreads = m_options.numThreads;
+
+    CpuTopology topo;
+    if (m_options.numaAware) {
+        topo = CpuTopology::system();
+        if (!m_options.cpuAffinity.empty()) {
+            topo = topo.restrictedTo(m_options.cpuAffinity);
+        }
+    }
+    if (topo.nodes.empty()) {
+        // a single group, pinned to cpuAffinity if any
+        topo.nodes.emplace_back(m_options.cpuAffinity);
+        topo.nodeIds.push_back(0);
+    }
+
+    // Spread workers over nodes in proportion to their number of CPUs: worker i goes to
+    // the node holding the (i * numCpus / numThreads)-th CPU
+    const auto numCpus = std::max<size_t>(topo.numCpus(), 1);
+    vector<int> groupOfNode(topo.nodes.size(), -1);
+    for (size_t i = 0; i < numThreads; i++) {
+        auto nth = i * numCpus / numThreads;
+        size_t nodeIdx = 0;
+        while (nodeIdx + 1 < topo.nodes.size() && nth >= topo.nodes[nodeIdx].size()) {
+            nth -= topo.nodes[nodeIdx].size();
+            ++nodeIdx;
+        }
+
+        if (groupOfNode[nodeIdx] < 0) {
+            // only nodes with at least one worker become a group
+            groupOfNode[nodeIdx] = static_cast<int>(m_nodeWorkers.size());
+            m_nodeWorkers.emplace_back();
+            m_nodeCpus.emplace_back(topo.nodes[nodeIdx]);
+        }
+        m_workerNode[i] = groupOfNode[nodeIdx];
+        m_nodeWorkers[m_workerNode[i]].push_back(static_cast<unsigned>(i));
+    }
+
+    if (m_nodeWorkers.size() > 1) {
+        LOG(INFO) << "Thread pool spreads " << numThreads << " workers over " << m_nodeWorkers.size()
+                  << " NUMA nodes";
+    }
+}
+
 int ThreadPoolPrivate::currentThreadId() const
 {
     auto pt = getPerThread();
@@ -312,17 +491,19 @@ ThreadPoolPrivate::~ThreadPoolPrivate()
 int ThreadPoolPrivate::nonEmptyQueueIndex()
 {
     auto pt = getPerThread();
-    const size_t size = m_queues.size();
+    const size_t size = m_options.numThreads;
     unsigned r = rand(&pt->rand);
     unsigned inc = m_coprimes[r % m_coprimes.size()];
-    unsigned victim = r % size;
-    for (unsigned i = 0; i < size; i++) {
-        if (!m_queues[victim].Empty()) {
-            return victim;
-        }
-        victim += inc;
-        if (victim >= size) {
-            victim -= size;
+    for (size_t prio = 0; prio != kNumPriorities; ++prio) {
+        unsigned victim = r % size;
+        for (unsigned i = 0; i < size; i++) {
+            if (!queue(victim, prio).Empty()) {
+                return static_cast<int>(prio * size + victim);
+            }
+            victim += inc;
+            if (victim >= size) {
+                victim -= size;
+            }
         }
     }
     return -1;
@@ -337,16 +518,39 @@ void ThreadPoolPrivate::workerLoop(int thread_id)
     }
 
     const auto numThreads = m_options.numThreads;
-    const auto spinCount = m_options.spinCount;
     const auto allowSpinning = m_options.allowSpinning;
+    const auto adaptive = m_options.adaptiveSpinning;
+
+    const auto &cpus = m_nodeCpus[m_workerNode[thread_id]];
+    if (!cpus.empty() && !salus::threading::set_thread_affinity(cpus)) {
+        LOG(WARNING) << "Failed to set CPU affinity for thread pool worker " << thread_id;
+    }
 
     auto pt = getPerThread();
     pt->pool = this;
     pt->rand = std::hash<std::thread::id>()(std::this_thread::get_id());
     pt->thread_id = thread_id;
-    auto &q = m_queues[thread_id];
     auto waiter = &m_waiters[thread_id];
 
+    // Track idle gaps for the adaptive spin budget
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point idleSince;
+    bool idle = false;
+    bool parked = false;
+    auto beginIdle = [&]() {
+        if (adaptive && !idle) {
+            idle = true;
+            parked = false;
+            idleSince = Clock::now();
+        }
+    };
+    auto endIdle = [&]() {
+        if (idle) {
+            idle = false;
+            m_spinBudgets[thread_id].recordGap(Clock::now() - idleSince, parked);
+        }
+    };
+
     if (numThreads == 1) {
         // For numThreads == 1 there is no point in going through the expensive
         // steal loop. Moreover, since steal() calls PopBack() on the victim
@@ -355,62 +559,132 @@ void ThreadPoolPrivate::workerLoop(int thread_id)
         // counter-productive for the types of I/O workloads the single thread
         // pools tend to be used for.
         while (!m_cancelled) {
-            auto t = q.PopFront();
-            for (int i = 0; i < spinCount && !t; i++) {
-                if (!m_cancelled.load(std::memory_order_relaxed)) {
-                    t = q.PopFront();
+            auto t = nextTask(thread_id, false);
+            if (!t) {
+                beginIdle();
+                if (!spinForTask(thread_id, false, &t)) {
+                    return;
                 }
             }
             if (!t) {
+                parked = true;
                 if (!waitForWork(waiter, &t)) {
                     return;
                 }
             }
             if (t) {
+                endIdle();
                 t();
             }
         }
     } else {
         while (!m_cancelled) {
-            auto t = q.PopFront();
+            auto t = nextTask(thread_id, true);
             if (!t) {
-                t = steal();
-                if (!t) {
-                    // Leave one thread spinning. This reduces latency.
-                    if (allowSpinning && !m_spinning && !m_spinning.exchange(true)) {
-                        for (int i = 0; i < spinCount && !t; i++) {
-                            if (!m_cancelled.load(std::memory_order_relaxed)) {
-                                t = steal();
-                            } else {
-                                return;
-                            }
-                        }
-                        m_spinning = false;
+                beginIdle();
+                // Leave one thread spinning. This reduces latency.
+                if (allowSpinning && !m_spinning && !m_spinning.exchange(true)) {
+                    auto ok = spinForTask(thread_id, true, &t);
+                    m_spinning = false;
+                    if (!ok) {
+                        return;
                     }
-                    if (!t) {
-                        if (!waitForWork(waiter, &t)) {
-                            return;
-                        }
+                }
+                if (!t) {
+                    parked = true;
+                    if (!waitForWork(waiter, &t)) {
+                        return;
                     }
                 }
             }
             if (t) {
+                endIdle();
                 t();
             }
         }
     }
 }
 
-Task ThreadPoolPrivate::steal()
+bool ThreadPoolPrivate::spinForTask(int thread_id, bool allowSteal, Task *t)
+{
+    auto &counters = m_counters[thread_id];
+
+    if (m_options.adaptiveSpinning) {
+        auto budget = m_spinBudgets[thread_id].budget();
+        if (budget.count() <= 0) {
+            return true;
+        }
+        counters.spins.fetch_add(1, std::memory_order_relaxed);
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        do {
+            if (m_cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            *t = nextTask(thread_id, allowSteal);
+        } while (!*t && std::chrono::steady_clock::now() < deadline);
+    } else {
+        if (m_options.spinCount <= 0) {
+            return true;
+        }
+        counters.spins.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < m_options.spinCount && !*t; i++) {
+            if (m_cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            *t = nextTask(thread_id, allowSteal);
+        }
+    }
+
+    if (*t) {
+        counters.spinHits.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+Task ThreadPoolPrivate::nextTask(int thread_id, bool allowSteal)
+{
+    // Own queue first within a priority, but never run lower priority work while
+    // higher priority work is queued anywhere.
+    for (size_t prio = 0; prio != kNumPriorities; ++prio) {
+        if (m_pending[prio].count.load(std::memory_order_relaxed) <= 0) {
+            continue;
+        }
+        auto t = popped(queue(thread_id, prio).PopFront(), prio);
+        if (!t && allowSteal) {
+            t = steal(prio);
+        }
+        if (t) {
+            return t;
+        }
+    }
+    return {};
+}
+
+Task ThreadPoolPrivate::steal(size_t prio)
 {
     auto pt = getPerThread();
-    const size_t size = m_queues.size();
+    const size_t size = m_options.numThreads;
     unsigned r = rand(&pt->rand);
+
+    if (m_nodeWorkers.size() > 1 && pt->pool == this) {
+        // Local node first, then the others in order
+        const auto numNodes = m_nodeWorkers.size();
+        const auto home = static_cast<size_t>(m_workerNode[pt->thread_id]);
+        for (size_t i = 0; i != numNodes; ++i) {
+            auto t = stealFrom(m_nodeWorkers[(home + i) % numNodes], prio, r);
+            if (t) {
+                return t;
+            }
+        }
+        return {};
+    }
+
     unsigned inc = m_coprimes[r % m_coprimes.size()];
     unsigned victim = r % size;
     for (unsigned i = 0; i < size; i++) {
-        auto t = m_queues[victim].PopBack();
+        auto t = popped(queue(victim, prio).PopBack(), prio);
         if (t) {
+            countSteal(victim);
             return t;
         }
         victim += inc;
@@ -421,6 +695,37 @@ Task ThreadPoolPrivate::steal()
     return {};
 }
 
+Task ThreadPoolPrivate::stealFrom(const vector<unsigned> &group, size_t prio, unsigned r)
+{
+    const size_t size = group.size();
+    auto idx = r % size;
+    for (size_t i = 0; i < size; i++) {
+        auto victim = group[idx];
+        auto t = popped(queue(victim, prio).PopBack(), prio);
+        if (t) {
+            countSteal(victim);
+            return t;
+        }
+        if (++idx == size) {
+            idx = 0;
+        }
+    }
+    return {};
+}
+
+void ThreadPoolPrivate::countSteal(unsigned victim)
+{
+    auto pt = getPerThread();
+    if (pt->pool != this || static_cast<unsigned>(pt->thread_id) == victim) {
+        return;
+    }
+    auto &c = m_counters[pt->thread_id];
+    c.steals.fetch_add(1, std::memory_order_relaxed);
+    if (m_workerNode[pt->thread_id] != m_workerNode[victim]) {
+        c.crossNode.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
 bool ThreadPoolPrivate::waitForWork(EventCount::Waiter *waiter, Task *t)
 {
     // We already did best-effort emptiness check in Steal, so prepare for blocking.
@@ -432,7 +737,10 @@ bool ThreadPoolPrivate::waitForWork(EventCount::Waiter *waiter, Task *t)
       if (m_cancelled) {
         return false;
       } else {
-        *t = m_queues[victim].PopBack();
+        *t = popped(m_queues[victim].PopBack(), victim / m_options.numThreads);
+        if (*t) {
+            countSteal(victim % m_options.numThreads);
+        }
         return true;
       }
     }
@@ -461,6 +769,7 @@ bool ThreadPoolPrivate::waitForWork(EventCount::Waiter *waiter, Task *t)
       m_ec.Notify(true);
       return false;
     }
+    m_counters[waiter - m_waiters.data()].parks.fetch_add(1, std::memory_order_relaxed);
     m_ec.CommitWait(waiter);
     m_blocked--;
     return true;
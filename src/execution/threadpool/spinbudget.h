@@ -0,0 +1,143 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_EXEC_THREADPOOL_SPINBUDGET_H
+#define SALUS_EXEC_THREADPOOL_SPINBUDGET_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+/**
+ * @brief Decides how long an idle worker spins before parking, from a histogram of its
+ * recent idle gaps, i.e. the time from running out of work to getting the next task.
+ *
+ * This is the ski rental problem: spinning through a gap of length g costs g of CPU, while
+ * parking costs parkCost of extra latency when woken up. For each candidate budget S, the
+ * expected cost over the histogram is sum(g) for gaps shorter than S, plus (S + parkCost) for
+ * the others, and the cheapest S is used until the next update. Bursty arrivals thus get a
+ * spin covering the typical gap inside a burst, while sparse arrivals get little or no spin.
+ *
+ * Not thread safe, each worker owns one.
+ */
+class alignas(64) SpinBudget
+{
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    // Bucket 0 holds gaps in [0, 2 * kUnit), bucket b > 0 holds [2^b, 2^(b+1)) * kUnit
+    static constexpr size_t kNumBuckets = 24;
+    static constexpr int64_t kUnitNs = 128;
+    // Update the budget after this many gaps, then halve the counts to forget old ones
+    static constexpr uint32_t kUpdateInterval = 64;
+
+    SpinBudget(Duration parkCost, Duration maxSpin)
+        : m_parkCostNs(parkCost.count())
+        , m_maxSpinNs(maxSpin.count())
+        // Before having any observation, spinning for the park cost is within 2x of optimal
+        , m_budgetNs(std::min(m_parkCostNs, m_maxSpinNs))
+    {
+    }
+
+    Duration budget() const
+    {
+        return Duration(m_budgetNs);
+    }
+
+    /**
+     * @param parked whether the worker parked during the gap. The wakeup latency included in
+     * the gap is then taken out, as it would not be there had the worker kept spinning.
+     */
+    void recordGap(Duration gap, bool parked)
+    {
+        auto ns = gap.count();
+        if (parked) {
+            ns = std::max<int64_t>(ns - m_parkCostNs, 0);
+        }
+        m_counts[bucketOf(ns)] += 1;
+        if (++m_sinceUpdate >= kUpdateInterval) {
+            update();
+        }
+    }
+
+private:
+    static size_t bucketOf(int64_t ns)
+    {
+        size_t b = 0;
+        for (auto v = ns / (2 * kUnitNs); v > 0 && b + 1 < kNumBuckets; v >>= 1) {
+            ++b;
+        }
+        return b;
+    }
+
+    static int64_t lowerOf(size_t b)
+    {
+        return b == 0 ? 0 : kUnitNs << b;
+    }
+
+    static int64_t upperOf(size_t b)
+    {
+        return kUnitNs << (b + 1);
+    }
+
+    void update()
+    {
+        m_sinceUpdate = 0;
+
+        // Candidates are 0 and bucket boundaries up to maxSpin
+        auto bestCost = std::numeric_limits<double>::max();
+        int64_t best = 0;
+        for (size_t cand = 0; cand <= kNumBuckets; ++cand) {
+            auto spin = cand == 0 ? 0 : upperOf(cand - 1);
+            if (spin > m_maxSpinNs) {
+                break;
+            }
+            double cost = 0;
+            for (size_t b = 0; b != kNumBuckets; ++b) {
+                if (!m_counts[b]) {
+                    continue;
+                }
+                if (upperOf(b) <= spin) {
+                    cost += m_counts[b] * (lowerOf(b) + upperOf(b)) / 2.0;
+                } else {
+                    cost += m_counts[b] * static_cast<double>(spin + m_parkCostNs);
+                }
+            }
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = spin;
+            }
+        }
+        m_budgetNs = best;
+
+        for (auto &c : m_counts) {
+            c /= 2;
+        }
+    }
+
+    const int64_t m_parkCostNs;
+    const int64_t m_maxSpinNs;
+    int64_t m_budgetNs;
+    uint32_t m_sinceUpdate = 0;
+    std::array<uint32_t, kNumBuckets> m_counts{};
+};
+
+#endif // SALUS_EXEC_THREADPOOL_SPINBUDGET_H
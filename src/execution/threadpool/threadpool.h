@@ -20,10 +20,14 @@
 #ifndef EXECUTION_THREADPOOL_H
 #define EXECUTION_THREADPOOL_H
 
-#include "utils/fixed_function.hpp"
+#include "utils/smallfunction.h"
 
+#include <cstdint>
 #include <future>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 struct ThreadPoolOptions
 {
@@ -62,6 +66,36 @@ struct ThreadPoolOptions
         return *this;
     }
 
+    /**
+     * @brief Instead of a fixed spinCount, let each worker adapt how long it spins before
+     * parking to the idle gaps it recently observed. Spins never last longer than maxSpinUs,
+     * and are only used when expected to be cheaper than parking, which is assumed to add
+     * parkCostUs of wakeup latency.
+     */
+    bool adaptiveSpinning = false;
+
+    ThreadPoolOptions &setAdaptiveSpinning(bool adaptive)
+    {
+        adaptiveSpinning = adaptive;
+        return *this;
+    }
+
+    int parkCostUs = 20;
+
+    ThreadPoolOptions &setParkCostUs(int us)
+    {
+        parkCostUs = us;
+        return *this;
+    }
+
+    int maxSpinUs = 200;
+
+    ThreadPoolOptions &setMaxSpinUs(int us)
+    {
+        maxSpinUs = us;
+        return *this;
+    }
+
     /**
      * @brief Optional worker thread name, truncated at 16 characters.
      */
@@ -73,6 +107,30 @@ struct ThreadPoolOptions
         return *this;
     }
 
+    /**
+     * @brief CPUs worker threads may run on. Empty for no restriction.
+     */
+    std::vector<int> cpuAffinity;
+
+    ThreadPoolOptions &setCpuAffinity(std::vector<int> cpus)
+    {
+        cpuAffinity = std::move(cpus);
+        return *this;
+    }
+
+    /**
+     * @brief Split workers into one group per NUMA node (within cpuAffinity), in proportion
+     * to the node's CPUs. Workers are pinned to their node, and steal from their own group
+     * before going to other nodes.
+     */
+    bool numaAware = false;
+
+    ThreadPoolOptions &setNumaAware(bool aware)
+    {
+        numaAware = aware;
+        return *this;
+    }
+
     ThreadPoolOptions();
     ThreadPoolOptions(const ThreadPoolOptions &) = default;
     ThreadPoolOptions(ThreadPoolOptions &&) = default;
@@ -95,13 +153,31 @@ public:
     ThreadPool(ThreadPool &&other) = default;
     ThreadPool &operator=(ThreadPool &&other) = default;
 
-    using Closure = sstl::FixedFunction<void()>;
+    using Closure = sstl::SmallFunction<void()>;
+
+    /**
+     * @brief Each priority has its own run queues. Workers always pick up, or steal, queued
+     * closures of a higher priority before lower ones, but never preempt a running closure.
+     */
+    enum class Priority : uint8_t
+    {
+        High = 0,
+        Normal,
+        Low,
+    };
+    static constexpr size_t kNumPriorities = 3;
+
+    /**
+     * @brief Home node hint meaning no preference
+     */
+    static constexpr int kAnyNode = -1;
 
     /**
      * @brief Try run a closure c in thread pool.
+     * @param node prefer running on workers of this node, between 0 and numNodes() - 1.
      * @returns c itself if queue is full. Otherwise a default constructed Closure.
      */
-    Closure tryRun(Closure c);
+    Closure tryRun(Closure c, Priority prio = Priority::Normal, int node = kAnyNode);
 
     /**
      * @brief Run the Func f in thread pool, don't care about its completion.
@@ -109,9 +185,9 @@ public:
      * If the queue is full, then f is run on calling thread.
      */
     template<typename Func>
-    void run(Func f)
+    void run(Func f, Priority prio = Priority::Normal, int node = kAnyNode)
     {
-        auto c = tryRun(std::move(f));
+        auto c = tryRun(std::move(f), prio, node);
         if (c) {
             // enqueue failed, run on current thread
             c();
@@ -124,17 +200,37 @@ public:
      * @returns future holding the return value of function f.
      */
     template<typename Func>
-    auto post(Func f)
+    auto post(Func f, Priority prio = Priority::Normal)
     {
         using R = std::invoke_result_t<Func>;
         using Task = std::packaged_task<R()>;
 
         Task tk(std::move(f));
         auto fu = tk.get_future();
-        run(std::move(tk));
+        run(std::move(tk), prio);
         return fu;
     }
 
+    /**
+     * @brief Run f in thread pool, then call then with its result on the same thread, right
+     * after f returns. If f returns void, then is called with no argument.
+     *
+     * Unlike post, no shared state is allocated, and the caller doesn't have to block on or
+     * poll a future. Like run, both are executed on calling thread if the queue is full.
+     */
+    template<typename Func, typename Then>
+    void runThen(Func f, Then then, Priority prio = Priority::Normal, int node = kAnyNode)
+    {
+        run([f = std::move(f), then = std::move(then)]() mutable {
+            if constexpr (std::is_void<std::invoke_result_t<Func &>>::value) {
+                f();
+                then();
+            } else {
+                then(f());
+            }
+        }, prio, node);
+    }
+
     /**
      * @brief Signal to stop the thread pool, currently running tasks will continue to run.
      */
@@ -156,6 +252,27 @@ public:
      */
     int currentThreadId() const;
 
+    /**
+     * @returns the number of worker groups. 1 unless the pool is NUMA aware and the
+     * machine has multiple nodes.
+     */
+    size_t numNodes() const;
+
+    struct Stats
+    {
+        uint64_t steals = 0;
+        // steals from a worker in another node
+        uint64_t crossNodeSteals = 0;
+        // times an idle worker spun waiting for work, and how many of those found some
+        uint64_t spins = 0;
+        uint64_t spinHits = 0;
+        // times an idle worker blocked waiting for work
+        uint64_t parks = 0;
+        // times submitting work had to wake up a blocked worker
+        uint64_t wakeups = 0;
+    };
+    Stats stats() const;
+
 private:
     std::unique_ptr<ThreadPoolPrivate> d;
 };
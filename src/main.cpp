@@ -52,6 +52,9 @@ const static auto disableFairness = "--disable-fairness";
 const static auto disableWorkConservative = "--disable-wc";
 const static auto smFactor = "--sm-factor";
 const static auto scheduler = "--sched";
+const static auto controlThreads = "--control-threads";
+const static auto dataThreads = "--data-threads";
+const static auto ioMaxThreads = "--io-max-threads";
 
 const static auto logConf = "--logconf";
 const static auto verbose = "--verbose";
@@ -74,7 +77,9 @@ Options:
     -h, --help                  Print this help message and exit.
     -V, --version               Print version and exit.
     -l <endpoint>, --listen=<endpoint>
-                                Listen on ZeroMQ endpoint <endpoint>.
+                                Listen on ZeroMQ endpoint <endpoint>, or on shared
+                                memory named <name> for clients on this host when
+                                <endpoint> is shm://<name>.
                                 [default: tcp://*:5501]
     -s <policy>, --sched=<policy>
                                 Use <policy> for scheduling . Choices: fair, preempt, pack, rr, fifo.
@@ -84,6 +89,14 @@ Options:
     --max-hol-waiting=<num>     Maximum number of task allowed go before queue head
                                 in scheduling. [default: 50]
     --sm-factor=<num>           Scale factor for # of SMs. [default: 1]
+    --control-threads=<num>     Threads handling control plane requests, e.g. session
+                                setup and teardown. [default: 2]
+    --data-threads=<num>        Threads handling data plane requests, i.e. running
+                                steps. 0 means half the number of cores.
+                                [default: 0]
+    --io-max-threads=<num>      Let each of the above grow up to <num> threads while
+                                requests wait in its queue, and shrink back when idle.
+                                0 means twice the number of cores. [default: 0]
     -c <file>, --logconf=<file> Path to log configuration file. Note that
                                 settings in this file takes precedence over
                                 other command line arguments.
@@ -232,7 +245,18 @@ void configureSMBlocker(std::map<std::string, docopt::value> &args)
 #endif
 }
 
-void printConfiguration(std::map<std::string, docopt::value> &)
+std::pair<salus::IOThreadPoolOptions, salus::IOThreadPoolOptions>
+ioPoolOptions(std::map<std::string, docopt::value> &args)
+{
+    auto maxThreads = static_cast<size_t>(value_or<long>(args[flags::ioMaxThreads], 0l));
+    return {
+        {"IOControl", static_cast<size_t>(value_or<long>(args[flags::controlThreads], 2l)), maxThreads},
+        // Steps may block on each other, grow as soon as one has to wait
+        {"IOData", static_cast<size_t>(value_or<long>(args[flags::dataThreads], 0l)), maxThreads, 1},
+    };
+}
+
+void printConfiguration(std::map<std::string, docopt::value> &args)
 {
     LOG(INFO) << "Running build type: " << SALUS_BUILD_TYPE;
 
@@ -256,6 +280,14 @@ void printConfiguration(std::map<std::string, docopt::value> &)
     LOG(INFO) << "    MaxQueueHeadWaiting: " << param.maxHolWaiting;
     LOG(INFO) << "    WorkConservative: " << (param.workConservative ? "on" : "off");
 
+    LOG(INFO) << "Request handling:";
+    auto [control, data] = ioPoolOptions(args);
+    for (const auto &opts : {control, data}) {
+        LOG(INFO) << "    " << opts.name
+                  << " threads: " << (opts.numThreads ? std::to_string(opts.numThreads) : "auto"s)
+                  << ", max: " << (opts.maxThreads ? std::to_string(opts.maxThreads) : "auto"s);
+    }
+
 #ifdef SALUS_ENABLE_TENSORFLOW
     LOG(INFO) << "GPU execution:";
     LOG(INFO) << "    SM scale factor: " << salus::oplib::tensorflow::SMBlocker::scaleFactorSM();
@@ -283,7 +315,8 @@ int main(int argc, char **argv)
     salus::ExecutionEngine::instance().startScheduler();
 
     // Then start server to accept request
-    ZmqServer server;
+    auto [control, data] = ioPoolOptions(args);
+    ZmqServer server(std::move(control), std::move(data));
     const auto &listen = (args)[flags::listen].asString();
     LOG(INFO) << "Starting server listening at " << listen;
     server.start(listen);
@@ -51,6 +51,12 @@ public:
 
     using DoneCallback = std::function<void(ProtoPtr &&)>;
 
+    /**
+     * onRun and onRunGraph are called on the data plane IO pool. onCustom is called on the request
+     * pipeline worker, in the order requests of a session are received, and must not block: post
+     * blocking work with sender->postControl or sender->postData.
+     */
+
     virtual void onRun(ZmqServer::Sender sender, const executor::EvenlopDef &evenlop,
                        const executor::RunRequest &request, DoneCallback cb) = 0;
 
@@ -30,8 +30,19 @@ void HandlerCallback::operator()(const Status &s) const
     cresp->mutable_result()->set_message(s.error_message());
     if (tfresp && s.ok()) {
         tfresp->SerializeToString(cresp->mutable_extra());
+        cresp->set_tensorframes(tensorFrames);
     }
     cb(std::move(cresp));
 }
 
+void HandlerCallback::sendPartial(const ::google::protobuf::Message &partial) const
+{
+    DCHECK(sender);
+    auto cresp = std::make_unique<zrpc::CustomResponse>();
+    cresp->mutable_result()->set_code(tf::error::OK);
+    partial.SerializeToString(cresp->mutable_extra());
+    cresp->set_more(true);
+    sender->sendMessage(std::move(cresp));
+}
+
 } // namespace salus::oplib::tensorflow
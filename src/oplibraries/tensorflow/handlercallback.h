@@ -32,26 +32,50 @@ namespace salus::oplib::tensorflow {
 struct HandlerCallback
 {
     IOpLibrary::DoneCallback cb;
-    ProtoPtr tfresp;
+    // Owns tfresp, and the request, when they are allocated on it. Reset and back to the pool
+    // when this goes away, which is after the reply is sent. Must be declared before tfresp.
+    sstl::ScopedArena arena;
+    sstl::MaybeArenaPtr<::google::protobuf::Message> tfresp;
+    // Sender of the request, for handlers exchanging tensor frames
+    ZmqServer::Sender sender;
+    // Whether tensor contents of the request and reply travel as frames, see tensorframes.h
+    bool tensorFrames = false;
     void operator()(const Status &s) const;
 
+    /**
+     * @brief Send a successful reply with `partial` as content ahead of the final one made by
+     * operator(), for requests answered with several replies. Needs sender.
+     */
+    void sendPartial(const ::google::protobuf::Message &partial) const;
+
     HandlerCallback() = default;
 
-    HandlerCallback(IOpLibrary::DoneCallback cb, ProtoPtr tfresp)
+    HandlerCallback(IOpLibrary::DoneCallback cb, ProtoPtr tfresp, ZmqServer::Sender sender = nullptr,
+                    bool tensorFrames = false)
         : cb(std::move(cb))
         , tfresp(std::move(tfresp))
+        , sender(std::move(sender))
+        , tensorFrames(tensorFrames)
     {
     }
 
     HandlerCallback(HandlerCallback &&other) noexcept
-        : HandlerCallback(std::move(other.cb), std::move(other.tfresp))
+        : cb(std::move(other.cb))
+        , arena(std::move(other.arena))
+        , tfresp(std::move(other.tfresp))
+        , sender(std::move(other.sender))
+        , tensorFrames(other.tensorFrames)
     {
     }
 
     HandlerCallback &operator =(HandlerCallback &&other) noexcept
     {
         cb = std::move(other.cb);
+        // Drop the old response before the arena it may live on
         tfresp = std::move(other.tfresp);
+        arena = std::move(other.arena);
+        sender = std::move(other.sender);
+        tensorFrames = other.tensorFrames;
         return *this;
     }
 
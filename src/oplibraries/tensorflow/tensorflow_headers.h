@@ -77,6 +77,7 @@
 #include <tensorflow/core/lib/gtl/inlined_vector.h>
 #include <tensorflow/core/lib/gtl/manual_constructor.h>
 #include <tensorflow/core/lib/gtl/stl_util.h>
+#include <tensorflow/core/lib/hash/hash.h>
 #include <tensorflow/core/lib/strings/strcat.h>
 #include <tensorflow/core/lib/strings/stringprintf.h>
 #include <tensorflow/core/platform/mutex.h>
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "oplibraries/tensorflow/tensorflow_headers.h"
+
+#include "oplibraries/tensorflow/tensorframes.h"
+
+#include "platform/logging.h"
+#include "utils/macros.h"
+
+#include <cstring>
+
+namespace salus::oplib::tensorflow {
+
+namespace {
+
+/**
+ * @brief Hands out the buffer of one ZeroMQ message as the only allocation, and deletes
+ * itself together with the message when that is deallocated.
+ *
+ * tf::Tensor can't be constructed over a custom TensorBuffer from outside, but it can over
+ * an allocator, which is all the adoption needs.
+ */
+class FrameAllocator : public tf::Allocator
+{
+    zmq::message_t m_frame;
+    bool m_allocated = false;
+
+public:
+    explicit FrameAllocator(zmq::message_t &&frame)
+        : m_frame(std::move(frame))
+    {
+    }
+
+    std::string Name() override
+    {
+        return "zmq_frame";
+    }
+
+    void *AllocateRaw(size_t alignment, size_t num_bytes) override
+    {
+        CHECK(!m_allocated) << "FrameAllocator can only allocate once";
+        CHECK_EQ(num_bytes, m_frame.size());
+        CHECK_EQ(reinterpret_cast<uintptr_t>(m_frame.data()) % alignment, 0u);
+        m_allocated = true;
+        return m_frame.data();
+    }
+
+    void DeallocateRaw(void *ptr) override
+    {
+        DCHECK_EQ(ptr, m_frame.data());
+        UNUSED(ptr);
+        delete this;
+    }
+};
+
+// Same alignment tf::Tensor asks its allocator for, which also satisfies Eigen
+bool isAligned(const void *ptr)
+{
+    return reinterpret_cast<uintptr_t>(ptr) % tf::Allocator::kAllocatorAlignment == 0;
+}
+
+} // namespace
+
+bool usesTensorFrame(tf::DataType dtype)
+{
+    return tf::DataTypeCanUseMemcpy(dtype);
+}
+
+Status tensorFromFrame(const tf::TensorProto &proto, zmq::message_t &&frame, tf::Tensor &out)
+{
+    if (!usesTensorFrame(proto.dtype())) {
+        return tf::errors::InvalidArgument("Tensor of type ", tf::DataTypeString(proto.dtype()),
+                                           " can't be sent in frame");
+    }
+    if (!tf::TensorShape::IsValid(proto.tensor_shape())) {
+        return tf::errors::InvalidArgument("Invalid tensor shape: ", proto.tensor_shape().DebugString());
+    }
+    tf::TensorShape shape(proto.tensor_shape());
+    auto expected = static_cast<size_t>(shape.num_elements()) * tf::DataTypeSize(proto.dtype());
+    if (frame.size() != expected) {
+        return tf::errors::InvalidArgument("Tensor frame has ", frame.size(), " bytes, expecting ", expected,
+                                           " for ", shape.DebugString(), " of ",
+                                           tf::DataTypeString(proto.dtype()));
+    }
+
+    // Nothing would be allocated from FrameAllocator for empty tensors
+    if (expected == 0) {
+        out = tf::Tensor(proto.dtype(), shape);
+        return Status::OK();
+    }
+
+    if (isAligned(frame.data())) {
+        out = tf::Tensor(new FrameAllocator(std::move(frame)), proto.dtype(), shape);
+    } else {
+        VLOG(3) << "Copying misaligned tensor frame of " << expected << " bytes";
+        out = tf::Tensor(proto.dtype(), shape);
+        std::memcpy(tf::DMAHelper::base(&out), frame.data(), expected);
+    }
+    return Status::OK();
+}
+
+zmq::message_t frameFromTensor(const tf::Tensor &tensor)
+{
+    DCHECK(usesTensorFrame(tensor.dtype()));
+
+    auto buf = tf::DMAHelper::buffer(&tensor);
+    if (!buf || tensor.TotalBytes() == 0) {
+        return zmq::message_t();
+    }
+
+    // The frame holds a ref on the buffer, dropped by ZeroMQ once sent
+    buf->Ref();
+    auto release = [](void *, void *hint) { static_cast<const tf::TensorBuffer *>(hint)->Unref(); };
+    return zmq::message_t(const_cast<void *>(tf::DMAHelper::base(&tensor)), tensor.TotalBytes(), release,
+                          const_cast<tf::TensorBuffer *>(buf));
+}
+
+} // namespace salus::oplib::tensorflow
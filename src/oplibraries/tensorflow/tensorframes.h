@@ -0,0 +1,59 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SALUS_OPLIB_TENSORFLOW_TENSORFRAMES_H
+#define SALUS_OPLIB_TENSORFLOW_TENSORFRAMES_H
+
+#include "oplibraries/tensorflow/tensorflow_headers.h"
+#include "oplibraries/tensorflow/tfutils.h"
+
+#include <zmq.hpp>
+
+/**
+ * Tensor contents of a RunStep may travel as separate ZeroMQ frames following the CustomRequest
+ * or CustomResponse, rather than serialized in TensorProto inside their extra bytes. This saves
+ * serializing, parsing and copying large contents through protobuf.
+ *
+ * Only tensors whose type can be memcpy-ed go in frames, one frame per tensor in the order of
+ * request feeds or response tensors. Their TensorProto keeps dtype and shape but no content.
+ * Other tensors carry contents in TensorProto as usual.
+ */
+namespace salus::oplib::tensorflow {
+
+/**
+ * @brief Whether contents of tensors of dtype travel in frames
+ */
+bool usesTensorFrame(tf::DataType dtype);
+
+/**
+ * @brief Make a tensor with dtype and shape from proto and contents from frame.
+ *
+ * The tensor takes over the frame's buffer if it is suitably aligned, otherwise the contents
+ * are copied once.
+ */
+Status tensorFromFrame(const tf::TensorProto &proto, zmq::message_t &&frame, tf::Tensor &out);
+
+/**
+ * @brief Make a frame referencing contents of tensor, which are kept alive until ZeroMQ is
+ * done sending them.
+ */
+zmq::message_t frameFromTensor(const tf::Tensor &tensor);
+
+} // namespace salus::oplib::tensorflow
+
+#endif // SALUS_OPLIB_TENSORFLOW_TENSORFRAMES_H
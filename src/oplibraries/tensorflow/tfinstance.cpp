@@ -141,9 +141,13 @@ void TFInstance::handleCreateSession(std::unique_ptr<tf::CreateSessionRequest> &
     ectx->setExpectedRunningTime(totalRunningTime);
 
     // smaller is higher priority
-    auto priority = static_cast<int>(sstl::getOrDefault(m.persistant(), "SCHED:PRIORITY", 20));
+    constexpr int kDefaultPriority = 20;
+    auto priority = static_cast<int>(sstl::getOrDefault(m.persistant(), "SCHED:PRIORITY", kDefaultPriority));
 
     LOG(INFO) << "Accept session with priority " << priority;
+    ectx->setPoolPriority(priority < kDefaultPriority
+                              ? ThreadPool::Priority::High
+                              : priority > kDefaultPriority ? ThreadPool::Priority::Low : ThreadPool::Priority::Normal);
 
     m_laneMgr->requestLanes(std::move(layout), [&resp, priority,
                                                 cb = std::move(cb), req = std::move(req), ectx = std::move(ectx),
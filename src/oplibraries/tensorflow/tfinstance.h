@@ -23,6 +23,7 @@
 #include "oplibraries/tensorflow/tfoplibraryv2.h"
 #include "oplibraries/tensorflow/tfutils.h"
 #include "platform/thread_annotations.h"
+#include "resources/resources.h"
 #include "utils/cpp17.h"
 #include "utils/macros.h"
 #include "utils/pointerutils.h"
@@ -61,6 +62,9 @@ class TFInstance
     {
         static constexpr int MaxDeviceType = 2;
         static constexpr int MaxDeviceId = 3;
+        static_assert(static_cast<size_t>(MaxDeviceType) <= ResourceVector::kNumDeviceTypes
+                          && static_cast<size_t>(MaxDeviceId) <= ResourceVector::kMaxDeviceId,
+                      "ResourceVector must have a slot for every device");
 
         tf::Device *specToTF[MaxDeviceType][MaxDeviceId] = {};
         std::unique_ptr<tf::DeviceMgr> deviceMgr;
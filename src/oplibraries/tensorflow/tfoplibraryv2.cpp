@@ -31,6 +31,9 @@
 #include "oplibraries/tensorflow/tfinstance.h"
 #include "oplibraries/tensorflow/tfsession.h"
 
+#include <iterator>
+#include <type_traits>
+
 namespace zrpc = executor;
 
 namespace salus::oplib::tensorflow {
@@ -38,27 +41,136 @@ namespace salus::oplib::tensorflow {
 namespace {
 
 template<typename REQUEST>
-auto prepareTFCall(const zrpc::CustomRequest &creq);
+auto prepareTFCall(const zrpc::CustomRequest &creq, ::google::protobuf::Arena *arena);
 
 #define IMPL_PARSE(name)                                                                                               \
     template<>                                                                                                         \
-    auto prepareTFCall<tf::name##Request>(const zrpc::CustomRequest &creq)                                             \
+    auto prepareTFCall<tf::name##Request>(const zrpc::CustomRequest &creq, ::google::protobuf::Arena *arena)           \
     {                                                                                                                  \
-        auto tfreq = sstl::createMessage<tf::name##Request>("tensorflow." #name "Request", creq.extra().data(),        \
-                                                            creq.extra().size());                                      \
+        auto tfreq = sstl::parseMessage<tf::name##Request>(arena, creq.extra().data(), creq.extra().size());           \
         if (!tfreq) {                                                                                                  \
             throw TFException(                                                                                         \
                 tf::errors::InvalidArgument("Failed to parse message as", "tensorflow." #name "Request"));             \
         }                                                                                                              \
                                                                                                                        \
-        return std::make_pair(std::move(tfreq), std::make_unique<tf::name##Response>());                               \
+        return std::make_pair(std::move(tfreq), sstl::newMessage<tf::name##Response>(arena));                          \
     }
 
 CallWithMasterMethodName(IMPL_PARSE)
 
 #undef IMPL_PARSE
 
-    OpLibraryRegistary::Register tfoplibraryv2(executor::TENSORFLOW, std::make_unique<TFOpLibraryV2>(), 200);
+// RunStep requests and responses have a TensorProto for each feed and fetch, which with large fetch sets
+// are thousands of small allocations per step. Those go on a pooled arena instead.
+template<typename REQUEST>
+constexpr bool kOnArena = std::is_same_v<REQUEST, tf::RunStepRequest>;
+
+// Where each master method goes
+#define INSTANCE_HANDLER(name)                                                                                         \
+    void handleParsed(sstl::MaybeArenaPtr<tf::name##Request> &&tfreq, tf::name##Response &resp,                        \
+                      HandlerCallback &&hcb)                                                                           \
+    {                                                                                                                  \
+        static_assert(!kOnArena<tf::name##Request>, "TFInstance takes ownership of the request");                      \
+        TFInstance::instance().handle##name(sstl::wrap_unique(tfreq.release()), resp, std::move(hcb));                 \
+    }
+
+INSTANCE_HANDLER(CreateSession)
+INSTANCE_HANDLER(CloseSession)
+INSTANCE_HANDLER(ListDevices)
+INSTANCE_HANDLER(Reset)
+
+#undef INSTANCE_HANDLER
+
+#define SESSION_HANDLER(name)                                                                                          \
+    void handleParsed(sstl::MaybeArenaPtr<tf::name##Request> &&tfreq, tf::name##Response &resp,                        \
+                      HandlerCallback &&hcb)                                                                           \
+    {                                                                                                                  \
+        auto sess = TFInstance::instance().findSession(tfreq->session_handle());                                       \
+        sess->handle##name(*tfreq, resp, std::move(hcb));                                                              \
+    }
+
+SESSION_HANDLER(ExtendSession)
+SESSION_HANDLER(PartialRunSetup)
+SESSION_HANDLER(RunStep)
+
+#undef SESSION_HANDLER
+
+template<typename REQUEST>
+void handleMethod(const zrpc::CustomRequest &creq, HandlerCallback &&hcb)
+{
+    if constexpr (kOnArena<REQUEST>) {
+        hcb.arena = sstl::ScopedArena::acquire();
+    }
+    auto [tfreq, tfresp] = prepareTFCall<REQUEST>(creq, hcb.arena.get());
+    auto &resp = *tfresp;
+    hcb.tfresp = std::move(tfresp);
+
+    if constexpr (std::is_same_v<REQUEST, tf::RunStepRequest>) {
+        // Goes to the data plane pool by itself
+        handleParsed(std::move(tfreq), resp, std::move(hcb));
+    } else {
+        // Everything else is control plane: session setup and teardown, graph extension, etc. They may
+        // take long, so are moved off the dispatch worker to not hold back other sessions' steps.
+        auto sender = hcb.sender;
+        sender->postControl([tfreq = std::move(tfreq), &resp, hcb = std::move(hcb)]() mutable {
+            try {
+                handleParsed(std::move(tfreq), resp, std::move(hcb));
+            } catch (const TFException &ex) {
+                LOG(ERROR) << "Error when executing " << REQUEST::descriptor()->full_name() << ": " << ex.what();
+                hcb(ex.code());
+            }
+        });
+    }
+}
+
+void handleRunStepBatch(const zrpc::CustomRequest &creq, HandlerCallback &&hcb)
+{
+    auto req = sstl::parseMessage<zrpc::RunStepBatchRequest>(creq.extra().data(), creq.extra().size());
+    if (!req) {
+        throw TFException(tf::errors::InvalidArgument("Failed to parse message as", "executor.RunStepBatchRequest"));
+    }
+    auto sess = TFInstance::instance().findSession(req->step().session_handle());
+    sess->handleRunStepBatch(std::move(req), std::move(hcb));
+}
+
+struct MasterMethod
+{
+    const char *typeName;
+    void (*handle)(const zrpc::CustomRequest &, HandlerCallback &&);
+};
+
+#define ITEM(name) {"tensorflow." #name "Request", &handleMethod<tf::name##Request>},
+
+// Indexed by TFMasterMethod
+constexpr MasterMethod kMasterMethods[] = {
+    {"", nullptr},
+    CallWithMasterMethodName(ITEM)
+    {"executor.RunStepBatchRequest", &handleRunStepBatch},
+};
+
+#undef ITEM
+
+static_assert(std::size(kMasterMethods) == zrpc::TFMasterMethod_ARRAYSIZE,
+              "TFMasterMethod must follow CallWithMasterMethodName and our own methods");
+
+/**
+ * @brief Find the method by creq.method, or by creq.type for old clients
+ */
+const MasterMethod *findMethod(const zrpc::CustomRequest &creq)
+{
+    auto method = creq.method();
+    if (method > zrpc::UNKNOWN_MASTER_METHOD && method < zrpc::TFMasterMethod_ARRAYSIZE) {
+        return &kMasterMethods[method];
+    }
+    for (size_t i = 1; i != std::size(kMasterMethods); ++i) {
+        if (creq.type() == kMasterMethods[i].typeName) {
+            return &kMasterMethods[i];
+        }
+    }
+    return nullptr;
+}
+
+OpLibraryRegistary::Register tfoplibraryv2(executor::TENSORFLOW, std::make_unique<TFOpLibraryV2>(), 200);
 
 } // namespace
 
@@ -100,49 +212,17 @@ void TFOpLibraryV2::onRun(ZmqServer::Sender sender, const zrpc::EvenlopDef &even
 void TFOpLibraryV2::onCustom(ZmqServer::Sender sender, const zrpc::EvenlopDef &evenlop, const zrpc::CustomRequest &creq,
                              DoneCallback cb)
 {
-    UNUSED(sender);
-
-    using Method = std::function<void(const zrpc::CustomRequest &, HandlerCallback &&)>;
-    static std::unordered_map<std::string, Method> funcs{
-#define INSTANCE_HANDLER(name)                                                                                         \
-    {                                                                                                                  \
-        "tensorflow." #name "Request", [](auto creq, auto &&hcb) {                                                     \
-            auto [tfreq, tfresp] = prepareTFCall<tf::name##Request>(creq);                                             \
-            auto &resp = *tfresp;                                                                                      \
-            hcb.tfresp = std::move(tfresp);                                                                            \
-            TFInstance::instance().handle##name(std::move(tfreq), resp, std::forward<decltype(hcb)>(hcb));             \
-        }                                                                                                              \
-    }
-
-        INSTANCE_HANDLER(CreateSession), INSTANCE_HANDLER(CloseSession),   INSTANCE_HANDLER(ListDevices),
-        INSTANCE_HANDLER(Reset),
-
-#undef INSTANCE_HANDLER
-
-#define SESSION_HANDLER(name)                                                                                          \
-    {                                                                                                                  \
-        "tensorflow." #name "Request", [](auto creq, auto &&hcb) -> void {                                             \
-            auto [tfreq, tfresp] = prepareTFCall<tf::name##Request>(creq);                                             \
-            auto &resp = *tfresp;                                                                                      \
-            hcb.tfresp = std::move(tfresp);                                                                            \
-            auto sess = TFInstance::instance().findSession(tfreq->session_handle());                                   \
-            sess->handle##name(*tfreq, resp, std::forward<decltype(hcb)>(hcb));                                        \
-        }                                                                                                              \
-    }
-
-        SESSION_HANDLER(ExtendSession),  SESSION_HANDLER(PartialRunSetup), SESSION_HANDLER(RunStep),
-#undef SESSION_HANDLER
-    };
-
-    HandlerCallback hcb{std::move(cb), nullptr};
+    const auto *method = findMethod(creq);
+    // Only RunStep knows how to exchange tensor contents in frames
+    auto tensorFrames = creq.tensorframes() && method && method->handle == &handleMethod<tf::RunStepRequest>;
+    HandlerCallback hcb{std::move(cb), nullptr, std::move(sender), tensorFrames};
     try {
-        auto it = funcs.find(creq.type());
-        if (it == funcs.end()) {
+        if (!method) {
             throw TFException(tf::errors::InvalidArgument(creq.type(), " not found in registered custom tasks"));
         }
 
-        VLOG(2) << "Dispatching custom task " << it->first << " of seq " << evenlop.seq();
-        it->second(creq, std::move(hcb));
+        VLOG(2) << "Dispatching custom task " << method->typeName << " of seq " << evenlop.seq();
+        method->handle(creq, std::move(hcb));
     } catch (const TFException &ex) {
         LOG(ERROR) << "Error when executing custom task " << creq.type() << " of seq " << evenlop.seq() << ": "
                    << ex.what();
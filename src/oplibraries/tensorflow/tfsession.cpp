@@ -23,14 +23,22 @@
 
 #include "execution/executionengine.h"
 #include "oplibraries/tensorflow/handlercallback.h"
+#include "oplibraries/tensorflow/tensorframes.h"
 #include "oplibraries/tensorflow/tfexception.h"
 #include "oplibraries/tensorflow/tfinstance.h"
 #include "oplibraries/tensorflow/v3/sigraphmgr.h"
 #include "oplibraries/tensorflow/worker/dummysessionmgr.h"
 #include "oplibraries/tensorflow/worker/dummyworkercache.h"
 #include "oplibraries/tensorflow/worker/rendezvousmgr.h"
+#include "utils/envutils.h"
+#include "utils/smallfunction.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <deque>
+#include <mutex>
+#include <vector>
 
 namespace salus::oplib::tensorflow {
 
@@ -42,6 +50,14 @@ auto computePool(tf::Env &env)
     return pool.get();
 }
 
+// Steps of a batch in MasterSession::Run at once, by default one running and the next one already queued
+// in the engine
+size_t batchWindow()
+{
+    struct BatchWindowTag;
+    return std::max(sstl::fromEnvVarCached<BatchWindowTag>("SALUS_BATCH_WINDOW", size_t{2}), size_t{1});
+}
+
 } // namespace
 
 class TFSession::TFSessionPrivate
@@ -57,10 +73,51 @@ public:
 
     DECLARE_HANDLER_PRIV(ExtendSession);
     DECLARE_HANDLER_PRIV(PartialRunSetup);
-    DECLARE_HANDLER_PRIV(RunStep);
 
 #undef DECLARE_HANDLER_PRIV
 
+    /**
+     * @brief Run the step on the IO pool, completing cb from there
+     */
+    void handleRunStep(std::shared_ptr<TFSession> &&self, const tf::RunStepRequest &req, tf::RunStepResponse &resp,
+                       HandlerCallback &&cb);
+
+    /**
+     * @brief Run the step, always completing cb even if it throws
+     */
+    void runStepGuarded(const tf::RunStepRequest &req, tf::RunStepResponse &resp, HandlerCallback &&cb);
+
+    void runStep(const tf::RunStepRequest &req, tf::RunStepResponse &resp, HandlerCallback &&cb);
+
+    /**
+     * @brief RunStep with tensor contents exchanged as frames, see tensorframes.h
+     */
+    void runStepFrames(const tf::RunStepRequest &req, tf::RunStepResponse &resp, HandlerCallback &&cb);
+
+    struct StepBatch;
+
+    void handleRunStepBatch(std::shared_ptr<TFSession> &&self, std::unique_ptr<executor::RunStepBatchRequest> &&req,
+                            HandlerCallback &&cb);
+
+    void launchBatchStep(const std::shared_ptr<TFSession> &self, const std::shared_ptr<StepBatch> &batch);
+
+    /**
+     * @return true if this was the last step of the batch to settle
+     */
+    bool runBatchStep(StepBatch &batch, size_t idx);
+
+    /**
+     * @brief Start the work now or once allowed. A batch orders its steps by the number of iterations
+     * scheduled in the session, so it runs exclusively of plain RunSteps and other batches, while
+     * plain RunSteps may run together.
+     */
+    void admitStep(bool exclusive, sstl::SmallFunction<void()> &&start);
+
+    /**
+     * @brief Called once work started by admitStep is done
+     */
+    void finishStep(bool exclusive);
+
     std::string handle() const;
 
     void safeClose(std::shared_ptr<TFSession> &&self);
@@ -81,6 +138,17 @@ public:
     std::unique_ptr<LocalSessionMgr> m_sessMgr;
 
     std::unique_ptr<SalusRendezvousMgr> m_rendezvousMgr;
+
+    struct PendingStep
+    {
+        bool exclusive;
+        sstl::SmallFunction<void()> start;
+    };
+    std::mutex m_stepMu;
+    size_t m_numSharedSteps GUARDED_BY(m_stepMu) = 0;
+    bool m_exclusiveStep GUARDED_BY(m_stepMu) = false;
+    // Started in order, so a batch isn't starved by a stream of RunSteps
+    std::deque<PendingStep> m_pendingSteps GUARDED_BY(m_stepMu);
 };
 
 TFSession::TFSession(TFInstance &inst, std::shared_ptr<ExecutionContext> ctx, std::vector<tf::Device *> devices,
@@ -110,10 +178,19 @@ void TFSession::safeClose()
 
 IMPL_HANDLER(ExtendSession)
 IMPL_HANDLER(PartialRunSetup)
-IMPL_HANDLER(RunStep)
 
 #undef IMPL_HANDLER
 
+void TFSession::handleRunStep(const tf::RunStepRequest &req, tf::RunStepResponse &resp, HandlerCallback &&cb)
+{
+    d->handleRunStep(shared_from_this(), req, resp, std::move(cb));
+}
+
+void TFSession::handleRunStepBatch(std::unique_ptr<executor::RunStepBatchRequest> &&req, HandlerCallback &&cb)
+{
+    d->handleRunStepBatch(shared_from_this(), std::move(req), std::move(cb));
+}
+
 TFSession::TFSessionPrivate::~TFSessionPrivate() = default;
 
 std::string TFSession::TFSessionPrivate::handle() const
@@ -210,8 +287,48 @@ void TFSession::TFSessionPrivate::handlePartialRunSetup(const tf::PartialRunSetu
     cb(Status::OK());
 }
 
-void TFSession::TFSessionPrivate::handleRunStep(const tf::RunStepRequest &req, tf::RunStepResponse &resp,
-                                                HandlerCallback &&cb)
+void TFSession::TFSessionPrivate::handleRunStep(std::shared_ptr<TFSession> &&self, const tf::RunStepRequest &req,
+                                                tf::RunStepResponse &resp, HandlerCallback &&cb)
+{
+    // Both req and resp are on cb.arena, so they live as long as cb
+    DCHECK(cb.arena);
+    DCHECK(cb.sender);
+
+    // MasterSession::Run has no asynchronous variant in this version of TensorFlow, it blocks until
+    // the step is done. So instead of completing asynchronously, the blocking is moved to an IO data
+    // thread, which leaves the dispatch worker free for requests of other sessions. Requests of this
+    // session after the RunStep may be handled before it is done, which the client can't tell apart
+    // from network reordering anyway.
+    auto sender = cb.sender;
+    admitStep(false, [sender, self = std::move(self), &req, &resp, cb = std::move(cb)]() mutable {
+        sender->postData([self = std::move(self), &req, &resp, cb = std::move(cb)]() mutable {
+            self->d->runStepGuarded(req, resp, std::move(cb));
+            self->d->finishStep(false);
+        });
+    });
+}
+
+void TFSession::TFSessionPrivate::runStepGuarded(const tf::RunStepRequest &req, tf::RunStepResponse &resp,
+                                                 HandlerCallback &&cb)
+{
+    // Nothing may escape without calling cb, or the client waits forever
+    try {
+        if (cb.tensorFrames) {
+            runStepFrames(req, resp, std::move(cb));
+        } else {
+            runStep(req, resp, std::move(cb));
+        }
+    } catch (const TFException &ex) {
+        LOG(ERROR) << "Error when running step in session " << handle() << ": " << ex.what();
+        cb(ex.code());
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "Unexpected error when running step in session " << handle() << ": " << ex.what();
+        cb(tf::errors::Internal(ex.what()));
+    }
+}
+
+void TFSession::TFSessionPrivate::runStep(const tf::RunStepRequest &req, tf::RunStepResponse &resp,
+                                          HandlerCallback &&cb)
 {
     tf::CallOptions opts;
     tf::ProtoRunStepRequest wreq(&req);
@@ -220,10 +337,269 @@ void TFSession::TFSessionPrivate::handleRunStep(const tf::RunStepRequest &req, t
     cb(Status::OK());
 }
 
+void TFSession::TFSessionPrivate::runStepFrames(const tf::RunStepRequest &req, tf::RunStepResponse &resp,
+                                                HandlerCallback &&cb)
+{
+    DCHECK(cb.sender);
+
+    // Feeds are built as tensors directly, adopting frame buffers where possible
+    tf::InMemoryRunStepRequest wreq;
+    wreq.set_session_handle(req.session_handle());
+    wreq.set_partial_run_handle(req.partial_run_handle());
+    *wreq.mutable_options() = req.options();
+
+    auto frames = cb.sender->takeAttachments();
+    size_t nextFrame = 0;
+    for (const auto &feed : req.feed()) {
+        tf::Tensor value;
+        if (usesTensorFrame(feed.tensor().dtype())) {
+            if (nextFrame >= frames->size()) {
+                throw TFException(tf::errors::InvalidArgument("Missing tensor frame for feed ", feed.name()));
+            }
+            SALUS_THROW_IF_ERROR(tensorFromFrame(feed.tensor(), std::move(frames->at(nextFrame++)), value));
+        } else if (!value.FromProto(feed.tensor())) {
+            throw TFException(tf::errors::InvalidArgument("Invalid TensorProto for feed ", feed.name()));
+        }
+        wreq.add_feed(feed.name(), value);
+    }
+    if (nextFrame != frames->size()) {
+        throw TFException(tf::errors::InvalidArgument("Got ", frames->size(), " tensor frames but used only ",
+                                                      nextFrame));
+    }
+    for (const auto &fetch : req.fetch()) {
+        wreq.add_fetch(fetch);
+    }
+    for (const auto &target : req.target()) {
+        wreq.add_target(target);
+    }
+
+    tf::CallOptions opts;
+    tf::InMemoryRunStepResponse wresp;
+    SALUS_THROW_IF_ERROR(m_masterSess->Run(&opts, wreq, &wresp));
+
+    // Fetches are sent as frames referencing their buffers, with only metadata in resp
+    MultiPartMessage fetchFrames;
+    for (size_t i = 0; i != wresp.num_tensors(); ++i) {
+        tf::Tensor value;
+        SALUS_THROW_IF_ERROR(wresp.TensorValue(i, &value));
+
+        auto named = resp.add_tensor();
+        named->set_name(wresp.tensor_name(i));
+        if (usesTensorFrame(value.dtype())) {
+            named->mutable_tensor()->set_dtype(value.dtype());
+            value.shape().AsProto(named->mutable_tensor()->mutable_tensor_shape());
+            fetchFrames->emplace_back(frameFromTensor(value));
+        } else {
+            value.AsProtoTensorContent(named->mutable_tensor());
+        }
+    }
+    resp.mutable_metadata()->Swap(wresp.mutable_metadata());
+
+    cb.sender->attachToReply(std::move(fetchFrames));
+    cb(Status::OK());
+}
+
+/**
+ * @brief State of one RunStepBatchRequest, shared by its steps, which each run MasterSession::Run on an
+ * IO thread. Step i only calls Run once step i - 1 has its main iteration queued in the engine, so
+ * iterations are queued in order and back to back, while replies are sent in order as steps complete.
+ */
+struct TFSession::TFSessionPrivate::StepBatch
+{
+    std::unique_ptr<executor::RunStepBatchRequest> req;
+    HandlerCallback cb;
+    const size_t numSteps;
+    // Expensive iterations scheduled on the session before the batch
+    const uint64_t baseScheduled;
+
+    // Set when step i returned from Run, so step i + 1 doesn't wait for its iteration
+    std::unique_ptr<std::atomic<bool>[]> finished;
+    std::atomic<bool> failed{false};
+
+    std::mutex mu;
+    size_t nextLaunch GUARDED_BY(mu) = 0;
+    size_t nextReply GUARDED_BY(mu) = 0;
+    size_t numRunning GUARDED_BY(mu) = 0;
+    // Steps at or after the first failed one are not replied
+    size_t failedStep GUARDED_BY(mu);
+    Status failure GUARDED_BY(mu);
+    std::vector<std::unique_ptr<tf::RunStepResponse>> results GUARDED_BY(mu);
+
+    StepBatch(std::unique_ptr<executor::RunStepBatchRequest> &&req, HandlerCallback &&cb, uint64_t baseScheduled)
+        : req(std::move(req))
+        , cb(std::move(cb))
+        , numSteps(static_cast<size_t>(this->req->feeds_size()))
+        , baseScheduled(baseScheduled)
+        , finished(new std::atomic<bool>[numSteps])
+        , failedStep(numSteps)
+        , results(numSteps)
+    {
+        for (size_t i = 0; i != numSteps; ++i) {
+            finished[i] = false;
+        }
+    }
+};
+
+void TFSession::TFSessionPrivate::handleRunStepBatch(std::shared_ptr<TFSession> &&self,
+                                                     std::unique_ptr<executor::RunStepBatchRequest> &&req,
+                                                     HandlerCallback &&cb)
+{
+    if (req->feeds_size() == 0) {
+        throw TFException(tf::errors::InvalidArgument("RunStepBatchRequest without any step"));
+    }
+    if (!req->step().partial_run_handle().empty()) {
+        throw TFException(tf::errors::InvalidArgument("Partial runs can't be batched"));
+    }
+    DCHECK(cb.sender);
+
+    VLOG(2) << "Running a batch of " << req->feeds_size() << " steps in session " << handle();
+    admitStep(true, [this, self = std::move(self), req = std::move(req), cb = std::move(cb)]() mutable {
+        // Nothing else schedules iterations in the session until the batch is done
+        auto batch = std::make_shared<StepBatch>(std::move(req), std::move(cb), m_execCtx->numExpensiveScheduled());
+        for (size_t i = 0, window = batchWindow(); i != window; ++i) {
+            launchBatchStep(self, batch);
+        }
+    });
+}
+
+void TFSession::TFSessionPrivate::admitStep(bool exclusive, sstl::SmallFunction<void()> &&start)
+{
+    {
+        auto g = sstl::with_guard(m_stepMu);
+        auto allowed = !m_exclusiveStep && (!exclusive || m_numSharedSteps == 0);
+        if (!allowed || !m_pendingSteps.empty()) {
+            m_pendingSteps.push_back({exclusive, std::move(start)});
+            return;
+        }
+        if (exclusive) {
+            m_exclusiveStep = true;
+        } else {
+            ++m_numSharedSteps;
+        }
+    }
+    start();
+}
+
+void TFSession::TFSessionPrivate::finishStep(bool exclusive)
+{
+    std::vector<sstl::SmallFunction<void()>> starts;
+    {
+        auto g = sstl::with_guard(m_stepMu);
+        if (exclusive) {
+            m_exclusiveStep = false;
+        } else {
+            --m_numSharedSteps;
+        }
+        while (!m_pendingSteps.empty() && !m_exclusiveStep) {
+            auto &next = m_pendingSteps.front();
+            if (next.exclusive) {
+                if (m_numSharedSteps != 0) {
+                    break;
+                }
+                m_exclusiveStep = true;
+            } else {
+                ++m_numSharedSteps;
+            }
+            starts.emplace_back(std::move(next.start));
+            m_pendingSteps.pop_front();
+        }
+    }
+    for (auto &start : starts) {
+        start();
+    }
+}
+
+void TFSession::TFSessionPrivate::launchBatchStep(const std::shared_ptr<TFSession> &self,
+                                                  const std::shared_ptr<StepBatch> &batch)
+{
+    size_t idx;
+    {
+        auto g = sstl::with_guard(batch->mu);
+        if (batch->nextLaunch == batch->numSteps || batch->failed) {
+            return;
+        }
+        idx = batch->nextLaunch++;
+        ++batch->numRunning;
+    }
+
+    // Run blocks until the step is done, so it goes to the IO pool
+    batch->cb.sender->postData([self, batch, idx]() {
+        auto &d = *self->d;
+        if (d.runBatchStep(*batch, idx)) {
+            d.finishStep(true);
+            return;
+        }
+        d.launchBatchStep(self, batch);
+    });
+}
+
+bool TFSession::TFSessionPrivate::runBatchStep(StepBatch &batch, size_t idx)
+{
+    if (idx > 0) {
+        // A step with no main iteration, or a failed one, is waited for until it returns
+        m_execCtx->waitExpensiveScheduled(batch.baseScheduled + idx, [&batch, idx]() {
+            return batch.finished[idx - 1].load() || batch.failed.load();
+        });
+    }
+
+    auto resp = std::make_unique<tf::RunStepResponse>();
+    Status status;
+    if (batch.failed) {
+        status = tf::errors::Cancelled("Earlier step in batch failed");
+    } else {
+        tf::RunStepRequest req(batch.req->step());
+        *req.mutable_feed() = batch.req->feeds(static_cast<int>(idx)).feed();
+
+        tf::CallOptions opts;
+        tf::ProtoRunStepRequest wreq(&req);
+        tf::NonOwnedProtoRunStepResponse wresp(resp.get());
+        try {
+            status = m_masterSess->Run(&opts, wreq, &wresp);
+        } catch (const TFException &ex) {
+            status = ex.code();
+        } catch (const std::exception &ex) {
+            status = tf::errors::Internal(ex.what());
+        }
+    }
+
+    // Reply to whatever is now complete in order, and the final reply once all steps settled
+    auto g = sstl::with_guard(batch.mu);
+    --batch.numRunning;
+    if (!status.ok() && idx < batch.failedStep) {
+        LOG(ERROR) << "Step " << idx << " of batch in session " << handle() << " failed: " << status;
+        batch.failedStep = idx;
+        batch.failure = status;
+        batch.failed = true;
+    }
+    batch.results[idx] = std::move(resp);
+    batch.finished[idx] = true;
+    m_execCtx->wakeScheduleWaiters();
+
+    auto last = std::min(batch.failedStep, batch.numSteps - 1);
+    while (batch.nextReply < last && batch.results[batch.nextReply]) {
+        batch.cb.sendPartial(*batch.results[batch.nextReply]);
+        batch.results[batch.nextReply].reset();
+        ++batch.nextReply;
+    }
+
+    if (batch.failed) {
+        if (batch.numRunning == 0 && batch.nextReply == batch.failedStep) {
+            batch.cb(batch.failure);
+            return true;
+        }
+    } else if (batch.nextReply == last && batch.results[last]) {
+        batch.cb.tfresp = std::move(batch.results[last]);
+        batch.cb(Status::OK());
+        return true;
+    }
+    return false;
+}
+
 void TFSession::deferClose(HandlerCallback &&cb)
 {
     // cb is move-only, can't be captured and pass to std::function.
     // so we extract and reconstruct inside the lambda
+    DCHECK(!cb.arena) << "Only RunStep is allocated on arena";
     auto raw_tfresp = cb.tfresp.release();
     LOG(INFO) << "Defer closing session " << d->handle();
 
@@ -31,6 +31,10 @@ namespace tensorflow {
 class Device;
 } // namespace tensorflow
 
+namespace executor {
+class RunStepBatchRequest;
+} // namespace executor
+
 namespace salus {
 class ExecutionContext;
 namespace oplib::tensorflow {
@@ -76,6 +80,11 @@ public:
 
 #undef DECLARE_HANDLER
 
+    /**
+     * @brief Run all steps of req back to back, replying to each as it completes, see RunStepBatchRequest
+     */
+    void handleRunStepBatch(std::unique_ptr<executor::RunStepBatchRequest> &&req, HandlerCallback &&cb);
+
 private:
     class TFSessionPrivate;
 
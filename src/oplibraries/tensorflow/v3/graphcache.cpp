@@ -0,0 +1,164 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "oplibraries/tensorflow/v3/graphcache.h"
+
+#include "utils/envutils.h"
+
+#include <google/protobuf/util/message_differencer.h>
+
+namespace salus::oplib::tensorflow {
+
+namespace {
+
+size_t cacheCapacity()
+{
+    struct GraphCacheTag;
+    return sstl::fromEnvVarCached<GraphCacheTag>("SALUS_GRAPH_CACHE_SIZE", size_t{32});
+}
+
+uint64_t hashNode(const tf::NodeDef &node)
+{
+    // Attrs are a map without defined order, leave them to the full comparison
+    auto h = tf::Hash64(node.name());
+    h = tf::Hash64Combine(h, tf::Hash64(node.op()));
+    h = tf::Hash64Combine(h, tf::Hash64(node.device()));
+    for (const auto &input : node.input()) {
+        h = tf::Hash64Combine(h, tf::Hash64(input));
+    }
+    return tf::Hash64Combine(h, static_cast<uint64_t>(node.attr_size()));
+}
+
+} // namespace
+
+GraphCache &GraphCache::instance()
+{
+    static GraphCache cache(cacheCapacity());
+    return cache;
+}
+
+bool GraphCache::enabled()
+{
+    return cacheCapacity() > 0;
+}
+
+GraphCache::GraphCache(size_t capacity)
+    : m_capacity(capacity)
+{
+}
+
+GraphCache::Key GraphCache::keyFor(const tf::GraphDef &gdef, const tf::GraphOptions &options)
+{
+    Key key;
+    key.bytes = gdef.ByteSizeLong() + options.ByteSizeLong();
+    key.hash = static_cast<uint64_t>(gdef.versions().producer());
+    for (const auto &node : gdef.node()) {
+        key.hash = tf::Hash64Combine(key.hash, hashNode(node));
+    }
+    key.hash = tf::Hash64Combine(key.hash, static_cast<uint64_t>(gdef.library().function_size()));
+    return key;
+}
+
+GraphCache::SlotList::iterator GraphCache::find(const Key &key, const tf::GraphDef &gdef,
+                                                const tf::GraphOptions &options)
+{
+    using google::protobuf::util::MessageDifferencer;
+
+    auto [it, end] = m_index.equal_range(key.hash);
+    while (it != end) {
+        auto slot = it->second;
+        if (slot->entry.expired()) {
+            it = m_index.erase(it);
+            m_lru.erase(slot);
+            continue;
+        }
+        // Only compare fully when the cheap key matches
+        if (slot->key.bytes == key.bytes && MessageDifferencer::Equals(slot->options, options)
+            && MessageDifferencer::Equals(slot->gdef, gdef)) {
+            return slot;
+        }
+        ++it;
+    }
+    return m_lru.end();
+}
+
+void GraphCache::erase(SlotList::iterator slot)
+{
+    auto [it, end] = m_index.equal_range(slot->key.hash);
+    for (; it != end; ++it) {
+        if (it->second == slot) {
+            m_index.erase(it);
+            break;
+        }
+    }
+    m_lru.erase(slot);
+}
+
+GraphCache::PEntry GraphCache::lookup(const Key &key, const tf::GraphDef &gdef, const tf::GraphOptions &options)
+{
+    std::lock_guard<std::mutex> g(m_mu);
+    auto slot = find(key, gdef, options);
+    PEntry entry;
+    if (slot != m_lru.end()) {
+        entry = slot->entry.lock();
+    }
+    if (!entry) {
+        ++m_misses;
+        VLOG(2) << "Graph cache miss for " << key.hash << ", hits " << m_hits << " misses " << m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    VLOG(2) << "Graph cache hit for " << key.hash << ", hits " << m_hits << " misses " << m_misses;
+    m_lru.splice(m_lru.begin(), m_lru, slot);
+    return entry;
+}
+
+void GraphCache::insert(const Key &key, const tf::GraphDef &gdef, const tf::GraphOptions &options,
+                        const PEntry &entry)
+{
+    DCHECK(entry);
+    if (m_capacity == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> g(m_mu);
+    if (auto slot = find(key, gdef, options); slot != m_lru.end()) {
+        // Another session registered the same graph concurrently, keep the newer one
+        slot->entry = entry;
+        m_lru.splice(m_lru.begin(), m_lru, slot);
+        return;
+    }
+
+    // Drop graphs whose sessions are all gone before evicting live ones
+    for (auto it = m_lru.begin(); it != m_lru.end();) {
+        auto next = std::next(it);
+        if (it->entry.expired()) {
+            erase(it);
+        }
+        it = next;
+    }
+
+    m_lru.push_front({key, gdef, options, entry});
+    m_index.emplace(key.hash, m_lru.begin());
+    while (m_lru.size() > m_capacity) {
+        erase(std::prev(m_lru.end()));
+    }
+}
+
+} // namespace salus::oplib::tensorflow
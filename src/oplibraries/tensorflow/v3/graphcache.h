@@ -0,0 +1,120 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_OPLIB_TENSORFLOW_GRAPHCACHE_H
+#define SALUS_OPLIB_TENSORFLOW_GRAPHCACHE_H
+
+#include "oplibraries/tensorflow/tensorflow_headers.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace salus::oplib::tensorflow {
+
+class ExecutorLayout;
+
+/**
+ * @brief Process wide cache of partitioned and optimized graphs, so sessions registering identical
+ * graphs skip partitioning and executor layout.
+ */
+class GraphCache
+{
+public:
+    struct Partition
+    {
+        // Name of the device this partition is placed on
+        std::string device;
+        // Never modified once in the cache
+        std::shared_ptr<const tf::Graph> graph;
+        std::shared_ptr<const ExecutorLayout> layout;
+    };
+    using Entry = std::vector<Partition>;
+    using PEntry = std::shared_ptr<const Entry>;
+
+    /**
+     * @brief Cheap fingerprint of a graph, only used to find candidates to compare against
+     */
+    struct Key
+    {
+        uint64_t hash = 0;
+        size_t bytes = 0;
+    };
+
+    static GraphCache &instance();
+
+    /**
+     * @brief Whether caching is enabled, controlled by env var SALUS_GRAPH_CACHE_SIZE.
+     */
+    static bool enabled();
+
+    /**
+     * @brief Compute the cache key of a graph, without serializing it
+     */
+    static Key keyFor(const tf::GraphDef &gdef, const tf::GraphOptions &options);
+
+    /**
+     * @brief Find the entry for a graph equal to gdef and options, or nullptr if there is none
+     */
+    PEntry lookup(const Key &key, const tf::GraphDef &gdef, const tf::GraphOptions &options);
+
+    /**
+     * @brief Insert or replace the entry for gdef and options, evicting the least recently used one if full.
+     *
+     * The cache only keeps a weak reference to entry, so it is evicted once every session holding it is gone.
+     */
+    void insert(const Key &key, const tf::GraphDef &gdef, const tf::GraphOptions &options, const PEntry &entry);
+
+private:
+    explicit GraphCache(size_t capacity);
+
+    struct Slot
+    {
+        Key key;
+        // Kept for a full comparison when keys match
+        tf::GraphDef gdef;
+        tf::GraphOptions options;
+        std::weak_ptr<const Entry> entry;
+    };
+    using SlotList = std::list<Slot>;
+
+    /**
+     * @brief Find the slot holding a graph equal to gdef and options, dropping expired ones met on the way
+     */
+    SlotList::iterator find(const Key &key, const tf::GraphDef &gdef, const tf::GraphOptions &options);
+
+    void erase(SlotList::iterator it);
+
+    const size_t m_capacity;
+
+    std::mutex m_mu;
+    // Most recently used first
+    SlotList m_lru;
+    std::unordered_multimap<uint64_t, SlotList::iterator> m_index;
+
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+} // namespace salus::oplib::tensorflow
+
+#endif // SALUS_OPLIB_TENSORFLOW_GRAPHCACHE_H
@@ -23,6 +23,7 @@
 #include "oplibraries/tensorflow/device/shadowdevices.h"
 #include "oplibraries/tensorflow/tfexception.h"
 #include "oplibraries/tensorflow/tfutils.h"
+#include "oplibraries/tensorflow/v3/graphcache.h"
 #include "oplibraries/tensorflow/v3/tf_executor.h"
 #include "oplibraries/tensorflow/worker/dummyworkercache.h"
 
@@ -74,7 +75,17 @@ tf::Status SIGraphMgr::InitSIItem(const std::string &session, const tf::GraphDef
     item.session = session;
     item.lib_def = std::make_unique<tf::FunctionLibraryDefinition>(tf::OpRegistry::Global(), gdef.library());
 
-    if (gdef.versions().producer() >= 5) {
+    // Identical graphs from other sessions are already validated, partitioned and optimized.
+    // Debug nodes are specific to a session, so such graphs are never cached.
+    const auto cacheable = GraphCache::enabled() && debug_options.debug_tensor_watch_opts().empty();
+    GraphCache::Key cacheKey;
+    GraphCache::PEntry cached;
+    if (cacheable) {
+        cacheKey = GraphCache::keyFor(gdef, graph_options);
+        cached = GraphCache::instance().lookup(cacheKey, gdef, graph_options);
+    }
+
+    if (!cached && gdef.versions().producer() >= 5) {
         // Validate the graph: we assume that merging two valid graphs
         // should maintain graph validity.
         TF_RETURN_IF_ERROR(tf::graph::ValidateGraphDef(gdef, *item.lib_def));
@@ -84,6 +95,71 @@ tf::Status SIGraphMgr::InitSIItem(const std::string &session, const tf::GraphDef
                                                                         gdef.versions().producer(), item.lib_def.get(),
                                                                         graph_options.optimizer_options(), cluster_flr);
 
+    TFExecutorParams params;
+    params.session = session;
+    params.graphHandle = item.handle;
+    params.ins = m_execCtx;
+
+    item.graph_mgr = this;
+
+    if (cached) {
+        item.units.reserve(cached->size());
+        for (const auto &part : *cached) {
+            TF_RETURN_IF_ERROR(InitSIUnit(session, part.device, item, params));
+            auto layout = part.layout;
+            TF_RETURN_IF_ERROR(NewSIExecutor(graph_options, part.graph, params, item.units.back(), &layout));
+        }
+        holdCacheEntry(std::move(cached));
+        return Status::OK();
+    }
+
+    std::unordered_map<std::string, std::unique_ptr<tf::Graph>> partition_graphs;
+    TF_RETURN_IF_ERROR(PartitionSIGraph(gdef, graph_options, item, partition_graphs));
+
+    auto entry = std::make_shared<GraphCache::Entry>();
+    item.units.reserve(partition_graphs.size());
+    const auto &optimizer_opts = graph_options.optimizer_options();
+    tf::GraphOptimizer optimizer(optimizer_opts);
+    for (auto &[key, subgraph] : partition_graphs) {
+        TF_RETURN_IF_ERROR(InitSIUnit(session, key, item, params));
+        auto &unit = item.units.back();
+
+        // Give the device an opportunity to rewrite its subgraph.
+        TF_RETURN_IF_ERROR(unit.device->MaybeRewriteGraph(&subgraph));
+
+        optimizer.Optimize(params.function_library, worker_env_->env, params.device, &subgraph,
+                           /*shape_map=*/nullptr);
+
+        // EXPERIMENTAL: tfdbg inserts debug nodes (i.e., probes) to the graph.
+        if (!debug_options.debug_tensor_watch_opts().empty()) {
+            TF_RETURN_IF_ERROR(DecorateAndPublishGraphForDebug(debug_options, subgraph.get(), params.device));
+        }
+
+        TF_RETURN_IF_ERROR(
+            tf::EnsureMemoryTypes(tf::DeviceType(unit.device->device_type()), unit.device->name(), subgraph.get()));
+
+        auto &part = entry->emplace_back();
+        part.device = key;
+        part.graph = std::move(subgraph);
+        TF_RETURN_IF_ERROR(NewSIExecutor(graph_options, part.graph, params, unit, &part.layout));
+    }
+
+    if (cacheable) {
+        GraphCache::instance().insert(cacheKey, gdef, graph_options, entry);
+        holdCacheEntry(std::move(entry));
+    }
+    return Status::OK();
+}
+
+void SIGraphMgr::holdCacheEntry(GraphCache::PEntry entry)
+{
+    tf::mutex_lock l(mu_);
+    m_cacheEntries.emplace_back(std::move(entry));
+}
+
+tf::Status SIGraphMgr::PartitionSIGraph(const tf::GraphDef &gdef, const tf::GraphOptions &graph_options, Item &item,
+                                        std::unordered_map<std::string, std::unique_ptr<tf::Graph>> &partition_graphs)
+{
     // Constructs the graph out of "gdef"
     tf::Graph graph(tf::OpRegistry::Global());
     tf::GraphConstructorOptions opts;
@@ -126,7 +202,6 @@ tf::Status SIGraphMgr::InitSIItem(const std::string &session, const tf::GraphDef
         TF_RETURN_IF_ERROR(AddControlEdges(popts, &partitions));
     }
 
-    std::unordered_map<std::string, std::unique_ptr<tf::Graph>> partition_graphs;
     for (const auto &[key, partdef] : partitions) {
         auto device_graph = std::make_unique<tf::Graph>(tf::OpRegistry::Global());
         tf::GraphConstructorOptions device_opts;
@@ -143,87 +218,75 @@ tf::Status SIGraphMgr::InitSIItem(const std::string &session, const tf::GraphDef
     TF_RETURN_IF_ERROR(
         tf::OptimizationPassRegistry::Global()->RunGrouping(tf::OptimizationPassRegistry::POST_PARTITIONING,
                                                             optimization_options));
+    return Status::OK();
+}
 
-    TFExecutorParams params;
-    params.session = session;
-    params.graphHandle = item.handle;
-
-    item.units.reserve(partitions.size());
-    item.graph_mgr = this;
-    const auto &optimizer_opts = graph_options.optimizer_options();
-    tf::GraphOptimizer optimizer(optimizer_opts);
-    for (auto &[key, subgraph] : partition_graphs) {
-        auto &unit = item.units.emplace_back();
-
-        // Find the device
-        auto s = device_mgr_->LookupDevice(key, &unit.device);
-        if (!s.ok()) {
-            // Remove the empty unit from the item as the item destructor wants all
-            // units to have valid devices.
-            item.units.pop_back();
-            return s;
-        }
-
-        // Give the device an opportunity to rewrite its subgraph.
-        TF_RETURN_IF_ERROR(unit.device->MaybeRewriteGraph(&subgraph));
+tf::Status SIGraphMgr::InitSIUnit(const std::string &session, const std::string &deviceName, Item &item,
+                                  TFExecutorParams &params)
+{
+    auto &unit = item.units.emplace_back();
 
-        // Top-level nodes in the graph uses the op segment to cache
-        // kernels. Therefore, as long as the executor is alive, we need
-        // to ensure the kernels cached for the session are alive.
-        auto opseg = unit.device->op_segment();
-        opseg->AddHold(session);
+    // Find the device
+    auto s = device_mgr_->LookupDevice(deviceName, &unit.device);
+    if (!s.ok()) {
+        // Remove the empty unit from the item as the item destructor wants all
+        // units to have valid devices.
+        item.units.pop_back();
+        return s;
+    }
 
-        // Function library runtime.
-        auto lib = item.proc_flr->GetFLR(unit.device->name());
-        if (!lib) {
-            return tf::errors::InvalidArgument("Cannot find FLR for device: ", unit.device->name());
-        }
+    // Top-level nodes in the graph uses the op segment to cache
+    // kernels. Therefore, as long as the executor is alive, we need
+    // to ensure the kernels cached for the session are alive.
+    auto opseg = unit.device->op_segment();
+    opseg->AddHold(session);
 
-        // Construct the root executor for the subgraph
-        params.device = unit.device;
-        params.function_library = lib;
-        params.create_kernel = [session, lib, opseg](const auto &ndef, tf::OpKernel **kernel) {
-            // We do not share the kernel via the OpSegment if the node is
-            // stateless, or a function.
-            // NOTE(mrry): We must not share function kernels (implemented
-            // using `CallOp`) between subgraphs, because `CallOp::handle_`
-            // is tied to a particular subgraph. Even if the function itself
-            // is stateful, the `CallOp` that invokes it is not.
-            if (!lib->IsStateful(ndef.op()) || lib->GetFunctionLibraryDefinition()->Find(ndef.op()) != nullptr) {
-                return lib->CreateKernel(ndef, kernel);
-            }
-            auto create_fn = [lib, &ndef](tf::OpKernel **kernel) { return lib->CreateKernel(ndef, kernel); };
-            // Kernels created for subgraph nodes need to be cached.  On
-            // cache miss, create_fn() is invoked to create a kernel based
-            // on the function library here + global op registry.
-            return opseg->FindOrCreate(session, ndef.name(), kernel, create_fn);
-        };
-        params.delete_kernel = [lib](tf::OpKernel *kernel) {
-            // If the node is stateful, opseg owns it. Otherwise, delete it.
-            if (kernel && !lib->IsStateful(kernel->type_string())) {
-                delete kernel;
-            }
-        };
-
-        optimizer.Optimize(lib, worker_env_->env, params.device, &subgraph, /*shape_map=*/nullptr);
+    // Function library runtime.
+    auto lib = item.proc_flr->GetFLR(unit.device->name());
+    if (!lib) {
+        return tf::errors::InvalidArgument("Cannot find FLR for device: ", unit.device->name());
+    }
 
-        // EXPERIMENTAL: tfdbg inserts debug nodes (i.e., probes) to the graph.
-        if (!debug_options.debug_tensor_watch_opts().empty()) {
-            TF_RETURN_IF_ERROR(DecorateAndPublishGraphForDebug(debug_options, subgraph.get(), params.device));
+    // Construct the root executor for the subgraph
+    params.device = unit.device;
+    params.function_library = lib;
+    params.create_kernel = [session, lib, opseg](const auto &ndef, tf::OpKernel **kernel) {
+        // We do not share the kernel via the OpSegment if the node is
+        // stateless, or a function.
+        // NOTE(mrry): We must not share function kernels (implemented
+        // using `CallOp`) between subgraphs, because `CallOp::handle_`
+        // is tied to a particular subgraph. Even if the function itself
+        // is stateful, the `CallOp` that invokes it is not.
+        if (!lib->IsStateful(ndef.op()) || lib->GetFunctionLibraryDefinition()->Find(ndef.op()) != nullptr) {
+            return lib->CreateKernel(ndef, kernel);
         }
-
-        TF_RETURN_IF_ERROR(
-            tf::EnsureMemoryTypes(tf::DeviceType(unit.device->device_type()), unit.device->name(), subgraph.get()));
-        unit.graph = subgraph.get();
-        unit.build_cost_model = graph_options.build_cost_model();
-        if (unit.build_cost_model > 0) {
-            skip_cost_models_ = false;
+        auto create_fn = [lib, &ndef](tf::OpKernel **kernel) { return lib->CreateKernel(ndef, kernel); };
+        // Kernels created for subgraph nodes need to be cached.  On
+        // cache miss, create_fn() is invoked to create a kernel based
+        // on the function library here + global op registry.
+        return opseg->FindOrCreate(session, ndef.name(), kernel, create_fn);
+    };
+    params.delete_kernel = [lib](tf::OpKernel *kernel) {
+        // If the node is stateful, opseg owns it. Otherwise, delete it.
+        if (kernel && !lib->IsStateful(kernel->type_string())) {
+            delete kernel;
         }
+    };
+    return Status::OK();
+}
 
-        params.ins = m_execCtx;
-        TF_RETURN_IF_ERROR(NewTFExecutor(params, std::move(subgraph), &unit.root));
+tf::Status SIGraphMgr::NewSIExecutor(const tf::GraphOptions &graph_options, std::shared_ptr<const tf::Graph> graph,
+                                     const TFExecutorParams &params, ExecutionUnit &unit,
+                                     std::shared_ptr<const ExecutorLayout> *layout)
+{
+    // The graph may be shared with other sessions, but no one modifies it once the executor is created
+    unit.graph = const_cast<tf::Graph *>(graph.get());
+    unit.build_cost_model = graph_options.build_cost_model();
+    if (unit.build_cost_model > 0) {
+        skip_cost_models_ = false;
     }
-    return Status::OK();
+
+    return NewTFExecutor(params, std::move(graph), &unit.root, layout);
 }
 
 CreateWorkerSessionFn GetCreateWorkerSessionFnForSIGraphMgr(const std::string &worker_name,
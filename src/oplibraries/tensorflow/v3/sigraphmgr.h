@@ -23,12 +23,16 @@
 #include "oplibraries/tensorflow/tensorflow_headers.h"
 
 #include "execution/executionengine.h"
+#include "oplibraries/tensorflow/v3/graphcache.h"
 #include "oplibraries/tensorflow/worker/dummysessionmgr.h"
 #include "resources/resources.h"
 #include "utils/macros.h"
 
 namespace salus::oplib::tensorflow {
 
+class ExecutorLayout;
+struct TFExecutorParams;
+
 /**
  * @brief A simple graph manager that doesn't hook into anything,
  * and only controls when an iteration starts
@@ -48,8 +52,29 @@ protected:
                           const tf::GraphOptions &graph_options, const tf::DebugOptions &debug_options,
                           tf::DistributedFunctionLibraryRuntime *cluster_flr, Item &item);
 
+    tf::Status PartitionSIGraph(const tf::GraphDef &gdef, const tf::GraphOptions &graph_options, Item &item,
+                                std::unordered_map<std::string, std::unique_ptr<tf::Graph>> &partition_graphs);
+
+    /**
+     * @brief Add a unit on device named deviceName to item, and prepare params to create kernels for it
+     */
+    tf::Status InitSIUnit(const std::string &session, const std::string &deviceName, Item &item,
+                          TFExecutorParams &params);
+
+    tf::Status NewSIExecutor(const tf::GraphOptions &graph_options, std::shared_ptr<const tf::Graph> graph,
+                             const TFExecutorParams &params, ExecutionUnit &unit,
+                             std::shared_ptr<const ExecutorLayout> *layout);
+
 private:
+    /**
+     * @brief Keep a graph cache entry alive as long as this session
+     */
+    void holdCacheEntry(GraphCache::PEntry entry);
+
     std::shared_ptr<ExecutionContext> m_execCtx;
+
+    // Graph cache entries used by this session, the cache drops them once no session holds them
+    std::vector<GraphCache::PEntry> m_cacheEntries;
 };
 
 CreateWorkerSessionFn GetCreateWorkerSessionFnForSIGraphMgr(const std::string &worker_name,
@@ -29,6 +29,7 @@
 #include "utils/threadutils.h"
 #include "utils/containerutils.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace {
@@ -137,11 +138,17 @@ void SMBlocker::saveCurrentThreadResults(uint64_t graphId, int nodeId)
     SavedCudaKernelLaunches.clear();
 }
 
-bool SMBlocker::tryTake(uint64_t graphId, int nodeId, int priority)
+int SMBlocker::semaphoreLevel(int priority, int costLevel)
+{
+    // Cost levels are nested within a priority, so sessions are still strictly ordered by priority
+    return std::clamp(priority, 0, MaxPriority - 1) * CostLevels + std::clamp(costLevel, 0, CostLevels - 1);
+}
+
+bool SMBlocker::tryTake(uint64_t graphId, int nodeId, int priority, int costLevel)
 {
     auto smUsage = getUsageForKernel(graphId, nodeId);
 
-    auto res = m_freeBlocks.try_wait(smUsage, priority);
+    auto res = m_freeBlocks.try_wait(smUsage, semaphoreLevel(priority, costLevel));
     if (res) {
         // save the count
         CurrentThreadHoldingBlocks = smUsage;
@@ -151,7 +158,7 @@ bool SMBlocker::tryTake(uint64_t graphId, int nodeId, int priority)
     return res;
 }
 
-void SMBlocker::wait(uint64_t graphId, int nodeId, int priority)
+void SMBlocker::wait(uint64_t graphId, int nodeId, int priority, int costLevel)
 {
     auto smUsage = getUsageForKernel(graphId, nodeId);
 
@@ -160,7 +167,7 @@ void SMBlocker::wait(uint64_t graphId, int nodeId, int priority)
 
     LogSMTracing() << "Wait at SMBlocker: graph " << graphId << " node " << nodeId
                << " sm " << smUsage << " priority " << priority;
-    m_freeBlocks.wait(smUsage, priority);
+    m_freeBlocks.wait(smUsage, semaphoreLevel(priority, costLevel));
     LogSMTracing() << "Took at SMBlocker: graph " << graphId << " node " << nodeId
                << " sm " << smUsage << " priority " << priority;
 }
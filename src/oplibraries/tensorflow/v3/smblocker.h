@@ -33,6 +33,7 @@
 
 #include <boost/functional/hash.hpp>
 
+#include <limits>
 #include <vector>
 #include <unordered_map>
 #include <shared_mutex>
@@ -91,19 +92,25 @@ public:
      * @param graphId
      * @param nodeId
      * @param priority Smaller priority is higher, default is 10
+     * @param costLevel Among the same priority, smaller cost level is served first
      * @return true if successfully get needed resource
      */
-    bool tryTake(uint64_t graphId, int nodeId, int priority);
+    bool tryTake(uint64_t graphId, int nodeId, int priority, int costLevel = 0);
 
     /**
      * @brief Blocking wait, takes SMs
      * @param graphId
      * @param nodeId
      * @param priority
+     * @param costLevel
      */
-    void wait(uint64_t graphId, int nodeId, int priority);
+    void wait(uint64_t graphId, int nodeId, int priority, int costLevel = 0);
 
     static constexpr int MaxPriority = 100;
+    static constexpr int CostLevels = 2;
+    // Levels of m_freeBlocks, which priority_semaphore counts and indexes with uint8_t
+    static_assert(MaxPriority * CostLevels <= std::numeric_limits<uint8_t>::max(),
+                  "Too many semaphore levels for priority_semaphore");
 
 private:
     static double m_scaleFactorSM;
@@ -113,6 +120,8 @@ private:
 
     uint64_t getUsageForKernel(uint64_t graphId, int nodeId);
 
+    static int semaphoreLevel(int priority, int costLevel);
+
     class MaxSMUsage
     {
         SMUsage usage;
@@ -139,7 +148,7 @@ private:
 
     MaxSMUsage m_maxUsage;
 
-    sstl::priority_semaphore<MaxPriority> m_freeBlocks;
+    sstl::priority_semaphore<MaxPriority * CostLevels> m_freeBlocks;
 
     using KernelId = std::pair<uint64_t, int>;
     std::unordered_map<KernelId, SMUsage, boost::hash<KernelId>> m_cache;
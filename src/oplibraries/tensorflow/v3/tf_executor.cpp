@@ -18,10 +18,16 @@ limitations under the License.
 
 #include "execution/engine/iterationcontext.h"
 #include "execution/iterationtask.h"
+#include "oplibraries/tensorflow/device/gpu/lane/lanemgr.h"
 #include "oplibraries/tensorflow/tfinstance.h"
 #include "oplibraries/tensorflow/v3/smblocker.h"
 #include "utils/envutils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
 namespace salus::oplib::tensorflow {
 
 namespace {
@@ -35,6 +41,7 @@ bool IsInitializationOp(const tf::Node *node)
 }
 
 class ExecutorImpl;
+class ExecutorState;
 class GraphView;
 
 struct EdgeInfo
@@ -164,6 +171,8 @@ public:
     ~GraphView();
 
     void Initialize(const tf::Graph *g);
+    // Initialize as a byte copy of an already initialized view of the same graph
+    void InitializeFrom(const GraphView &other);
     Status SetAllocAttrs(const tf::Graph *g, const tf::Device *device);
 
     NodeItem *node(size_t id) const
@@ -183,14 +192,164 @@ private:
     // node_offsets_[id] holds the byte offset for node w/ "id" in space_
 
     char *space_; // NodeItem objects are allocated here
+    size_t space_bytes_ = 0;
 
     TF_DISALLOW_COPY_AND_ASSIGN(GraphView);
 };
 
+struct ControlFlowInfo
+{
+    tf::gtl::FlatSet<tf::string> unique_frame_names;
+    std::vector<tf::string> frame_names;
+};
+
+struct FrameInfo
+{
+    FrameInfo()
+        : input_count(0)
+        , total_inputs(0)
+        , pending_counts(nullptr)
+        , nodes(nullptr)
+    {
+    }
+
+    // The total number of inputs to a frame.
+    int input_count;
+
+    // The total number of input tensors of a frame.
+    // == sum(nodes[*].num_inputs()) where nodes are the nodes in the frame.
+    int total_inputs;
+
+    // Used to determine the next place to allocate space in the
+    // pending_counts data structure we'll eventually construct
+    tf::PendingCounts::Layout pending_counts_layout;
+
+    // Each frame has its own PendingCounts only for the nodes in the frame.
+    tf::PendingCounts *pending_counts; // Owned
+
+    // Initial count of every handle in pending_counts, to reset a copy of it in place
+    std::vector<std::pair<tf::PendingCounts::Handle, size_t>> initial_counts;
+
+    // The nodes in a frame. Used only for debugging.
+    std::vector<const tf::Node *> *nodes; // Owned
+
+    ~FrameInfo()
+    {
+        delete pending_counts;
+        delete nodes;
+    }
+};
+
+} // namespace
+
+/**
+ * @brief The part of an executor that only depends on the graph and the device type.
+ *
+ * It is immutable once built, so executors created for identical partitions, e.g. from
+ * sessions registering the same GraphDef, share one instance instead of rebuilding it.
+ */
+class ExecutorLayout
+{
+public:
+    explicit ExecutorLayout(std::shared_ptr<const tf::Graph> g)
+        : graph(std::move(g))
+    {
+    }
+
+    ~ExecutorLayout()
+    {
+        for (auto fiter : frame_info) {
+            delete fiter.second;
+        }
+    }
+
+    FrameInfo *EnsureFrameInfo(const tf::string &fname)
+    {
+        auto slot = &frame_info[fname];
+        if (*slot == nullptr) {
+            *slot = new FrameInfo;
+        }
+        return *slot;
+    }
+
+    void InitializePending(const ControlFlowInfo &cf_info);
+
+    // Static liveness analysis over the graph, must be called after gview is initialized
+    void EstimatePeakMemory();
+
+    // Nodes in gview refer to this graph
+    std::shared_ptr<const tf::Graph> graph;
+
+    // Template of the executor's GraphView, with all kernel pointers cleared
+    GraphView gview;
+
+    // Root nodes (with no in edges) that should form the initial ready queue
+    std::vector<const tf::Node *> root_nodes;
+
+    // All nodes in post order, i.e. successors before predecessors except along loop back edges
+    std::vector<const tf::Node *> rank_order;
+
+    // Mapping from frame name to static information about the frame.
+    tf::gtl::FlatMap<tf::string, FrameInfo *> frame_info;
+
+    bool is_main_iter = false;
+
+    // Estimated device memory usage of one run of the graph
+    ResStats peak_estimation;
+
+    TF_DISALLOW_COPY_AND_ASSIGN(ExecutorLayout);
+};
+
+namespace {
+
+// Measured per node execution time in nanoseconds, from start running to done,
+// read and updated without locks.
+// Racing updates may drop a sample, which only slows down convergence.
+class NodeCostTable
+{
+public:
+    void Initialize(int num_nodes)
+    {
+        costs_.reset(new std::atomic<tf::uint64>[num_nodes]());
+    }
+
+    // Exponentially weighted moving average, giving 1/8 weight to the new sample
+    void Record(int id, tf::uint64 nsec)
+    {
+        auto &cost = costs_[id];
+        const auto old = cost.load(std::memory_order_relaxed);
+        const auto updated = old == 0 ? nsec : old - old / 8 + nsec / 8;
+        cost.store(std::max<tf::uint64>(updated, 1), std::memory_order_relaxed);
+    }
+
+    // The measured cost, or def if the node never ran
+    tf::uint64 Get(int id, tf::uint64 def) const
+    {
+        const auto cost = costs_[id].load(std::memory_order_relaxed);
+        return cost ? cost : def;
+    }
+
+private:
+    std::unique_ptr<std::atomic<tf::uint64>[]> costs_;
+};
+
+// Order of ready nodes. Higher rank runs first, and among the same rank,
+// the node allocating fewer net bytes runs first.
+struct ReadyPriority
+{
+    tf::uint64 rank;
+    tf::int64 net_bytes;
+
+    bool RunsBefore(const ReadyPriority &other) const
+    {
+        return rank > other.rank || (rank == other.rank && net_bytes < other.net_bytes);
+    }
+};
+
 class ExecutorImpl : public tf::Executor
 {
 public:
-    ExecutorImpl(const TFExecutorParams &p, std::unique_ptr<const tf::Graph> &&g)
+    ExecutorImpl(const TFExecutorParams &p, std::shared_ptr<const tf::Graph> g)
         : params_(p)
         , graph_(std::move(g))
         , gview_()
@@ -203,18 +362,22 @@ public:
 
     ~ExecutorImpl() override
     {
+        DeleteIdleStates();
         for (int i = 0; i < graph_->num_node_ids(); i++) {
             NodeItem *item = gview_.node(i);
             if (item != nullptr) {
                 params_.delete_kernel(item->kernel);
             }
         }
-        for (auto fiter : frame_info_) {
-            delete fiter.second;
-        }
     }
 
-    Status Initialize();
+    // Build everything from graph_, or reuse the static part from layout if it is given.
+    Status Initialize(std::shared_ptr<const ExecutorLayout> layout);
+
+    std::shared_ptr<const ExecutorLayout> layout() const
+    {
+        return layout_;
+    }
 
     // Process all Nodes in the current graph, attempting to infer the
     // memory allocation attributes to be used wherever they may allocate
@@ -227,78 +390,105 @@ private:
     friend class ExecutorState;
     friend class TFExecutorTask;
 
-    struct ControlFlowInfo
+    static Status BuildControlFlowInfo(const tf::Graph *graph, ControlFlowInfo *cf_info);
+    Status BuildLayout();
+    Status CreateKernel(const tf::Node *n, NodeItem *item);
+    void InitializeRanks();
+
+    // Whether the node should be dispatched to another thread rather than run inline. Uses the
+    // measured cost once available, and the kernel's own IsExpensive() before that.
+    bool IsExpensive(const NodeItem &item) const;
+
+    // Critical path length from the node to the end of the graph, counting the node itself.
+    tf::uint64 NodeRank(int id) const
     {
-        tf::gtl::FlatSet<tf::string> unique_frame_names;
-        std::vector<tf::string> frame_names;
-    };
+        return node_ranks_[id].load(std::memory_order_relaxed);
+    }
 
-    struct FrameInfo
+    // Rank of the node, coarsened into buckets when memory aware scheduling is on,
+    // so that nodes about equally critical are ordered by their memory usage instead.
+    ReadyPriority NodePriority(int id) const
     {
-        FrameInfo()
-            : input_count(0)
-            , total_inputs(0)
-            , pending_counts(nullptr)
-            , nodes(nullptr)
-        {
+        const auto rank = NodeRank(id);
+        const auto bucket = rank_bucket_.load(std::memory_order_relaxed);
+        if (bucket == 0) {
+            return {rank, 0};
         }
+        return {rank / bucket, node_net_bytes_[id].load(std::memory_order_relaxed)};
+    }
 
-        // The total number of inputs to a frame.
-        int input_count;
-
-        // The total number of input tensors of a frame.
-        // == sum(nodes[*].num_inputs()) where nodes are the nodes in the frame.
-        int total_inputs;
-
-        // Used to determine the next place to allocate space in the
-        // pending_counts data structure we'll eventually construct
-        tf::PendingCounts::Layout pending_counts_layout;
-
-        // Each frame has its own PendingCounts only for the nodes in the frame.
-        tf::PendingCounts *pending_counts; // Owned
+    bool MemoryAware() const
+    {
+        return mem_aware_slack_ > 0;
+    }
 
-        // The nodes in a frame. Used only for debugging.
-        std::vector<const tf::Node *> *nodes; // Owned
+    // Remember net bytes allocated by the node, i.e. output bytes minus freed input bytes
+    void RecordNodeNetBytes(int id, tf::int64 bytes) const
+    {
+        node_net_bytes_[id].store(bytes, std::memory_order_relaxed);
+    }
 
-        ~FrameInfo()
-        {
-            delete pending_counts;
-            delete nodes;
-        }
-    };
+    void RecordNodeCost(int id, std::chrono::steady_clock::time_point start) const
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        node_costs_.Record(id, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
 
-    static Status BuildControlFlowInfo(const tf::Graph *graph, ControlFlowInfo *cf_info);
-    void InitializePending(const tf::Graph *graph, const ControlFlowInfo &cf_info);
+    // Recompute ranks from measured costs
+    void UpdateRanks() const;
+    // Called once per step, updates ranks every kRankUpdateSteps steps
+    void MaybeUpdateRanks() const;
 
-    FrameInfo *EnsureFrameInfo(const tf::string &fname)
+    const FrameInfo *FindFrameInfo(const tf::string &fname) const
     {
-        auto slot = &frame_info_[fname];
-        if (*slot == nullptr) {
-            *slot = new FrameInfo;
-        }
-        return *slot;
+        auto it = layout_->frame_info.find(fname);
+        DCHECK(it != layout_->frame_info.end());
+        return it->second;
     }
 
+    // Get an idle state from a previous step, or a new one, ready to run a step with args
+    std::unique_ptr<ExecutorState> AcquireState(const Args &args, DoneCallback done);
+    // Keep a finished state around for later steps
+    void RecycleState(ExecutorState *state) const;
+    void DeleteIdleStates();
+
     // Owned.
     TFExecutorParams params_;
-    std::unique_ptr<const tf::Graph> graph_;
+    std::shared_ptr<const tf::Graph> graph_;
     GraphView gview_;
 
+    // Root nodes, frame info and pending count templates, possibly shared with other executors
+    std::shared_ptr<const ExecutorLayout> layout_;
+
     // A cached value of params_
     bool device_record_tensor_accesses_ = false;
 
-    // Root nodes (with no in edges) that should form the initial ready queue
-    std::vector<const tf::Node *> root_nodes_;
-
-    // Mapping from frame name to static information about the frame.
-    // TODO(yuanbyu): We could cache it along with the graph so to avoid
-    // the overhead of constructing it for each executor instance.
-    tf::gtl::FlatMap<tf::string, FrameInfo *> frame_info_;
-
     bool is_main_iter;
     // a combination of graphHandle and partition
     const uint64_t graph_id_;
 
+    // Cost of nodes that never ran, in the same unit as NodeCostTable
+    static constexpr tf::uint64 kDefaultNodeCostNs = 1000;
+    // Nodes measured to run at least this long are dispatched to other threads.
+    // Roughly the overhead of a thread pool hop.
+    static constexpr tf::uint64 kDefaultExpensiveNodeNs = 10000;
+    static constexpr tf::uint64 kRankUpdateSteps = 32;
+    mutable NodeCostTable node_costs_;
+    std::unique_ptr<std::atomic<tf::uint64>[]> node_ranks_;
+    mutable std::atomic<tf::uint64> steps_since_rank_update_{0};
+    mutable std::atomic_flag updating_ranks_ = ATOMIC_FLAG_INIT;
+
+    // Memory aware scheduling treats ranks within this fraction of the critical path length
+    // as equal, which bounds how much it may stretch the critical path. 0 disables it.
+    double mem_aware_slack_ = 0;
+    std::unique_ptr<std::atomic<tf::int64>[]> node_net_bytes_;
+    mutable std::atomic<tf::uint64> rank_bucket_{0};
+
+    // States of finished steps, which are reset instead of being rebuilt for the next step
+    static constexpr size_t kMaxIdleStates = 4;
+    mutable tf::mutex idle_states_mu_;
+    mutable std::vector<ExecutorState *> idle_states_ GUARDED_BY(idle_states_mu_);
+
     static std::atomic_int_fast64_t NextSeq;
 
     TF_DISALLOW_COPY_AND_ASSIGN(ExecutorImpl);
@@ -449,6 +639,7 @@ void GraphView::Initialize(const tf::Graph *g)
     }
 
     space_ = new char[total_bytes]; // NodeItem objects are allocated here
+    space_bytes_ = total_bytes;
     char *ptr = space_;
     for (const auto *n : g->nodes()) {
         ptr = InitializeNode(ptr, n);
@@ -456,6 +647,24 @@ void GraphView::Initialize(const tf::Graph *g)
     CHECK_EQ(ptr, space_ + total_bytes);
 }
 
+void GraphView::InitializeFrom(const GraphView &other)
+{
+    static_assert(std::is_trivially_destructible<NodeItem>::value,
+                  "Update code if NodeItem gains a destructor");
+    CHECK(node_offsets_ == nullptr);
+    CHECK(other.space_ != nullptr);
+
+    num_nodes_ = other.num_nodes_;
+    node_offsets_ = new tf::uint32[num_nodes_];
+    std::copy_n(other.node_offsets_, num_nodes_, node_offsets_);
+
+    // NodeItem and its variable length section are plain data without any
+    // pointer into space_, so a byte copy is a complete copy of the view.
+    space_bytes_ = other.space_bytes_;
+    space_ = new char[space_bytes_];
+    std::memcpy(space_, other.space_, space_bytes_);
+}
+
 void GetMaxPendingCounts(const tf::Node *n, size_t *max_pending, size_t *max_dead_count)
 {
     const size_t num_in_edges = n->in_edges().size();
@@ -479,10 +688,8 @@ void GetMaxPendingCounts(const tf::Node *n, size_t *max_pending, size_t *max_dea
     *max_dead_count = num_in_edges;
 }
 
-Status ExecutorImpl::Initialize()
+Status ExecutorImpl::Initialize(std::shared_ptr<const ExecutorLayout> layout)
 {
-    gview_.Initialize(graph_.get());
-
     struct ExecutorImplTag;
     if (sstl::fromEnvVarCached<ExecutorImplTag>("DumpGraph", false)) {
         LogOpTracing() << "event: new_graph "
@@ -495,17 +702,126 @@ Status ExecutorImpl::Initialize()
                                          });
     }
 
+    // Cache this value so we make this virtual function call once, rather
+    // that O(# steps * # nodes per step) times.
+    device_record_tensor_accesses_ = params_.device->RequiresRecordingAccessedTensors();
+
+    if (!layout) {
+        TF_RETURN_IF_ERROR(BuildLayout());
+        InitializeRanks();
+        return Status::OK();
+    }
+
+    // Everything except the kernels is already known
+    DCHECK(layout->graph == graph_);
+    layout_ = std::move(layout);
+    is_main_iter = layout_->is_main_iter;
+    if (is_main_iter) {
+        VLOG(2) << params_.session << ":" << params_.graphHandle << " is main iteration";
+    }
+
+    gview_.InitializeFrom(layout_->gview);
+    for (const auto *n : graph_->nodes()) {
+        TF_RETURN_IF_ERROR(CreateKernel(n, gview_.node(n->id())));
+    }
+    InitializeRanks();
+    return Status::OK();
+}
+
+void ExecutorImpl::InitializeRanks()
+{
+    node_costs_.Initialize(graph_->num_node_ids());
+    node_ranks_.reset(new std::atomic<tf::uint64>[graph_->num_node_ids()]());
+
+    struct MemoryAwareSlackTag;
+    mem_aware_slack_ = sstl::fromEnvVarCached<MemoryAwareSlackTag>("SALUS_MEMORY_AWARE_SCHED_SLACK", 0.0);
+    if (MemoryAware()) {
+        node_net_bytes_.reset(new std::atomic<tf::int64>[graph_->num_node_ids()]());
+    }
+
+    // Without any measurement, this ranks by the number of nodes on the longest path
+    UpdateRanks();
+}
+
+bool ExecutorImpl::IsExpensive(const NodeItem &item) const
+{
+    // Setting it to 0 falls back to static IsExpensive()
+    struct ExpensiveNodeTag;
+    const auto threshold = sstl::fromEnvVarCached<ExpensiveNodeTag>("SALUS_EXPENSIVE_NODE_NS", kDefaultExpensiveNodeNs);
+    // Measured time of async kernels includes waiting for their inputs, which doesn't occupy the thread
+    if (threshold == 0 || item.kernel_is_async) {
+        return item.kernel_is_expensive;
+    }
+    const auto cost = node_costs_.Get(item.node->id(), 0);
+    if (cost == 0) {
+        return item.kernel_is_expensive;
+    }
+    return cost >= threshold;
+}
+
+void ExecutorImpl::UpdateRanks() const
+{
+    tf::uint64 max_rank = 0;
+    for (const auto *n : layout_->rank_order) {
+        tf::uint64 succ_rank = 0;
+        // NextIteration edges go back to the loop head, skip them to keep the graph acyclic
+        if (!IsNextIteration(n)) {
+            for (const auto *e : n->out_edges()) {
+                succ_rank = std::max(succ_rank, NodeRank(e->dst()->id()));
+            }
+        }
+        const auto cost = node_costs_.Get(n->id(), kDefaultNodeCostNs);
+        node_ranks_[n->id()].store(cost + succ_rank, std::memory_order_relaxed);
+        max_rank = std::max(max_rank, cost + succ_rank);
+    }
+
+    if (MemoryAware()) {
+        const auto bucket = static_cast<tf::uint64>(max_rank * mem_aware_slack_);
+        rank_bucket_.store(std::max<tf::uint64>(bucket, 1), std::memory_order_relaxed);
+    }
+}
+
+void ExecutorImpl::MaybeUpdateRanks() const
+{
+    if (steps_since_rank_update_.fetch_add(1, std::memory_order_relaxed) + 1 < kRankUpdateSteps) {
+        return;
+    }
+    // Someone else is already on it
+    if (updating_ranks_.test_and_set(std::memory_order_acquire)) {
+        return;
+    }
+    steps_since_rank_update_.store(0, std::memory_order_relaxed);
+    UpdateRanks();
+    updating_ranks_.clear(std::memory_order_release);
+}
+
+Status ExecutorImpl::CreateKernel(const tf::Node *n, NodeItem *item)
+{
+    Status s = params_.create_kernel(n->def(), &item->kernel);
+    if (!s.ok()) {
+        item->kernel = nullptr;
+        s = AttachDef(s, *n);
+        LOG(ERROR) << "Executor failed to create kernel. " << s;
+        return s;
+    }
+    CHECK(item->kernel);
+    item->kernel_is_expensive = item->kernel->IsExpensive();
+    item->kernel_is_async = (item->kernel->AsAsync() != nullptr);
+    return Status::OK();
+}
+
+Status ExecutorImpl::BuildLayout()
+{
+    gview_.Initialize(graph_.get());
+
+    auto layout = std::make_shared<ExecutorLayout>(graph_);
 
     // Build the information about frames in this subgraph.
     ControlFlowInfo cf_info;
     TF_RETURN_IF_ERROR(BuildControlFlowInfo(graph_.get(), &cf_info));
 
-    // Cache this value so we make this virtual function call once, rather
-    // that O(# steps * # nodes per step) times.
-    device_record_tensor_accesses_ = params_.device->RequiresRecordingAccessedTensors();
-
     for (auto &it : cf_info.unique_frame_names) {
-        EnsureFrameInfo(it)->nodes = new std::vector<const tf::Node *>;
+        layout->EnsureFrameInfo(it)->nodes = new std::vector<const tf::Node *>;
     }
 
     // Preprocess every node in the graph to create an instance of op
@@ -513,7 +829,7 @@ Status ExecutorImpl::Initialize()
     for (const auto *n : graph_->nodes()) {
         const int id = n->id();
         const auto &frame_name = cf_info.frame_names[id];
-        FrameInfo *frame_info = EnsureFrameInfo(frame_name);
+        FrameInfo *frame_info = layout->EnsureFrameInfo(frame_name);
 
         // Check if this is main iteration
         if (n->name() == "salus_main_iter") {
@@ -521,9 +837,9 @@ Status ExecutorImpl::Initialize()
             is_main_iter = true;
         }
 
-        // See if this node is a root node, and if so, add to root_nodes_.
+        // See if this node is a root node, and if so, add to root_nodes.
         if (n->in_edges().empty()) {
-            root_nodes_.push_back(n);
+            layout->root_nodes.push_back(n);
         }
 
         NodeItem *item = gview_.node(id);
@@ -532,16 +848,7 @@ Status ExecutorImpl::Initialize()
         item->input_start = frame_info->total_inputs;
         frame_info->total_inputs += n->num_inputs();
 
-        Status s = params_.create_kernel(n->def(), &item->kernel);
-        if (!s.ok()) {
-            item->kernel = nullptr;
-            s = AttachDef(s, *n);
-            LOG(ERROR) << "Executor failed to create kernel. " << s;
-            return s;
-        }
-        CHECK(item->kernel);
-        item->kernel_is_expensive = item->kernel->IsExpensive();
-        item->kernel_is_async = (item->kernel->AsAsync() != nullptr);
+        TF_RETURN_IF_ERROR(CreateKernel(n, item));
         item->is_merge = IsMerge(n);
         item->is_enter = IsEnter(n);
         item->is_exit = IsExit(n);
@@ -562,15 +869,34 @@ Status ExecutorImpl::Initialize()
         if (IsEnter(n)) {
             tf::string enter_name;
             TF_RETURN_IF_ERROR(GetNodeAttr(n->attrs(), "frame_name", &enter_name));
-            EnsureFrameInfo(enter_name)->input_count++;
+            layout->EnsureFrameInfo(enter_name)->input_count++;
         }
     }
+    layout->is_main_iter = is_main_iter;
+
+    TF_RETURN_IF_ERROR(gview_.SetAllocAttrs(graph_.get(), params_.device));
+
+    // Keep a kernel-free copy of the view, from which other executors of
+    // the same graph can start
+    layout->gview.InitializeFrom(gview_);
+    for (const auto *n : graph_->nodes()) {
+        layout->gview.node(n->id())->kernel = nullptr;
+    }
 
     // Initialize PendingCounts only after item->pending_id is initialized for
     // all nodes.
-    InitializePending(graph_.get(), cf_info);
+    layout->InitializePending(cf_info);
 
-    return gview_.SetAllocAttrs(graph_.get(), params_.device);
+    layout->EstimatePeakMemory();
+
+    std::vector<tf::Node *> post_order;
+    tf::GetPostOrder(*graph_, &post_order);
+    layout->rank_order.assign(post_order.begin(), post_order.end());
+    VLOG(2) << params_.session << ":" << params_.graphHandle << " on " << params_.device->name()
+            << " estimated peak memory " << layout->peak_estimation.DebugString();
+
+    layout_ = std::move(layout);
+    return Status::OK();
 }
 
 Status GraphView::SetAllocAttrs(const tf::Graph *g, const tf::Device *device)
@@ -675,9 +1001,13 @@ Status InferAllocAttr(const tf::Node *n, const tf::Node *dst,
 class ExecutorState
 {
 public:
-    ExecutorState(const tf::Executor::Args &args, ExecutorImpl *impl, tf::Executor::DoneCallback done);
+    explicit ExecutorState(const ExecutorImpl *impl);
     ~ExecutorState();
 
+    // Prepare the state to run a new step. Must be called before runAsync, and
+    // again before reusing the state after it finished a step.
+    void Reset(const tf::Executor::Args &args, tf::Executor::DoneCallback done);
+
     void runAsync(std::shared_ptr<IterationContext> &&ictx) noexcept;
 
 private:
@@ -748,6 +1078,17 @@ private:
             }
         }
 
+        // Back to the default constructed state.
+        void Reset()
+        {
+            ClearVal();
+            ref = nullptr;
+            ref_mu = nullptr;
+            has_value = false;
+            alloc_attr = tf::AllocatorAttributes();
+            device_context = nullptr;
+        }
+
         // A tensor value, if val_field_is_set.
         tf::ManualConstructor<tf::Tensor> val;
 
@@ -777,14 +1118,29 @@ private:
 
     struct IterationState
     {
-        explicit IterationState(const tf::PendingCounts *pending_counts, int total_input_tensors)
-            : input_tensors(new Entry[total_input_tensors])
+        explicit IterationState(const FrameInfo *finfo)
+            : input_tensors(new Entry[finfo->total_inputs])
             , outstanding_ops(0)
             , outstanding_frame_count(0)
-            , counts_(*pending_counts)
+            , frame_info_(finfo)
+            , counts_(*finfo->pending_counts)
         { // Initialize with copy of *pending_counts
         }
 
+        // Back to the state right after construction, without reallocating
+        // input_tensors or counts_.
+        void Reset()
+        {
+            for (int i = 0; i != frame_info_->total_inputs; ++i) {
+                input_tensors[i].Reset();
+            }
+            outstanding_ops = 0;
+            outstanding_frame_count = 0;
+            for (const auto &[h, count] : frame_info_->initial_counts) {
+                counts_.set_initial_count(h, count);
+            }
+        }
+
         // The state of an iteration.
 
         // One copy per iteration. For iteration k, i-th node's j-th input is in
@@ -851,15 +1207,16 @@ private:
         }
 
     private:
+        const FrameInfo *frame_info_;
         tf::PendingCounts counts_;
     };
 
     struct FrameState
     {
-        explicit FrameState(const ExecutorImpl *impl, int parallel_iters)
+        explicit FrameState(const ExecutorImpl *impl, const FrameInfo *finfo)
             : executor(impl)
-            , max_parallel_iterations(parallel_iters)
-            , num_outstanding_iterations(1)
+            , frame_info(finfo)
+            , nodes(finfo->nodes)
         {
         }
 
@@ -912,7 +1269,7 @@ private:
         FrameState *parent_frame = nullptr;
 
         // The maximum allowed number of parallel iterations.
-        const int max_parallel_iterations;
+        int max_parallel_iterations = 1;
 
         // The number of inputs this frame is still waiting.
         int num_pending_inputs = 0;
@@ -944,22 +1301,65 @@ private:
         std::vector<const tf::Node *> dead_exits GUARDED_BY(mu);
 
         // Static information specific to this frame.
-        tf::PendingCounts *pending_counts = nullptr;
-        int total_input_tensors = 0;
+        const FrameInfo *frame_info = nullptr;
         std::vector<const tf::Node *> *nodes = nullptr;
 
+        // Finished iterations, kept to be reused by NewIteration.
+        std::vector<IterationState *> free_iterations GUARDED_BY(mu);
+
         // Lock ordering: ExecutorState.mu_ < mu.
         tf::mutex mu;
 
-        void InitializeFrameInfo(const tf::string &enter_name)
+        // (Re)start the frame with iteration 0 ready, for both new frames and ones
+        // recycled from a finished frame of the same FrameInfo.
+        void Start(tf::string name, FrameState *parent, tf::int64 iter, int parallel_iters,
+                   size_t num_iter_slots) NO_THREAD_SAFETY_ANALYSIS
+        {
+            frame_name = std::move(name);
+            // The root frame must have id 0
+            frame_id = parent ? tf::Hash64(frame_name) : 0;
+            parent_frame = parent;
+            parent_iter = iter;
+            max_parallel_iterations = parallel_iters;
+            num_pending_inputs = frame_info->input_count;
+            iteration_count = 0;
+            num_outstanding_iterations = 1;
+
+            // 'iterations' is a fixed-length circular buffer.
+            for (auto &istate : iterations) {
+                if (istate) {
+                    RecycleIteration(istate);
+                    istate = nullptr;
+                }
+            }
+            iterations.resize(num_iter_slots);
+            // Initialize iteration 0.
+            iterations[0] = NewIteration();
+        }
+
+        // Release values held by a finished frame before keeping it for reuse.
+        void Clear() NO_THREAD_SAFETY_ANALYSIS
         {
-            auto it_frame_info = executor->frame_info_.find(enter_name);
-            DCHECK(it_frame_info != executor->frame_info_.end());
-            ExecutorImpl::FrameInfo *finfo = it_frame_info->second;
-            pending_counts = finfo->pending_counts;
-            total_input_tensors = finfo->total_inputs;
-            num_pending_inputs = finfo->input_count;
-            nodes = finfo->nodes;
+            next_iter_roots.clear();
+            inv_values.clear();
+            dead_exits.clear();
+        }
+
+        IterationState *NewIteration() EXCLUSIVE_LOCKS_REQUIRED(mu)
+        {
+            if (free_iterations.empty()) {
+                return new IterationState(frame_info);
+            }
+            auto istate = free_iterations.back();
+            free_iterations.pop_back();
+            return istate;
+        }
+
+        // Values are released right away rather than on the next use
+        void RecycleIteration(IterationState *istate) EXCLUSIVE_LOCKS_REQUIRED(mu)
+        {
+            istate->Reset();
+            free_iterations.push_back(istate);
         }
 
         inline IterationState *GetIteration(tf::int64 iter) EXCLUSIVE_LOCKS_REQUIRED(mu)
@@ -1036,6 +1436,9 @@ private:
                 delete iterations[i];
                 iterations[i] = nullptr;
             }
+            for (auto istate : free_iterations) {
+                delete istate;
+            }
         }
     };
 
@@ -1056,53 +1459,31 @@ private:
         }
     };
 
-    // A drop-in replacement for std::deque<TaggedNode>.  We typically don't
-    // have that many nodes in the ready queue, so we just use a vector and
-    // don't free up memory from the queue as we consume nodes.
+    // Nodes ready to run inline in the current thread, ordered by ReadyPriority, and
+    // kept in FIFO order among equal priorities. Only used by a single thread.
     class TaggedNodeReadyQueue
     {
     public:
-        TaggedNodeReadyQueue()
-            : front_index_(0)
+        void push_back(TaggedNode node, ReadyPriority priority)
         {
-        }
-
-        void push_back(TaggedNode node)
-        {
-            ready_.push_back(node);
+            ready_.push_back({priority, next_seq_++, node});
+            std::push_heap(ready_.begin(), ready_.end(), &RunsAfter);
         }
         TaggedNode front() const
         {
-            DCHECK_LT(front_index_, ready_.size());
-            return ready_[front_index_];
+            DCHECK(!ready_.empty());
+            return ready_.front().node;
         }
         void pop_front()
         {
-            DCHECK_LT(front_index_, ready_.size());
-            front_index_++;
-            if ((front_index_ == ready_.size()) || (front_index_ > 16384)) {
-                if (front_index_ == ready_.size()) {
-                    ready_.clear();
-                } else {
-                    // Lots of unused entries at beginning of vector: move everything down
-                    // to start of vector.
-                    ready_.erase(ready_.begin(), ready_.begin() + front_index_);
-                }
-                front_index_ = 0;
-            }
+            DCHECK(!ready_.empty());
+            std::pop_heap(ready_.begin(), ready_.end(), &RunsAfter);
+            ready_.pop_back();
         }
         bool empty() const
         {
             return ready_.empty();
         }
-        const TaggedNode *begin() const
-        {
-            return ready_.begin() + front_index_;
-        }
-        const TaggedNode *end() const
-        {
-            return ready_.end();
-        }
 
         auto size() const
         {
@@ -1110,18 +1491,33 @@ private:
         }
 
     private:
-        tf::gtl::InlinedVector<TaggedNode, 16> ready_;
-        size_t front_index_;
+        struct Item
+        {
+            ReadyPriority priority;
+            tf::uint64 seq;
+            TaggedNode node;
+        };
+
+        static bool RunsAfter(const Item &a, const Item &b)
+        {
+            if (b.priority.RunsBefore(a.priority)) {
+                return true;
+            }
+            return !a.priority.RunsBefore(b.priority) && a.seq > b.seq;
+        }
+
+        tf::gtl::InlinedVector<Item, 16> ready_;
+        tf::uint64 next_seq_ = 0;
     };
 
     struct AsyncState;
 
-    const bool vlog_; // true if VLOG_IS_ON(1). Used to check vlog cheaply.
+    bool vlog_; // true if VLOG_IS_ON(1). Used to check vlog cheaply.
 
     std::shared_ptr<IterationContext> ictx_;
 
     // true if LogMemory::IsEnabled(). Used to check memory enabled cheaply.
-    const bool log_memory_;
+    bool log_memory_;
 
     tf::int64 step_id_;
     // Not owned.
@@ -1133,7 +1529,7 @@ private:
     tf::StepStatsCollector *stats_collector_;
     // QUESTION: Make it a checkpoint::TensorSliceReaderCacheWrapper
     // instead of a pointer?  (avoids having to delete).
-    tf::checkpoint::TensorSliceReaderCacheWrapper *slice_reader_cache_;
+    tf::checkpoint::TensorSliceReaderCacheWrapper *slice_reader_cache_ = nullptr;
     tf::CallFrameInterface *call_frame_;
     const ExecutorImpl *impl_;
     tf::CancellationManager *cancellation_manager_;
@@ -1164,6 +1560,9 @@ private:
     // name of the new frame from nodedef.
     tf::gtl::FlatMap<tf::string, FrameState *> outstanding_frames_ GUARDED_BY(mu_);
 
+    // Frames that are done, kept to be reused for the same FrameInfo in this or later steps.
+    tf::gtl::FlatMap<const FrameInfo *, std::vector<FrameState *>> free_frames_ GUARDED_BY(mu_);
+
     // The unique name of a frame.
     inline tf::string MakeFrameName(FrameState *frame, tf::int64 iter_id, const tf::string &name)
     {
@@ -1185,6 +1584,11 @@ private:
     void Process(TaggedNode node, tf::int64 scheduled_usec);
 
     // Before invoking item->kernel, fills in its "inputs".
+    // Bytes of non-ref inputs not referenced by anyone else, which are freed after the node runs
+    static tf::int64 InputBytesToFree(const TensorValueVec &inputs);
+    // Bytes of non-ref outputs
+    static tf::int64 OutputBytes(const EntryVector &outputs);
+
     Status PrepareInputs(const NodeItem &item, Entry *first_input, TensorValueVec *inputs,
                          DeviceContextVec *input_device_contexts, AllocatorAttributeVec *input_alloc_attrs,
                          bool *is_input_dead);
@@ -1201,8 +1605,11 @@ private:
 
     // "node" just finishes. Takes ownership of "stats". Returns true if
     // execution has completed.
+    // running_since is when the node started running, used to measure its cost. Default constructed
+    // if the node shouldn't be measured.
     bool NodeDone(const Status &s, const tf::Node *node, const TaggedNodeSeq &ready,
-                  tf::NodeExecStatsWrapper *stats, TaggedNodeReadyQueue *inline_ready);
+                  tf::NodeExecStatsWrapper *stats, TaggedNodeReadyQueue *inline_ready,
+                  std::chrono::steady_clock::time_point running_since);
 
     // Schedule all the expensive nodes in 'ready', and put all the inexpensive
     // nodes in 'ready' into 'inline_ready'.
@@ -1214,6 +1621,9 @@ private:
     // Clean up when this executor is done.
     void Finish();
 
+    // Release per step resources. Returns true if the state can be reused for another step.
+    bool Cleanup();
+
     // A standalone routine for this expression so that we can express
     // that we don't want thread safety analysis on this reference (it's
     // safe to do without the lock because the iterations array never
@@ -1225,38 +1635,56 @@ private:
     }
 };
 
-ExecutorState::ExecutorState(const tf::Executor::Args &args, ExecutorImpl *impl,
-                             tf::Executor::DoneCallback done)
-    : vlog_(VLOG_IS_ON(1))
-    , log_memory_(tf::LogMemory::IsEnabled())
-    , step_id_(args.step_id)
-    , rendezvous_(args.rendezvous)
-    , session_state_(args.session_state)
-    , tensor_store_(args.tensor_store)
-    , step_container_(args.step_container)
-    , stats_collector_(args.stats_collector)
-    , slice_reader_cache_(new tf::checkpoint::TensorSliceReaderCacheWrapper)
-    , call_frame_(args.call_frame)
-    , impl_(impl)
-    , cancellation_manager_(args.cancellation_manager)
-    , runner_(args.runner)
-    , sync_on_finish_(args.sync_on_finish)
-    , done_cb_(std::move(done))
-    , num_outstanding_ops_(0)
+ExecutorState::ExecutorState(const ExecutorImpl *impl)
+    : impl_(impl)
 {
     // We start the entire execution in iteration 0 of the root frame
-    // so let us create the root frame and the state for iteration 0.
-    // We assume root_frame_->frame_name.empty().
-    root_frame_ = new FrameState(impl_, 1);
-    root_frame_->frame_id = 0; // must be 0
-    root_frame_->InitializeFrameInfo(root_frame_->frame_name);
+    // so let us create the root frame. We assume root_frame_->frame_name.empty().
+    root_frame_ = new FrameState(impl_, impl_->FindFrameInfo(""));
+    outstanding_frames_.insert({root_frame_->frame_name, root_frame_});
+}
 
-    // Initialize iteration 0.
-    root_frame_->iterations.resize(root_frame_->max_parallel_iterations);
-    root_frame_->iterations[0] =
-        new IterationState(root_frame_->pending_counts, root_frame_->total_input_tensors);
+void ExecutorState::Reset(const tf::Executor::Args &args, tf::Executor::DoneCallback done)
+{
+    vlog_ = VLOG_IS_ON(1);
+    log_memory_ = tf::LogMemory::IsEnabled();
+    step_id_ = args.step_id;
+    rendezvous_ = args.rendezvous;
+    session_state_ = args.session_state;
+    tensor_store_ = args.tensor_store;
+    step_container_ = args.step_container;
+    stats_collector_ = args.stats_collector;
+    DCHECK(slice_reader_cache_ == nullptr);
+    slice_reader_cache_ = new tf::checkpoint::TensorSliceReaderCacheWrapper;
+    call_frame_ = args.call_frame;
+    cancellation_manager_ = args.cancellation_manager;
+    runner_ = args.runner;
+    sync_on_finish_ = args.sync_on_finish;
+    dumped_on_error_ = false;
+    done_cb_ = std::move(done);
+    num_outstanding_ops_ = 0;
+
+    // Initialize iteration 0 of the root frame.
+    root_frame_->Start("", nullptr, -1, 1, 1);
+}
 
-    outstanding_frames_.insert({root_frame_->frame_name, root_frame_});
+bool ExecutorState::Cleanup()
+{
+    for (auto it : device_context_map_) {
+        it->Unref();
+    }
+    device_context_map_.clear();
+    delete slice_reader_cache_;
+    slice_reader_cache_ = nullptr;
+    ictx_.reset();
+
+    tf::mutex_lock l(mu_);
+    // Child frames of failed steps may still be outstanding with live iterations
+    if (!status_.ok() || outstanding_frames_.size() != 1) {
+        return false;
+    }
+    root_frame_->Clear();
+    return true;
 }
 
 ExecutorState::~ExecutorState()
@@ -1264,6 +1692,11 @@ ExecutorState::~ExecutorState()
     for (auto name_frame : outstanding_frames_) {
         delete name_frame.second;
     }
+    for (const auto &it : free_frames_) {
+        for (auto frame : it.second) {
+            delete frame;
+        }
+    }
     for (auto it : device_context_map_) {
         it->Unref();
     }
@@ -1332,7 +1765,128 @@ Status ExecutorImpl::BuildControlFlowInfo(const tf::Graph *g, ControlFlowInfo *c
     return Status::OK();
 }
 
-void ExecutorImpl::InitializePending(const tf::Graph *graph, const ControlFlowInfo &cf_info)
+} // namespace
+
+namespace {
+
+// Bytes of the tensor at output slot of n, or 0 if its shape or element size isn't statically known.
+size_t KnownOutputBytes(const tf::Node *n, int slot)
+{
+    const auto elemSize = tf::DataTypeSize(tf::BaseType(n->output_type(slot)));
+    if (elemSize == 0) {
+        return 0;
+    }
+
+    tf::PartialTensorShape shape;
+    std::vector<tf::PartialTensorShape> shapes;
+    if (GetNodeAttr(n->attrs(), "_output_shapes", &shapes).ok() && static_cast<size_t>(slot) < shapes.size()) {
+        shape = shapes[slot];
+    } else if (n->num_outputs() != 1 || !GetNodeAttr(n->attrs(), "shape", &shape).ok()) {
+        return 0;
+    }
+
+    if (!shape.IsFullyDefined()) {
+        return 0;
+    }
+    return static_cast<size_t>(shape.num_elements()) * elemSize;
+}
+
+} // namespace
+
+void ExecutorLayout::EstimatePeakMemory()
+{
+    struct LiveTensor
+    {
+        size_t bytes = 0;
+        int uses = 0;
+    };
+    std::vector<tf::gtl::InlinedVector<LiveTensor, 4>> outputs(graph->num_node_ids());
+
+    std::vector<tf::Node *> order;
+    tf::GetReversePostOrder(*graph, &order);
+    std::vector<bool> visited(graph->num_node_ids(), false);
+
+    size_t live = 0;
+    size_t peak = 0;
+    size_t persist = 0;
+    size_t allocating = 0;
+    size_t known = 0;
+    for (const auto *n : order) {
+        visited[n->id()] = true;
+        const auto *item = gview.node(n->id());
+        auto &outs = outputs[n->id()];
+        outs.resize(n->num_outputs());
+
+        // Variables hold their buffer across iterations
+        if (n->IsVariable()) {
+            persist += KnownOutputBytes(n, 0);
+            continue;
+        }
+
+        for (int slot = 0; slot != n->num_outputs(); ++slot) {
+            // Ref outputs alias an existing buffer, and host memory doesn't count against the device
+            if (tf::IsRefType(n->output_type(slot)) || item->output_attrs()[slot].on_host()) {
+                continue;
+            }
+            ++allocating;
+            auto bytes = KnownOutputBytes(n, slot);
+            if (bytes == 0) {
+                continue;
+            }
+            ++known;
+            outs[slot].bytes = bytes;
+            live += bytes;
+        }
+        for (const auto *e : n->out_edges()) {
+            // Readers along loop back edges come earlier in the order, and would never release the tensor
+            if (visited[e->dst()->id()]) {
+                continue;
+            }
+            if (!e->IsControlEdge() && outs[e->src_output()].bytes) {
+                outs[e->src_output()].uses++;
+            }
+        }
+        peak = std::max(peak, live);
+
+        // Outputs nobody reads are freed right away
+        for (auto &o : outs) {
+            if (o.bytes && o.uses == 0) {
+                live -= o.bytes;
+                o.bytes = 0;
+            }
+        }
+
+        // Inputs are freed once their last reader in the order has run
+        for (const auto *e : n->in_edges()) {
+            if (e->IsControlEdge()) {
+                continue;
+            }
+            auto &srcOuts = outputs[e->src()->id()];
+            if (static_cast<size_t>(e->src_output()) >= srcOuts.size()) {
+                continue;
+            }
+            auto &o = srcOuts[e->src_output()];
+            if (o.bytes && --o.uses == 0) {
+                live -= o.bytes;
+                o.bytes = 0;
+            }
+        }
+    }
+
+    // Extrapolate over tensors of unknown size when most shapes are known,
+    // otherwise the static analysis is only a lower bound
+    constexpr double kMinShapeCoverage = 0.5;
+    const auto coverage = allocating ? static_cast<double>(known) / allocating : 1.0;
+    if (coverage >= kMinShapeCoverage) {
+        peak = static_cast<size_t>(peak / coverage);
+    }
+
+    peak_estimation.temporary = peak;
+    peak_estimation.persist = persist;
+    peak_estimation.count = allocating;
+}
+
+void ExecutorLayout::InitializePending(const ControlFlowInfo &cf_info)
 {
     for (auto &it : cf_info.unique_frame_names) {
         FrameInfo *finfo = EnsureFrameInfo(it);
@@ -1345,12 +1899,15 @@ void ExecutorImpl::InitializePending(const tf::Graph *graph, const ControlFlowIn
         const auto &name = cf_info.frame_names[id];
         size_t max_pending, max_dead;
         GetMaxPendingCounts(n, &max_pending, &max_dead);
-        const NodeItem *item = gview_.node(id);
-        auto *counts = EnsureFrameInfo(name)->pending_counts;
-        counts->set_initial_count(item->pending_id, max_pending);
+        const NodeItem *item = gview.node(id);
+        auto *finfo = EnsureFrameInfo(name);
+        finfo->pending_counts->set_initial_count(item->pending_id, max_pending);
+        finfo->initial_counts.emplace_back(item->pending_id, max_pending);
     }
 }
 
+namespace {
+
 void ExecutorState::runAsync(std::shared_ptr<IterationContext> &&ictx) noexcept
 {
     ictx_ = std::move(ictx);
@@ -1377,7 +1934,7 @@ void ExecutorState::runAsync(std::shared_ptr<IterationContext> &&ictx) noexcept
     }
 
     // Initialize the ready queue.
-    for (const auto *n : impl_->root_nodes_) {
+    for (const auto *n : impl_->layout_->root_nodes) {
         DCHECK(n->in_edges().empty());
         if (vlog_) {
             LogOpTracing() << "event: queued "
@@ -1441,6 +1998,8 @@ struct ExecutorState::AsyncState
     Entry *first_input;
     tf::OpKernelContext ctx;
     tf::NodeExecStatsWrapper *stats;
+    std::chrono::steady_clock::time_point running_since;
+    tf::int64 freed_bytes = 0;
 
 private:
     tf::OpKernelContext::Params *ParamsButClearingEigenGPUDevice(tf::OpKernelContext::Params *p)
@@ -1489,16 +2048,18 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
     bool completed = false;
     uint64_t failedTake = 0;
     auto priority = std::any_cast<TFExecutionCtxData>(impl_->params_.ins->userData()).priority;
-    inline_ready.push_back(tagged_node);
+    inline_ready.push_back(tagged_node, impl_->NodePriority(tagged_node.node->id()));
     while (!inline_ready.empty()) {
         tagged_node = inline_ready.front();
 
-        if (!SMBlocker::instance().tryTake(impl_->graph_id_, tagged_node.node->id(), priority)) {
+        // Let cheaper kernels go first among kernels of the same priority
+        const int costLevel = impl_->IsExpensive(*gview.node(tagged_node.node->id())) ? 1 : 0;
+        if (!SMBlocker::instance().tryTake(impl_->graph_id_, tagged_node.node->id(), priority, costLevel)) {
             ++failedTake;
             if (failedTake < inline_ready.size()) {
                 continue;
             } else {
-                SMBlocker::instance().wait(impl_->graph_id_, tagged_node.node->id(), priority);
+                SMBlocker::instance().wait(impl_->graph_id_, tagged_node.node->id(), priority, costLevel);
                 failedTake = 0;
             }
         }
@@ -1525,6 +2086,10 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
 
         params.track_allocations = false;
 
+        // For GPU kernels this only covers the launch and output processing, which is still what
+        // occupies this thread. Dead nodes only propagate deadness, which says nothing about their cost.
+        const auto running_since =
+            tagged_node.is_dead ? std::chrono::steady_clock::time_point{} : std::chrono::steady_clock::now();
         if (vlog_) {
             VLOG(2) << "Process node: " << id << " step " << params.step_id << " " << SummarizeNode(*node)
                     << " is dead: " << tagged_node.is_dead;
@@ -1565,10 +2130,13 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
                 }
                 MaybeMarkCompleted(input_frame, input_iter, id);
                 // Continue to process the nodes in 'inline_ready'.
-                completed = NodeDone(s, item.node, ready, nullptr, &inline_ready);
+                completed = NodeDone(s, item.node, ready, nullptr, &inline_ready, running_since);
                 continue;
             }
 
+            // Memory freed once this node clears its inputs, to compare against what it allocates
+            const tf::int64 freed_bytes = impl_->MemoryAware() ? InputBytesToFree(inputs) : 0;
+
             // Set up compute params.
             auto *op_kernel = item.kernel;
             params.op_kernel = op_kernel;
@@ -1582,6 +2150,8 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
                 DCHECK(async != nullptr);
                 launched_asynchronously = true;
                 AsyncState *state = new AsyncState(params, tagged_node, &item, first_input, nullptr);
+                state->running_since = running_since;
+                state->freed_bytes = freed_bytes;
 
                 auto done = [this, state]() {
                     SMBlocker::instance().saveCurrentThreadResults(impl_->graph_id_, state->item->node->id());
@@ -1591,6 +2161,9 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
 
                     EntryVector outputs;
                     Status s = ProcessOutputs(*state->item, &state->ctx, &outputs, nullptr);
+                    if (s.ok() && impl_->MemoryAware()) {
+                        impl_->RecordNodeNetBytes(state->item->node->id(), OutputBytes(outputs) - state->freed_bytes);
+                    }
                     if (vlog_) {
                         VLOG(2) << "Async kernel done: " << state->item->node->id() << " step " << step_id_
                                 << " " << SummarizeNode(*state->item->node)
@@ -1617,7 +2190,8 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
                         // callee takes ownership of the vector
                         device->ConsumeListOfAccessedTensors(state->ctx.op_device_context(), accessed);
                     }
-                    const bool completed = NodeDone(s, state->item->node, ready, nullptr, nullptr);
+                    const bool completed =
+                        NodeDone(s, state->item->node, ready, nullptr, nullptr, state->running_since);
                     delete state;
                     if (completed)
                         Finish();
@@ -1632,6 +2206,9 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
                 SMBlocker::instance().saveCurrentThreadResults(impl_->graph_id_, item.node->id());
 
                 s = ProcessOutputs(item, &ctx, &outputs, nullptr);
+                if (s.ok() && impl_->MemoryAware()) {
+                    impl_->RecordNodeNetBytes(id, OutputBytes(outputs) - freed_bytes);
+                }
                 if (s.ok() && impl_->device_record_tensor_accesses_) {
                     // Get the list of all tensors accessed during the execution
                     ctx.retrieve_accessed_tensors(&accessed_tensors);
@@ -1662,7 +2239,7 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
                 device->ConsumeListOfAccessedTensors(device_context, accessed_tensors);
             }
             // Postprocess.
-            completed = NodeDone(s, item.node, ready, nullptr, &inline_ready);
+            completed = NodeDone(s, item.node, ready, nullptr, &inline_ready, running_since);
         }
     } // while !inline_ready.empty()
 
@@ -1671,6 +2248,28 @@ void ExecutorState::Process(TaggedNode tagged_node, tf::int64)
         Finish();
 }
 
+tf::int64 ExecutorState::InputBytesToFree(const TensorValueVec &inputs)
+{
+    tf::int64 bytes = 0;
+    for (const auto &input : inputs) {
+        if (!input.is_ref() && input.tensor && input.tensor->RefCountIsOne()) {
+            bytes += input.tensor->TotalBytes();
+        }
+    }
+    return bytes;
+}
+
+tf::int64 ExecutorState::OutputBytes(const EntryVector &outputs)
+{
+    tf::int64 bytes = 0;
+    for (const auto &output : outputs) {
+        if (output.has_value && !output.ref && output.val_field_is_set) {
+            bytes += output.val->TotalBytes();
+        }
+    }
+    return bytes;
+}
+
 Status ExecutorState::PrepareInputs(const NodeItem &item, Entry *first_input, TensorValueVec *inputs,
                                     DeviceContextVec *input_device_contexts,
                                     AllocatorAttributeVec *input_alloc_attrs, bool *is_input_dead)
@@ -1966,8 +2565,13 @@ void ExecutorState::PropagateOutputs(const TaggedNode &tagged_node, const NodeIt
 }
 
 bool ExecutorState::NodeDone(const Status &s, const tf::Node *node, const TaggedNodeSeq &ready,
-                             tf::NodeExecStatsWrapper *, TaggedNodeReadyQueue *inline_ready)
+                             tf::NodeExecStatsWrapper *, TaggedNodeReadyQueue *inline_ready,
+                             std::chrono::steady_clock::time_point running_since)
 {
+    if (s.ok() && running_since != std::chrono::steady_clock::time_point{}) {
+        impl_->RecordNodeCost(node->id(), running_since);
+    }
+
     VLOG(2) << "NodeDone: " << node->id() << " step " << step_id_ << " " << SummarizeNode(*node);
     if (VLOG_IS_ON(1)) {
         for (auto &tn : ready) {
@@ -2028,34 +2632,58 @@ void ExecutorState::ScheduleReady(const TaggedNodeSeq &ready, TaggedNodeReadyQue
     if (ready.empty())
         return;
 
+    // Start nodes on the longest remaining path first. Ranks may be updated concurrently,
+    // so take a snapshot to sort on. Ties keep the order of ready, without the temporary buffer
+    // of stable_sort.
+    struct OrderedNode
+    {
+        ReadyPriority priority;
+        size_t index;
+        const TaggedNode *node;
+    };
+    tf::gtl::InlinedVector<OrderedNode, 8> ordered;
+    ordered.reserve(ready.size());
+    for (size_t i = 0; i != ready.size(); ++i) {
+        ordered.push_back({impl_->NodePriority(ready[i].node->id()), i, &ready[i]});
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const auto &lhs, const auto &rhs) {
+        if (lhs.priority.RunsBefore(rhs.priority)) {
+            return true;
+        }
+        return !rhs.priority.RunsBefore(lhs.priority) && lhs.index < rhs.index;
+    });
+
     tf::int64 scheduled_usec = 0;
     if (inline_ready == nullptr) {
         // Schedule to run all the ready ops in thread pool.
-        for (auto &tagged_node : ready) {
-            runner_([=]() { Process(tagged_node, scheduled_usec); });
+        for (const auto &o : ordered) {
+            runner_([=, tagged_node = *o.node]() { Process(tagged_node, scheduled_usec); });
         }
         return;
     }
     const GraphView &gview = impl_->gview_;
     const TaggedNode *curr_expensive_node = nullptr;
-    for (auto &tagged_node : ready) {
-        const NodeItem &item = *gview.node(tagged_node.node->id());
-        if (tagged_node.is_dead || !item.kernel_is_expensive) {
+    ReadyPriority curr_expensive_priority{};
+    for (const auto &o : ordered) {
+        const auto *tagged_node = o.node;
+        const NodeItem &item = *gview.node(tagged_node->node->id());
+        if (tagged_node->is_dead || !impl_->IsExpensive(item)) {
             // Inline this inexpensive node.
-            inline_ready->push_back(tagged_node);
+            inline_ready->push_back(*tagged_node, o.priority);
         } else {
             if (curr_expensive_node) {
                 // Dispatch to another thread since there is plenty of work to
                 // do for this thread.
                 runner_(std::bind(&ExecutorState::Process, this, *curr_expensive_node, scheduled_usec));
             }
-            curr_expensive_node = &tagged_node;
+            curr_expensive_node = tagged_node;
+            curr_expensive_priority = o.priority;
         }
     }
     if (curr_expensive_node) {
         if (inline_ready->empty()) {
             // Tail recursion optimization
-            inline_ready->push_back(*curr_expensive_node);
+            inline_ready->push_back(*curr_expensive_node, curr_expensive_priority);
         } else {
             // There are inline nodes to run already. We dispatch this expensive
             // node to other thread.
@@ -2103,7 +2731,13 @@ void ExecutorState::Finish()
         ictx_->finish();
     }
 
-    delete this;
+    impl_->MaybeUpdateRanks();
+
+    if (Cleanup()) {
+        impl_->RecycleState(this);
+    } else {
+        delete this;
+    }
     CHECK(done_cb != nullptr);
     runner([=]() {
         done_cb(status);
@@ -2136,17 +2770,20 @@ void ExecutorState::FindOrCreateChildFrame(FrameState *frame, tf::int64 iter, co
     int parallel_iters;
     s = GetNodeAttr(node->attrs(), "parallel_iterations", &parallel_iters);
     DCHECK(s.ok()) << s;
-    FrameState *temp = new FrameState(impl_, parallel_iters);
-    temp->frame_name = child_name;
-    temp->frame_id = tf::Hash64(child_name);
-    temp->parent_frame = frame;
-    temp->parent_iter = iter;
-    temp->InitializeFrameInfo(enter_name);
-
-    // 'iterations' is a fixed-length circular buffer.
-    temp->iterations.resize(temp->max_parallel_iterations + 1);
-    // Initialize iteration 0.
-    temp->iterations[0] = new IterationState(temp->pending_counts, temp->total_input_tensors);
+    const auto *finfo = impl_->FindFrameInfo(enter_name);
+    FrameState *temp = nullptr;
+    {
+        tf::mutex_lock executor_lock(mu_);
+        auto &frees = free_frames_[finfo];
+        if (!frees.empty()) {
+            temp = frees.back();
+            frees.pop_back();
+        }
+    }
+    if (!temp) {
+        temp = new FrameState(impl_, finfo);
+    }
+    temp->Start(child_name, frame, iter, parallel_iters, parallel_iters + 1);
 
     {
         tf::mutex_lock executor_lock(mu_);
@@ -2160,8 +2797,11 @@ void ExecutorState::FindOrCreateChildFrame(FrameState *frame, tf::int64 iter, co
             *child = temp;
             temp = nullptr;
         }
+        if (temp) {
+            // Not used so keep it for later.
+            free_frames_[finfo].push_back(temp);
+        }
     }
-    delete temp; // Not used so delete it.
 }
 
 void ExecutorState::DeleteFrame(FrameState *frame, TaggedNodeSeq *ready)
@@ -2218,11 +2858,12 @@ void ExecutorState::DeleteFrame(FrameState *frame, TaggedNodeSeq *ready)
     const auto &frame_name = frame->frame_name;
     if (vlog_)
         VLOG(2) << "Delete frame " << frame_name;
+    frame->Clear();
     {
         tf::mutex_lock executor_lock(mu_);
         outstanding_frames_.erase(frame_name);
+        free_frames_[frame->frame_info].push_back(frame);
     }
-    delete frame;
 }
 
 void ExecutorState::CleanupFramesIterations(FrameState *frame, tf::int64 iter, TaggedNodeSeq *ready)
@@ -2398,7 +3039,7 @@ void ExecutorState::FrameState::IncrementIteration(const GraphView *gview, Tagge
     const tf::int64 next_iter = iteration_count;
 
     // Initialize the next iteration.
-    IterationState *iter_state = new IterationState(pending_counts, total_input_tensors);
+    IterationState *iter_state = NewIteration();
     SetIteration(next_iter, iter_state);
     num_outstanding_iterations++;
     dead_exits.clear();
@@ -2416,7 +3057,7 @@ bool ExecutorState::FrameState::CleanupIterations(const GraphView *gview, tf::in
     tf::int64 curr_iter = iter;
     while (curr_iter <= iteration_count && IsIterationDone(curr_iter)) {
         // Delete the iteration curr_iter.
-        delete GetIteration(curr_iter);
+        RecycleIteration(GetIteration(curr_iter));
         SetIteration(curr_iter, nullptr);
         --num_outstanding_iterations;
         ++curr_iter;
@@ -2441,7 +3082,7 @@ public:
     TFExecutorTask(ExecutorImpl &impl, const tf::Executor::Args &args, tf::Executor::DoneCallback done)
         : m_impl(impl)
         , m_cm(*args.cancellation_manager)
-        , m_state(std::make_unique<ExecutorState>(args, &impl, std::move(done)))
+        , m_state(impl.AcquireState(args, std::move(done)))
     {
     }
 
@@ -2457,12 +3098,31 @@ public:
         }
 
         auto &ectx = m_impl.params_.ins;
-        return ectx->m_item->beginIteration(ectx->m_ticket, {}, graphId());
+        // Only memory on the tracked device is reserved per iteration
+        const auto spec = tfDeviceNameToSpec(m_impl.params_.device->name());
+        if (spec != SessionItem::trackerTag.device) {
+            return ectx->m_item->beginIteration(ectx->m_ticket, {}, graphId());
+        }
+
+        auto est = estimatedPeakAllocation(spec);
+        // The static estimation may overshoot, but can't be more than the lanes we run on
+        size_t laneMemory = 0;
+        const auto data = std::any_cast<TFExecutionCtxData>(ectx->userData());
+        for (const auto &lane : data.lanes) {
+            laneMemory += lane->totalMemory();
+        }
+        if (laneMemory > 0) {
+            est.temporary = std::min(est.temporary, laneMemory);
+        }
+        return ectx->m_item->beginIteration(ectx->m_ticket, est, graphId());
     }
 
-    ResStats estimatedPeakAllocation(const DeviceSpec &) const override
+    ResStats estimatedPeakAllocation(const DeviceSpec &dev) const override
     {
-        return {};
+        if (tfDeviceNameToSpec(m_impl.params_.device->name()) != dev) {
+            return {};
+        }
+        return m_impl.layout_->peak_estimation;
     }
 
     void runAsync(std::shared_ptr<IterationContext> &&ictx) noexcept override
@@ -2487,6 +3147,44 @@ public:
     }
 };
 
+std::unique_ptr<ExecutorState> ExecutorImpl::AcquireState(const Args &args, DoneCallback done)
+{
+    std::unique_ptr<ExecutorState> state;
+    {
+        tf::mutex_lock l(idle_states_mu_);
+        if (!idle_states_.empty()) {
+            state.reset(idle_states_.back());
+            idle_states_.pop_back();
+        }
+    }
+    if (!state) {
+        state = std::make_unique<ExecutorState>(this);
+    }
+    state->Reset(args, std::move(done));
+    return state;
+}
+
+void ExecutorImpl::RecycleState(ExecutorState *state) const
+{
+    {
+        tf::mutex_lock l(idle_states_mu_);
+        if (idle_states_.size() < kMaxIdleStates) {
+            idle_states_.push_back(state);
+            return;
+        }
+    }
+    delete state;
+}
+
+void ExecutorImpl::DeleteIdleStates()
+{
+    tf::mutex_lock l(idle_states_mu_);
+    for (auto state : idle_states_) {
+        delete state;
+    }
+    idle_states_.clear();
+}
+
 void ExecutorImpl::RunAsync(const Args &args, DoneCallback done)
 {
     params_.ins->scheduleIteartion(std::make_unique<TFExecutorTask>(*this, args, std::move(done)));
@@ -2494,12 +3192,15 @@ void ExecutorImpl::RunAsync(const Args &args, DoneCallback done)
 
 } // end namespace
 
-Status NewTFExecutor(TFExecutorParams params, std::unique_ptr<const tf::Graph> &&graph,
-                     tf::Executor **executor)
+Status NewTFExecutor(TFExecutorParams params, std::shared_ptr<const tf::Graph> graph, tf::Executor **executor,
+                     std::shared_ptr<const ExecutorLayout> *layout)
 {
     auto *impl = new ExecutorImpl(params, std::move(graph));
-    const Status s = impl->Initialize();
+    const Status s = impl->Initialize(layout ? *layout : nullptr);
     if (s.ok()) {
+        if (layout) {
+            *layout = impl->layout();
+        }
         *executor = impl;
     } else {
         delete impl;
@@ -48,8 +48,16 @@ struct TFExecutorParams
     tf::Executor::Args::NodeOutputsCallback node_outputs_cb;
 };
 
-Status NewTFExecutor(TFExecutorParams params, std::unique_ptr<const tf::Graph> &&graph,
-                     tf::Executor **executor);
+class ExecutorLayout;
+
+/**
+ * @brief Create an executor for graph.
+ *
+ * If layout points to a non-null layout, which must have been produced for the same graph,
+ * only kernels are created. Otherwise, the newly built layout is stored into it, if given.
+ */
+Status NewTFExecutor(TFExecutorParams params, std::shared_ptr<const tf::Graph> graph, tf::Executor **executor,
+                     std::shared_ptr<const ExecutorLayout> *layout = nullptr);
 Status CreateNonCachedKernel(tf::Device* device, tf::FunctionLibraryRuntime* flib,
                              const tf::NodeDef& ndef, int graph_def_version,
                              tf::OpKernel** kernel);
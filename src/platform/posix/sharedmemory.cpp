@@ -0,0 +1,127 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "platform/sharedmemory.h"
+
+#include "platform/logging.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace salus::ipc {
+
+namespace {
+
+std::string shmPath(const std::string &name)
+{
+    return "/" + name;
+}
+
+} // namespace
+
+void *mapShared(const std::string &name, size_t size, bool create)
+{
+    auto path = shmPath(name);
+    auto fd = shm_open(path.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) {
+        auto err = errno;
+        // Let the caller decide whether the existing one can be replaced
+        if (!(create && err == EEXIST)) {
+            LOG(ERROR) << "Failed to open shared memory " << path << ": " << std::strerror(err);
+        }
+        errno = err;
+        return nullptr;
+    }
+    // Sparse, pages are only backed once touched
+    if (create && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        LOG(ERROR) << "Failed to size shared memory " << path << ": " << std::strerror(errno);
+        close(fd);
+        shm_unlink(path.c_str());
+        return nullptr;
+    }
+    auto addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG(ERROR) << "Failed to map shared memory " << path << ": " << std::strerror(errno);
+        return nullptr;
+    }
+    return addr;
+}
+
+void unmapShared(void *addr, size_t size)
+{
+    munmap(addr, size);
+}
+
+void unlinkShared(const std::string &name)
+{
+    shm_unlink(shmPath(name).c_str());
+}
+
+void futexWait(std::atomic<uint32_t> *addr, uint32_t expected, std::chrono::microseconds timeout)
+{
+#if defined(__linux__)
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32bit word");
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    timespec ts{};
+    ts.tv_sec = secs.count();
+    ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - secs).count();
+    // Not FUTEX_PRIVATE_FLAG, the word is shared with other processes
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+    // No cross process futex, fall back to polling
+    auto until = std::chrono::steady_clock::now() + timeout;
+    while (addr->load() == expected && std::chrono::steady_clock::now() < until) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+#endif
+}
+
+void futexWake(std::atomic<uint32_t> *addr)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    (void) addr;
+#endif
+}
+
+int currentPid()
+{
+    return static_cast<int>(getpid());
+}
+
+bool processAlive(int pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+} // namespace salus::ipc
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "platform/topology.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <thread>
+
+namespace salus::threading {
+
+namespace {
+
+CpuSet allowedCpus()
+{
+    CpuSet cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i != CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &set)) {
+                cpus.push_back(i);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        auto n = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int i = 0; i != n; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+bool readFile(const std::string &path, std::string &content)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        return false;
+    }
+    std::getline(ifs, content);
+    return true;
+}
+
+} // namespace
+
+CpuSet parse_cpu_list(std::string_view list)
+{
+    CpuSet cpus;
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto range = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+        // trim whitespace, sysfs files end with a newline
+        while (!range.empty() && std::isspace(static_cast<unsigned char>(range.back()))) {
+            range.remove_suffix(1);
+        }
+        if (range.empty()) {
+            continue;
+        }
+
+        std::string str(range);
+        char *end = nullptr;
+        auto first = std::strtol(str.c_str(), &end, 10);
+        auto last = first;
+        if (*end == '-') {
+            last = std::strtol(end + 1, &end, 10);
+        }
+        if (*end != '\0' || first < 0 || last < first) {
+            return {};
+        }
+        for (auto i = first; i <= last; ++i) {
+            cpus.push_back(static_cast<int>(i));
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+size_t CpuTopology::numCpus() const
+{
+    size_t n = 0;
+    for (const auto &node : nodes) {
+        n += node.size();
+    }
+    return n;
+}
+
+int CpuTopology::nodeOf(int cpu) const
+{
+    for (size_t i = 0; i != nodes.size(); ++i) {
+        if (std::binary_search(nodes[i].begin(), nodes[i].end(), cpu)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+CpuTopology CpuTopology::restrictedTo(const CpuSet &cpus) const
+{
+    auto sorted = cpus;
+    std::sort(sorted.begin(), sorted.end());
+
+    CpuTopology topo;
+    for (size_t i = 0; i != nodes.size(); ++i) {
+        CpuSet set;
+        std::set_intersection(nodes[i].begin(), nodes[i].end(), sorted.begin(), sorted.end(),
+                              std::back_inserter(set));
+        if (!set.empty()) {
+            topo.nodes.emplace_back(std::move(set));
+            topo.nodeIds.push_back(nodeIds[i]);
+        }
+    }
+    return topo;
+}
+
+/*static*/ CpuTopology CpuTopology::fromSysfs(const std::string &sysfsRoot)
+{
+    auto allowed = allowedCpus();
+
+    // node id -> cpus, ordered by id
+    std::map<int, CpuSet> found;
+    auto nodeDir = sysfsRoot + "/devices/system/node";
+    if (auto dir = opendir(nodeDir.c_str())) {
+        while (auto entry = readdir(dir)) {
+            std::string_view name(entry->d_name);
+            if (name.substr(0, 4) != "node" || name.size() == 4
+                || !std::all_of(name.begin() + 4, name.end(), [](char c) { return std::isdigit(c); })) {
+                continue;
+            }
+            std::string content;
+            if (readFile(nodeDir + "/" + std::string(name) + "/cpulist", content)) {
+                found[std::atoi(name.data() + 4)] = parse_cpu_list(content);
+            }
+        }
+        closedir(dir);
+    }
+
+    CpuTopology topo;
+    for (auto &[id, cpus] : found) {
+        topo.nodes.emplace_back(std::move(cpus));
+        topo.nodeIds.push_back(id);
+    }
+    topo = topo.restrictedTo(allowed);
+
+    if (topo.nodes.empty()) {
+        topo.nodes.emplace_back(std::move(allowed));
+        topo.nodeIds.push_back(0);
+    }
+    return topo;
+}
+
+/*static*/ const CpuTopology &CpuTopology::system()
+{
+    static const auto topo = fromSysfs();
+    return topo;
+}
+
+bool set_thread_affinity(const CpuSet &cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) == 0) {
+        return false;
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+int current_cpu()
+{
+#if defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+} // namespace salus::threading
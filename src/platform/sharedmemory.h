@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_PLATFORM_SHAREDMEMORY_H
+#define SALUS_PLATFORM_SHAREDMEMORY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace salus::ipc {
+
+/**
+ * @brief Map a named shared memory region of size bytes, visible to other processes on this host.
+ * If create is true, a new zero filled region is created, failing if one of the same name exists.
+ * @returns the mapped address, or nullptr on failure, in which case errno is EEXIST if create is true
+ * and the region already exists
+ */
+void *mapShared(const std::string &name, size_t size, bool create);
+
+void unmapShared(void *addr, size_t size);
+
+/**
+ * @brief Remove the name, the region itself stays until all mappings are gone
+ */
+void unlinkShared(const std::string &name);
+
+/**
+ * @brief Block while *addr still equals expected, for at most timeout. May return spuriously.
+ * addr may be in shared memory and woken from another process.
+ */
+void futexWait(std::atomic<uint32_t> *addr, uint32_t expected, std::chrono::microseconds timeout);
+
+/**
+ * @brief Wake all waiters blocked in futexWait on addr
+ */
+void futexWake(std::atomic<uint32_t> *addr);
+
+int currentPid();
+
+bool processAlive(int pid);
+
+} // namespace salus::ipc
+
+#endif // SALUS_PLATFORM_SHAREDMEMORY_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_PLATFORM_TOPOLOGY_H
+#define SALUS_PLATFORM_TOPOLOGY_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace salus::threading {
+
+using CpuSet = std::vector<int>;
+
+/**
+ * @brief Parse a cpu list in the format used by Linux, e.g. "0-3,8,10-11".
+ * @returns sorted CPU ids, or empty if `list` is malformed.
+ */
+CpuSet parse_cpu_list(std::string_view list);
+
+/**
+ * @brief NUMA nodes of this machine, and the CPUs on each that this process is allowed to run on.
+ */
+struct CpuTopology
+{
+    /**
+     * @brief CPUs of each node. Nodes without any allowed CPU are left out.
+     */
+    std::vector<CpuSet> nodes;
+    /**
+     * @brief Node id as reported by the OS, for each entry in nodes
+     */
+    std::vector<int> nodeIds;
+
+    size_t numCpus() const;
+
+    /**
+     * @returns index into nodes, or -1 if cpu isn't on any of them.
+     */
+    int nodeOf(int cpu) const;
+
+    /**
+     * @brief Keep only CPUs in `cpus`, dropping nodes that become empty.
+     */
+    CpuTopology restrictedTo(const CpuSet &cpus) const;
+
+    /**
+     * @brief Read topology from `<sysfsRoot>/devices/system/node`. Falls back to a single node
+     * with all allowed CPUs if NUMA information isn't available.
+     */
+    static CpuTopology fromSysfs(const std::string &sysfsRoot = "/sys");
+
+    /**
+     * @brief Topology of this machine, read once.
+     */
+    static const CpuTopology &system();
+};
+
+/**
+ * @brief Restrict the calling thread to `cpus`.
+ * @returns false if not supported or the OS refused.
+ */
+bool set_thread_affinity(const CpuSet &cpus);
+
+/**
+ * @returns the CPU the calling thread is running on, or -1 if unknown.
+ */
+int current_cpu();
+
+} // namespace salus::threading
+
+#endif // SALUS_PLATFORM_TOPOLOGY_H
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "platform/sharedmemory.h"
+
+#include "platform/logging.h"
+
+#include <thread>
+
+namespace salus::ipc {
+
+void *mapShared(const std::string &name, size_t, bool)
+{
+    LOG(ERROR) << "Shared memory transport not available on windows: " << name;
+    return nullptr;
+}
+
+void unmapShared(void *, size_t)
+{
+}
+
+void unlinkShared(const std::string &)
+{
+}
+
+void futexWait(std::atomic<uint32_t> *addr, uint32_t expected, std::chrono::microseconds timeout)
+{
+    if (addr->load() == expected) {
+        std::this_thread::sleep_for(timeout);
+    }
+}
+
+void futexWake(std::atomic<uint32_t> *)
+{
+}
+
+int currentPid()
+{
+    return 0;
+}
+
+bool processAlive(int)
+{
+    return false;
+}
+
+} // namespace salus::ipc
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "platform/topology.h"
+
+#include <algorithm>
+#include <thread>
+
+// NUMA placement isn't supported on Windows, everything is reported as a single node.
+namespace salus::threading {
+
+CpuSet parse_cpu_list(std::string_view)
+{
+    return {};
+}
+
+size_t CpuTopology::numCpus() const
+{
+    return nodes.empty() ? 0 : nodes[0].size();
+}
+
+int CpuTopology::nodeOf(int cpu) const
+{
+    return !nodes.empty() && std::binary_search(nodes[0].begin(), nodes[0].end(), cpu) ? 0 : -1;
+}
+
+CpuTopology CpuTopology::restrictedTo(const CpuSet &) const
+{
+    return *this;
+}
+
+/*static*/ CpuTopology CpuTopology::fromSysfs(const std::string &)
+{
+    CpuTopology topo;
+    topo.nodes.emplace_back();
+    topo.nodeIds.push_back(0);
+    for (unsigned i = 0; i != std::max(1u, std::thread::hardware_concurrency()); ++i) {
+        topo.nodes[0].push_back(static_cast<int>(i));
+    }
+    return topo;
+}
+
+/*static*/ const CpuTopology &CpuTopology::system()
+{
+    static const auto topo = fromSysfs();
+    return topo;
+}
+
+bool set_thread_affinity(const CpuSet &)
+{
+    return false;
+}
+
+int current_cpu()
+{
+    return -1;
+}
+
+} // namespace salus::threading
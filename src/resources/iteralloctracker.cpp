@@ -21,6 +21,8 @@
 #include "utils/date.h"
 #include "platform/logging.h"
 
+#include <cmath>
+
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 using std::chrono::milliseconds;
@@ -33,13 +35,33 @@ using namespace date;
 
 namespace salus {
 
-IterAllocTracker::IterAllocTracker(const ResourceTag &tag, size_t window, double peakthr)
+IterAllocTracker::IterAllocTracker(const ResourceTag &tag, size_t window, double peakthr, double confidence)
     : m_tag(tag)
     , m_peakthr(peakthr)
     , m_window(window)
+    , m_confidence(confidence)
 {
 }
 
+ResStats IterAllocTracker::calibrate(const ResStats &estimation) const
+{
+    if (m_numSamples == 0) {
+        return estimation;
+    }
+
+    auto est = m_est;
+    est.persist = estimation.persist;
+    if (m_numSamples == 1) {
+        // A single sample tells nothing about the spread
+        est.temporary = std::max<size_t>(m_tempMax, estimation.temporary);
+        return est;
+    }
+
+    auto stddev = std::sqrt(m_tempM2 / (m_numSamples - 1));
+    est.temporary = static_cast<size_t>(m_tempMean + m_confidence * stddev);
+    return est;
+}
+
 bool IterAllocTracker::beginIter(AllocationRegulator::Ticket ticket, ResStats estimation, uint64_t currentUsage)
 {
     if (m_holding) {
@@ -47,9 +69,7 @@ bool IterAllocTracker::beginIter(AllocationRegulator::Ticket ticket, ResStats es
     }
 
     m_ticket = ticket;
-    if (m_numIters == 0) {
-        m_est = estimation;
-    }
+    m_est = calibrate(estimation);
 
     VLOG(3) << "IterAllocTracker@" << as_hex(this) << "::beginIter ticket=" << m_ticket.as_int
             << ", estimation=" << m_est.DebugString() << ", numIter=" << m_numIters;
@@ -70,11 +90,19 @@ bool IterAllocTracker::beginIter(AllocationRegulator::Ticket ticket, ResStats es
         m_buf.set_capacity(m_window);
     }
 
-    // reserve res
+    // reserve res, never more than the regulator could ever grant, or the session would starve
+    m_est.temporary = std::min<size_t>(m_est.temporary, m_ticket.capacity(m_tag));
     Resources cap;
     cap[m_tag] = m_est.temporary;
     VLOG(3) << "IterAllocTracker@" << as_hex(this) << " reserve: " << cap;
     m_holding = m_ticket.beginAllocation(cap);
+    if (!m_holding && m_est.temporary > m_tempMax) {
+        // The estimation is above anything actually seen, fall back to the observed max
+        m_est.temporary = m_tempMax;
+        cap[m_tag] = m_est.temporary;
+        VLOG(3) << "IterAllocTracker@" << as_hex(this) << " reserve observed max: " << cap;
+        m_holding = m_ticket.beginAllocation(cap);
+    }
     if (m_holding) {
         ++m_numIters;
     } else {
@@ -154,12 +182,14 @@ void IterAllocTracker::endIter()
     // first release hold, because we'll be modifying m_est
     releaseAllocationHold();
 
-    // update our estimation using running average
-
-    // persist usage
+    // update our estimation, keeping the variance of temporary usage for the confidence bound
     if (m_currPeak > m_currPersist) {
         auto newTemporary = m_currPeak - m_currPersist;
-        m_est.temporary = runningAvg(m_est.temporary, newTemporary, m_numIters);
+        ++m_numSamples;
+        auto delta = newTemporary - m_tempMean;
+        m_tempMean += delta / m_numSamples;
+        m_tempM2 += delta * (newTemporary - m_tempMean);
+        m_tempMax = std::max(m_tempMax, newTemporary);
     }
     m_est.count = runningAvg(m_est.count, m_count, m_numIters);
 }
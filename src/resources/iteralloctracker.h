@@ -32,10 +32,16 @@ class IterAllocTracker
     ResourceTag m_tag;
     double m_peakthr;
     size_t m_window;
+    double m_confidence;
 
     // cross iter state
     int m_numIters = 0;
     ResStats m_est{};
+    // learned temporary usage of past iterations
+    int m_numSamples = 0;
+    double m_tempMean = 0;
+    double m_tempM2 = 0;
+    uint64_t m_tempMax = 0;
     // in iter state
     bool m_holding = false;
     uint64_t m_currPersist = 0;
@@ -46,9 +52,18 @@ class IterAllocTracker
     boost::circular_buffer<std::pair<long, size_t>> m_buf;
 
     void releaseAllocationHold();
+    ResStats calibrate(const ResStats &estimation) const;
 public:
-    IterAllocTracker(const ResourceTag &tag, size_t window = 0, double peakthr = 0.9);
+    /**
+     * @param confidence number of standard deviations above the mean temporary usage of past
+     * iterations to reserve for a new iteration
+     */
+    IterAllocTracker(const ResourceTag &tag, size_t window = 0, double peakthr = 0.9, double confidence = 2.0);
 
+    /**
+     * @brief Try to reserve resources for a new iteration.
+     * @param estimation static estimation of the iteration, used until enough iterations are seen
+     */
     bool beginIter(AllocationRegulator::Ticket ticket, ResStats estimation, uint64_t currentUsage);
     bool update(size_t num);
     void endIter();
@@ -27,6 +27,7 @@
 #include <algorithm>
 #include <functional>
 #include <sstream>
+#include <stdexcept>
 #include <tuple>
 #include <optional>
 
@@ -105,118 +106,151 @@ std::string ResourceMonitor::DebugString() const
     std::ostringstream oss;
     oss << "ResourceMonitor: dumping available resources" << std::endl;
 
-    auto g = sstl::with_guard(m_mu);
-
     oss << "    Available:" << std::endl;
-    oss << resources::DebugString(m_limits, "        ");
-
-    oss << "    Staging " << m_staging.size() << " tickets, in total:" << std::endl;
-    Resources total;
-    for (auto p : m_staging) {
-        resources::merge(total, p.second);
+    Resources avail;
+    for (auto rest = m_knownTags; rest; rest &= rest - 1) {
+        auto slot = static_cast<size_t>(__builtin_ctz(rest));
+        avail[ResourceVector::tagOf(slot)] = m_shards[slot].avail.load(std::memory_order_relaxed);
     }
-    oss << resources::DebugString(total, "       ");
-
-    oss << "    In use " << m_using.size() << " tickets, in total:" << std::endl;
-    total.clear();
-    for (auto p : m_using) {
-        resources::merge(total, p.second);
+    oss << resources::DebugString(avail, "        ");
+
+    // Stripes are visited one by one, so the totals are not an atomic snapshot.
+    size_t numStaging = 0;
+    size_t numUsing = 0;
+    Resources totalStaging;
+    Resources totalUsing;
+    for (const auto &stripe : m_stripes) {
+        auto g = sstl::with_guard(stripe.mu);
+        numStaging += stripe.staging.size();
+        for (const auto &p : stripe.staging) {
+            resources::merge(totalStaging, p.second);
+        }
+        numUsing += stripe.inuse.size();
+        for (const auto &p : stripe.inuse) {
+            resources::merge(totalUsing, p.second);
+        }
     }
-    oss << resources::DebugString(total, "       ");
+
+    oss << "    Staging " << numStaging << " tickets, in total:" << std::endl;
+    oss << resources::DebugString(totalStaging, "       ");
+
+    oss << "    In use " << numUsing << " tickets, in total:" << std::endl;
+    oss << resources::DebugString(totalUsing, "       ");
 
     return oss.str();
 }
 
+/*static*/ void ResourceVector::invalidTag(const ResourceTag &tag)
+{
+    throw std::out_of_range("Resource tag out of range for ResourceVector: " + tag.DebugString());
+}
+
 namespace resources {
-bool contains(const Resources &avail, const Resources &req)
+namespace {
+constexpr auto kNumSlots = ResourceVector::kNumSlots;
+
+/**
+ * @brief Mask with a bit set for every slot that is non-zero
+ */
+ResourceVector::Mask nonZeroMask(const size_t *vals)
 {
-    auto aend = avail.end();
+    ResourceVector::Mask mask = 0;
+    for (size_t i = 0; i != kNumSlots; ++i) {
+        mask |= static_cast<ResourceVector::Mask>(vals[i] != 0) << i;
+    }
+    return mask;
+}
 
-    ResourceTag tag{};
-    size_t val;
-    for (auto p : req) {
-        std::tie(tag, val) = p;
-        auto it = avail.find(tag);
-        if (it == aend && val != 0) {
-            return false;
-        }
-        if (it == aend) {
-            continue;
-        }
-        if (val > it->second) {
-            return false;
-        }
+/**
+ * @brief Expand bit i of mask to an all-one or all-zero word
+ */
+constexpr size_t laneMask(ResourceVector::Mask mask, size_t i)
+{
+    return size_t{0} - ((mask >> i) & 1u);
+}
+} // namespace
+
+bool contains(const Resources &avail, const Resources &req)
+{
+    // Absent slots hold 0, so a missing tag in avail fails iff the request is non-zero
+    const auto *a = avail.data();
+    const auto *r = req.data();
+    bool exceeds = false;
+    for (size_t i = 0; i != kNumSlots; ++i) {
+        exceeds |= r[i] > a[i];
     }
-    return true;
+    return !exceeds;
 }
 
 bool compatible(const Resources &lhs, const Resources &rhs)
 {
-    for (auto p : rhs) {
-        if (lhs.count(p.first) == 0) {
-            return false;
-        }
-    }
-    return true;
+    return (rhs.presentMask() & ~lhs.presentMask()) == 0;
 }
 
 Resources &merge(Resources &lhs, const Resources &rhs, bool skipNonExist)
 {
-    for (auto p : rhs) {
-        if (lhs.count(p.first) == 0 && skipNonExist) {
-            continue;
+    auto *l = lhs.data();
+    const auto *r = rhs.data();
+    if (skipNonExist) {
+        const auto mask = lhs.presentMask();
+        for (size_t i = 0; i != kNumSlots; ++i) {
+            l[i] += r[i] & laneMask(mask, i);
+        }
+    } else {
+        for (size_t i = 0; i != kNumSlots; ++i) {
+            l[i] += r[i];
         }
-        lhs[p.first] += p.second;
+        lhs.presentMask() |= rhs.presentMask();
     }
     return lhs;
 }
 
 Resources &subtract(Resources &lhs, const Resources &rhs, bool skipNonExist)
 {
-    for (auto p : rhs) {
-        if (lhs.count(p.first) == 0 && skipNonExist) {
-            continue;
+    auto *l = lhs.data();
+    const auto *r = rhs.data();
+    if (skipNonExist) {
+        const auto mask = lhs.presentMask();
+        for (size_t i = 0; i != kNumSlots; ++i) {
+            l[i] -= r[i] & laneMask(mask, i);
+        }
+    } else {
+        for (size_t i = 0; i != kNumSlots; ++i) {
+            l[i] -= r[i];
         }
-        lhs[p.first] -= p.second;
+        lhs.presentMask() |= rhs.presentMask();
     }
     return lhs;
 }
 
 Resources subtractBounded(Resources &lhs, const Resources &rhs)
 {
-    const auto lend = lhs.end();
+    // Absent slots hold 0, so min() is 0 for anything not in both
     Resources res;
-    for (auto [tag, val] : rhs) {
-        auto it = lhs.find(tag);
-        if (it == lend) {
-            continue;
-        }
-        auto v = std::min(val, it->second);
-        it->second -= v;
-        res[tag] = v;
+    auto *l = lhs.data();
+    const auto *r = rhs.data();
+    auto *out = res.data();
+    for (size_t i = 0; i != kNumSlots; ++i) {
+        auto v = std::min(l[i], r[i]);
+        l[i] -= v;
+        out[i] = v;
     }
+    res.presentMask() = lhs.presentMask() & rhs.presentMask();
     return res;
 }
 
 Resources &scale(Resources &lhs, double scale)
 {
-    for (auto &p : lhs) {
-        p.second *= scale;
+    auto *l = lhs.data();
+    for (size_t i = 0; i != kNumSlots; ++i) {
+        l[i] = static_cast<size_t>(l[i] * scale);
     }
     return lhs;
 }
 
 Resources &removeInvalid(Resources &lhs)
 {
-    auto it = lhs.begin();
-    auto itend = lhs.end();
-    while (it != itend) {
-        if (it->second <= 0) {
-            it = lhs.erase(it);
-        } else {
-            ++it;
-        }
-    }
+    lhs.presentMask() &= nonZeroMask(lhs.data());
     return lhs;
 }
 
@@ -253,19 +287,26 @@ using namespace resources;
 AllocationRegulator::AllocationRegulator()
 {
     m_limits = resources::platformLimits();
+    m_capacity = m_limits;
 }
 
 AllocationRegulator::AllocationRegulator(const Resources &cap)
     : AllocationRegulator()
 {
-    auto lend = m_limits.end();
-
-    for (auto [tag, val] : cap) {
-        auto it = m_limits.find(tag);
-        if (it != lend) {
-            it->second = std::min(it->second, val);
+    auto *limits = m_limits.data();
+    const auto *c = cap.data();
+    const auto mask = m_limits.presentMask() & cap.presentMask();
+    for (size_t i = 0; i != ResourceVector::kNumSlots; ++i) {
+        if (mask & ResourceVector::bit(i)) {
+            limits[i] = std::min(limits[i], c[i]);
         }
     }
+    m_capacity = m_limits;
+}
+
+size_t AllocationRegulator::capacity(const ResourceTag &tag) const
+{
+    return sstl::getOrDefault(m_capacity, tag, 0);
 }
 
 AllocationRegulator::Ticket AllocationRegulator::registerJob()
@@ -344,49 +385,119 @@ std::string AllocationRegulator::DebugString() const
 
 void ResourceMonitor::initializeLimits()
 {
-    auto g = sstl::with_guard(m_mu);
+    auto limits = resources::platformLimits();
 
-    m_limits = resources::platformLimits();
+    m_knownTags = limits.presentMask();
+    for (size_t i = 0; i != ResourceVector::kNumSlots; ++i) {
+        m_shards[i].avail.store(limits.data()[i], std::memory_order_relaxed);
+    }
 }
 
 void ResourceMonitor::initializeLimits(const Resources &cap)
 {
     initializeLimits();
 
-    auto g = sstl::with_guard(m_mu);
+    for (const auto &[tag, val] : cap) {
+        auto slot = ResourceVector::slotOf(tag);
+        if (m_knownTags & ResourceVector::bit(slot)) {
+            auto &shard = m_shards[slot];
+            shard.avail.store(std::min(shard.avail.load(std::memory_order_relaxed), val),
+                              std::memory_order_relaxed);
+        }
+    }
+}
 
-    auto lend = m_limits.end();
+bool ResourceMonitor::reserveGlobal(const Resources &res, Resources *missing)
+{
+    const auto *vals = res.data();
+    ResourceVector::Mask reserved = 0;
 
-    ResourceTag tag{};
-    size_t val;
-    for (auto p : cap) {
-        std::tie(tag, val) = p;
-        auto it = m_limits.find(tag);
-        if (it != lend) {
-            it->second = std::min(it->second, val);
+    bool ok = true;
+    for (auto rest = res.presentMask(); rest; rest &= rest - 1) {
+        auto slot = static_cast<size_t>(__builtin_ctz(rest));
+        if (vals[slot] == 0) {
+            continue;
+        }
+        if (!(m_knownTags & ResourceVector::bit(slot)) || !m_shards[slot].tryReserve(vals[slot])) {
+            ok = false;
+            break;
+        }
+        reserved |= ResourceVector::bit(slot);
+    }
+
+    if (ok) {
+        return true;
+    }
+
+    // roll back what we already took
+    for (; reserved; reserved &= reserved - 1) {
+        auto slot = static_cast<size_t>(__builtin_ctz(reserved));
+        m_shards[slot].release(vals[slot]);
+    }
+
+    if (missing) {
+        missing->clear();
+        for (const auto &[tag, val] : res) {
+            auto avail = queryAvailable(tag);
+            if (val > avail) {
+                (*missing)[tag] = val - avail;
+            }
         }
     }
+    return false;
+}
+
+void ResourceMonitor::releaseGlobal(const Resources &res)
+{
+    DCHECK_EQ(res.presentMask() & ~m_knownTags, 0) << "Releasing unknown resource " << res;
+
+    const auto *vals = res.data();
+    ResourceVector::Mask freed = 0;
+    for (auto rest = res.presentMask() & m_knownTags; rest; rest &= rest - 1) {
+        auto slot = static_cast<size_t>(__builtin_ctz(rest));
+        if (vals[slot] != 0) {
+            m_shards[slot].release(vals[slot]);
+            freed |= ResourceVector::bit(slot);
+        }
+    }
+
+    if (!freed) {
+        return;
+    }
+    // Only notify on tags not yet reported, so a burst of frees wakes up the listener once
+    auto prev = m_freedTags.fetch_or(freed, std::memory_order_acq_rel);
+    if ((prev & freed) != freed && m_releaseListener) {
+        m_releaseListener();
+    }
+}
+
+void ResourceMonitor::setReleaseListener(std::function<void()> cb)
+{
+    m_releaseListener = std::move(cb);
+}
+
+size_t ResourceMonitor::queryAvailable(const ResourceTag &tag) const
+{
+    auto slot = ResourceVector::slotOf(tag);
+    if (slot == ResourceVector::kInvalidSlot || !(m_knownTags & ResourceVector::bit(slot))) {
+        return 0;
+    }
+    return m_shards[slot].avail.load(std::memory_order_relaxed);
 }
 
 std::optional<uint64_t> ResourceMonitor::preAllocate(const Resources &req, Resources *missing)
 {
     // TODO: check ticket
 
-    auto g = sstl::with_guard(m_mu);
-    if (!contains(m_limits, req)) {
-        if (missing) {
-            *missing = req;
-            subtract(*missing, m_limits, true /* skipNonExist */);
-            removeInvalid(*missing);
-        }
+    if (!reserveGlobal(req, missing)) {
         return {};
     }
 
-    auto ticket = ++m_nextTicket;
+    auto ticket = m_nextTicket.fetch_add(1, std::memory_order_relaxed) + 1;
 
-    // Allocate
-    subtract(m_limits, req);
-    m_staging[ticket] = req;
+    auto &stripe = stripeFor(ticket);
+    auto g = sstl::with_guard(stripe.mu);
+    stripe.staging[ticket] = req;
 
     return ticket;
 }
@@ -398,8 +509,9 @@ bool ResourceMonitor::allocate(uint64_t ticket, const Resources &res)
         return false;
     }
 
-    auto g = sstl::with_uguard(m_mu);
-    return allocateUnsafe(ticket, res);
+    auto &stripe = stripeFor(ticket);
+    auto g = sstl::with_guard(stripe.mu);
+    return allocateUnsafe(stripe, ticket, res);
 }
 
 bool ResourceMonitor::LockedProxy::allocate(uint64_t ticket, const Resources &res)
@@ -410,18 +522,20 @@ bool ResourceMonitor::LockedProxy::allocate(uint64_t ticket, const Resources &re
         return false;
     }
 
-    return m_resMonitor->allocateUnsafe(ticket, res);
+    auto &stripe = m_resMonitor->stripeFor(ticket);
+    DCHECK_EQ(m_ug.mutex(), &stripe.mu);
+    return m_resMonitor->allocateUnsafe(stripe, ticket, res);
 }
 
-bool ResourceMonitor::allocateUnsafe(uint64_t ticket, const Resources &res)
+bool ResourceMonitor::allocateUnsafe(TicketStripe &stripe, uint64_t ticket, const Resources &res)
 {
     auto remaining(res);
-    auto it = m_staging.find(ticket);
-    if (it != m_staging.end()) {
+    auto it = stripe.staging.find(ticket);
+    if (it != stripe.staging.end()) {
         // first try allocate from reserve
         if (contains(it->second, remaining)) {
             subtract(it->second, remaining);
-            merge(m_using[ticket], remaining);
+            merge(stripe.inuse[ticket], remaining);
             return true;
         }
 
@@ -433,11 +547,11 @@ bool ResourceMonitor::allocateUnsafe(uint64_t ticket, const Resources &res)
     removeInvalid(remaining);
 
     // ... then try from global avail
-    if (!contains(m_limits, remaining)) {
+    if (!reserveGlobal(remaining, nullptr)) {
         return false;
     }
 
-    if (it != m_staging.end()) {
+    if (it != stripe.staging.end()) {
         // actual subtract from staging
         auto fromStaging(res);
         subtract(fromStaging, remaining);
@@ -446,11 +560,8 @@ bool ResourceMonitor::allocateUnsafe(uint64_t ticket, const Resources &res)
         subtract(it->second, fromStaging);
     }
 
-    // actual subtract from global
-    subtract(m_limits, remaining);
-
     // add to used
-    merge(m_using[ticket], res);
+    merge(stripe.inuse[ticket], res);
 
     return true;
 }
@@ -463,63 +574,72 @@ void ResourceMonitor::freeStaging(uint64_t ticket)
         return;
     }
 
-    auto g = sstl::with_uguard(m_mu);
+    Resources staging;
+    {
+        auto &stripe = stripeFor(ticket);
+        auto g = sstl::with_uguard(stripe.mu);
 
-    auto it = m_staging.find(ticket);
-    if (it == m_staging.end()) {
-        g.unlock();
-        LOG(ERROR) << "Unknown ticket for freeStaging: " << ticket;
-        return;
+        auto it = stripe.staging.find(ticket);
+        if (it == stripe.staging.end()) {
+            g.unlock();
+            LOG(ERROR) << "Unknown ticket for freeStaging: " << ticket;
+            return;
+        }
+
+        staging = std::move(it->second);
+        stripe.staging.erase(it);
     }
 
-    merge(m_limits, it->second);
-    m_staging.erase(it);
+    releaseGlobal(staging);
 }
 
 bool ResourceMonitor::free(uint64_t ticket, const Resources &res)
 {
-    auto g = sstl::with_guard(m_mu);
-    return freeUnsafe(ticket, res);
+    auto &stripe = stripeFor(ticket);
+    auto g = sstl::with_guard(stripe.mu);
+    return freeUnsafe(stripe, ticket, res);
 }
 
 bool ResourceMonitor::LockedProxy::free(uint64_t ticket, const Resources &res)
 {
     assert(m_resMonitor);
-    return m_resMonitor->freeUnsafe(ticket, res);
+    auto &stripe = m_resMonitor->stripeFor(ticket);
+    DCHECK_EQ(m_ug.mutex(), &stripe.mu);
+    return m_resMonitor->freeUnsafe(stripe, ticket, res);
 }
 
 std::optional<Resources> ResourceMonitor::LockedProxy::queryStaging(uint64_t ticket) const
 {
     DCHECK(m_resMonitor);
-    return m_resMonitor->queryStagingUnsafe(ticket);
+    return m_resMonitor->queryStagingUnsafe(m_resMonitor->stripeFor(ticket), ticket);
 }
 
-bool ResourceMonitor::freeUnsafe(uint64_t ticket, const Resources &res)
+bool ResourceMonitor::freeUnsafe(TicketStripe &stripe, uint64_t ticket, const Resources &res)
 {
     // Ticket can not be 0 when free actual resource to prevent
     // monitor go out of sync of physical usage.
     DCHECK_NE(ticket, 0);
 
-    merge(m_limits, res);
+    releaseGlobal(res);
 
-    auto it = m_using.find(ticket);
-    DCHECK_NE(it, m_using.end());
+    auto it = stripe.inuse.find(ticket);
+    DCHECK_NE(it, stripe.inuse.end());
 
     DCHECK(contains(it->second, res));
 
     subtract(it->second, res);
     removeInvalid(it->second);
     if (it->second.empty()) {
-        m_using.erase(it);
+        stripe.inuse.erase(it);
         return true;
     }
     return false;
 }
 
-std::optional<Resources> ResourceMonitor::queryStagingUnsafe(uint64_t ticket) const
+std::optional<Resources> ResourceMonitor::queryStagingUnsafe(const TicketStripe &stripe, uint64_t ticket) const
 {
     DCHECK_NE(ticket, 0);
-    return sstl::optionalGet(m_staging, ticket);
+    return sstl::optionalGet(stripe.staging, ticket);
 }
 
 std::vector<std::pair<size_t, uint64_t>> ResourceMonitor::sortVictim(
@@ -532,19 +652,16 @@ std::vector<std::pair<size_t, uint64_t>> ResourceMonitor::sortVictim(
 
     // TODO: currently only select based on GPU memory usage, generalize to all resources
     ResourceTag tag{ResourceType::MEMORY, devices::GPU0};
-    {
-        auto g = sstl::with_guard(m_mu);
-        for (auto &ticket : candidates) {
-            auto usagemap = sstl::optionalGet(m_using, ticket);
-            if (!usagemap) {
-                continue;
-            }
-            auto gpuusage = sstl::optionalGet(usagemap, tag);
-            if (!gpuusage || *gpuusage == 0) {
-                continue;
-            }
-            usages.emplace_back(*gpuusage, ticket);
+    for (auto &ticket : candidates) {
+        auto usagemap = queryUsage(ticket);
+        if (!usagemap) {
+            continue;
+        }
+        auto gpuusage = sstl::optionalGet(usagemap, tag);
+        if (!gpuusage || *gpuusage == 0) {
+            continue;
         }
+        usages.emplace_back(*gpuusage, ticket);
     }
 
     std::sort(usages.begin(), usages.end(), [](const auto &lhs, const auto &rhs) {
@@ -555,22 +672,25 @@ std::vector<std::pair<size_t, uint64_t>> ResourceMonitor::sortVictim(
 
 Resources ResourceMonitor::queryUsages(const std::unordered_set<uint64_t> &tickets) const
 {
-    auto g = sstl::with_guard(m_mu);
     Resources res;
     for (auto t : tickets) {
-        merge(res, sstl::getOrDefault(m_using, t, {}));
+        const auto &stripe = stripeFor(t);
+        auto g = sstl::with_guard(stripe.mu);
+        merge(res, sstl::getOrDefault(stripe.inuse, t, {}));
     }
     return res;
 }
 
 optional<Resources> ResourceMonitor::queryUsage(uint64_t ticket) const
 {
-    auto g = sstl::with_guard(m_mu);
-    return sstl::optionalGet(m_using, ticket);
+    const auto &stripe = stripeFor(ticket);
+    auto g = sstl::with_guard(stripe.mu);
+    return sstl::optionalGet(stripe.inuse, ticket);
 }
 
 bool ResourceMonitor::hasUsage(uint64_t ticket) const
 {
-    auto g = sstl::with_guard(m_mu);
-    return m_using.count(ticket) > 0;
+    const auto &stripe = stripeFor(ticket);
+    auto g = sstl::with_guard(stripe.mu);
+    return stripe.inuse.count(ticket) > 0;
 }
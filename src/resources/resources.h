@@ -26,6 +26,12 @@
 #include "utils/threadutils.h"
 #include "platform/thread_annotations.h"
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <list>
 #include <mutex>
 #include <unordered_map>
@@ -93,7 +99,205 @@ public:
 };
 } // namespace std
 
-using Resources = std::unordered_map<ResourceTag, size_t>;
+/**
+ * @brief A dense, fixed-size map from ResourceTag to amount.
+ *
+ * The set of resource tags is small and bounded, so every possible tag gets a fixed slot
+ * computed at compile time, and set operations become simple loops over an array that the
+ * compiler can vectorize. A bitmask records which tags are present, to keep the same
+ * semantics as a map (a present tag with amount 0 is different from an absent tag).
+ *
+ * Invariant: slots whose tag is absent always hold 0.
+ */
+class ResourceVector
+{
+public:
+    // NOTE: these should cover salus::oplib::tensorflow::TFInstance::DeviceContainer, which checks that
+    static constexpr size_t kNumResourceTypes = 4;
+    static constexpr size_t kNumDeviceTypes = 2;
+    static constexpr size_t kMaxDeviceId = 3;
+    static_assert(kNumResourceTypes == static_cast<size_t>(ResourceType::EXCLUSIVE) + 1,
+                  "kNumResourceTypes must follow ResourceType");
+    static_assert(kNumDeviceTypes == static_cast<size_t>(salus::DeviceType::GPU) + 1,
+                  "kNumDeviceTypes must follow DeviceType");
+    static constexpr size_t kNumSlots = kNumResourceTypes * kNumDeviceTypes * kMaxDeviceId;
+    static constexpr size_t kInvalidSlot = kNumSlots;
+
+    using Mask = uint32_t;
+    static_assert(kNumSlots <= sizeof(Mask) * 8, "Mask too small for all slots");
+
+    using key_type = ResourceTag;
+    using mapped_type = size_t;
+    using value_type = std::pair<ResourceTag, size_t>;
+
+    static constexpr size_t slotOf(const ResourceTag &tag) noexcept
+    {
+        auto type = static_cast<size_t>(tag.type);
+        auto devType = static_cast<size_t>(tag.device.type);
+        auto id = static_cast<size_t>(tag.device.id);
+        if (type >= kNumResourceTypes || devType >= kNumDeviceTypes || id >= kMaxDeviceId) {
+            return kInvalidSlot;
+        }
+        return (type * kNumDeviceTypes + devType) * kMaxDeviceId + id;
+    }
+
+    /**
+     * @brief Whether tag has a slot, i.e. can be stored at all
+     */
+    static constexpr bool covers(const ResourceTag &tag) noexcept
+    {
+        return slotOf(tag) != kInvalidSlot;
+    }
+
+    static constexpr ResourceTag tagOf(size_t slot) noexcept
+    {
+        auto id = static_cast<int>(slot % kMaxDeviceId);
+        slot /= kMaxDeviceId;
+        auto devType = static_cast<salus::DeviceType>(slot % kNumDeviceTypes);
+        auto type = static_cast<ResourceType>(slot / kNumDeviceTypes);
+        return {type, salus::DeviceSpec{devType, id}};
+    }
+
+    /**
+     * @brief Iterates over present tags in slot order.
+     */
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ResourceVector::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type *;
+        using reference = const value_type &;
+
+        const_iterator() = default;
+
+        reference operator*() const { return m_cur; }
+        pointer operator->() const { return &m_cur; }
+
+        const_iterator &operator++()
+        {
+            m_rest &= m_rest - 1;
+            load();
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const const_iterator &rhs) const { return m_rest == rhs.m_rest; }
+        bool operator!=(const const_iterator &rhs) const { return m_rest != rhs.m_rest; }
+
+    private:
+        friend class ResourceVector;
+
+        const_iterator(const ResourceVector *vec, Mask rest)
+            : m_vec(vec)
+            , m_rest(rest)
+        {
+            load();
+        }
+
+        void load()
+        {
+            if (m_rest) {
+                auto slot = static_cast<size_t>(__builtin_ctz(m_rest));
+                m_cur = {tagOf(slot), m_vec->m_vals[slot]};
+            }
+        }
+
+        const ResourceVector *m_vec = nullptr;
+        Mask m_rest = 0;
+        value_type m_cur{};
+    };
+    using iterator = const_iterator;
+
+    ResourceVector() = default;
+    ResourceVector(std::initializer_list<value_type> init)
+    {
+        for (const auto &[tag, val] : init) {
+            (*this)[tag] = val;
+        }
+    }
+
+    /**
+     * @throws std::out_of_range if tag is not covered
+     */
+    size_t &operator[](const ResourceTag &tag)
+    {
+        auto slot = checkedSlot(tag);
+        m_present |= bit(slot);
+        return m_vals[slot];
+    }
+
+    size_t count(const ResourceTag &tag) const
+    {
+        auto slot = slotOf(tag);
+        return slot != kInvalidSlot && (m_present & bit(slot)) ? 1 : 0;
+    }
+
+    const_iterator find(const ResourceTag &tag) const
+    {
+        auto slot = slotOf(tag);
+        if (slot == kInvalidSlot || !(m_present & bit(slot))) {
+            return end();
+        }
+        return {this, static_cast<Mask>(m_present & ~(bit(slot) - 1))};
+    }
+
+    size_t erase(const ResourceTag &tag)
+    {
+        if (!count(tag)) {
+            return 0;
+        }
+        auto slot = slotOf(tag);
+        m_present &= ~bit(slot);
+        m_vals[slot] = 0;
+        return 1;
+    }
+
+    const_iterator begin() const { return {this, m_present}; }
+    const_iterator end() const { return {}; }
+
+    bool empty() const { return m_present == 0; }
+    size_t size() const { return static_cast<size_t>(__builtin_popcount(m_present)); }
+
+    void clear()
+    {
+        m_vals.fill(0);
+        m_present = 0;
+    }
+
+    /**
+     * @brief Raw access for the kernels in namespace resources.
+     */
+    Mask presentMask() const { return m_present; }
+    Mask &presentMask() { return m_present; }
+    const size_t *data() const { return m_vals.data(); }
+    size_t *data() { return m_vals.data(); }
+
+    static constexpr Mask bit(size_t slot) { return Mask{1} << slot; }
+
+private:
+    static size_t checkedSlot(const ResourceTag &tag)
+    {
+        auto slot = slotOf(tag);
+        if (slot == kInvalidSlot) {
+            invalidTag(tag);
+        }
+        return slot;
+    }
+
+    [[noreturn]] static void invalidTag(const ResourceTag &tag);
+
+    alignas(64) std::array<size_t, kNumSlots> m_vals{};
+    Mask m_present = 0;
+};
+
+using Resources = ResourceVector;
 
 namespace resources {
 /**
@@ -235,6 +439,15 @@ public:
          */
         void finishJob();
 
+        /**
+         * @brief Total amount of resource the regulator ever hands out, reservations beyond
+         * this can never succeed.
+         */
+        size_t capacity(const ResourceTag &tag) const
+        {
+            return reg->capacity(tag);
+        }
+
         std::string DebugString() const
         {
             return reg->DebugString();
@@ -256,11 +469,16 @@ public:
      */
     Ticket registerJob();
 
+    size_t capacity(const ResourceTag &tag) const;
+
     std::string DebugString() const;
 
 private:
     mutable std::mutex m_mu;
 
+    // Initial limits, never changed after construction
+    Resources m_capacity;
+
     uint64_t m_next = 0 GUARDED_BY(m_mu);
 
     Resources m_limits GUARDED_BY(m_mu);
@@ -284,6 +502,10 @@ private:
 
 /**
  * A monitor of resources. This class is thread-safe.
+ *
+ * Global capacity is sharded per ResourceTag (one per ResourceVector slot), each shard being an
+ * atomic counter that is reserved from using compare-and-swap. Per ticket bookkeeping is striped by ticket, so
+ * operations on different tickets never contend on the same lock.
  */
 class ResourceMonitor
 {
@@ -291,7 +513,9 @@ public:
     ResourceMonitor() = default;
 
     /**
-     * @brief Read limits from hardware
+     * @brief Read limits from hardware.
+     *
+     * Must be called before any other operation, and not concurrently with them.
      */
     void initializeLimits();
     /**
@@ -331,13 +555,38 @@ public:
     std::optional<Resources> queryUsage(uint64_t ticket) const;
     bool hasUsage(uint64_t ticket) const;
 
+    /**
+     * @brief Currently available amount of resource `tag`, 0 if the tag is unknown.
+     */
+    size_t queryAvailable(const ResourceTag &tag) const;
+
+    /**
+     * @brief Set a callback invoked whenever capacity of a tag is given back, unless that tag
+     * already had capacity given back since the last takeFreedTags. Used to wake up schedulers.
+     *
+     * Must not be called concurrently with any other operation.
+     */
+    void setReleaseListener(std::function<void()> cb);
+
+    /**
+     * @brief Tags (as a mask of ResourceVector slots) that had capacity given back since the last call.
+     */
+    ResourceVector::Mask takeFreedTags()
+    {
+        return m_freedTags.exchange(0, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief Holds the lock of the stripe `ticket` belongs to, making a sequence of operations
+     * on that ticket atomic with regard to other operations on the same ticket.
+     */
     struct LockedProxy
     {
         SALUS_DISALLOW_COPY_AND_ASSIGN(LockedProxy);
 
-        explicit LockedProxy(sstl::not_null<ResourceMonitor*> resMon)
+        explicit LockedProxy(sstl::not_null<ResourceMonitor*> resMon, uint64_t ticket)
             : m_resMonitor(resMon)
-            , m_ug(sstl::with_uguard(m_resMonitor->m_mu))
+            , m_ug(sstl::with_uguard(m_resMonitor->stripeFor(ticket).mu))
         {
         }
 
@@ -353,6 +602,7 @@ public:
             release();
             using std::swap;
             swap(m_resMonitor, other.m_resMonitor);
+            swap(m_ug, other.m_ug);
             return *this;
         }
 
@@ -380,37 +630,95 @@ public:
         sstl::detail::UGuard m_ug;
     };
 
-    LockedProxy lock()
+    LockedProxy lock(uint64_t ticket)
     {
-        return LockedProxy(this);
+        return LockedProxy(this, ticket);
     }
 
     std::string DebugString() const;
 
 private:
-    bool allocateUnsafe(uint64_t ticket, const Resources &res);
-    bool freeUnsafe(uint64_t ticket, const Resources &res);
-    std::optional<Resources> queryStagingUnsafe(uint64_t ticket) const;
+    /**
+     * @brief Global capacity of one resource tag.
+     */
+    struct alignas(64) CapacityShard
+    {
+        std::atomic<size_t> avail{0};
 
-    mutable std::mutex m_mu;
+        /**
+         * @brief Reserve `num` from this shard with a CAS loop.
+         * @returns false if there isn't enough capacity, in which case nothing is changed.
+         */
+        bool tryReserve(size_t num)
+        {
+            auto curr = avail.load(std::memory_order_relaxed);
+            do {
+                if (curr < num) {
+                    return false;
+                }
+            } while (!avail.compare_exchange_weak(curr, curr - num, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed));
+            return true;
+        }
 
-    // 0 is invalid ticket
-    uint64_t m_nextTicket = 1;
+        void release(size_t num)
+        {
+            avail.fetch_add(num, std::memory_order_acq_rel);
+        }
+    };
 
     /**
-     * @brief Available resources
+     * @brief Per ticket bookkeeping for tickets that hash to the same stripe.
      */
-    Resources m_limits;
+    struct alignas(64) TicketStripe
+    {
+        mutable std::mutex mu;
+        /**
+         * @brief Staging resources
+         */
+        std::unordered_map<uint64_t, Resources> staging GUARDED_BY(mu);
+        /**
+         * @brief In-use resources
+         */
+        std::unordered_map<uint64_t, Resources> inuse GUARDED_BY(mu);
+    };
+
+    static constexpr size_t kNumStripes = 32;
+
+    TicketStripe &stripeFor(uint64_t ticket)
+    {
+        return m_stripes[ticket % kNumStripes];
+    }
+    const TicketStripe &stripeFor(uint64_t ticket) const
+    {
+        return m_stripes[ticket % kNumStripes];
+    }
 
     /**
-     * @brief Staging resources
+     * @brief Reserve all of `res` from global capacity, or nothing at all.
+     * @param missing if not null, filled with the amount lacking when failed.
      */
-    std::unordered_map<uint64_t, Resources> m_staging;
+    bool reserveGlobal(const Resources &res, Resources *missing);
+    void releaseGlobal(const Resources &res);
+
+    bool allocateUnsafe(TicketStripe &stripe, uint64_t ticket, const Resources &res);
+    bool freeUnsafe(TicketStripe &stripe, uint64_t ticket, const Resources &res);
+    std::optional<Resources> queryStagingUnsafe(const TicketStripe &stripe, uint64_t ticket) const;
+
+    // 0 is invalid ticket
+    std::atomic<uint64_t> m_nextTicket{1};
 
     /**
-     * @brief In-use resources
+     * @brief Available resources, one shard per tag, indexed by ResourceVector slot.
+     * Only those in m_knownTags are used, which is fixed after initializeLimits.
      */
-    std::unordered_map<uint64_t, Resources> m_using;
+    std::array<CapacityShard, ResourceVector::kNumSlots> m_shards;
+    ResourceVector::Mask m_knownTags = 0;
+
+    std::atomic<ResourceVector::Mask> m_freedTags{0};
+    std::function<void()> m_releaseListener;
+
+    std::array<TicketStripe, kNumStripes> m_stripes;
 };
 
 #endif // SALUS_EXEC_RESOURCES_H
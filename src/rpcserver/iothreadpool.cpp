@@ -18,33 +18,205 @@
  */
 
 #include "iothreadpool.h"
+#include "platform/logging.h"
 #include "platform/thread_annotations.h"
 
+#include <algorithm>
 #include <thread>
 
+using namespace std::chrono_literals;
+
 namespace salus {
 
-IOThreadPoolImpl::IOThreadPoolImpl()
-    : m_numThreads(std::max(std::thread::hardware_concurrency() / 2, 1u))
-    , m_context(static_cast<int>(m_numThreads))
+namespace {
+
+// Threads above numThreads exit after being idle this long
+constexpr auto kIdleTimeout = 5s;
+// How often stats are written to the perf log, if there were tasks
+constexpr auto kReportInterval = 10s;
+
+size_t defaultNumThreads(size_t requested)
+{
+    return requested ? requested : std::max(std::thread::hardware_concurrency() / 2, 1u);
+}
+
+size_t defaultMaxThreads(size_t requested)
+{
+    // Same as boost::asio::system_context, so blocking tasks can run as many at once as before
+    return requested ? requested : std::max(std::thread::hardware_concurrency() * 2, 1u);
+}
+
+void updateMax(std::atomic<uint64_t> &max, uint64_t value)
+{
+    auto curr = max.load(std::memory_order_relaxed);
+    while (value > curr && !max.compare_exchange_weak(curr, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+IOThreadPoolImpl::IOThreadPoolImpl(IOThreadPoolOptions options)
+    : m_options(std::move(options))
+    , m_maxThreads(std::max(defaultNumThreads(m_options.numThreads), defaultMaxThreads(m_options.maxThreads)))
+    , m_context(static_cast<int>(m_maxThreads))
     , m_workguard(boost::asio::make_work_guard(m_context))
 {
-    while (m_threads.size() < m_numThreads) {
-        m_threads.create_thread(std::bind(&IOThreadPoolImpl::workerLoop, this));
+    for (size_t i = 0, n = defaultNumThreads(m_options.numThreads); i != n; ++i) {
+        addThread(false);
     }
 }
 
 IOThreadPoolImpl::~IOThreadPoolImpl()
 {
-    m_context.stop();
+    // Without the guard, threads leave once the context runs out of work, so queued tasks still run
     m_workguard.reset();
     m_threads.join_all();
+    // Tasks still running on added threads may add more threads
+    while (true) {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> g(m_extraMu);
+            if (m_extraThreads.empty() && m_exitedThreads.empty()) {
+                break;
+            }
+            threads = std::move(m_exitedThreads);
+            m_exitedThreads.clear();
+            for (auto &[id, thread] : m_extraThreads) {
+                threads.emplace_back(std::move(thread));
+            }
+            m_extraThreads.clear();
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+IOThreadPoolImpl::Stats IOThreadPoolImpl::stats() const
+{
+    Stats s;
+    s.numThreads = m_numThreads.load(std::memory_order_relaxed);
+    s.queued = m_queued.load(std::memory_order_relaxed);
+    s.executed = m_executed.load(std::memory_order_relaxed);
+    s.totalWaitUs = m_totalWaitUs.load(std::memory_order_relaxed);
+    s.maxWaitUs = m_maxWaitUs.load(std::memory_order_relaxed);
+    return s;
+}
+
+void IOThreadPoolImpl::onQueued()
+{
+    auto queued = m_queued.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    // Grow when tasks pile up beyond what idle threads will soon pick up. A single task waiting behind
+    // busy threads doesn't, so one long running task doesn't add a thread each time.
+    if (queued < m_numIdle.load(std::memory_order_acquire) + m_options.growQueueDepth) {
+        return;
+    }
+    auto curr = m_numThreads.load(std::memory_order_relaxed);
+    if (curr < m_maxThreads && m_numThreads.compare_exchange_strong(curr, curr + 1)) {
+        VLOG(2) << "Growing " << m_options.name << " to " << curr + 1 << " threads";
+        addThread(true);
+    }
 }
 
-void IOThreadPoolImpl::workerLoop()
+void IOThreadPoolImpl::onStarted(Clock::time_point queuedAt)
 {
-    threading::set_thread_name("salus::IOThreadPoolWorker");
-    m_context.run();
+    m_numIdle.fetch_sub(1, std::memory_order_acq_rel);
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+
+    auto now = Clock::now();
+    auto waitUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - queuedAt).count());
+    m_executed.fetch_add(1, std::memory_order_relaxed);
+    m_totalWaitUs.fetch_add(waitUs, std::memory_order_relaxed);
+    updateMax(m_maxWaitUs, waitUs);
+    updateMax(m_intervalMaxWaitUs, waitUs);
+
+    maybeReport(now);
+}
+
+void IOThreadPoolImpl::maybeReport(Clock::time_point now)
+{
+    auto nowNs = static_cast<uint64_t>(now.time_since_epoch().count());
+    auto last = m_lastReportNs.load(std::memory_order_relaxed);
+    if (nowNs - last < static_cast<uint64_t>(std::chrono::nanoseconds(kReportInterval).count())
+        || !m_lastReportNs.compare_exchange_strong(last, nowNs)) {
+        return;
+    }
+
+    auto s = stats();
+    LogPerf() << "event: iopool_stats "
+              << nlohmann::json({
+                     {"pool", m_options.name},
+                     {"threads", s.numThreads},
+                     {"queued", s.queued},
+                     {"executed", s.executed},
+                     {"avgWaitUs", s.executed ? s.totalWaitUs / s.executed : 0},
+                     {"intervalMaxWaitUs", m_intervalMaxWaitUs.exchange(0, std::memory_order_relaxed)},
+                     {"maxWaitUs", s.maxWaitUs},
+                 });
+}
+
+void IOThreadPoolImpl::addThread(bool extra)
+{
+    // Idle from the start, so a burst doesn't add more threads while the new one is starting
+    m_numIdle.fetch_add(1, std::memory_order_acq_rel);
+    if (!extra) {
+        m_numThreads.fetch_add(1, std::memory_order_relaxed);
+        m_threads.create_thread([this]() { workerLoop(false); });
+        return;
+    }
+    // Not kept in m_threads, which would accumulate exited threads as the pool grows and shrinks
+    std::vector<std::thread> exited;
+    {
+        std::lock_guard<std::mutex> g(m_extraMu);
+        exited = std::move(m_exitedThreads);
+        m_exitedThreads.clear();
+        // Registered before the thread can retire itself, which takes the lock first
+        std::thread thread([this]() { workerLoop(true); });
+        auto id = thread.get_id();
+        m_extraThreads.emplace(id, std::move(thread));
+    }
+    for (auto &thread : exited) {
+        thread.join();
+    }
+}
+
+void IOThreadPoolImpl::retireExtraThread()
+{
+    std::lock_guard<std::mutex> g(m_extraMu);
+    // Already taken by the destructor if it is not found
+    auto it = m_extraThreads.find(std::this_thread::get_id());
+    if (it != m_extraThreads.end()) {
+        m_exitedThreads.emplace_back(std::move(it->second));
+        m_extraThreads.erase(it);
+    }
+}
+
+void IOThreadPoolImpl::workerLoop(bool extra)
+{
+    threading::set_thread_name(m_options.name);
+
+    while (true) {
+        // Idle is taken by onStarted when a task runs
+        auto ran = extra ? m_context.run_one_for(kIdleTimeout) : m_context.run_one();
+        if (ran) {
+            m_numIdle.fetch_add(1, std::memory_order_acq_rel);
+            continue;
+        }
+        // Out of work after the destructor released the guard, or idle for too long
+        if (extra && !m_context.stopped()) {
+            VLOG(2) << "Shrinking " << m_options.name << " to " << m_numThreads - 1 << " threads";
+        }
+        if (extra || m_context.stopped()) {
+            break;
+        }
+    }
+    m_numIdle.fetch_sub(1, std::memory_order_acq_rel);
+    m_numThreads.fetch_sub(1, std::memory_order_release);
+    if (extra) {
+        // Joined by the next thread added, or the destructor
+        retireExtraThread();
+    }
 }
 
 } // namespace salus
@@ -23,19 +23,74 @@
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 namespace salus {
+
+struct IOThreadPoolOptions
+{
+    // Thread name, and how the pool is called in stats
+    std::string name = "IOThreadPool";
+    // 0 means half the hardware threads
+    size_t numThreads = 0;
+    // If larger than numThreads, a thread is added each time a task is queued while at least growQueueDepth
+    // tasks are queued beyond what idle threads will pick up, up to maxThreads in total. The added threads
+    // exit again after being idle for a while. 0 means twice the hardware threads, which is what asio's
+    // system executor, where tasks used to be posted, runs with.
+    size_t maxThreads = 0;
+    // Use 1 if tasks may wait on each other, so a waiting task always gets a thread
+    size_t growQueueDepth = 2;
+};
+
 /**
  * @brief Simple blocking IO thread pool made from boost::asio
  */
 class IOThreadPoolImpl
 {
-    size_t m_numThreads;
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats
+    {
+        size_t numThreads = 0;
+        // posted but not yet started
+        size_t queued = 0;
+        uint64_t executed = 0;
+        // time from posted to started, over all executed tasks
+        uint64_t totalWaitUs = 0;
+        uint64_t maxWaitUs = 0;
+    };
+
+private:
+    const IOThreadPoolOptions m_options;
+    const size_t m_maxThreads;
 
     boost::asio::io_context m_context;
     boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_workguard;
 
+    std::atomic<size_t> m_numThreads{0};
+    std::atomic<size_t> m_numIdle{0};
+    std::atomic<size_t> m_queued{0};
+    std::atomic<uint64_t> m_executed{0};
+    std::atomic<uint64_t> m_totalWaitUs{0};
+    std::atomic<uint64_t> m_maxWaitUs{0};
+    // Tasks and max wait since the last report to perf log
+    std::atomic<uint64_t> m_lastReportNs{0};
+    std::atomic<uint64_t> m_intervalMaxWaitUs{0};
+
     boost::thread_group m_threads;
 
+    // Threads added above numThreads, and those of them that exited but are not yet joined
+    std::mutex m_extraMu;
+    std::unordered_map<std::thread::id, std::thread> m_extraThreads;
+    std::vector<std::thread> m_exitedThreads;
+
     /**
      * @brief A wrapper class that is copy-able to pass move-only objects.
      *
@@ -65,36 +120,58 @@ class IOThreadPoolImpl
         return std::forward<T>(t);
     }
 
-public:
-    IOThreadPoolImpl();
-    ~IOThreadPoolImpl();
-
-    /*
-    template<typename Func, typename SFINAE = std::enable_if<std::is_copy_constructible_v<Func> ||
-    !use_moveonly_trick>> auto post(Func &&f)
+    /**
+     * @brief Wrap f to account for its time in queue
+     */
+    template<typename Func>
+    auto timed(Func &&f)
     {
-        return boost::asio::post(std::forward<Func>(f));
+        onQueued();
+        return [this, queuedAt = Clock::now(), f = std::forward<Func>(f)]() mutable {
+            onStarted(queuedAt);
+            f();
+        };
     }
-    */
+
+public:
+    explicit IOThreadPoolImpl(IOThreadPoolOptions options = {});
+    /**
+     * @brief Runs all queued tasks, including ones posted meanwhile, before returning
+     */
+    ~IOThreadPoolImpl();
 
     template<typename Func, bool use_moveonly_trick = false>
     auto post(Func &&f)
     {
-        if constexpr (!std::is_copy_constructible_v<Func> && use_moveonly_trick) {
-            return boost::asio::post(move_handler(f));
+        auto wrapped = timed(std::forward<Func>(f));
+        if constexpr (!std::is_copy_constructible_v<decltype(wrapped)> && use_moveonly_trick) {
+            return boost::asio::post(m_context, move_handler(std::move(wrapped)));
         } else {
-            return boost::asio::post(std::forward<Func>(f));
+            return boost::asio::post(m_context, std::move(wrapped));
         }
     }
 
     template<typename Func>
     auto defer(Func &&f)
     {
-        return boost::asio::defer(std::forward<Func>(f));
+        return boost::asio::defer(m_context, timed(std::forward<Func>(f)));
     }
 
+    const IOThreadPoolOptions &options() const
+    {
+        return m_options;
+    }
+
+    Stats stats() const;
+
 private:
-    void workerLoop();
+    void onQueued();
+    void onStarted(Clock::time_point queuedAt);
+    void maybeReport(Clock::time_point now);
+
+    void addThread(bool extra);
+    void workerLoop(bool extra);
+    void retireExtraThread();
 };
 
 using IOThreadPool = IOThreadPoolImpl;
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rpcserver/requestpipeline.h"
+
+#include "platform/logging.h"
+#include "platform/thread_annotations.h"
+#include "utils/protoutils.h"
+
+#include "protos.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+
+RawRequest::RawRequest() = default;
+RawRequest::RawRequest(RawRequest &&) = default;
+RawRequest &RawRequest::operator=(RawRequest &&) = default;
+RawRequest::~RawRequest() = default;
+
+struct RequestPipeline::Worker
+{
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<RawRequest> queue GUARDED_BY(mu);
+    bool stopping GUARDED_BY(mu) = false;
+};
+
+RequestPipeline::RequestPipeline(size_t numWorkers, Handler handler, Handler reject)
+    : m_handler(std::move(handler))
+    , m_reject(std::move(reject))
+    , m_staging(std::max<size_t>(numWorkers, 1))
+{
+    numWorkers = m_staging.size();
+    m_workers.reserve(numWorkers);
+    for (size_t i = 0; i != numWorkers; ++i) {
+        m_workers.emplace_back(std::make_unique<Worker>());
+    }
+    m_threads.reserve(numWorkers);
+    for (auto &w : m_workers) {
+        m_threads.emplace_back([this, &w = *w]() { workerLoop(w); });
+    }
+}
+
+RequestPipeline::~RequestPipeline()
+{
+    stop();
+}
+
+void RequestPipeline::stop()
+{
+    for (auto &w : m_workers) {
+        {
+            std::lock_guard<std::mutex> g(w->mu);
+            w->stopping = true;
+        }
+        w->cv.notify_all();
+    }
+    for (auto &t : m_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+/*static*/ size_t RequestPipeline::recvAvailable(zmq::socket_t &sock, std::vector<RawRequest> &batch,
+                                                 size_t maxBatch)
+{
+    size_t received = 0;
+    while (received < maxBatch) {
+        RawRequest req;
+        zmq::message_t evenlop;
+        try {
+            // Only the first frame may not be there yet, once it arrives the whole message is
+            // available, like in ZmqServer::dispatch.
+            req.identities->emplace_back();
+            if (!sock.recv(&req.identities->back(), ZMQ_DONTWAIT)) {
+                break;
+            }
+            // Identity frames stop at an empty message
+            while (req.identities->back().size() != 0 && sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
+                req.identities->emplace_back();
+                sock.recv(&req.identities->back());
+            }
+            if (!sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
+                LOG(ERROR) << "Skipped one request due to no evenlop found after identity frames";
+                continue;
+            }
+            sock.recv(&evenlop);
+            if (!sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
+                LOG(ERROR) << "Skipped one request due to no body found after evenlop";
+                continue;
+            }
+            sock.recv(&req.body);
+            while (sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
+                req.attachments->emplace_back();
+                sock.recv(&req.attachments->back());
+            }
+        } catch (zmq::error_t &err) {
+            LOG(ERROR) << "Stopped receiving due to error: " << err;
+            break;
+        }
+
+        // The evenlop is small, and needed to know the session
+        req.evenlop = sstl::parseMessage<executor::EvenlopDef>(evenlop.data(), evenlop.size());
+        if (!req.evenlop) {
+            LOG(ERROR) << "Skipped one request due to malformatted request evenlop received.";
+            continue;
+        }
+        VLOG(2) << "Received request evenlop: " << *req.evenlop << " with body size " << req.body.size()
+                << " and " << req.attachments->size() << " attachments";
+
+        batch.emplace_back(std::move(req));
+        ++received;
+    }
+    return received;
+}
+
+size_t RequestPipeline::workerOf(RawRequest &req) const
+{
+    std::string_view key = req.evenlop->sessionid();
+    if (key.empty()) {
+        // Requests before a session exists are ordered per client
+        auto &front = req.identities->front();
+        key = std::string_view(static_cast<const char *>(front.data()), front.size());
+    }
+    return std::hash<std::string_view>{}(key) % m_workers.size();
+}
+
+void RequestPipeline::submit(std::vector<RawRequest> &batch)
+{
+    for (auto &req : batch) {
+        m_staging[workerOf(req)].emplace_back(std::move(req));
+    }
+    batch.clear();
+
+    // One lock and wakeup per worker per batch
+    for (size_t i = 0; i != m_staging.size(); ++i) {
+        auto &staged = m_staging[i];
+        if (staged.empty()) {
+            continue;
+        }
+        auto &w = *m_workers[i];
+        {
+            std::lock_guard<std::mutex> g(w.mu);
+            if (w.stopping) {
+                // Rejected below, outside of the lock
+            } else if (w.queue.empty()) {
+                w.queue.swap(staged);
+            } else {
+                std::move(staged.begin(), staged.end(), std::back_inserter(w.queue));
+                staged.clear();
+            }
+        }
+        if (!staged.empty()) {
+            reject(staged);
+            continue;
+        }
+        w.cv.notify_one();
+    }
+}
+
+void RequestPipeline::reject(std::vector<RawRequest> &reqs)
+{
+    if (m_reject) {
+        for (auto &req : reqs) {
+            m_reject(std::move(req));
+        }
+    } else {
+        VLOG(2) << "Dropping " << reqs.size() << " requests due to stopping";
+    }
+    reqs.clear();
+}
+
+void RequestPipeline::workerLoop(Worker &w)
+{
+    salus::threading::set_thread_name("RpcDispatch");
+
+    std::vector<RawRequest> local;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> ul(w.mu);
+            w.cv.wait(ul, [&w]() { return w.stopping || !w.queue.empty(); });
+            local.swap(w.queue);
+            if (w.stopping) {
+                ul.unlock();
+                reject(local);
+                return;
+            }
+        }
+
+        for (auto &req : local) {
+            m_handler(std::move(req));
+        }
+        local.clear();
+    }
+}
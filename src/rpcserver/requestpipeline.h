@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_RPCSERVER_REQUESTPIPELINE_H
+#define SALUS_RPCSERVER_REQUESTPIPELINE_H
+
+#include "utils/zmqutils.h"
+
+#include <zmq.hpp>
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace executor {
+class EvenlopDef;
+} // namespace executor
+
+/**
+ * @brief A request as received from a ZMQ_ROUTER socket, with only the evenlop parsed.
+ */
+struct RawRequest
+{
+    sstl::MultiPartMessage identities;
+    std::unique_ptr<executor::EvenlopDef> evenlop;
+    zmq::message_t body;
+    // Frames following the body, e.g. tensor contents sent out of band
+    sstl::MultiPartMessage attachments;
+
+    RawRequest();
+    RawRequest(RawRequest &&);
+    RawRequest &operator=(RawRequest &&);
+    ~RawRequest();
+};
+
+/**
+ * @brief Second stage of the server front end. The receiving thread reads whatever is readable
+ * in one go with recvAvailable, and hands the batch to a fixed set of workers, which parse the
+ * body and route it. Requests of the same session always go to the same worker, so they are
+ * routed in the order received, while different sessions are parsed in parallel.
+ *
+ * The handler must not block, as that holds back every session on the worker. Blocking work,
+ * e.g. running a step, is posted to the IO pools of ZmqServer.
+ */
+class RequestPipeline
+{
+public:
+    using Handler = std::function<void(RawRequest &&)>;
+
+    /**
+     * @param handler called on worker threads with each request
+     * @param reject if given, called with each request that is not handled because the pipeline stopped
+     */
+    RequestPipeline(size_t numWorkers, Handler handler, Handler reject = nullptr);
+
+    ~RequestPipeline();
+
+    /**
+     * @brief Receive, without blocking, all complete messages readable on a ZMQ_ROUTER socket,
+     * but at most maxBatch of them. Malformed messages are logged and dropped.
+     * @returns number of requests appended to batch
+     */
+    static size_t recvAvailable(zmq::socket_t &sock, std::vector<RawRequest> &batch, size_t maxBatch);
+
+    /**
+     * @brief Queue all requests in batch to workers, leaving batch empty.
+     */
+    void submit(std::vector<RawRequest> &batch);
+
+    /**
+     * @brief Stop and join workers. Requests still queued, or submitted afterwards, are rejected.
+     */
+    void stop();
+
+    size_t numWorkers() const
+    {
+        return m_workers.size();
+    }
+
+private:
+    struct Worker;
+
+    void workerLoop(Worker &worker);
+
+    size_t workerOf(RawRequest &req) const;
+
+    void reject(std::vector<RawRequest> &reqs);
+
+    Handler m_handler;
+    Handler m_reject;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    // Reused by submit, which is only called from the receiving thread
+    std::vector<std::vector<RawRequest>> m_staging;
+};
+
+#endif // SALUS_RPCSERVER_REQUESTPIPELINE_H
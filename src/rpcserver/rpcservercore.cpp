@@ -27,13 +27,31 @@
 
 #include "protos.h"
 
-#include <functional>
-#include <unordered_map>
+#include <iterator>
 
 using namespace executor;
 using ::google::protobuf::Message;
 using std::unique_ptr;
 
+namespace {
+
+template<typename Request>
+ProtoPtr parseAs(const void *data, size_t len)
+{
+    return sstl::parseMessage<Request>(data, len);
+}
+
+template<typename Response>
+ProtoPtr errorAs(int32_t code, const std::string &message)
+{
+    auto resp = std::make_unique<Response>();
+    resp->mutable_result()->set_code(code);
+    resp->mutable_result()->set_message(message);
+    return resp;
+}
+
+} // namespace
+
 RpcServerCore::RpcServerCore()
 {
     OpLibraryRegistary::instance().initializeLibraries();
@@ -44,33 +62,71 @@ RpcServerCore::~RpcServerCore()
     OpLibraryRegistary::instance().uninitializeLibraries();
 }
 
-void RpcServerCore::dispatch(ZmqServer::Sender sender, const EvenlopDef &evenlop, const Message &request)
+struct RpcServerCore::ServiceEntry
+{
+    const char *typeName;
+    ProtoPtr (*parse)(const void *, size_t);
+    ProtoPtr (*error)(int32_t, const std::string &);
+    void (RpcServerCore::*handle)(ZmqServer::Sender &&, IOpLibrary *, const EvenlopDef &, const Message &);
+};
+
+const RpcServerCore::ServiceEntry *RpcServerCore::findService(const EvenlopDef &evenlop)
 {
-    // NOTE: this-> is need to workaround a bug in GCC 6.x where member function lookup is broken
-    // for generic lambda. See https://gcc.gnu.org/bugzilla/show_bug.cgi?id=61636
 #define ITEM(name) \
-        {"executor." #name "Request", [this](auto &&sender, auto *oplib, \
-                                             const auto &evenlop, const auto &request) { \
-            return this->name (std::move(sender), oplib, evenlop, static_cast<const name ## Request&>(request)); \
-        }},
-
-    using ServiceMethod = std::function<void(ZmqServer::Sender &&sender, IOpLibrary*,
-                                             const EvenlopDef&, const Message&)>;
-    static std::unordered_map<std::string, ServiceMethod> funcs {
+        {"executor." #name "Request", &parseAs<name ## Request>, &errorAs<name ## Response>, \
+         &RpcServerCore::invoke<name ## Request, &RpcServerCore::name>},
+
+    // Indexed by ServiceMethod
+    static constexpr ServiceEntry services[] = {
+        {"", nullptr, nullptr, nullptr},
         CALL_ALL_SERVICE_NAME(ITEM)
     };
 
 #undef ITEM
+    static_assert(std::size(services) == ServiceMethod_ARRAYSIZE,
+                  "ServiceMethod must follow CALL_ALL_SERVICE_NAME");
 
-    DCHECK(sender);
+    auto method = evenlop.method();
+    if (method > UNKNOWN_SERVICE_METHOD && method < ServiceMethod_ARRAYSIZE) {
+        return &services[method];
+    }
+    // Old clients only set type
+    for (size_t i = 1; i != std::size(services); ++i) {
+        if (evenlop.type() == services[i].typeName) {
+            return &services[i];
+        }
+    }
+    return nullptr;
+}
 
-    VLOG(2) << "Serving " << evenlop.type() << " for oplibrary " << OpLibraryType_Name(evenlop.oplibrary());
+RpcServerCore::ParsedRequest RpcServerCore::parseRequest(const EvenlopDef &evenlop, const void *data, size_t len)
+{
+    ParsedRequest parsed;
+    parsed.service = findService(evenlop);
+    if (!parsed.service) {
+        LOG(ERROR) << "Requested method not found: " << evenlop.type();
+        return parsed;
+    }
+    parsed.message = parsed.service->parse(data, len);
+    return parsed;
+}
 
-    auto fit = funcs.find(evenlop.type());
-    if (fit == funcs.end()) {
-        LOG(ERROR) << "Skipping request because requested method not found: " << evenlop.type();
-        return;
+ProtoPtr RpcServerCore::errorResponse(const EvenlopDef &evenlop, int32_t code, const std::string &message)
+{
+    auto service = findService(evenlop);
+    if (!service) {
+        return nullptr;
     }
+    return service->error(code, message);
+}
+
+void RpcServerCore::dispatch(ZmqServer::Sender sender, const EvenlopDef &evenlop, const ParsedRequest &request)
+{
+    DCHECK(sender);
+    DCHECK(request.service);
+    DCHECK(request.message);
+
+    VLOG(2) << "Serving " << evenlop.type() << " for oplibrary " << OpLibraryType_Name(evenlop.oplibrary());
 
     auto oplib = OpLibraryRegistary::instance().findOpLibrary(evenlop.oplibrary());
     if (!oplib) {
@@ -78,7 +134,7 @@ void RpcServerCore::dispatch(ZmqServer::Sender sender, const EvenlopDef &evenlop
         return;
     }
 
-    fit->second(std::move(sender), oplib, evenlop, request);
+    (this->*request.service->handle)(std::move(sender), oplib, evenlop, *request.message);
 }
 
 void RpcServerCore::Run(ZmqServer::Sender &&sender, IOpLibrary *oplib, const EvenlopDef &evenlop,
@@ -89,10 +145,14 @@ void RpcServerCore::Run(ZmqServer::Sender &&sender, IOpLibrary *oplib, const Eve
     VLOG(2) << "Serving RunRequest with opkernel id " << opdef.id();
     DCHECK(oplib->accepts(opdef));
 
-    oplib->onRun(sender, evenlop, request, [sender](auto resp) {
-        if (resp) {
-            sender->sendMessage(std::move(resp));
-        }
+    // The pipeline worker only routes, the library may run the kernel right away. request is freed
+    // once we return, hence the copies.
+    sender->postData([sender, oplib, evenlop, request]() {
+        oplib->onRun(sender, evenlop, request, [sender](auto resp) {
+            if (resp) {
+                sender->sendMessage(std::move(resp));
+            }
+        });
     });
 }
 
@@ -101,10 +161,12 @@ void RpcServerCore::RunGraph(ZmqServer::Sender &&sender, IOpLibrary *oplib, cons
 {
     VLOG(2) << "Serving RunGraphRequest";
 
-    oplib->onRunGraph(sender, evenlop, request, [sender](auto resp) {
-        if (resp) {
-            sender->sendMessage(std::move(resp));
-        }
+    sender->postData([sender, oplib, evenlop, request]() {
+        oplib->onRunGraph(sender, evenlop, request, [sender](auto resp) {
+            if (resp) {
+                sender->sendMessage(std::move(resp));
+            }
+        });
     });
 }
 
@@ -120,16 +182,18 @@ void RpcServerCore::Alloc(ZmqServer::Sender &&sender, IOpLibrary *oplib, const E
 
     VLOG(2) << "Serving AllocRequest with alignment " << alignment << " and num_bytes " << num_bytes;
 
-    auto ptr = MemoryMgr::instance().allocate(num_bytes, alignment);
-    auto addr_handle = reinterpret_cast<uint64_t>(ptr);
+    sender->postControl([sender, alignment, num_bytes]() {
+        auto ptr = MemoryMgr::instance().allocate(num_bytes, alignment);
+        auto addr_handle = reinterpret_cast<uint64_t>(ptr);
 
-    auto response = std::make_unique<AllocResponse>();
-    response->set_addr_handle(addr_handle);
+        auto response = std::make_unique<AllocResponse>();
+        response->set_addr_handle(addr_handle);
 
-    VLOG(2) << "Allocated address handel: " << as_hex(ptr);
+        VLOG(2) << "Allocated address handel: " << as_hex(ptr);
 
-    response->mutable_result()->set_code(0);
-    sender->sendMessage(std::move(response));
+        response->mutable_result()->set_code(0);
+        sender->sendMessage(std::move(response));
+    });
 }
 
 void RpcServerCore::Dealloc(ZmqServer::Sender &&sender, IOpLibrary *oplib, const EvenlopDef &evenlop,
@@ -144,16 +208,19 @@ void RpcServerCore::Dealloc(ZmqServer::Sender &&sender, IOpLibrary *oplib, const
 
     VLOG(2) << "Serving DeallocRequest with address handel: " << as_hex(ptr);
 
-    MemoryMgr::instance().deallocate(ptr);
+    sender->postControl([sender, ptr]() {
+        MemoryMgr::instance().deallocate(ptr);
 
-    auto response = std::make_unique<DeallocResponse>();
-    response->mutable_result()->set_code(0);
-    sender->sendMessage(std::move(response));
+        auto response = std::make_unique<DeallocResponse>();
+        response->mutable_result()->set_code(0);
+        sender->sendMessage(std::move(response));
+    });
 }
 
 void RpcServerCore::Custom(ZmqServer::Sender &&sender, IOpLibrary *oplib, const EvenlopDef &evenlop,
                            const CustomRequest &request)
 {
+    // Called inline, so requests of a session reach the library in order. It posts blocking work itself.
     oplib->onCustom(sender, evenlop, request, [sender](auto resp) {
         if (resp) {
             sender->sendMessage(std::move(resp));
@@ -25,6 +25,7 @@
 #include "utils/protoutils.h"
 
 #include <memory>
+#include <string>
 
 namespace executor {
 class RunRequest;
@@ -57,13 +58,50 @@ public:
     RpcServerCore();
 
     ~RpcServerCore();
+
+    struct ServiceEntry;
+
+    /**
+     * A request body parsed by parseRequest, along with the service handling it
+     */
+    struct ParsedRequest
+    {
+        const ServiceEntry *service = nullptr;
+        ProtoPtr message;
+    };
+
     /**
      * Dispatch the call.
      */
-    void dispatch(ZmqServer::Sender sender, const executor::EvenlopDef &evenlop,
-                  const ::google::protobuf::Message &request);
+    void dispatch(ZmqServer::Sender sender, const executor::EvenlopDef &evenlop, const ParsedRequest &request);
+
+    /**
+     * Parse the request body for evenlop.
+     * @returns a ParsedRequest with null message if the method is unknown or the body is malformatted
+     */
+    static ParsedRequest parseRequest(const executor::EvenlopDef &evenlop, const void *data, size_t len);
+
+    /**
+     * Make a response of the type expected for evenlop, carrying only an error status.
+     * @returns nullptr if the method is unknown
+     */
+    static ProtoPtr errorResponse(const executor::EvenlopDef &evenlop, int32_t code, const std::string &message);
 
 private:
+    /**
+     * Find the service by evenlop.method, or by evenlop.type for old clients
+     */
+    static const ServiceEntry *findService(const executor::EvenlopDef &evenlop);
+
+    template<typename Request,
+             void (RpcServerCore::*method)(ZmqServer::Sender &&, IOpLibrary *, const executor::EvenlopDef &,
+                                           const Request &)>
+    void invoke(ZmqServer::Sender &&sender, IOpLibrary *oplib, const executor::EvenlopDef &evenlop,
+                const ::google::protobuf::Message &request)
+    {
+        (this->*method)(std::move(sender), oplib, evenlop, static_cast<const Request &>(request));
+    }
+
 #define DECL_METHOD(name)                                                                                    \
     void name(ZmqServer::Sender &&sender, IOpLibrary *oplib, const executor::EvenlopDef &evenlop,            \
               const executor::name##Request &request);
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rpcserver/sendqueue.h"
+
+#include "platform/logging.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+namespace {
+
+struct ThreadProducer
+{
+    explicit ThreadProducer(std::shared_ptr<SendQueue::Queue> q)
+        : queue(std::move(q))
+        , token(*queue)
+    {
+    }
+
+    // Declared first so the token is destroyed, and its producer marked reusable, before the queue
+    std::shared_ptr<SendQueue::Queue> queue;
+    moodycamel::ProducerToken token;
+};
+
+// One per queue the thread pushed to, usually just the one of ZmqServer
+thread_local std::vector<std::unique_ptr<ThreadProducer>> tlsProducers;
+
+} // namespace
+
+SendQueue::SendQueue()
+    : m_queue(std::make_shared<Queue>(128))
+    , m_eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    CHECK(m_eventFd >= 0) << "Failed to create eventfd for send queue: " << std::strerror(errno);
+}
+
+SendQueue::~SendQueue()
+{
+    close(m_eventFd);
+}
+
+void SendQueue::push(sstl::MultiPartMessage &&parts)
+{
+    m_queue->enqueue(producer(), std::move(parts));
+    // Only the first push after a drain pays for the syscall
+    signal();
+}
+
+moodycamel::ProducerToken &SendQueue::producer()
+{
+    auto &producers = tlsProducers;
+    for (auto &p : producers) {
+        if (p->queue == m_queue) {
+            return p->token;
+        }
+    }
+    // Drop producers of queues gone since, of which we hold the last reference
+    producers.erase(std::remove_if(producers.begin(), producers.end(),
+                                   [](const auto &p) { return p->queue.use_count() == 1; }),
+                    producers.end());
+    return producers.emplace_back(std::make_unique<ThreadProducer>(m_queue))->token;
+}
+
+void SendQueue::signal()
+{
+    if (!m_signaled.exchange(true)) {
+        uint64_t one = 1;
+        while (write(m_eventFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+size_t SendQueue::drain(std::vector<sstl::MultiPartMessage> &out, size_t max)
+{
+    uint64_t count;
+    while (read(m_eventFd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+    // Rearm before dequeuing, so a push racing with us either is seen below or signals again
+    m_signaled.store(false);
+
+    auto n = m_queue->try_dequeue_bulk(std::back_inserter(out), max);
+    if (n == max) {
+        // There may be more left, keep fd() readable
+        signal();
+    }
+    return n;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SALUS_RPCSERVER_SENDQUEUE_H
+#define SALUS_RPCSERVER_SENDQUEUE_H
+
+#include "utils/zmqutils.h"
+
+#include <concurrentqueue.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Outgoing messages from any thread to the thread owning the ZMQ_ROUTER socket.
+ *
+ * Messages are moved into a lock free queue that reuses its blocks, so pushing doesn't allocate
+ * in steady state. The consumer polls fd() together with its sockets: it becomes readable when
+ * messages are pushed, but only the first push after each drain actually signals it, so a burst
+ * of responses costs one wakeup and is then flushed in one go.
+ *
+ * Each pushing thread uses its own explicit producer, which the queue reuses once the thread exits.
+ * Implicit producers would be kept until the queue is gone, one for every IO pool thread ever created.
+ */
+class SendQueue
+{
+public:
+    SendQueue();
+
+    ~SendQueue();
+
+    /**
+     * @brief Queue one message of identity frames, evenlop and body. Thread safe.
+     */
+    void push(sstl::MultiPartMessage &&parts);
+
+    /**
+     * @brief File descriptor to poll for ZMQ_POLLIN, signaled when there may be messages
+     */
+    int fd() const
+    {
+        return m_eventFd;
+    }
+
+    /**
+     * @brief Move at most max queued messages to the end of out. Must only be called from one
+     * thread. Messages pushed while draining, or left over, either are taken or keep fd() signaled.
+     * @returns number of messages taken
+     */
+    size_t drain(std::vector<sstl::MultiPartMessage> &out, size_t max);
+
+    /**
+     * @brief Whether all messages pushed so far have been drained. Only approximate while pushing.
+     */
+    bool empty() const
+    {
+        return m_queue->size_approx() == 0;
+    }
+
+    using Queue = moodycamel::ConcurrentQueue<sstl::MultiPartMessage>;
+
+private:
+    void signal();
+
+    /**
+     * @brief Producer of the calling thread, created on its first push
+     */
+    moodycamel::ProducerToken &producer();
+
+    // Also held by the producers of threads that pushed, as their tokens must not outlive it
+    std::shared_ptr<Queue> m_queue;
+    int m_eventFd;
+    // Whether fd() has been signaled since last drain
+    std::atomic_bool m_signaled{false};
+};
+
+#endif // SALUS_RPCSERVER_SENDQUEUE_H
@@ -0,0 +1,1022 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "rpcserver/shmtransport.h"
+
+#include "platform/logging.h"
+#include "platform/sharedmemory.h"
+#include "platform/thread_annotations.h"
+#include "utils/envutils.h"
+#include "utils/protoutils.h"
+#include "utils/threadutils.h"
+
+#include "protos.h"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+using namespace std::chrono_literals;
+using sstl::MultiPartMessage;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x53484d31; // "SHM1"
+constexpr size_t kPageSize = 4096;
+// Upper bound of waiting before checking whether the other side is still there
+constexpr auto kWaitTimeout = 100ms;
+// How often rings are checked for room while responses are waiting for it
+constexpr auto kRetryInterval = 1ms;
+// Like ZmqServer
+constexpr size_t kMaxRecvBatch = 64;
+constexpr size_t kMaxSendBatch = 256;
+// Sane ranges of the knobs, the segment is 2 * slots * (1 << shift) bytes
+constexpr uint32_t kMinSlots = 1;
+constexpr uint32_t kMaxSlots = 1024;
+// At least a page, at most 64MB per ring
+constexpr uint32_t kMinRingShift = 12;
+constexpr uint32_t kMaxRingShift = 26;
+// Bounds of a single message a peer may send, anything larger is treated as a broken peer
+constexpr uint32_t kMaxParts = 1024;
+constexpr uint64_t kMaxMessageRings = 64;
+
+/**
+ * @brief A futex word, which the ringing side only wakes if someone is waiting
+ */
+struct Doorbell
+{
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> waiting;
+};
+
+void ring(Doorbell &bell)
+{
+    bell.seq.fetch_add(1);
+    if (bell.waiting.load()) {
+        salus::ipc::futexWake(&bell.seq);
+    }
+}
+
+/**
+ * @brief Wait on bell unless ready() becomes true, or timeout
+ */
+template<typename Ready>
+void waitOn(Doorbell &bell, Ready &&ready, std::chrono::microseconds timeout)
+{
+    bell.waiting.fetch_add(1);
+    // Any ring after this load changes seq, so futexWait won't sleep through it
+    auto seq = bell.seq.load();
+    if (!ready()) {
+        salus::ipc::futexWait(&bell.seq, seq, timeout);
+    }
+    bell.waiting.fetch_sub(1);
+}
+
+struct RingHeader
+{
+    // Total bytes written, only advanced by the producer
+    alignas(64) std::atomic<uint64_t> head;
+    // Total bytes read, only advanced by the consumer
+    alignas(64) std::atomic<uint64_t> tail;
+    // Rung by the producer, unless the ring uses a shared doorbell
+    alignas(64) Doorbell data;
+    // Rung by the consumer
+    Doorbell space;
+};
+
+/**
+ * A client moves a slot from kFree (or kConnected of a dead client) to kClaiming, sets its pid,
+ * then asks the server for the slot with kRequested. Only the server resets the rings, bumps
+ * the generation and moves the slot to kConnected, so it never races with its own writes of
+ * responses to the previous client.
+ */
+enum SlotStatus : uint32_t
+{
+    kFree = 0,
+    kConnected = 1,
+    kClaiming = 2,
+    kRequested = 3,
+};
+
+struct SlotHeader
+{
+    alignas(64) std::atomic<uint32_t> status;
+    // Bumped by the server on each connection. Every message carries it, so a client on the slot
+    // never gets responses of the previous one
+    std::atomic<uint32_t> generation;
+    std::atomic<int32_t> pid;
+    RingHeader requests;
+    RingHeader responses;
+};
+
+struct SegmentHeader
+{
+    std::atomic<uint32_t> magic;
+    uint32_t numSlots;
+    uint64_t ringCapacity;
+    std::atomic<int32_t> serverPid;
+    // Rung by clients after writing requests, the server waits on all slots at once
+    alignas(64) Doorbell serverBell;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "shared memory atomics must be lock free");
+
+// What the synthesized identity frame of a request contains
+struct SlotId
+{
+    uint32_t slot;
+    uint32_t generation;
+};
+
+size_t roundUp(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+/**
+ * @brief Process local view of a single producer single consumer byte ring in the segment
+ */
+class ByteRing
+{
+public:
+    ByteRing(RingHeader &h, char *data, uint64_t capacity, Doorbell &dataBell)
+        : m_h(h)
+        , m_data(data)
+        , m_capacity(capacity)
+        , m_dataBell(dataBell)
+    {
+    }
+
+    uint64_t readable() const
+    {
+        return m_h.head.load() - m_h.tail.load();
+    }
+
+    /**
+     * @brief Whether the other side moved its counter so that the ring holds more than its capacity,
+     * after which nothing is read from or written to it
+     */
+    bool broken() const
+    {
+        return m_broken;
+    }
+
+    uint64_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    bool full() const
+    {
+        return readable() == m_capacity;
+    }
+
+    /**
+     * @returns number of bytes written, as many as fit
+     */
+    size_t tryWrite(const void *src, size_t len)
+    {
+        auto head = m_h.head.load(std::memory_order_relaxed);
+        auto used = head - m_h.tail.load(std::memory_order_acquire);
+        if (used > m_capacity) {
+            m_broken = true;
+            return 0;
+        }
+        auto n = std::min<uint64_t>(len, m_capacity - used);
+        if (n == 0) {
+            return 0;
+        }
+        copyIn(head, static_cast<const char *>(src), n);
+        m_h.head.store(head + n);
+        ring(m_dataBell);
+        return n;
+    }
+
+    /**
+     * @returns number of bytes read, as many as available
+     */
+    size_t tryRead(void *dst, size_t len)
+    {
+        auto tail = m_h.tail.load(std::memory_order_relaxed);
+        auto avail = m_h.head.load(std::memory_order_acquire) - tail;
+        if (avail > m_capacity) {
+            m_broken = true;
+            return 0;
+        }
+        auto n = std::min<uint64_t>(len, avail);
+        if (n == 0) {
+            return 0;
+        }
+        copyOut(tail, static_cast<char *>(dst), n);
+        m_h.tail.store(tail + n);
+        ring(m_h.space);
+        return n;
+    }
+
+    void waitSpace(std::chrono::microseconds timeout)
+    {
+        waitOn(m_h.space, [this]() { return !full(); }, timeout);
+    }
+
+    void waitData(std::chrono::microseconds timeout)
+    {
+        waitOn(m_dataBell, [this]() { return readable() > 0; }, timeout);
+    }
+
+    void reset()
+    {
+        m_h.head.store(0);
+        m_h.tail.store(0);
+    }
+
+private:
+    void copyIn(uint64_t pos, const char *src, size_t n)
+    {
+        auto off = pos & (m_capacity - 1);
+        auto first = std::min<uint64_t>(n, m_capacity - off);
+        std::memcpy(m_data + off, src, first);
+        std::memcpy(m_data, src + first, n - first);
+    }
+
+    void copyOut(uint64_t pos, char *dst, size_t n) const
+    {
+        auto off = pos & (m_capacity - 1);
+        auto first = std::min<uint64_t>(n, m_capacity - off);
+        std::memcpy(dst, m_data + off, first);
+        std::memcpy(dst + first, m_data, n - first);
+    }
+
+    RingHeader &m_h;
+    char *const m_data;
+    const uint64_t m_capacity;
+    Doorbell &m_dataBell;
+    bool m_broken = false;
+};
+
+/**
+ * @brief Write all of src, waiting while the ring is full
+ * @returns false if gave up because alive() turned false
+ */
+template<typename Alive>
+bool writeAll(ByteRing &ring, const void *src, size_t len, Alive &&alive)
+{
+    auto p = static_cast<const char *>(src);
+    while (len > 0) {
+        auto n = ring.tryWrite(p, len);
+        if (ring.broken()) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        if (n == 0) {
+            ring.waitSpace(kWaitTimeout);
+            if (ring.full() && !alive()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Wire format: u32 slot generation, u32 number of frames, then for each frame u64 size
+ * followed by its bytes
+ */
+template<typename Alive>
+bool writeMessage(ByteRing &ring, uint32_t generation, const zmq::message_t *begin, const zmq::message_t *end,
+                  Alive &&alive)
+{
+    uint32_t header[] = {generation, static_cast<uint32_t>(end - begin)};
+    if (!writeAll(ring, header, sizeof(header), alive)) {
+        return false;
+    }
+    for (auto it = begin; it != end; ++it) {
+        uint64_t size = it->size();
+        if (!writeAll(ring, &size, sizeof(size), alive) || !writeAll(ring, it->data(), size, alive)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+/**
+ * @brief Mapping of the segment: a header page or more, then request and response ring data of
+ * each slot.
+ */
+class ShmSegment
+{
+public:
+    static std::unique_ptr<ShmSegment> create(const std::string &name, uint32_t numSlots, uint64_t capacity)
+    {
+        auto size = totalSize(numSlots, capacity);
+        auto addr = salus::ipc::mapShared(name, size, true);
+        if (!addr && errno == EEXIST && removeStale(name)) {
+            addr = salus::ipc::mapShared(name, size, true);
+        }
+        if (!addr) {
+            return nullptr;
+        }
+        auto seg = std::unique_ptr<ShmSegment>(new ShmSegment(name, addr, size, numSlots, capacity, true));
+        // Fresh mapping is zero filled, which is a valid initial state for everything
+        auto &h = seg->header();
+        h.numSlots = numSlots;
+        h.ringCapacity = capacity;
+        h.serverPid.store(salus::ipc::currentPid());
+        h.magic.store(kMagic);
+        return seg;
+    }
+
+    static std::unique_ptr<ShmSegment> open(const std::string &name)
+    {
+        // Map the header first to learn the size
+        auto addr = salus::ipc::mapShared(name, kPageSize, false);
+        if (!addr) {
+            return nullptr;
+        }
+        auto &h = *static_cast<SegmentHeader *>(addr);
+        auto ok = h.magic.load() == kMagic;
+        auto numSlots = h.numSlots;
+        auto capacity = h.ringCapacity;
+        auto size = totalSize(numSlots, capacity);
+        salus::ipc::unmapShared(addr, kPageSize);
+        if (!ok) {
+            LOG(ERROR) << "Shared memory " << name << " is not a salus segment";
+            return nullptr;
+        }
+
+        addr = salus::ipc::mapShared(name, size, false);
+        if (!addr) {
+            return nullptr;
+        }
+        return std::unique_ptr<ShmSegment>(new ShmSegment(name, addr, size, numSlots, capacity, false));
+    }
+
+    ~ShmSegment()
+    {
+        salus::ipc::unmapShared(m_addr, m_size);
+        if (m_owner) {
+            salus::ipc::unlinkShared(m_name);
+        }
+    }
+
+    SegmentHeader &header()
+    {
+        return *static_cast<SegmentHeader *>(m_addr);
+    }
+
+    // Read once when mapped, the copy in the segment is writable by clients
+    uint32_t numSlots() const
+    {
+        return m_numSlots;
+    }
+
+    SlotHeader &slot(uint32_t i)
+    {
+        return slotsOf(m_addr)[i];
+    }
+
+    ByteRing requests(uint32_t i)
+    {
+        // All request rings share the server doorbell
+        return ByteRing(slot(i).requests, ringData(2 * i), m_capacity, header().serverBell);
+    }
+
+    ByteRing responses(uint32_t i)
+    {
+        return ByteRing(slot(i).responses, ringData(2 * i + 1), m_capacity, slot(i).responses.data);
+    }
+
+private:
+    /**
+     * @brief Remove an existing segment of the name, only if its server is gone
+     * @returns true if removed
+     */
+    static bool removeStale(const std::string &name)
+    {
+        auto seg = open(name);
+        if (!seg) {
+            LOG(ERROR) << "Refusing to replace shared memory " << name << ", remove it manually if it is unused";
+            return false;
+        }
+        auto pid = seg->header().serverPid.load();
+        if (salus::ipc::processAlive(pid)) {
+            LOG(ERROR) << "Shared memory " << name << " is in use by server " << pid;
+            return false;
+        }
+        seg.reset();
+        LOG(WARNING) << "Removing stale shared memory " << name << " of server " << pid;
+        salus::ipc::unlinkShared(name);
+        return true;
+    }
+
+    ShmSegment(std::string name, void *addr, size_t size, uint32_t numSlots, uint64_t capacity, bool owner)
+        : m_name(std::move(name))
+        , m_addr(addr)
+        , m_size(size)
+        , m_numSlots(numSlots)
+        , m_capacity(capacity)
+        , m_owner(owner)
+    {
+    }
+
+    static SlotHeader *slotsOf(void *addr)
+    {
+        return reinterpret_cast<SlotHeader *>(static_cast<char *>(addr) + roundUp(sizeof(SegmentHeader), 64));
+    }
+
+    static size_t headerSize(uint32_t numSlots)
+    {
+        return roundUp(roundUp(sizeof(SegmentHeader), 64) + numSlots * sizeof(SlotHeader), kPageSize);
+    }
+
+    static size_t totalSize(uint32_t numSlots, uint64_t capacity)
+    {
+        return headerSize(numSlots) + 2 * numSlots * capacity;
+    }
+
+    char *ringData(uint32_t idx)
+    {
+        return static_cast<char *>(m_addr) + headerSize(m_numSlots) + idx * m_capacity;
+    }
+
+    const std::string m_name;
+    void *const m_addr;
+    const size_t m_size;
+    const uint32_t m_numSlots;
+    const uint64_t m_capacity;
+    const bool m_owner;
+};
+
+/**
+ * @brief A response being written to a slot in the wire format of writeMessage. Written over
+ * several attempts if the client is slow to make room, without blocking other clients meanwhile.
+ */
+class PendingResponse
+{
+public:
+    PendingResponse(MultiPartMessage &&parts, size_t first, uint32_t generation)
+        : m_parts(std::move(parts))
+        , m_first(first)
+        , m_generation(generation)
+    {
+        m_header[0] = generation;
+        m_header[1] = static_cast<uint32_t>(m_parts->size() - first);
+        m_sizes.reserve(m_parts->size() - first);
+        for (auto i = first; i != m_parts->size(); ++i) {
+            m_sizes.push_back(m_parts->at(i).size());
+        }
+    }
+
+    uint32_t generation() const
+    {
+        return m_generation;
+    }
+
+    /**
+     * @brief Write as much as fits
+     * @returns true once all of it is written
+     */
+    bool writeTo(ByteRing &ring)
+    {
+        // Pieces are the header, then the size and data of each frame
+        const auto numPieces = 1 + 2 * m_sizes.size();
+        while (m_piece != numPieces) {
+            auto [data, len] = piece(m_piece);
+            m_offset += ring.tryWrite(data + m_offset, len - m_offset);
+            if (m_offset != len) {
+                return false;
+            }
+            m_offset = 0;
+            ++m_piece;
+        }
+        return true;
+    }
+
+private:
+    std::pair<const char *, size_t> piece(size_t idx)
+    {
+        if (idx == 0) {
+            return {reinterpret_cast<const char *>(m_header), sizeof(m_header)};
+        }
+        auto frame = (idx - 1) / 2;
+        if (idx % 2 == 1) {
+            return {reinterpret_cast<const char *>(&m_sizes[frame]), sizeof(uint64_t)};
+        }
+        auto &msg = m_parts->at(m_first + frame);
+        return {static_cast<const char *>(msg.data()), msg.size()};
+    }
+
+    MultiPartMessage m_parts;
+    size_t m_first;
+    uint32_t m_generation;
+    uint32_t m_header[2];
+    std::vector<uint64_t> m_sizes;
+    // Progress, as the piece being written and bytes of it already written
+    size_t m_piece = 0;
+    size_t m_offset = 0;
+};
+
+/**
+ * @brief Incrementally parses messages from a ring, as bytes become available
+ */
+class ShmFrameReader
+{
+public:
+    /**
+     * @brief Consume available bytes
+     * @returns true once a whole message is parsed, which is then got with take(). False if more
+     * bytes are needed, or the message is over the limits or the ring is broken, after which failed()
+     * is true.
+     */
+    bool readFrom(ByteRing &ring)
+    {
+        if (parse(ring)) {
+            return true;
+        }
+        if (ring.broken() && !m_failed) {
+            LOG(ERROR) << "Rejecting ring holding " << ring.readable() << " bytes over its capacity";
+            m_failed = true;
+        }
+        return false;
+    }
+
+    MultiPartMessage take()
+    {
+        return std::move(m_parts);
+    }
+
+    /**
+     * @brief Slot generation the last parsed message was sent with
+     */
+    uint32_t generation() const
+    {
+        return m_generation;
+    }
+
+    bool failed() const
+    {
+        return m_failed;
+    }
+
+    void reset()
+    {
+        m_stage = Stage::Count;
+        m_filled = 0;
+        m_failed = false;
+        m_parts = MultiPartMessage();
+    }
+
+private:
+    bool parse(ByteRing &ring)
+    {
+        while (!m_failed) {
+            switch (m_stage) {
+            case Stage::Count:
+                if (!readHeader(ring, 2 * sizeof(uint32_t))) {
+                    return false;
+                }
+                std::memcpy(&m_generation, m_header, sizeof(m_generation));
+                std::memcpy(&m_count, m_header + sizeof(m_generation), sizeof(m_count));
+                if (m_count > kMaxParts) {
+                    LOG(ERROR) << "Rejecting message of " << m_count << " parts";
+                    m_failed = true;
+                    return false;
+                }
+                m_parts->reserve(m_count);
+                m_bytes = 0;
+                m_stage = Stage::Size;
+                break;
+            case Stage::Size:
+                if (m_parts->size() == m_count) {
+                    m_stage = Stage::Count;
+                    return true;
+                }
+                if (!readHeader(ring, sizeof(uint64_t))) {
+                    return false;
+                }
+                uint64_t size;
+                std::memcpy(&size, m_header, sizeof(size));
+                if (size > kMaxMessageRings * ring.capacity() - m_bytes) {
+                    LOG(ERROR) << "Rejecting message part of " << size << " bytes after " << m_bytes << " bytes";
+                    m_failed = true;
+                    return false;
+                }
+                m_bytes += size;
+                m_parts->emplace_back(size);
+                m_stage = Stage::Data;
+                break;
+            case Stage::Data: {
+                auto &frame = m_parts->back();
+                auto dst = static_cast<char *>(frame.data());
+                m_filled += ring.tryRead(dst + m_filled, frame.size() - m_filled);
+                if (m_filled != frame.size()) {
+                    return false;
+                }
+                m_filled = 0;
+                m_stage = Stage::Size;
+                break;
+            }
+            }
+        }
+        return false;
+    }
+
+    bool readHeader(ByteRing &ring, size_t len)
+    {
+        m_filled += ring.tryRead(m_header + m_filled, len - m_filled);
+        if (m_filled != len) {
+            return false;
+        }
+        m_filled = 0;
+        return true;
+    }
+
+    enum class Stage
+    {
+        Count,
+        Size,
+        Data,
+    };
+    Stage m_stage = Stage::Count;
+    uint32_t m_generation = 0;
+    uint32_t m_count = 0;
+    uint64_t m_bytes = 0;
+    bool m_failed = false;
+    size_t m_filled = 0;
+    char m_header[sizeof(uint64_t)];
+    MultiPartMessage m_parts;
+};
+
+struct ShmServer::SlotState
+{
+    bool active = false;
+    uint32_t generation = 0;
+    ShmFrameReader reader;
+};
+
+ShmServer::ShmServer(std::string name, RequestPipeline &pipeline, SendQueue &sendQueue)
+    : m_name(std::move(name))
+    , m_pipeline(pipeline)
+    , m_sendQueue(sendQueue)
+{
+}
+
+ShmServer::~ShmServer()
+{
+    stop();
+}
+
+bool ShmServer::start()
+{
+    auto numSlots = std::clamp(sstl::fromEnvVar("SALUS_SHM_SLOTS", 16u), kMinSlots, kMaxSlots);
+    // Must be a power of 2
+    auto shift = std::clamp(sstl::fromEnvVar("SALUS_SHM_RING_SHIFT", 22u), kMinRingShift, kMaxRingShift);
+    auto capacity = uint64_t{1} << shift;
+    m_segment = ShmSegment::create(m_name, numSlots, capacity);
+    if (!m_segment) {
+        return false;
+    }
+    m_slotMu = std::make_unique<std::mutex[]>(numSlots);
+    LOG(INFO) << "Shared memory transport at " << kShmScheme << m_name << " with " << numSlots
+              << " slots of " << capacity << " bytes rings";
+
+    m_running = true;
+    m_recvThread = std::thread([this]() { recvLoop(); });
+    m_sendThread = std::thread([this]() { sendLoop(); });
+    return true;
+}
+
+void ShmServer::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+    ring(m_segment->header().serverBell);
+    m_recvThread.join();
+    m_sendThread.join();
+    m_segment.reset();
+}
+
+void ShmServer::recvLoop()
+{
+    salus::threading::set_thread_name("ShmRecvLoop");
+
+    auto &seg = *m_segment;
+    std::vector<SlotState> slots(seg.numSlots());
+    std::vector<RawRequest> batch;
+    batch.reserve(kMaxRecvBatch);
+
+    auto anyReadable = [&seg, &slots]() {
+        for (uint32_t i = 0; i != slots.size(); ++i) {
+            if (slots[i].active && seg.requests(i).readable() > 0) {
+                return true;
+            }
+            if (seg.slot(i).status.load() == kRequested) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    while (m_running) {
+        for (uint32_t i = 0; i != slots.size(); ++i) {
+            auto &sh = seg.slot(i);
+            auto &st = slots[i];
+            auto status = sh.status.load();
+            if (status == kRequested) {
+                acceptClient(i, st);
+                status = kConnected;
+            }
+            if (status != kConnected || sh.generation.load() != st.generation) {
+                st.active = false;
+                continue;
+            }
+
+            auto ring = seg.requests(i);
+            while (batch.size() < kMaxRecvBatch && st.reader.readFrom(ring)) {
+                auto frames = st.reader.take();
+                if (st.reader.generation() != st.generation) {
+                    LOG(ERROR) << "Skipped one request of stale generation " << st.reader.generation()
+                               << " on slot " << i;
+                    continue;
+                }
+                if (frames->size() < 2) {
+                    LOG(ERROR) << "Skipped one request due to no body found after evenlop";
+                    continue;
+                }
+
+                RawRequest req;
+                req.evenlop = sstl::parseMessage<executor::EvenlopDef>(frames->front().data(),
+                                                                      frames->front().size());
+                if (!req.evenlop) {
+                    LOG(ERROR) << "Skipped one request due to malformatted request evenlop received.";
+                    continue;
+                }
+                SlotId id{i, st.generation};
+                req.identities->emplace_back(&id, sizeof(id));
+                req.identities->emplace_back();
+                req.body = std::move(frames->at(1));
+                for (size_t f = 2; f < frames->size(); ++f) {
+                    req.attachments->emplace_back(std::move(frames->at(f)));
+                }
+                batch.emplace_back(std::move(req));
+            }
+            if (st.reader.failed()) {
+                dropClient(i, st);
+            }
+        }
+
+        if (!batch.empty()) {
+            VLOG(2) << "Received " << batch.size() << " requests";
+            m_pipeline.submit(batch);
+            continue;
+        }
+        waitOn(seg.header().serverBell, [&]() { return !m_running || anyReadable(); }, kWaitTimeout);
+    }
+}
+
+void ShmServer::acceptClient(uint32_t i, SlotState &st)
+{
+    auto &sh = m_segment->slot(i);
+    {
+        // route() may still be writing responses of the previous client
+        auto g = sstl::with_guard(m_slotMu[i]);
+        m_segment->requests(i).reset();
+        m_segment->responses(i).reset();
+        st.generation = sh.generation.load() + 1;
+        sh.generation.store(st.generation);
+        sh.status.store(kConnected);
+    }
+    st.active = true;
+    st.reader.reset();
+    // The client waits for the acknowledgement on its response doorbell
+    ring(sh.responses.data);
+    VLOG(2) << "Client " << sh.pid.load() << " connected on slot " << i << " generation " << st.generation;
+}
+
+void ShmServer::dropClient(uint32_t i, SlotState &st)
+{
+    LOG(ERROR) << "Disconnecting client " << m_segment->slot(i).pid.load() << " on slot " << i
+               << " due to malformed request";
+    auto &sh = m_segment->slot(i);
+    {
+        auto g = sstl::with_guard(m_slotMu[i]);
+        auto status = uint32_t{kConnected};
+        sh.status.compare_exchange_strong(status, kFree);
+    }
+    st.active = false;
+    st.reader.reset();
+    // Wake the client if it is waiting for responses
+    ring(sh.responses.data);
+}
+
+void ShmServer::sendLoop()
+{
+    salus::threading::set_thread_name("ShmSendLoop");
+
+    std::vector<MultiPartMessage> outgoing;
+    outgoing.reserve(kMaxSendBatch);
+    // Responses waiting for room in their slot's ring, in order
+    std::vector<std::deque<PendingResponse>> pending(m_segment->numSlots());
+    size_t numBlocked = 0;
+    pollfd pfd{m_sendQueue.fd(), POLLIN, 0};
+    while (m_running) {
+        // Clients don't notify the server of room, so rings are polled while something is waiting for it
+        auto timeout = numBlocked ? kRetryInterval : kWaitTimeout;
+        if (poll(&pfd, 1, std::chrono::milliseconds(timeout).count()) > 0) {
+            m_sendQueue.drain(outgoing, kMaxSendBatch);
+            for (auto &parts : outgoing) {
+                route(std::move(parts), pending);
+            }
+            outgoing.clear();
+        }
+
+        numBlocked = 0;
+        for (uint32_t i = 0; i != pending.size(); ++i) {
+            if (!pending[i].empty() && !flush(i, pending[i])) {
+                ++numBlocked;
+            }
+        }
+    }
+}
+
+bool ShmServer::clientAlive(uint32_t slot, uint32_t generation)
+{
+    auto &sh = m_segment->slot(slot);
+    return m_running && sh.status.load() == kConnected && sh.generation.load() == generation
+           && salus::ipc::processAlive(sh.pid.load());
+}
+
+bool ShmServer::flush(uint32_t slot, std::deque<PendingResponse> &queue)
+{
+    // Hold the slot so it is not handed over to a new client in the middle of a response
+    auto g = sstl::with_guard(m_slotMu[slot]);
+    auto ring = m_segment->responses(slot);
+    while (!queue.empty()) {
+        auto &resp = queue.front();
+        if (!clientAlive(slot, resp.generation()) || ring.broken()) {
+            VLOG(2) << "Dropping response to slot " << slot << " generation " << resp.generation()
+                    << " as the client is gone";
+        } else if (!resp.writeTo(ring)) {
+            if (!ring.broken()) {
+                return false;
+            }
+            continue;
+        }
+        queue.pop_front();
+    }
+    return true;
+}
+
+void ShmServer::route(MultiPartMessage &&parts, std::vector<std::deque<PendingResponse>> &pending)
+{
+    SlotId id{};
+    if (parts->empty() || parts->front().size() != sizeof(id)) {
+        LOG(ERROR) << "Dropping response with unknown identity";
+        return;
+    }
+    std::memcpy(&id, parts->front().data(), sizeof(id));
+    if (id.slot >= m_segment->numSlots()) {
+        LOG(ERROR) << "Dropping response to invalid slot " << id.slot;
+        return;
+    }
+
+    // Identity frames stop at an empty frame
+    auto first = std::find_if(parts->begin(), parts->end(), [](auto &m) { return m.size() == 0; });
+    if (first == parts->end()) {
+        LOG(ERROR) << "Dropping response without identity delimiter";
+        return;
+    }
+    auto firstIdx = static_cast<size_t>(std::distance(parts->begin(), first)) + 1;
+
+    // Behind earlier responses still waiting for room, if any
+    auto &queue = pending[id.slot];
+    queue.emplace_back(std::move(parts), firstIdx, id.generation);
+    if (queue.size() == 1) {
+        flush(id.slot, queue);
+    }
+}
+
+ShmClient::ShmClient(const std::string &name)
+    : m_segment(ShmSegment::open(name))
+    , m_reader(std::make_unique<ShmFrameReader>())
+{
+    if (!m_segment) {
+        return;
+    }
+
+    for (uint32_t i = 0; i != m_segment->numSlots(); ++i) {
+        auto &sh = m_segment->slot(i);
+        auto status = sh.status.load();
+        // Take over slots left by dead clients
+        if (status == kClaiming || status == kRequested
+            || (status == kConnected && salus::ipc::processAlive(sh.pid.load()))) {
+            continue;
+        }
+        if (!sh.status.compare_exchange_strong(status, kClaiming)) {
+            continue;
+        }
+        sh.pid.store(salus::ipc::currentPid());
+        auto oldGeneration = sh.generation.load();
+        sh.status.store(kRequested);
+        ring(m_segment->header().serverBell);
+
+        // The server resets the slot and acknowledges by moving it to kConnected
+        auto accepted = [&sh, oldGeneration]() {
+            return sh.status.load() == kConnected && sh.generation.load() != oldGeneration;
+        };
+        while (!accepted()) {
+            waitOn(sh.responses.data, accepted, kWaitTimeout);
+            if (!accepted() && !serverAlive()) {
+                LOG(ERROR) << "Server of shared memory " << name << " is gone";
+                m_segment.reset();
+                return;
+            }
+        }
+        m_slot = i;
+        m_generation = sh.generation.load();
+        return;
+    }
+
+    LOG(ERROR) << "No free slot in shared memory " << name;
+    m_segment.reset();
+}
+
+ShmClient::~ShmClient()
+{
+    if (m_segment) {
+        auto &sh = m_segment->slot(m_slot);
+        // Unless the server already dropped us and gave the slot to someone else
+        if (sh.generation.load() == m_generation) {
+            auto status = uint32_t{kConnected};
+            sh.status.compare_exchange_strong(status, kFree);
+        }
+    }
+}
+
+bool ShmClient::serverAlive() const
+{
+    return salus::ipc::processAlive(m_segment->header().serverPid.load());
+}
+
+bool ShmClient::alive() const
+{
+    auto &sh = m_segment->slot(m_slot);
+    return sh.status.load() == kConnected && sh.generation.load() == m_generation && serverAlive();
+}
+
+bool ShmClient::send(MultiPartMessage &&parts)
+{
+    DCHECK(connected());
+    auto ring = m_segment->requests(m_slot);
+    return writeMessage(ring, m_generation, parts->data(), parts->data() + parts->size(),
+                        [this]() { return alive(); });
+}
+
+MultiPartMessage ShmClient::recv()
+{
+    DCHECK(connected());
+    auto ring = m_segment->responses(m_slot);
+    while (true) {
+        while (!m_reader->readFrom(ring)) {
+            if (m_reader->failed()) {
+                m_reader->reset();
+                return {};
+            }
+            ring.waitData(kWaitTimeout);
+            if (ring.readable() == 0 && !alive()) {
+                m_reader->reset();
+                return {};
+            }
+        }
+        if (m_reader->generation() == m_generation) {
+            return m_reader->take();
+        }
+        LOG(ERROR) << "Skipped one response of stale generation " << m_reader->generation();
+        m_reader->take();
+    }
+}
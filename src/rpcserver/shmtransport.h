@@ -0,0 +1,154 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SALUS_RPCSERVER_SHMTRANSPORT_H
+#define SALUS_RPCSERVER_SHMTRANSPORT_H
+
+#include "rpcserver/requestpipeline.h"
+#include "rpcserver/sendqueue.h"
+#include "utils/zmqutils.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Address prefix selecting the shared memory transport, e.g. shm://salus
+ */
+constexpr const char kShmScheme[] = "shm://";
+
+class ShmSegment;
+class ShmFrameReader;
+class PendingResponse;
+
+/**
+ * @brief Shared memory transport for clients on the same host, used instead of the ZMQ_ROUTER
+ * socket of ZmqServer.
+ *
+ * The server creates a named segment with a fixed number of client slots. A client claims a free
+ * slot, after which each direction is a single producer single consumer byte ring. Messages of
+ * any size stream through it, with one copy on each side. Waiting is on futexes inside the
+ * segment, which are only woken when the other side actually sleeps.
+ *
+ * Messages are frames like on ZeroMQ minus identity frames: evenlop, body, then attachments.
+ * Requests get a synthesized identity naming their slot, by which responses taken from the
+ * SendQueue are routed back. Thus evenlop recvIdentity is not supported.
+ */
+class ShmServer
+{
+public:
+    ShmServer(std::string name, RequestPipeline &pipeline, SendQueue &sendQueue);
+
+    ~ShmServer();
+
+    /**
+     * @brief Create the segment and start serving
+     * @returns false if the segment could not be created
+     */
+    bool start();
+
+    /**
+     * @brief Stop serving and remove the segment. Idempotent.
+     */
+    void stop();
+
+private:
+    struct SlotState;
+
+    void recvLoop();
+    void sendLoop();
+
+    /**
+     * @brief Acknowledge a client requesting the slot, after resetting it for a new generation
+     */
+    void acceptClient(uint32_t slot, SlotState &st);
+
+    /**
+     * @brief Disconnect a client that sent something unparsable, as its stream can't be recovered
+     */
+    void dropClient(uint32_t slot, SlotState &st);
+
+    /**
+     * @brief Queue one response for the client named by its identity frames, and write as much of
+     * the slot's queue as fits without waiting
+     */
+    void route(sstl::MultiPartMessage &&parts, std::vector<std::deque<PendingResponse>> &pending);
+
+    /**
+     * @brief Write queued responses of slot until its ring is full. Drops those of a gone client.
+     * @returns true if the queue is now empty
+     */
+    bool flush(uint32_t slot, std::deque<PendingResponse> &queue);
+
+    bool clientAlive(uint32_t slot, uint32_t generation);
+
+    const std::string m_name;
+    RequestPipeline &m_pipeline;
+    SendQueue &m_sendQueue;
+
+    std::unique_ptr<ShmSegment> m_segment;
+    // Serializes writing responses to a slot with handing it over to a new client
+    std::unique_ptr<std::mutex[]> m_slotMu;
+    std::atomic_bool m_running{false};
+    std::thread m_recvThread;
+    std::thread m_sendThread;
+};
+
+/**
+ * @brief Client side of ShmServer, for C++ clients and benchmarks. Not thread safe.
+ */
+class ShmClient
+{
+public:
+    explicit ShmClient(const std::string &name);
+
+    ~ShmClient();
+
+    bool connected() const
+    {
+        return m_segment != nullptr;
+    }
+
+    /**
+     * @brief Send a request of evenlop, body and attachments, waiting while the ring is full.
+     * @returns false if the server is gone
+     */
+    bool send(sstl::MultiPartMessage &&parts);
+
+    /**
+     * @brief Wait for the next response of evenlop, body and attachments.
+     * @returns empty message if the server is gone
+     */
+    sstl::MultiPartMessage recv();
+
+private:
+    bool serverAlive() const;
+    // Server is alive and the slot is still ours
+    bool alive() const;
+
+    std::unique_ptr<ShmSegment> m_segment;
+    std::unique_ptr<ShmFrameReader> m_reader;
+    uint32_t m_slot = 0;
+    uint32_t m_generation = 0;
+};
+
+#endif // SALUS_RPCSERVER_SHMTRANSPORT_H
@@ -23,25 +23,45 @@
 #include "platform/logging.h"
 #include "platform/signals.h"
 #include "platform/thread_annotations.h"
+#include "utils/envutils.h"
 #include "utils/protoutils.h"
 
 #include "protos.h"
 
+#include <algorithm>
 #include <functional>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 
 using namespace std::literals::chrono_literals;
 
 namespace {
-constexpr const char kBeAddr[] = "inproc://backend";
+// Upper bound of messages received in one go, so sending out isn't delayed for too long
+constexpr size_t kMaxRecvBatch = 64;
+// Likewise for messages sent out in one go, and bound of those waiting for a slow client
+constexpr size_t kMaxSendBatch = 256;
+// How often to retry messages to clients not reading fast enough. The ROUTER socket always
+// reports POLLOUT, so there is nothing to wait on for a particular client.
+constexpr long kSendRetryMs = 1;
+// How long to wait on stopping for replies to rejected requests to go out
+constexpr auto kStopFlushTimeout = 1s;
+// Code of replies to rejected requests, UNAVAILABLE in the TensorFlow error codes clients understand
+constexpr int32_t kUnavailable = 14;
+
+size_t numDispatchWorkers()
+{
+    auto def = std::max<size_t>(std::thread::hardware_concurrency() / 4, 2);
+    return sstl::fromEnvVar("SALUS_RPC_DISPATCH_WORKERS", def);
+}
 } // namespace
 
-ZmqServer::ZmqServer()
+ZmqServer::ZmqServer(salus::IOThreadPoolOptions control, salus::IOThreadPoolOptions data)
     : m_zmqCtx(1)
     , m_keepRunning(false)
     , m_pLogic(std::make_unique<RpcServerCore>())
-    , m_sendQueue(128)
+    , m_controlPool(std::move(control))
+    , m_dataPool(std::move(data))
 {
 }
 
@@ -58,9 +78,20 @@ void ZmqServer::start(const std::string& address)
     }
 
     m_keepRunning = true;
-    m_recvThread = std::make_unique<std::thread>(std::bind(&ZmqServer::proxyRecvLoop, this, address));
+    m_pipeline = std::make_unique<RequestPipeline>(numDispatchWorkers(),
+                                                   [this](RawRequest &&req) { dispatch(std::move(req)); },
+                                                   [this](RawRequest &&req) { reject(std::move(req)); });
+
+    // Co-located clients may use shared memory instead
+    if (address.compare(0, std::strlen(kShmScheme), kShmScheme) == 0) {
+        m_shm = std::make_unique<ShmServer>(address.substr(std::strlen(kShmScheme)), *m_pipeline, m_sendQueue);
+        if (!m_shm->start()) {
+            LOG(FATAL) << "Error while creating shared memory transport at " << address;
+        }
+        return;
+    }
 
-    m_sendThread = std::make_unique<std::thread>(std::bind(&ZmqServer::sendLoop, this));
+    m_recvThread = std::make_unique<std::thread>(std::bind(&ZmqServer::proxyRecvLoop, this, address));
 }
 
 bool ZmqServer::pollWithCheck(const std::vector<zmq::pollitem_t> &items, long timeout)
@@ -88,16 +119,12 @@ void ZmqServer::proxyRecvLoop(const std::string &feAddr)
 {
     VLOG(2) << "Started recving and sending loop";
     zmq::socket_t m_frontend_sock(m_zmqCtx, zmq::socket_type::router);
-    zmq::socket_t m_backend_sock(m_zmqCtx, zmq::socket_type::pair);
     m_frontend_sock.setsockopt(ZMQ_ROUTER_MANDATORY, 1);
     m_frontend_sock.setsockopt(ZMQ_ROUTER_HANDOVER, 1);
 
     try {
         VLOG(2) << "Binding frontend socket to address: " << feAddr;
         m_frontend_sock.bind(feAddr);
-
-        VLOG(2) << "Binding backend socket to address: " << kBeAddr;
-        m_backend_sock.bind(kBeAddr);
     } catch (zmq::error_t &err) {
         LOG(FATAL) << "Error while binding sockets: " << err;
         // re-throw to stop the process
@@ -105,154 +132,153 @@ void ZmqServer::proxyRecvLoop(const std::string &feAddr)
     }
 
     // set up pulling.
-    // we are interested in POLLIN and POLLOUT on m_frontend_sock, and POLLIN out m_backend_sock.
-    // messages received on m_frontend_sock are directly dispatched using m_pLogic,
-    // messages received on m_backend_sock are forwarded to m_frontend_sock.
-
-    static std::vector<zmq::pollitem_t> pollin_events {
+    // messages received on m_frontend_sock are handed to m_pipeline,
+    // messages queued in m_sendQueue are sent out on m_frontend_sock.
+    // Messages to clients whose pipe is full are kept in outgoing and retried every kSendRetryMs,
+    // while more from m_sendQueue are taken as long as outgoing has room.
+    std::vector<zmq::pollitem_t> events {
         {m_frontend_sock, 0, ZMQ_POLLIN, 0},
-        {m_backend_sock, 0, ZMQ_POLLIN, 0},
-    };
-    static std::vector<zmq::pollitem_t> all_events {
-        {m_frontend_sock, 0, ZMQ_POLLIN | ZMQ_POLLOUT, 0},
-        {m_backend_sock, 0, ZMQ_POLLIN, 0},
+        {nullptr, m_sendQueue.fd(), ZMQ_POLLIN, 0},
     };
-    std::vector<zmq::pollitem_t> *wait_events = &pollin_events;
 
-    bool canSendOut = false;
-    bool needSendOut = false;
-    bool shouldDispatch = false;
+    std::vector<RawRequest> batch;
+    batch.reserve(kMaxRecvBatch);
+    std::vector<MultiPartMessage> outgoing;
+    outgoing.reserve(kMaxSendBatch);
     while (m_keepRunning) {
-        // first blocking wait on pollin (read) events
-        VLOG(2) << "Blocking pool on " << (wait_events == &pollin_events ? "pollin events" : "all events");
-        if (!pollWithCheck(*wait_events, -1)) {
-            break;
-        }
-        // something happened, so we poll w/o waiting on all_events
-        // to set events in all_events
-        VLOG(2) << "Non-blocking poll on all events";
-        if (!pollWithCheck(all_events, 0)) {
+        events[1].events = outgoing.size() < kMaxSendBatch ? ZMQ_POLLIN : 0;
+        auto timeout = outgoing.empty() ? -1 : kSendRetryMs;
+        VLOG(2) << "Blocking poll with " << outgoing.size() << " messages pending";
+        if (!pollWithCheck(events, timeout)) {
             break;
         }
 
-        // process events
-        for (auto item : all_events) {
-            if (item.socket == m_frontend_sock) {
-                shouldDispatch = (item.revents & ZMQ_POLLIN) != 0;
-                canSendOut = (item.revents & ZMQ_POLLOUT) != 0;
-            } else if (item.socket == m_backend_sock) {
-                needSendOut = (item.revents & ZMQ_POLLIN) != 0;
-            }
+        auto shouldDispatch = (events[0].revents & ZMQ_POLLIN) != 0;
+        if (events[1].revents & ZMQ_POLLIN) {
+            m_sendQueue.drain(outgoing, kMaxSendBatch - outgoing.size());
         }
-        VLOG(3) << "Events summary: shouldDispatch=" << shouldDispatch
-                << ", canSendOut=" << canSendOut << ", needSendOut=" << needSendOut;
+        VLOG(3) << "Events summary: shouldDispatch=" << shouldDispatch << ", pending=" << outgoing.size();
 
-        // process dispatch if any
+        // receive everything available and hand to the pipeline
         if (shouldDispatch) {
-            dispatch(m_frontend_sock);
-            shouldDispatch = false;
+            auto n = RequestPipeline::recvAvailable(m_frontend_sock, batch, kMaxRecvBatch);
+            VLOG(2) << "Received " << n << " requests";
+            m_pipeline->submit(batch);
         }
 
-        // forward any send message
-        if (needSendOut && canSendOut) {
-            VLOG(2) << "Forwarding message out";
-            zmq::message_t msg;
-            bool more = false;
-            while (true) {
-                try {
-                    m_backend_sock.recv(&msg);
-                    VLOG(2) << "Forwarding message part: " << msg;
-                    more = m_backend_sock.getsockopt<int64_t>(ZMQ_RCVMORE);
-                    m_frontend_sock.send(msg, more ? ZMQ_SNDMORE : 0);
-                    if (!more)
-                        break;
-                } catch (zmq::error_t &err) {
-                    LOG(ERROR) << "Dropping message part while sending out due to error: " << err;
-                    if (!more)
-                        break;
-                }
-            }
-            needSendOut = canSendOut = false;
-            wait_events = &pollin_events;
-        } else if (needSendOut) {
-            // should also wait for POLLOUT on m_frontend_sock
-            wait_events = &all_events;
-        } else if (canSendOut) {
-            // only wait for POLLIN on sockets
-            wait_events = &pollin_events;
+        // flush all drained messages in one burst
+        if (!outgoing.empty()) {
+            auto sent = sendAvailable(m_frontend_sock, outgoing);
+            VLOG(2) << "Sent " << sent << " messages out, " << outgoing.size() << " pending";
         }
     }
 }
 
-void ZmqServer::dispatch(zmq::socket_t &sock)
+/*static*/ size_t ZmqServer::sendAvailable(zmq::socket_t &sock, std::vector<MultiPartMessage> &outgoing)
 {
-    MultiPartMessage identities;
-    zmq::message_t evenlop;
-    zmq::message_t body;
-    try {
-        VLOG(2) << "==============================================================";
-        // First receive all identity frames added by ZMQ_ROUTER socket
-        identities->emplace_back();
-        sock.recv(&identities->back());
-        VLOG(2) << "Received identity frame " << (identities->size() - 1) << ": " << identities->back();
-        // Identity frames stop at an empty message
-        // ZMQ_RCVMORE is a int64_t according to doc, not a bool
-        while (identities->back().size() != 0 && sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
-            identities->emplace_back();
-            sock.recv(&identities->back());
-            VLOG(2) << "Received identity frame " << (identities->size() - 1) << ": " << identities->back();
-        }
-        if (!sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
-            LOG(ERROR) << "Skipped one iteration due to no body message part found after identity frames";
-            return;
+    // Identities of clients whose pipe is full. Rare, so a linear scan of copies is fine.
+    std::vector<std::string> blocked;
+    auto isBlocked = [&blocked](const zmq::message_t &identity) {
+        return std::any_of(blocked.begin(), blocked.end(), [&identity](const auto &b) {
+            return b.size() == identity.size() && std::memcmp(b.data(), identity.data(), b.size()) == 0;
+        });
+    };
+
+    size_t sent = 0;
+    size_t kept = 0;
+    for (size_t idx = 0; idx != outgoing.size(); ++idx) {
+        auto &parts = outgoing[idx];
+        auto &identity = parts->front();
+        // Later messages to a blocked client are kept too, so they go out in order
+        auto keep = isBlocked(identity);
+        if (!keep) {
+            const auto numParts = parts->size();
+            try {
+                // Once the first part is accepted, the rest of the message is too
+                if (sock.send(identity, (numParts > 1 ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT)) {
+                    for (size_t i = 1; i != numParts; ++i) {
+                        sock.send(parts->at(i), i + 1 != numParts ? ZMQ_SNDMORE : 0);
+                    }
+                    ++sent;
+                } else {
+                    blocked.emplace_back(identity.data<char>(), identity.size());
+                    keep = true;
+                }
+            } catch (zmq::error_t &err) {
+                LOG(ERROR) << "Dropping message while sending out due to error: " << err;
+            }
         }
-        // Now receive our message
-        sock.recv(&evenlop);
-        VLOG(2) << "Received evenlop frame: " << evenlop;
-        if (!sock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
-            LOG(ERROR) << "Skipped one iteration due to no body message part found after identity frames";
-            return;
+        if (keep) {
+            if (kept != idx) {
+                outgoing[kept] = std::move(parts);
+            }
+            ++kept;
         }
-        // NOTE: we only assume there's only one body part.
-        sock.recv(&body);
-        VLOG(2) << "Received body frame: " << body;
-    } catch (zmq::error_t &err) {
-        LOG(ERROR) << "Skipped one iteration due to error while receiving: " << err;
-        return;
     }
+    outgoing.erase(outgoing.begin() + kept, outgoing.end());
+    return sent;
+}
 
-    m_iopool.post([this, identities{std::move(identities)}, evenlop{std::move(evenlop)}, body{std::move(body)}]() mutable {
-        auto pEvenlop = sstl::createMessage<executor::EvenlopDef>("executor.EvenlopDef", evenlop.data(), evenlop.size());
-        if (!pEvenlop) {
-            LOG(ERROR) << "Skipped one iteration due to malformatted request evenlop received.";
-            return;
-        }
-        VLOG(2) << "Received request evenlop: " << *pEvenlop;
+ZmqServer::Sender ZmqServer::makeSender(RawRequest &req)
+{
+    const auto &evenlop = *req.evenlop;
 
-        // step 1. replace the first frame in identity with the requested identity and make a sender
-        if (!pEvenlop->recvidentity().empty()) {
-            identities->front().rebuild(pEvenlop->recvidentity().data(), pEvenlop->recvidentity().size());
-        }
-        auto sender = std::make_shared<SenderImpl>(*this, pEvenlop->seq(), std::move(identities));
+    // replace the first frame in identity with the requested identity
+    if (!evenlop.recvidentity().empty()) {
+        req.identities->front().rebuild(evenlop.recvidentity().data(), evenlop.recvidentity().size());
+    }
+    return std::make_shared<SenderImpl>(*this, evenlop.seq(), std::move(req.identities),
+                                        std::move(req.attachments));
+}
 
-        // step 2. create request object
-        auto pRequest = sstl::createMessage(pEvenlop->type(), body.data(), body.size());
-        if (!pRequest) {
-            LOG(ERROR) << "Skipped one iteration due to malformatted request received.";
-            return;
-        }
-        VLOG(2) << "Received request body byte array size " << body.size();
+void ZmqServer::dispatch(RawRequest &&req)
+{
+    const auto &evenlop = *req.evenlop;
 
-        // step 3. dispatch
-        m_pLogic->dispatch(std::move(sender), *pEvenlop, *pRequest);
-    });
+    // step 1. make a sender
+    auto sender = makeSender(req);
+
+    // step 2. create request object
+    auto request = RpcServerCore::parseRequest(evenlop, req.body.data(), req.body.size());
+    if (!request.message) {
+        LOG(ERROR) << "Skipped one iteration due to malformatted request received.";
+        return;
+    }
+    VLOG(2) << "Received request body byte array size " << req.body.size();
+
+    // step 3. dispatch
+    m_pLogic->dispatch(std::move(sender), evenlop, request);
+}
+
+void ZmqServer::reject(RawRequest &&req)
+{
+    const auto &evenlop = *req.evenlop;
+    auto resp = RpcServerCore::errorResponse(evenlop, kUnavailable, "Server is stopping");
+    if (!resp) {
+        LOG(ERROR) << "Dropping request of unknown method " << evenlop.type() << " due to stopping";
+        return;
+    }
+    VLOG(2) << "Rejecting request of seq " << evenlop.seq() << " due to stopping";
+    makeSender(req)->sendMessage(std::move(resp));
 }
 
-ZmqServer::SenderImpl::SenderImpl(ZmqServer &server, uint64_t seq, MultiPartMessage &&identities)
+ZmqServer::SenderImpl::SenderImpl(ZmqServer &server, uint64_t seq, MultiPartMessage &&identities,
+                                  MultiPartMessage &&attachments)
     : m_server(server)
     , m_identities(std::move(identities))
     , m_seq(seq)
+    , m_attachments(std::move(attachments))
+{
+}
+
+MultiPartMessage ZmqServer::SenderImpl::takeAttachments()
 {
+    return std::move(m_attachments);
+}
+
+void ZmqServer::SenderImpl::attachToReply(MultiPartMessage &&frames)
+{
+    m_replyAttachments.merge(std::move(frames));
 }
 
 void ZmqServer::SenderImpl::sendMessage(ProtoPtr &&msg)
@@ -261,6 +287,7 @@ void ZmqServer::SenderImpl::sendMessage(ProtoPtr &&msg)
     parts->emplace_back(msg->ByteSizeLong());
     auto &reply = parts->back();
     msg->SerializeToArray(reply.data(), reply.size());
+    parts.merge(std::move(m_replyAttachments));
     sendMessage(msg->GetTypeName(), std::move(parts));
 }
 
@@ -288,36 +315,7 @@ uint64_t ZmqServer::SenderImpl::sequenceNumber() const
 
 void ZmqServer::sendMessage(MultiPartMessage &&parts)
 {
-    m_sendQueue.push({parts.release()});
-}
-
-void ZmqServer::sendLoop()
-{
-    salus::threading::set_thread_name("ZmqSendLoop");
-
-    zmq::socket_t sock(m_zmqCtx, zmq::socket_type::pair);
-    sock.connect(kBeAddr);
-    VLOG(2) << "Sending loop started";
-
-    while (m_keepRunning) {
-        SendItem item;
-        if(!m_sendQueue.pop(item)) {
-            std::this_thread::sleep_for(1ms);
-            continue;
-        }
-        // Wrap the address in smart pointer immediately so we won't risk memory leak.
-        MultiPartMessage parts(item.p_parts);
-        try {
-            for (size_t i = 0; i != parts->size() - 1; ++i) {
-                auto &msg = parts->at(i);
-                sock.send(msg, ZMQ_SNDMORE);
-            }
-            sock.send(parts->back());
-            VLOG(2) << "Response sent on internal socket";
-        } catch (zmq::error_t &err) {
-            LOG(ERROR) << "Sending error: " << err;
-        }
-    }
+    m_sendQueue.push(std::move(parts));
 }
 
 void ZmqServer::requestStop()
@@ -329,6 +327,9 @@ void ZmqServer::requestStop()
     VLOG(2) << "Stopping ZMQ context";
     m_keepRunning = false;
     m_zmqCtx.close();
+    if (m_shm) {
+        m_shm->stop();
+    }
 }
 
 void ZmqServer::join()
@@ -340,12 +341,19 @@ void ZmqServer::join()
     }
 
     LOG(INFO) << "Stopping ZmqServer";
-    requestStop();
 
-    if (m_sendThread && m_sendThread->joinable()) {
-        m_sendThread->join();
+    // Stop the pipeline while the transport is still up, so requests queued or received
+    // from now on get an error reply, and give those replies a moment to go out
+    if (m_pipeline) {
+        m_pipeline->stop();
+        auto deadline = std::chrono::steady_clock::now() + kStopFlushTimeout;
+        while (!m_sendQueue.empty() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(1ms);
+        }
     }
 
+    requestStop();
+
     if (m_recvThread && m_recvThread->joinable()) {
         m_recvThread->join();
     }
@@ -21,13 +21,14 @@
 #define ZMQSERVER_H
 
 #include "rpcserver/iothreadpool.h"
+#include "rpcserver/requestpipeline.h"
+#include "rpcserver/sendqueue.h"
+#include "rpcserver/shmtransport.h"
 #include "utils/protoutils.h"
 #include "utils/zmqutils.h"
 
 #include <zmq.hpp>
 
-#include <boost/lockfree/queue.hpp>
-
 #include <atomic>
 #include <vector>
 #include <memory>
@@ -44,13 +45,21 @@ class RpcServerCore;
 class ZmqServer
 {
 public:
-    ZmqServer();
+    /**
+     * @param control options of the pool for control plane requests, e.g. session setup and teardown
+     * @param data options of the pool for data plane requests, i.e. running steps. Steps may block on each
+     * other, e.g. a queue dequeue waiting for an enqueue, so it should grow as soon as a task has to wait.
+     */
+    explicit ZmqServer(salus::IOThreadPoolOptions control = {"IOControl", 2, 0},
+                       salus::IOThreadPoolOptions data = {"IOData", 0, 0, 1});
 
     ~ZmqServer();
 
     /**
      * Start the server, must be called in the same thread as the constructor. Will blocks until
      * stop is called in another thread or ctrl-c signal received.
+     *
+     * address is a ZeroMQ endpoint, or shm://<name> to serve co-located clients over shared memory.
      */
     void start(const std::string &address);
 
@@ -61,29 +70,49 @@ public:
     class SenderImpl
     {
     public:
-        SenderImpl(ZmqServer &server, uint64_t seq, MultiPartMessage &&m_identities);
+        SenderImpl(ZmqServer &server, uint64_t seq, MultiPartMessage &&m_identities,
+                   MultiPartMessage &&attachments = {});
 
         void sendMessage(ProtoPtr &&msg);
         void sendMessage(const std::string &typeName, MultiPartMessage &&msg);
 
         uint64_t sequenceNumber() const;
 
+        /**
+         * @brief Take frames that followed the request body
+         */
+        MultiPartMessage takeAttachments();
+
+        /**
+         * @brief Frames to be sent after the body of the next message sent with sendMessage(ProtoPtr&&).
+         * Not thread safe, must be called on the thread that then sends the reply.
+         */
+        void attachToReply(MultiPartMessage &&frames);
+
+        /**
+         * @brief Run blocking control plane work, e.g. creating a session, off the dispatch workers
+         */
         template<typename Func>
-        auto post(Func &&f)
+        auto postControl(Func &&f)
         {
-            return m_server.m_iopool.post(std::forward<Func>(f));
+            return m_server.m_controlPool.post(std::forward<Func>(f));
         }
 
+        /**
+         * @brief Run blocking data plane work, e.g. a step, off the dispatch workers
+         */
         template<typename Func>
-        auto defer(Func &&f)
+        auto postData(Func &&f)
         {
-            return m_server.m_iopool.defer(std::forward<Func>(f));
+            return m_server.m_dataPool.post(std::forward<Func>(f));
         }
 
     private:
         ZmqServer &m_server;
         MultiPartMessage m_identities;
         uint64_t m_seq;
+        MultiPartMessage m_attachments;
+        MultiPartMessage m_replyAttachments;
     };
     using Sender = std::shared_ptr<SenderImpl>;
 
@@ -93,39 +122,60 @@ private:
      */
     void sendMessage(MultiPartMessage &&parts);
 
-    void sendLoop();
     void proxyRecvLoop(const std::string &feAddr);
 
+    /**
+     * Send out messages without blocking. Messages to a client whose pipe is full, and any after them
+     * to the same client, are kept in outgoing in order, so one slow client doesn't hold back others.
+     * @returns number of messages sent
+     */
+    static size_t sendAvailable(zmq::socket_t &sock, std::vector<MultiPartMessage> &outgoing);
+
     /**
      * Poll on items with check
      */
     bool pollWithCheck(const std::vector<zmq::pollitem_t> &items, long timeout);
 
     /**
-     * Read a whole message from m_frontend_sock, and dispatch using m_pLogic
+     * Parse the request body and dispatch using m_pLogic. Called on pipeline workers.
      */
-    void dispatch(zmq::socket_t &sock);
+    void dispatch(RawRequest &&req);
+
+    /**
+     * Reply to a request the pipeline won't dispatch because it is stopping
+     */
+    void reject(RawRequest &&req);
+
+    /**
+     * Make a sender replying to the client of req, taking its identities and attachments
+     */
+    Sender makeSender(RawRequest &req);
 
 private:
-    // Pool to place blocking operations
-    salus::IOThreadPool m_iopool;
+    // Responses from any thread, sent out by the proxy&recv loop.
+    // Declared first so it outlives everything that may send.
+    SendQueue m_sendQueue;
 
-    // Shared by proxy&recv and send threads
     zmq::context_t m_zmqCtx;
     std::atomic_bool m_keepRunning;
 
-    // For the proxy&recv loop
+    // For the proxy&recv loop, which also sends out messages
     std::unique_ptr<std::thread> m_recvThread;
 
     std::unique_ptr<RpcServerCore> m_pLogic;
 
-    // For send loop
-    std::unique_ptr<std::thread> m_sendThread;
-    struct SendItem {
-        // we cannot use unique_ptr because boost::lockfree::queue does not support move semantics
-        std::vector<zmq::message_t> *p_parts;
-    };
-    boost::lockfree::queue<SendItem> m_sendQueue;
+    // Pools to place blocking operations, separate so a burst of session setup doesn't
+    // hold back steps of running jobs. Declared after m_pLogic, which their tasks use, so they
+    // drain before it is gone, and before m_pipeline, which posts to them.
+    salus::IOThreadPool m_controlPool;
+    salus::IOThreadPool m_dataPool;
+
+    // Parses and dispatches requests received by the proxy&recv loop,
+    // declared after m_pLogic so it stops before m_pLogic is gone
+    std::unique_ptr<RequestPipeline> m_pipeline;
+
+    // Used instead of the proxy&recv loop when listening on shm://
+    std::unique_ptr<ShmServer> m_shm;
 };
 
 #endif // ZMQSERVER_H
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "schedsim/histogram.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace salus::schedsim {
+
+/*static*/ size_t Histogram::bucketOf(uint64_t value)
+{
+    if (value < kSubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    // position of highest set bit, >= kSubBucketBits
+    auto msb = static_cast<size_t>(63 - __builtin_clzll(value));
+    auto shift = msb - kSubBucketBits;
+    auto sub = static_cast<size_t>(value >> shift) & (kSubBuckets - 1);
+    return (shift + 1) * kSubBuckets + sub;
+}
+
+/*static*/ uint64_t Histogram::lowerBoundOf(size_t bucket)
+{
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    auto shift = bucket / kSubBuckets - 1;
+    auto sub = bucket % kSubBuckets;
+    return (uint64_t{kSubBuckets} | sub) << shift;
+}
+
+void Histogram::record(uint64_t value)
+{
+    m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    auto curr = m_min.load(std::memory_order_relaxed);
+    while (value < curr && !m_min.compare_exchange_weak(curr, value, std::memory_order_relaxed)) {
+    }
+    curr = m_max.load(std::memory_order_relaxed);
+    while (value > curr && !m_max.compare_exchange_weak(curr, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::min() const
+{
+    return count() ? m_min.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t Histogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+    auto n = count();
+    return n ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    auto n = count();
+    if (n == 0) {
+        return 0;
+    }
+    auto rank = static_cast<uint64_t>(std::max(1.0, p / 100.0 * n + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i != kNumBuckets; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::clamp(lowerBoundOf(i), min(), max());
+        }
+    }
+    return max();
+}
+
+nlohmann::json Histogram::toJson() const
+{
+    return {
+        {"count", count()},
+        {"min", min()},
+        {"mean", mean()},
+        {"p50", percentile(50)},
+        {"p90", percentile(90)},
+        {"p99", percentile(99)},
+        {"p999", percentile(99.9)},
+        {"max", max()},
+    };
+}
+
+std::string Histogram::DebugString(const std::string &unit) const
+{
+    std::ostringstream oss;
+    oss << "count=" << count() << " min=" << min() << unit << " mean=" << std::fixed << std::setprecision(1)
+        << mean() << unit << " p50=" << percentile(50) << unit << " p90=" << percentile(90) << unit
+        << " p99=" << percentile(99) << unit << " max=" << max() << unit << std::endl;
+
+    uint64_t peak = 0;
+    for (const auto &b : m_buckets) {
+        peak = std::max(peak, b.load(std::memory_order_relaxed));
+    }
+    if (peak == 0) {
+        return oss.str();
+    }
+
+    constexpr uint64_t kBarWidth = 50;
+    for (size_t i = 0; i != kNumBuckets; ++i) {
+        auto n = m_buckets[i].load(std::memory_order_relaxed);
+        if (n == 0) {
+            continue;
+        }
+        oss << "    " << std::setw(12) << lowerBoundOf(i) << unit << " | " << std::setw(8) << n << " "
+            << std::string(std::max<uint64_t>(1, n * kBarWidth / peak), '#') << std::endl;
+    }
+    return oss.str();
+}
+
+} // namespace salus::schedsim
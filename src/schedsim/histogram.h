@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SCHEDSIM_HISTOGRAM_H
+#define SALUS_SCHEDSIM_HISTOGRAM_H
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace salus::schedsim {
+
+/**
+ * @brief A lock free, log-linear histogram of non-negative integer samples.
+ *
+ * Values are bucketed by their highest set bit, and each power of two range is
+ * further split into kSubBuckets linear sub-buckets, giving a relative error
+ * below 1/kSubBuckets. Safe to record from multiple threads.
+ */
+class Histogram
+{
+public:
+    static constexpr size_t kSubBucketBits = 3;
+    static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+    static constexpr size_t kNumBuckets = 64 * kSubBuckets;
+
+    void record(uint64_t value);
+
+    uint64_t count() const;
+    uint64_t min() const;
+    uint64_t max() const;
+    double mean() const;
+
+    /**
+     * @brief Approximate value at percentile `p` in [0, 100]
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * @brief Summary statistics, in the unit samples were recorded.
+     */
+    nlohmann::json toJson() const;
+
+    /**
+     * @brief Human readable summary plus an ASCII bar chart of non-empty buckets.
+     */
+    std::string DebugString(const std::string &unit) const;
+
+private:
+    static size_t bucketOf(uint64_t value);
+    static uint64_t lowerBoundOf(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, kNumBuckets> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_min{UINT64_MAX};
+    std::atomic<uint64_t> m_max{0};
+};
+
+} // namespace salus::schedsim
+
+#endif // SALUS_SCHEDSIM_HISTOGRAM_H
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "schedsim/simulator.h"
+#include "schedsim/workload.h"
+
+#include "execution/executionengine.h"
+#include "execution/scheduler/basescheduler.h"
+#include "platform/logging.h"
+
+#include <docopt.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <regex>
+#include <string>
+
+using namespace std;
+using namespace std::string_literals;
+
+namespace {
+
+namespace flags {
+const static auto scheduler = "--sched";
+const static auto maxHolWaiting = "--max-hol-waiting";
+const static auto disableWorkConservative = "--disable-wc";
+
+const static auto trace = "--trace";
+const static auto dumpTrace = "--dump-trace";
+const static auto seed = "--seed";
+const static auto jobs = "--jobs";
+const static auto lanes = "--lanes";
+const static auto iterations = "--iters";
+const static auto ops = "--ops";
+const static auto width = "--width";
+const static auto shape = "--shape";
+const static auto arrivalInterval = "--arrival-interval";
+const static auto timeScale = "--time-scale";
+const static auto json = "--json";
+
+const static auto logConf = "--logconf";
+const static auto verbose = "--verbose";
+const static auto vModule = "--vmodule";
+const static auto vLogFile = "--vlogfile";
+const static auto pLogFile = "--perflog";
+} // namespace flags
+
+static auto kUsage =
+    R"(Usage:
+    <program-name> [options]
+    <program-name> --help
+
+Replay a synthetic or recorded workload through Salus' execution engine and
+scheduling policies, without GPUs or an oplibrary.
+
+Options:
+    -h, --help                  Print this help message and exit.
+    -s <policy>, --sched=<policy>
+                                Use <policy> for scheduling. Choices: fair, preempt, pack, rr, fifo,
+                                or all to run every registered policy on the same workload.
+                                [default: all]
+    --disable-wc                Disable work conservation.
+    --max-hol-waiting=<num>     Maximum number of task allowed go before queue head
+                                in scheduling. [default: 50]
+    -t <file>, --trace=<file>   Replay the workload in trace file <file> instead of generating one.
+    --dump-trace=<file>         Write the fully materialized workload to <file> and exit.
+    --seed=<num>                Seed for workload generation. [default: 0]
+    --jobs=<num>                Number of jobs to generate. [default: 4]
+    --lanes=<num>               Number of lanes jobs are spread over. [default: 1]
+    --iters=<num>               Number of iterations per job. [default: 10]
+    --ops=<num>                 Number of operations per iteration. [default: 50]
+    --width=<num>               Width of generated DAGs. [default: 4]
+    --shape=<shape>             Shape of generated DAGs. Choices: chain, fanout, layered, random.
+                                [default: layered]
+    --arrival-interval=<ms>     Time between arrivals of generated jobs. [default: 0]
+    --time-scale=<factor>       Multiply every duration in the workload by <factor>. [default: 1.0]
+    --json                      Print reports as JSON, one line per policy.
+    -c <file>, --logconf=<file> Path to log configuration file. Note that
+                                settings in this file takes precedence over
+                                other command line arguments.
+    -v <level>, --verbose=<level>
+                                Enable verbose logging level <level>.
+                                Valid range: 0-9. (0 means disable)
+                                [default: 0]
+    --vmodule=<vmodules>        Specify verbose level per module.
+                                Refer to https://github.com/muflihun/easyloggingpp#vmodule
+                                for syntax.
+                                [default: ]
+    --vlogfile=<file>           Verbose logging goes to <file>.
+                                [default: verbose.log]
+    --perflog=<file>            Enable performance logging and log to <file>.
+)"s;
+
+template<typename T>
+std::optional<T> optional_arg(const docopt::value &v);
+
+template<>
+std::optional<std::string> optional_arg(const docopt::value &v)
+{
+    return v ? std::make_optional(v.asString()) : std::nullopt;
+}
+
+template<>
+std::optional<int> optional_arg(const docopt::value &v)
+{
+    return v ? std::make_optional(static_cast<int>(v.asLong())) : std::nullopt;
+}
+
+} // namespace
+
+auto parseArguments(int argc, char **argv)
+{
+    string executable(argv[0]);
+    auto idx = executable.find_last_of('/');
+    if (idx != string::npos) {
+        executable = executable.substr(idx + 1);
+    }
+
+    regex pattern(R"(<program-name>)");
+    kUsage = regex_replace(kUsage, pattern, executable);
+
+    return docopt::docopt(kUsage, {argv + 1, argv + argc}, /* help = */ true);
+}
+
+void initializeLogging(std::map<std::string, docopt::value> &args)
+{
+    logging::initialize({
+        optional_arg<std::string>(args[flags::logConf]),
+        optional_arg<int>(args[flags::verbose]),
+        optional_arg<std::string>(args[flags::vModule]),
+        optional_arg<std::string>(args[flags::vLogFile]),
+        optional_arg<std::string>(args[flags::pLogFile]),
+    });
+}
+
+salus::schedsim::Workload loadWorkload(std::map<std::string, docopt::value> &args)
+{
+    using namespace salus::schedsim;
+
+    if (auto trace = optional_arg<std::string>(args[flags::trace])) {
+        return Workload::fromFile(*trace);
+    }
+
+    GeneratorParams params;
+    params.seed = static_cast<uint64_t>(args[flags::seed].asLong());
+    params.numJobs = static_cast<size_t>(args[flags::jobs].asLong());
+    params.numLanes = static_cast<size_t>(args[flags::lanes].asLong());
+    params.iterations = static_cast<size_t>(args[flags::iterations].asLong());
+    params.opsPerIter = static_cast<size_t>(args[flags::ops].asLong());
+    params.width = static_cast<size_t>(args[flags::width].asLong());
+    params.shape = dagShapeFromString(args[flags::shape].asString());
+    params.arrivalIntervalMs = static_cast<uint64_t>(args[flags::arrivalInterval].asLong());
+    return generateWorkload(params);
+}
+
+/**
+ * @brief Run the workload under one policy in this process
+ */
+int runPolicy(const salus::schedsim::Workload &workload, const std::string &policy,
+              std::map<std::string, docopt::value> &args)
+{
+    uint64_t maxHolWaiting = static_cast<uint64_t>(args[flags::maxHolWaiting].asLong());
+    auto workConservative = !args[flags::disableWorkConservative].asBool();
+    // docopt doesn't handle double number
+    auto scale = std::atof(args[flags::timeScale].asString().c_str());
+
+    auto &engine = salus::ExecutionEngine::instance();
+    engine.setSchedulingParam({maxHolWaiting, workConservative, policy});
+    engine.startScheduler();
+
+    salus::schedsim::Simulator sim(workload, scale);
+    sim.run();
+
+    if (args[flags::json].asBool()) {
+        std::cout << sim.report(policy).dump() << std::endl;
+    } else {
+        std::cout << sim.DebugString(policy) << std::endl;
+    }
+
+    engine.stopScheduler();
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    auto args = parseArguments(argc, argv);
+
+    // NOTE: logging is initialized as global objects, avoid using any global variables
+    initializeLogging(args);
+
+    auto workload = loadWorkload(args);
+
+    if (auto dump = optional_arg<std::string>(args[flags::dumpTrace])) {
+        std::ofstream ofs(*dump);
+        ofs << workload.toJson().dump(2) << std::endl;
+        return ofs ? 0 : 1;
+    }
+
+    auto policy = args[flags::scheduler].asString();
+    if (policy != "all") {
+        return runPolicy(workload, policy, args);
+    }
+
+    // ExecutionEngine is a process wide singleton, so run each policy in a fresh child process
+    int ret = 0;
+    for (const auto &name : SchedulerRegistary::instance().names()) {
+        std::cout.flush();
+        auto pid = fork();
+        if (pid < 0) {
+            LOG(ERROR) << "Failed to fork for policy " << name;
+            return 1;
+        }
+        if (pid == 0) {
+            std::exit(runPolicy(workload, name, args));
+        }
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            LOG(ERROR) << "Simulation with policy " << name << " failed";
+            ret = 1;
+        }
+    }
+    return ret;
+}
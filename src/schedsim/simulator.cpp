@@ -0,0 +1,480 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "schedsim/simulator.h"
+
+#include "execution/engine/iterationcontext.h"
+#include "execution/engine/resourcecontext.h"
+#include "execution/executionengine.h"
+#include "execution/iterationtask.h"
+#include "execution/operationtask.h"
+#include "execution/scheduler/sessionitem.h"
+#include "platform/logging.h"
+
+#include <iomanip>
+#include <sstream>
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using Clock = std::chrono::steady_clock;
+using nlohmann::json;
+
+namespace salus::schedsim {
+
+SimClock::SimClock()
+    : m_thread(&SimClock::loop, this)
+{
+}
+
+SimClock::~SimClock()
+{
+    stop();
+}
+
+void SimClock::schedule(nanoseconds delay, std::function<void()> fn)
+{
+    {
+        auto g = sstl::with_guard(m_mu);
+        m_events.push({Clock::now() + delay, m_nextSeq++, std::move(fn)});
+    }
+    m_cv.notify_one();
+}
+
+void SimClock::stop()
+{
+    {
+        auto g = sstl::with_guard(m_mu);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void SimClock::loop()
+{
+    threading::set_thread_name("SimClock");
+
+    auto g = sstl::with_uguard(m_mu);
+    while (true) {
+        m_cv.wait(g, [this]() { return m_stop || !m_events.empty(); });
+        if (m_stop) {
+            break;
+        }
+
+        auto deadline = m_events.top().deadline;
+        if (Clock::now() < deadline) {
+            m_cv.wait_until(g, deadline);
+            continue;
+        }
+
+        // priority_queue::top is const, but we are popping it anyway
+        auto fn = std::move(const_cast<Event &>(m_events.top()).fn);
+        m_events.pop();
+
+        g.unlock();
+        fn();
+        g.lock();
+    }
+}
+
+struct Simulator::JobState
+{
+    const JobSpec &spec;
+    uint64_t graphId;
+    /**
+     * @brief Reverse of OpSpec::deps
+     */
+    std::vector<std::vector<size_t>> successors;
+
+    std::shared_ptr<ExecutionContext> ectx;
+    size_t itersDone = 0;
+    SimTime arrival;
+
+    JobState(const JobSpec &spec, uint64_t graphId)
+        : spec(spec)
+        , graphId(graphId)
+        , successors(spec.ops.size())
+    {
+        for (size_t i = 0; i != spec.ops.size(); ++i) {
+            for (auto d : spec.ops[i].deps) {
+                successors[d].push_back(i);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Dependency tracking for one running iteration, shared by all its ops
+ */
+struct SimIterState : std::enable_shared_from_this<SimIterState>
+{
+    Simulator &sim;
+    Simulator::JobState &job;
+    std::shared_ptr<IterationContext> ictx;
+    SimTime started;
+
+    std::unique_ptr<std::atomic<size_t>[]> pendingDeps;
+    std::atomic<size_t> remaining;
+
+    SimIterState(Simulator &sim, Simulator::JobState &job, std::shared_ptr<IterationContext> &&ictx)
+        : sim(sim)
+        , job(job)
+        , ictx(std::move(ictx))
+        , started(Clock::now())
+        , pendingDeps(std::make_unique<std::atomic<size_t>[]>(job.spec.ops.size()))
+        , remaining(job.spec.ops.size())
+    {
+        for (size_t i = 0; i != job.spec.ops.size(); ++i) {
+            pendingDeps[i] = job.spec.ops[i].deps.size();
+        }
+    }
+
+    void start();
+    void submit(size_t op);
+    void opDone(size_t op);
+};
+
+class SimOperationTask : public OperationTask
+{
+public:
+    SimOperationTask(std::shared_ptr<SimIterState> iter, size_t idx)
+        : m_iter(std::move(iter))
+        , m_idx(idx)
+        , m_spec(m_iter->job.spec.ops[idx])
+        , m_queued(Clock::now())
+    {
+    }
+
+    std::string DebugString() const override
+    {
+        std::ostringstream oss;
+        oss << "SimOp(job=" << m_iter->job.spec.name << ", iter=" << m_iter->job.itersDone << ", op=" << m_idx
+            << ")";
+        return oss.str();
+    }
+
+    uint64_t graphId() const override
+    {
+        return m_iter->job.graphId;
+    }
+
+    Resources estimatedUsage(const DeviceSpec &dev) override
+    {
+        Resources res;
+        if (m_spec.memoryBytes) {
+            res[{ResourceType::MEMORY, dev}] = m_spec.memoryBytes;
+        }
+        return res;
+    }
+
+    bool hasExactEstimation(const DeviceSpec &) override
+    {
+        return true;
+    }
+
+    DeviceTypes supportedDeviceTypes() const override
+    {
+        static std::vector<DeviceType> types{DeviceType::GPU};
+        return types;
+    }
+
+    int failedTimes() const override
+    {
+        return m_failedTimes;
+    }
+
+    bool prepare(std::unique_ptr<ResourceContext> &&rctx) noexcept override
+    {
+        m_rctx = std::move(rctx);
+        return true;
+    }
+
+    ResourceContext &resourceContext() const override
+    {
+        DCHECK(m_rctx);
+        return *m_rctx;
+    }
+
+    bool isAsync() const override
+    {
+        return false;
+    }
+
+    void run(Callbacks cbs) noexcept override
+    {
+        auto &sim = m_iter->sim;
+        sim.m_stats.opSchedLatencyUs.record(duration_cast<microseconds>(Clock::now() - m_queued).count());
+
+        if (m_spec.memoryBytes) {
+            {
+                // the scope holds resource monitor's lock until destroyed
+                auto scope = m_rctx->alloc(ResourceType::MEMORY, m_spec.memoryBytes);
+                m_allocated = scope;
+            }
+            if (!m_allocated) {
+                sim.m_stats.numOpMemFailures.fetch_add(1, std::memory_order_relaxed);
+                ++m_failedTimes;
+                if (cbs.memFailure && cbs.memFailure()) {
+                    // put back to queue by the executor
+                    return;
+                }
+                LOG(ERROR) << "Running " << DebugString() << " without memory after allocation failure";
+            }
+        }
+
+        // `this` is owned by the opItem captured in cbs.done, so must not be touched after calling it.
+        sim.m_clock.schedule(sim.scaled(microseconds(m_spec.durationUs)), [this, done = std::move(cbs.done)]() {
+            if (m_allocated) {
+                m_rctx->dealloc(ResourceType::MEMORY, m_spec.memoryBytes);
+            }
+            auto iter = m_iter;
+            auto idx = m_idx;
+            done();
+            iter->opDone(idx);
+        });
+    }
+
+    void cancel() override {}
+
+private:
+    std::shared_ptr<SimIterState> m_iter;
+    size_t m_idx;
+    const OpSpec &m_spec;
+
+    SimTime m_queued;
+    int m_failedTimes = 0;
+    bool m_allocated = false;
+
+    std::unique_ptr<ResourceContext> m_rctx;
+};
+
+class SimIterationTask : public IterationTask
+{
+public:
+    SimIterationTask(Simulator &sim, Simulator::JobState &job)
+        : m_sim(sim)
+        , m_job(job)
+    {
+    }
+
+    uint64_t graphId() const override
+    {
+        return m_job.graphId;
+    }
+
+    bool prepare() override
+    {
+        if (!isExpensive()) {
+            return true;
+        }
+        auto &ectx = m_job.ectx;
+        return ectx->m_item->beginIteration(ectx->m_ticket, estimatedPeakAllocation(devices::GPU0), graphId());
+    }
+
+    ResStats estimatedPeakAllocation(const DeviceSpec &) const override
+    {
+        return {m_job.spec.peakMemory(), 0, m_job.spec.ops.size()};
+    }
+
+    void runAsync(std::shared_ptr<IterationContext> &&ictx) noexcept override
+    {
+        ictx->setGraphId(graphId());
+        auto iter = std::make_shared<SimIterState>(m_sim, m_job, std::move(ictx));
+        iter->start();
+    }
+
+    void cancel() override
+    {
+        m_canceled = true;
+    }
+
+    bool isCanceled() const override
+    {
+        return m_canceled;
+    }
+
+    bool isExpensive() const override
+    {
+        return m_job.spec.expensive;
+    }
+
+private:
+    Simulator &m_sim;
+    Simulator::JobState &m_job;
+    std::atomic<bool> m_canceled{false};
+};
+
+void SimIterState::start()
+{
+    if (job.spec.ops.empty()) {
+        sim.iterationDone(job, started);
+        return;
+    }
+    for (size_t i = 0; i != job.spec.ops.size(); ++i) {
+        if (job.spec.ops[i].deps.empty()) {
+            submit(i);
+        }
+    }
+}
+
+void SimIterState::submit(size_t op)
+{
+    ictx->scheduleTask(std::make_unique<SimOperationTask>(shared_from_this(), op));
+}
+
+void SimIterState::opDone(size_t op)
+{
+    sim.m_stats.numOps.fetch_add(1, std::memory_order_relaxed);
+
+    for (auto succ : job.successors[op]) {
+        if (pendingDeps[succ].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            submit(succ);
+        }
+    }
+
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (job.spec.expensive) {
+            job.ectx->dropExlusiveMode();
+            ictx->finish();
+        }
+        sim.iterationDone(job, started);
+    }
+}
+
+Simulator::Simulator(Workload workload, double timeScale)
+    : m_workload(std::move(workload))
+    , m_timeScale(timeScale)
+{
+    m_jobs.reserve(m_workload.jobs.size());
+    uint64_t graphId = 0;
+    for (const auto &spec : m_workload.jobs) {
+        m_jobs.emplace_back(std::make_unique<JobState>(spec, ++graphId));
+    }
+}
+
+Simulator::~Simulator()
+{
+    m_clock.stop();
+}
+
+nanoseconds Simulator::scaled(nanoseconds d) const
+{
+    return nanoseconds(static_cast<nanoseconds::rep>(d.count() * m_timeScale));
+}
+
+void Simulator::run()
+{
+    m_start = Clock::now();
+    for (auto &job : m_jobs) {
+        m_clock.schedule(scaled(milliseconds(job->spec.arrivalMs)), [this, &job = *job]() { startJob(job); });
+    }
+
+    m_jobsDone.wait(m_jobs.size());
+    m_end = Clock::now();
+}
+
+void Simulator::startJob(JobState &job)
+{
+    job.arrival = Clock::now();
+
+    job.ectx = ExecutionEngine::instance().makeContext();
+    CHECK(job.ectx) << "ExecutionEngine is not accepting new sessions";
+
+    job.ectx->setLaneId(job.spec.laneId);
+    auto expected = job.spec.expectedRunningMs;
+    if (expected == 0) {
+        expected = job.spec.criticalPathUs() * job.spec.iterations / 1000;
+    }
+    job.ectx->setExpectedRunningTime(static_cast<uint64_t>(expected * m_timeScale));
+    job.ectx->setSessionHandle(job.spec.name);
+
+    VLOG(1) << "Job " << job.spec.name << " arrived";
+    scheduleIteration(job);
+}
+
+void Simulator::scheduleIteration(JobState &job)
+{
+    job.ectx->scheduleIteartion(std::make_unique<SimIterationTask>(*this, job));
+}
+
+void Simulator::iterationDone(JobState &job, SimTime started)
+{
+    auto now = Clock::now();
+    m_stats.iterDurationUs.record(duration_cast<microseconds>(now - started).count());
+    m_stats.numIters.fetch_add(1, std::memory_order_relaxed);
+
+    if (++job.itersDone < job.spec.iterations) {
+        scheduleIteration(job);
+        return;
+    }
+
+    m_stats.jctMs.record(duration_cast<milliseconds>(now - job.arrival).count());
+    VLOG(1) << "Job " << job.spec.name << " finished";
+
+    // Finishing may drop the last reference to the session, don't do it on engine threads
+    m_clock.schedule(nanoseconds(0), [this, &job]() {
+        job.ectx->finish([]() {});
+        job.ectx.reset();
+        m_jobsDone.notify();
+    });
+}
+
+json Simulator::report(const std::string &policy) const
+{
+    auto makespanUs = duration_cast<microseconds>(m_end - m_start).count();
+    auto seconds = makespanUs / 1e6;
+    return {
+        {"policy", policy},
+        {"jobs", m_jobs.size()},
+        {"makespan_ms", makespanUs / 1000},
+        {"iterations", m_stats.numIters.load()},
+        {"ops", m_stats.numOps.load()},
+        {"op_mem_failures", m_stats.numOpMemFailures.load()},
+        {"throughput",
+         {
+             {"iters_per_sec", seconds > 0 ? m_stats.numIters.load() / seconds : 0.0},
+             {"ops_per_sec", seconds > 0 ? m_stats.numOps.load() / seconds : 0.0},
+         }},
+        {"jct_ms", m_stats.jctMs.toJson()},
+        {"iter_duration_us", m_stats.iterDurationUs.toJson()},
+        {"op_sched_latency_us", m_stats.opSchedLatencyUs.toJson()},
+    };
+}
+
+std::string Simulator::DebugString(const std::string &policy) const
+{
+    auto r = report(policy);
+
+    std::ostringstream oss;
+    oss << "Policy: " << policy << std::endl;
+    oss << "Jobs: " << m_jobs.size() << ", makespan: " << r["makespan_ms"] << "ms" << std::endl;
+    oss << "Throughput: " << std::fixed << std::setprecision(1) << r["throughput"]["iters_per_sec"].get<double>()
+        << " iters/s, " << r["throughput"]["ops_per_sec"].get<double>() << " ops/s" << std::endl;
+    oss << "Op memory failures: " << m_stats.numOpMemFailures.load() << std::endl;
+    oss << std::endl << "JCT: " << m_stats.jctMs.DebugString("ms");
+    oss << std::endl << "Iteration duration: " << m_stats.iterDurationUs.DebugString("us");
+    oss << std::endl << "Op scheduling latency: " << m_stats.opSchedLatencyUs.DebugString("us");
+    return oss.str();
+}
+
+} // namespace salus::schedsim
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SCHEDSIM_SIMULATOR_H
+#define SALUS_SCHEDSIM_SIMULATOR_H
+
+#include "schedsim/histogram.h"
+#include "schedsim/workload.h"
+#include "platform/thread_annotations.h"
+#include "utils/threadutils.h"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace salus {
+class ExecutionContext;
+} // namespace salus
+
+namespace salus::schedsim {
+
+using SimTime = std::chrono::steady_clock::time_point;
+
+/**
+ * @brief Runs callbacks at given points in time on a dedicated thread. Stands in for the GPU,
+ * so simulated operations don't occupy executor threads while "running".
+ */
+class SimClock
+{
+public:
+    SimClock();
+    ~SimClock();
+
+    void schedule(std::chrono::nanoseconds delay, std::function<void()> fn);
+
+    void stop();
+
+private:
+    void loop();
+
+    struct Event
+    {
+        SimTime deadline;
+        uint64_t seq;
+        std::function<void()> fn;
+
+        bool operator>(const Event &other) const
+        {
+            return std::tie(deadline, seq) > std::tie(other.deadline, other.seq);
+        }
+    };
+
+    std::mutex m_mu;
+    std::condition_variable m_cv;
+    std::priority_queue<Event, std::vector<Event>, std::greater<>> m_events GUARDED_BY(m_mu);
+    uint64_t m_nextSeq = 0 GUARDED_BY(m_mu);
+    bool m_stop = false GUARDED_BY(m_mu);
+
+    std::thread m_thread;
+};
+
+struct SimStats
+{
+    Histogram opSchedLatencyUs;
+    Histogram iterDurationUs;
+    Histogram jctMs;
+
+    std::atomic<uint64_t> numOps{0};
+    std::atomic<uint64_t> numIters{0};
+    std::atomic<uint64_t> numOpMemFailures{0};
+};
+
+/**
+ * @brief Replays a workload through the real ExecutionEngine, TaskExecutor and scheduler policy,
+ * with synthetic iterations and operations in place of an oplibrary.
+ */
+class Simulator
+{
+public:
+    /**
+     * @param timeScale every duration and arrival time in the workload is multiplied by this
+     */
+    Simulator(Workload workload, double timeScale);
+    ~Simulator();
+
+    /**
+     * @brief Run until every job finishes. ExecutionEngine must be started.
+     */
+    void run();
+
+    nlohmann::json report(const std::string &policy) const;
+    std::string DebugString(const std::string &policy) const;
+
+    struct JobState;
+
+private:
+    friend class SimIterationTask;
+    friend class SimOperationTask;
+    friend struct SimIterState;
+
+    void startJob(JobState &job);
+    void scheduleIteration(JobState &job);
+    void iterationDone(JobState &job, SimTime started);
+
+    std::chrono::nanoseconds scaled(std::chrono::nanoseconds d) const;
+
+    Workload m_workload;
+    double m_timeScale;
+
+    SimClock m_clock;
+    SimStats m_stats;
+
+    std::vector<std::unique_ptr<JobState>> m_jobs;
+    sstl::semaphore m_jobsDone;
+
+    SimTime m_start;
+    SimTime m_end;
+};
+
+} // namespace salus::schedsim
+
+#endif // SALUS_SCHEDSIM_SIMULATOR_H
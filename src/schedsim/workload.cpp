@@ -0,0 +1,317 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "schedsim/workload.h"
+
+#include "platform/logging.h"
+#include "utils/macros.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+using nlohmann::json;
+
+namespace salus::schedsim {
+
+uint64_t Distribution::sample(std::mt19937_64 &rng) const
+{
+    double v = 0;
+    switch (kind) {
+    case Kind::Const:
+        v = a;
+        break;
+    case Kind::Uniform:
+        v = std::uniform_real_distribution<double>(a, b)(rng);
+        break;
+    case Kind::Exponential:
+        v = a > 0 ? std::exponential_distribution<double>(1.0 / a)(rng) : 0;
+        break;
+    case Kind::Normal:
+        v = std::normal_distribution<double>(a, b)(rng);
+        break;
+    }
+    return v > 0 ? static_cast<uint64_t>(v) : 0;
+}
+
+/*static*/ Distribution Distribution::fromJson(const json &j)
+{
+    if (j.is_number()) {
+        return {Kind::Const, j.get<double>(), 0};
+    }
+
+    auto dist = j.value("dist", std::string("const"));
+    if (dist == "const") {
+        return {Kind::Const, j.at("value").get<double>(), 0};
+    } else if (dist == "uniform") {
+        return {Kind::Uniform, j.at("min").get<double>(), j.at("max").get<double>()};
+    } else if (dist == "exp") {
+        return {Kind::Exponential, j.at("mean").get<double>(), 0};
+    } else if (dist == "normal") {
+        return {Kind::Normal, j.at("mean").get<double>(), j.at("stddev").get<double>()};
+    }
+    LOG(FATAL) << "Unknown distribution: " << dist;
+    return {};
+}
+
+json Distribution::toJson() const
+{
+    switch (kind) {
+    case Kind::Const:
+        return {{"dist", "const"}, {"value", a}};
+    case Kind::Uniform:
+        return {{"dist", "uniform"}, {"min", a}, {"max", b}};
+    case Kind::Exponential:
+        return {{"dist", "exp"}, {"mean", a}};
+    case Kind::Normal:
+        return {{"dist", "normal"}, {"mean", a}, {"stddev", b}};
+    }
+    return {};
+}
+
+DagShape dagShapeFromString(const std::string &str)
+{
+    static const std::unordered_map<std::string, DagShape> lookup{
+        {"chain", DagShape::Chain},
+        {"fanout", DagShape::FanOut},
+        {"layered", DagShape::Layered},
+        {"random", DagShape::Random},
+    };
+    auto it = lookup.find(str);
+    if (it == lookup.end()) {
+        LOG(FATAL) << "Unknown DAG shape: " << str;
+        return DagShape::Chain;
+    }
+    return it->second;
+}
+
+std::string enumToString(const DagShape &shape)
+{
+    switch (shape) {
+    case DagShape::Chain:
+        return "chain";
+    case DagShape::FanOut:
+        return "fanout";
+    case DagShape::Layered:
+        return "layered";
+    case DagShape::Random:
+        return "random";
+    }
+    return "Unknown DagShape";
+}
+
+uint64_t JobSpec::peakMemory() const
+{
+    // Peak of concurrently running ops' memory, when every op starts as soon as its deps finish
+    std::vector<uint64_t> finish(ops.size(), 0);
+    std::vector<std::pair<uint64_t, int64_t>> events;
+    events.reserve(ops.size() * 2);
+    for (size_t i = 0; i != ops.size(); ++i) {
+        uint64_t start = 0;
+        for (auto d : ops[i].deps) {
+            start = std::max(start, finish[d]);
+        }
+        finish[i] = start + ops[i].durationUs;
+        auto mem = static_cast<int64_t>(ops[i].memoryBytes);
+        events.emplace_back(start, mem);
+        events.emplace_back(finish[i], -mem);
+    }
+    // frees before allocations at the same time
+    std::sort(events.begin(), events.end());
+
+    int64_t curr = 0;
+    int64_t peak = 0;
+    for (const auto &[time, delta] : events) {
+        UNUSED(time);
+        curr += delta;
+        peak = std::max(peak, curr);
+    }
+    return static_cast<uint64_t>(peak);
+}
+
+uint64_t JobSpec::criticalPathUs() const
+{
+    std::vector<uint64_t> finish(ops.size(), 0);
+    uint64_t longest = 0;
+    for (size_t i = 0; i != ops.size(); ++i) {
+        uint64_t start = 0;
+        for (auto d : ops[i].deps) {
+            start = std::max(start, finish[d]);
+        }
+        finish[i] = start + ops[i].durationUs;
+        longest = std::max(longest, finish[i]);
+    }
+    return longest;
+}
+
+std::vector<OpSpec> generateDag(std::mt19937_64 &rng, size_t numOps, DagShape shape, size_t width,
+                                const Distribution &durationUs, const Distribution &memoryBytes)
+{
+    std::vector<OpSpec> ops(numOps);
+    width = std::max<size_t>(width, 1);
+
+    for (size_t i = 0; i != numOps; ++i) {
+        auto &op = ops[i];
+        op.durationUs = durationUs.sample(rng);
+        op.memoryBytes = memoryBytes.sample(rng);
+
+        if (i == 0) {
+            continue;
+        }
+
+        switch (shape) {
+        case DagShape::Chain:
+            op.deps.push_back(i - 1);
+            break;
+        case DagShape::FanOut:
+            // fork from the first op, join at the last one
+            if (i + 1 != numOps) {
+                op.deps.push_back(0);
+            } else {
+                for (size_t d = 1; d + 1 < numOps; ++d) {
+                    op.deps.push_back(d);
+                }
+                if (op.deps.empty()) {
+                    op.deps.push_back(0);
+                }
+            }
+            break;
+        case DagShape::Layered: {
+            // ops are grouped into layers of `width`, each depends on up to two ops of the previous layer
+            auto layer = i / width;
+            if (layer == 0) {
+                break;
+            }
+            auto prevBegin = (layer - 1) * width;
+            std::uniform_int_distribution<size_t> pick(prevBegin, prevBegin + width - 1);
+            auto a = pick(rng);
+            auto b = pick(rng);
+            op.deps.push_back(std::min(a, b));
+            if (a != b) {
+                op.deps.push_back(std::max(a, b));
+            }
+            break;
+        }
+        case DagShape::Random: {
+            std::uniform_int_distribution<size_t> pick(0, i - 1);
+            auto n = std::min<size_t>(i, 3);
+            for (size_t k = 0; k != n; ++k) {
+                op.deps.push_back(pick(rng));
+            }
+            std::sort(op.deps.begin(), op.deps.end());
+            op.deps.erase(std::unique(op.deps.begin(), op.deps.end()), op.deps.end());
+            break;
+        }
+        }
+    }
+    return ops;
+}
+
+Workload generateWorkload(const GeneratorParams &params)
+{
+    Workload w;
+    w.seed = params.seed;
+
+    std::mt19937_64 rng(params.seed);
+    for (size_t i = 0; i != params.numJobs; ++i) {
+        JobSpec job;
+        job.name = "job" + std::to_string(i);
+        job.laneId = i % std::max<size_t>(params.numLanes, 1);
+        job.arrivalMs = i * params.arrivalIntervalMs;
+        job.iterations = params.iterations;
+        job.ops = generateDag(rng, params.opsPerIter, params.shape, params.width, params.durationUs,
+                              params.memoryBytes);
+        w.jobs.emplace_back(std::move(job));
+    }
+    return w;
+}
+
+/*static*/ Workload Workload::fromFile(const std::string &path)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        LOG(FATAL) << "Can not open trace file: " << path;
+    }
+    return fromJson(json::parse(ifs));
+}
+
+/*static*/ Workload Workload::fromJson(const json &j)
+{
+    Workload w;
+    w.seed = j.value("seed", uint64_t{0});
+
+    std::mt19937_64 rng(w.seed);
+    size_t idx = 0;
+    for (const auto &jj : j.at("jobs")) {
+        JobSpec job;
+        job.name = jj.value("name", "job" + std::to_string(idx));
+        job.laneId = jj.value("lane", uint64_t{0});
+        job.arrivalMs = jj.value("arrival_ms", uint64_t{0});
+        job.iterations = jj.value("iterations", size_t{1});
+        job.expensive = jj.value("expensive", true);
+        job.expectedRunningMs = jj.value("expected_running_ms", uint64_t{0});
+
+        if (auto it = jj.find("graph"); it != jj.end()) {
+            for (const auto &jop : *it) {
+                OpSpec op;
+                op.durationUs = jop.value("duration_us", uint64_t{0});
+                op.memoryBytes = jop.value("memory_bytes", uint64_t{0});
+                op.deps = jop.value("deps", std::vector<size_t>{});
+                for (auto d : op.deps) {
+                    CHECK_LT(d, job.ops.size()) << "Op in job " << job.name << " depends on a later op";
+                }
+                job.ops.emplace_back(std::move(op));
+            }
+        } else {
+            job.ops = generateDag(rng, jj.value("ops", size_t{1}), dagShapeFromString(jj.value("shape", "layered")),
+                                  jj.value("width", size_t{4}), Distribution::fromJson(jj.value("duration_us", json(100))),
+                                  Distribution::fromJson(jj.value("memory_bytes", json(0))));
+        }
+        w.jobs.emplace_back(std::move(job));
+        ++idx;
+    }
+    return w;
+}
+
+json Workload::toJson() const
+{
+    auto jobsJson = json::array();
+    for (const auto &job : jobs) {
+        auto graph = json::array();
+        for (const auto &op : job.ops) {
+            graph.push_back({
+                {"duration_us", op.durationUs},
+                {"memory_bytes", op.memoryBytes},
+                {"deps", op.deps},
+            });
+        }
+        jobsJson.push_back({
+            {"name", job.name},
+            {"lane", job.laneId},
+            {"arrival_ms", job.arrivalMs},
+            {"iterations", job.iterations},
+            {"expensive", job.expensive},
+            {"expected_running_ms", job.expectedRunningMs},
+            {"graph", std::move(graph)},
+        });
+    }
+    return {{"seed", seed}, {"jobs", std::move(jobsJson)}};
+}
+
+} // namespace salus::schedsim
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SCHEDSIM_WORKLOAD_H
+#define SALUS_SCHEDSIM_WORKLOAD_H
+
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace salus::schedsim {
+
+/**
+ * @brief A random distribution of non-negative values, described in trace files as
+ *
+ *      {"dist": "const", "value": 10}
+ *      {"dist": "uniform", "min": 1, "max": 10}
+ *      {"dist": "exp", "mean": 10}
+ *      {"dist": "normal", "mean": 10, "stddev": 2}
+ *
+ * A plain number is a shorthand for "const".
+ */
+struct Distribution
+{
+    enum class Kind
+    {
+        Const,
+        Uniform,
+        Exponential,
+        Normal,
+    };
+
+    Kind kind = Kind::Const;
+    double a = 0;
+    double b = 0;
+
+    uint64_t sample(std::mt19937_64 &rng) const;
+
+    static Distribution fromJson(const nlohmann::json &j);
+    nlohmann::json toJson() const;
+};
+
+/**
+ * @brief One synthetic operation in an iteration's DAG
+ */
+struct OpSpec
+{
+    uint64_t durationUs = 0;
+    uint64_t memoryBytes = 0;
+    /**
+     * @brief Indices of ops in the same iteration this op depends on, all smaller than its own
+     */
+    std::vector<size_t> deps;
+};
+
+enum class DagShape
+{
+    Chain,
+    FanOut,
+    Layered,
+    Random,
+};
+
+/**
+ * @brief A job is one session, running `iterations` iterations of the same DAG one after another
+ */
+struct JobSpec
+{
+    std::string name;
+    uint64_t laneId = 0;
+    uint64_t arrivalMs = 0;
+    size_t iterations = 1;
+    /**
+     * @brief Expensive iterations run exclusively in a lane, like training iterations
+     */
+    bool expensive = true;
+    /**
+     * @brief Expected total running time in ms, used by the preempt policy. 0 to compute from the DAG.
+     */
+    uint64_t expectedRunningMs = 0;
+
+    std::vector<OpSpec> ops;
+
+    /**
+     * @brief Peak memory usage of one iteration if ops run as early as possible
+     */
+    uint64_t peakMemory() const;
+    uint64_t criticalPathUs() const;
+};
+
+struct Workload
+{
+    uint64_t seed = 0;
+    std::vector<JobSpec> jobs;
+
+    /**
+     * @brief Load a workload from a trace file.
+     *
+     * Each job either lists its ops explicitly in "graph", or describes how to generate them
+     * with "ops", "shape", "width", "duration_us" and "memory_bytes". Generation is seeded
+     * with the top level "seed", so a trace always replays to the same workload.
+     */
+    static Workload fromFile(const std::string &path);
+    static Workload fromJson(const nlohmann::json &j);
+
+    /**
+     * @brief Fully materialized trace, with every op listed explicitly.
+     */
+    nlohmann::json toJson() const;
+};
+
+struct GeneratorParams
+{
+    uint64_t seed = 0;
+    size_t numJobs = 4;
+    size_t numLanes = 1;
+    size_t iterations = 10;
+    size_t opsPerIter = 50;
+    size_t width = 4;
+    DagShape shape = DagShape::Layered;
+    uint64_t arrivalIntervalMs = 0;
+    Distribution durationUs{Distribution::Kind::Exponential, 200, 0};
+    Distribution memoryBytes{Distribution::Kind::Uniform, 1 << 20, 64 << 20};
+};
+
+std::vector<OpSpec> generateDag(std::mt19937_64 &rng, size_t numOps, DagShape shape, size_t width,
+                                const Distribution &durationUs, const Distribution &memoryBytes);
+
+Workload generateWorkload(const GeneratorParams &params);
+
+DagShape dagShapeFromString(const std::string &str);
+std::string enumToString(const DagShape &shape);
+
+} // namespace salus::schedsim
+
+#endif // SALUS_SCHEDSIM_WORKLOAD_H
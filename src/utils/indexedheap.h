@@ -0,0 +1,249 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ *
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SSTL_INDEXEDHEAP_H
+#define SALUS_SSTL_INDEXEDHEAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sstl {
+
+/**
+ * @brief A binary min-heap (w.r.t. Compare) that supports changing the priority of, or removing,
+ * any element by key in O(log n).
+ *
+ * Not thread safe.
+ */
+template<typename Key, typename Priority, typename Compare = std::less<Priority>, typename Hash = std::hash<Key>>
+class IndexedHeap
+{
+public:
+    struct Entry
+    {
+        Key key;
+        Priority priority;
+    };
+
+    IndexedHeap() = default;
+    explicit IndexedHeap(Compare comp)
+        : m_comp(std::move(comp))
+    {
+    }
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+
+    void reserve(size_t n)
+    {
+        m_heap.reserve(n);
+        m_pos.reserve(n);
+    }
+
+    void clear()
+    {
+        m_heap.clear();
+        m_pos.clear();
+    }
+
+    bool contains(const Key &key) const { return m_pos.count(key) > 0; }
+
+    const Entry &top() const
+    {
+        assert(!empty());
+        return m_heap.front();
+    }
+
+    const Priority &priority(const Key &key) const { return m_heap[m_pos.at(key)].priority; }
+
+    /**
+     * @brief Insert `key` with `prio`, or update its priority if it's already in the heap.
+     */
+    void push(const Key &key, Priority prio)
+    {
+        auto [it, inserted] = m_pos.try_emplace(key, m_heap.size());
+        if (!inserted) {
+            update(it->second, std::move(prio));
+            return;
+        }
+        m_heap.push_back({key, std::move(prio)});
+        siftUp(m_heap.size() - 1);
+    }
+
+    /**
+     * @brief Change the priority of an existing key. The key must be in the heap.
+     */
+    void update(const Key &key, Priority prio) { update(m_pos.at(key), std::move(prio)); }
+
+    /**
+     * @brief Apply `f` to the priority of an existing key in place, then restore heap order.
+     */
+    template<typename F>
+    void modify(const Key &key, F &&f)
+    {
+        auto idx = m_pos.at(key);
+        f(m_heap[idx].priority);
+        restore(idx);
+    }
+
+    /**
+     * @brief Remove `key`, returns whether it was in the heap.
+     */
+    bool erase(const Key &key)
+    {
+        auto it = m_pos.find(key);
+        if (it == m_pos.end()) {
+            return false;
+        }
+        auto idx = it->second;
+        m_pos.erase(it);
+
+        auto last = m_heap.size() - 1;
+        if (idx != last) {
+            m_heap[idx] = std::move(m_heap[last]);
+            m_pos[m_heap[idx].key] = idx;
+        }
+        m_heap.pop_back();
+        if (idx != last) {
+            restore(idx);
+        }
+        return true;
+    }
+
+    void pop()
+    {
+        assert(!empty());
+        auto key = m_heap.front().key;
+        erase(key);
+    }
+
+    /**
+     * @brief Visit entries in priority order without modifying the heap.
+     *
+     * Only the frontier of the heap is kept in an auxiliary heap, so visiting the first k
+     * entries costs O(k log k). Visiting stops early when `f` returns false.
+     */
+    template<typename F>
+    void visitInOrder(F &&f) const
+    {
+        std::vector<size_t> frontier;
+        visitInOrder(std::forward<F>(f), frontier);
+    }
+
+    /**
+     * @brief Same as above, but keeps the frontier in `frontier`, so that callers visiting
+     * repeatedly can reuse its capacity rather than allocating on every visit.
+     */
+    template<typename F>
+    void visitInOrder(F &&f, std::vector<size_t> &frontier) const
+    {
+        frontier.clear();
+        if (m_heap.empty()) {
+            return;
+        }
+        auto cmp = [this](size_t lhs, size_t rhs) {
+            // std heap algorithms build a max heap
+            return m_comp(m_heap[rhs].priority, m_heap[lhs].priority);
+        };
+        frontier.push_back(0);
+        while (!frontier.empty()) {
+            std::pop_heap(frontier.begin(), frontier.end(), cmp);
+            auto idx = frontier.back();
+            frontier.pop_back();
+            if (!f(m_heap[idx])) {
+                return;
+            }
+            for (auto child : {2 * idx + 1, 2 * idx + 2}) {
+                if (child < m_heap.size()) {
+                    frontier.push_back(child);
+                    std::push_heap(frontier.begin(), frontier.end(), cmp);
+                }
+            }
+        }
+    }
+
+private:
+    void update(size_t idx, Priority prio)
+    {
+        m_heap[idx].priority = std::move(prio);
+        restore(idx);
+    }
+
+    void restore(size_t idx)
+    {
+        if (idx > 0 && m_comp(m_heap[idx].priority, m_heap[(idx - 1) / 2].priority)) {
+            siftUp(idx);
+        } else {
+            siftDown(idx);
+        }
+    }
+
+    void siftUp(size_t idx)
+    {
+        auto entry = std::move(m_heap[idx]);
+        while (idx > 0) {
+            auto parent = (idx - 1) / 2;
+            if (!m_comp(entry.priority, m_heap[parent].priority)) {
+                break;
+            }
+            place(idx, std::move(m_heap[parent]));
+            idx = parent;
+        }
+        place(idx, std::move(entry));
+    }
+
+    void siftDown(size_t idx)
+    {
+        auto entry = std::move(m_heap[idx]);
+        const auto n = m_heap.size();
+        while (true) {
+            auto child = 2 * idx + 1;
+            if (child >= n) {
+                break;
+            }
+            if (child + 1 < n && m_comp(m_heap[child + 1].priority, m_heap[child].priority)) {
+                ++child;
+            }
+            if (!m_comp(m_heap[child].priority, entry.priority)) {
+                break;
+            }
+            place(idx, std::move(m_heap[child]));
+            idx = child;
+        }
+        place(idx, std::move(entry));
+    }
+
+    void place(size_t idx, Entry &&entry)
+    {
+        m_heap[idx] = std::move(entry);
+        m_pos[m_heap[idx].key] = idx;
+    }
+
+    std::vector<Entry> m_heap;
+    std::unordered_map<Key, size_t, Hash> m_pos;
+    Compare m_comp;
+};
+
+} // namespace sstl
+
+#endif // SALUS_SSTL_INDEXEDHEAP_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SSTL_MPSCQUEUE_H
+#define SALUS_SSTL_MPSCQUEUE_H
+
+#include "utils/macros.h"
+
+#include <atomic>
+#include <type_traits>
+
+namespace sstl {
+
+/**
+ * @brief Base class for elements that can be linked into a MpscQueue. An element can be in at
+ * most one queue at a time.
+ */
+struct MpscQueueHook
+{
+    std::atomic<MpscQueueHook *> mpscNext{nullptr};
+};
+
+/**
+ * @brief An intrusive, unbounded, multi-producer single-consumer queue (Vyukov's algorithm).
+ *
+ * push is wait-free and never allocates. pop must only be called from one thread at a time, and
+ * may spuriously return nullptr while a producer is in the middle of a push; the element becomes
+ * visible as soon as that push completes.
+ *
+ * The queue doesn't own its elements: it's up to the caller to keep them alive while queued.
+ */
+template<typename T>
+class MpscQueue
+{
+    static_assert(std::is_base_of_v<MpscQueueHook, T>, "T must derive from MpscQueueHook");
+
+public:
+    MpscQueue() noexcept
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    {
+    }
+
+    void push(T *item) noexcept
+    {
+        pushHook(item);
+    }
+
+    T *pop() noexcept
+    {
+        auto tail = m_tail;
+        auto next = tail->mpscNext.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (!next) {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            m_tail = next;
+            return static_cast<T *>(tail);
+        }
+
+        // tail is the last element, unless a producer has swapped head but not linked it yet
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // re-insert the stub so tail can be unlinked
+        pushHook(&m_stub);
+
+        next = tail->mpscNext.load(std::memory_order_acquire);
+        if (next) {
+            m_tail = next;
+            return static_cast<T *>(tail);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Only meaningful on the consumer thread, and may still report non-empty when a
+     * following pop returns nullptr.
+     */
+    bool empty() const noexcept
+    {
+        return m_tail == &m_stub && !m_stub.mpscNext.load(std::memory_order_acquire);
+    }
+
+private:
+    void pushHook(MpscQueueHook *node) noexcept
+    {
+        node->mpscNext.store(nullptr, std::memory_order_relaxed);
+        auto prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->mpscNext.store(node, std::memory_order_release);
+    }
+
+    // producers only touch head, keep it away from the consumer's cache line
+    alignas(64) std::atomic<MpscQueueHook *> m_head;
+    alignas(64) MpscQueueHook *m_tail;
+    MpscQueueHook m_stub;
+
+    SALUS_DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+} // namespace sstl
+
+#endif // SALUS_SSTL_MPSCQUEUE_H
@@ -37,6 +37,59 @@ namespace protobuf = ::google::protobuf;
 
 namespace sstl {
 
+namespace {
+
+::google::protobuf::ArenaOptions arenaOptions(char *initial)
+{
+    ::google::protobuf::ArenaOptions options;
+    options.initial_block = initial;
+    options.initial_block_size = PooledArena::kInitialBlockSize;
+    // Large fetch sets have thousands of small messages, grow quickly past the first block
+    options.max_block_size = 1024 * 1024;
+    return options;
+}
+
+} // namespace
+
+PooledArena::PooledArena()
+    : m_initial(new char[kInitialBlockSize])
+    , m_arena(arenaOptions(m_initial.get()))
+{
+}
+
+void PooledArena::reset()
+{
+    m_arena.Reset();
+}
+
+ScopedArena::ScopedArena(ObjectPool<PooledArena>::ptr_type &&arena)
+    : m_arena(std::move(arena))
+{
+}
+
+ScopedArena::~ScopedArena()
+{
+    if (m_arena) {
+        m_arena->reset();
+    }
+}
+
+ScopedArena &ScopedArena::operator=(ScopedArena &&other) noexcept
+{
+    if (m_arena) {
+        m_arena->reset();
+    }
+    m_arena = std::move(other.m_arena);
+    return *this;
+}
+
+/*static*/ ScopedArena ScopedArena::acquire()
+{
+    // Never destroyed, so arenas still in use at exit don't go back to a dead pool
+    static auto pool = new std::shared_ptr<ObjectPool<PooledArena>>(std::make_shared<ObjectPool<PooledArena>>());
+    return ScopedArena((*pool)->acquire());
+}
+
 ProtoPtr newMessage(const std::string &type)
 {
     auto desc = protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(type);
@@ -20,6 +20,7 @@
 #ifndef SALUS_SSTL_PROTOUTILS_H
 #define SALUS_SSTL_PROTOUTILS_H
 
+#include "utils/objectpool.h"
 #include "utils/pointerutils.h"
 
 #ifndef NDEBUG
@@ -27,6 +28,7 @@
 #define NEED_UNDEF_NDEBUG
 #endif
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/message.h>
 
 #ifdef NEED_UNDEF_NDEBUG
@@ -52,6 +54,140 @@ std::unique_ptr<T> createMessage(const std::string &type, const void *data, size
     return static_unique_ptr_cast<T, ::google::protobuf::Message>(createMessage(type, data, len));
 }
 
+/**
+ * @brief Parse the protobuf message of static type `T` from a byte buffer `data` of length `len`, without
+ * looking up the type by name.
+ *
+ * @return parsed message, or nullptr if data is malformatted.
+ */
+template<typename T>
+std::unique_ptr<T> parseMessage(const void *data, size_t len)
+{
+    auto message = std::make_unique<T>();
+    if (!message->ParseFromArray(data, static_cast<int>(len))) {
+        return {};
+    }
+    return message;
+}
+
+/**
+ * @brief Deleter for messages that may be allocated on a protobuf Arena, in which case the arena owns
+ * them and nothing is done. Whether that is the case is recorded when created, so the pointer may
+ * safely go out of scope after the arena has been reset.
+ */
+struct ArenaAwareDelete
+{
+    bool onArena = false;
+
+    ArenaAwareDelete() noexcept = default;
+
+    explicit ArenaAwareDelete(bool onArena) noexcept
+        : onArena(onArena)
+    {
+    }
+
+    // Allows taking over plain heap allocated messages
+    template<typename U>
+    ArenaAwareDelete(const std::default_delete<U> &) noexcept // NOLINT(google-explicit-constructor)
+    {
+    }
+
+    template<typename T>
+    void operator()(T *ptr) const noexcept
+    {
+        if (!onArena) {
+            delete ptr;
+        }
+    }
+};
+
+template<typename T>
+using MaybeArenaPtr = std::unique_ptr<T, ArenaAwareDelete>;
+
+/**
+ * @brief Create an empty message of static type `T` on `arena`, or on heap if `arena` is nullptr.
+ */
+template<typename T>
+MaybeArenaPtr<T> newMessage(::google::protobuf::Arena *arena)
+{
+    return MaybeArenaPtr<T>(::google::protobuf::Arena::CreateMessage<T>(arena), ArenaAwareDelete(arena != nullptr));
+}
+
+/**
+ * @brief Like parseMessage, but with the message and all its nested fields allocated on `arena`, or on
+ * heap if `arena` is nullptr.
+ */
+template<typename T>
+MaybeArenaPtr<T> parseMessage(::google::protobuf::Arena *arena, const void *data, size_t len)
+{
+    auto message = newMessage<T>(arena);
+    if (!message->ParseFromArray(data, static_cast<int>(len))) {
+        return {};
+    }
+    return message;
+}
+
+/**
+ * @brief A protobuf Arena, with the first block kept across uses, so a message that fits in it takes no
+ * allocation at all.
+ */
+class PooledArena
+{
+public:
+    static constexpr size_t kInitialBlockSize = 64 * 1024;
+
+    PooledArena();
+
+    ::google::protobuf::Arena *get()
+    {
+        return &m_arena;
+    }
+
+    /**
+     * @brief Free everything allocated, but the first block. Called by ObjectPool before reuse.
+     */
+    void reset();
+
+private:
+    // Must outlive m_arena
+    std::unique_ptr<char[]> m_initial;
+    ::google::protobuf::Arena m_arena;
+};
+
+/**
+ * @brief Scoped ownership of a PooledArena from a process wide pool. The arena is reset when going out of
+ * scope, before going back to the pool, so idle arenas only hold their first block.
+ */
+class ScopedArena
+{
+public:
+    ScopedArena() = default;
+    ~ScopedArena();
+
+    ScopedArena(ScopedArena &&) noexcept = default;
+    ScopedArena &operator=(ScopedArena &&other) noexcept;
+
+    static ScopedArena acquire();
+
+    /**
+     * @return the arena, or nullptr if not acquired
+     */
+    ::google::protobuf::Arena *get() const
+    {
+        return m_arena ? m_arena->get() : nullptr;
+    }
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(m_arena);
+    }
+
+private:
+    explicit ScopedArena(ObjectPool<PooledArena>::ptr_type &&arena);
+
+    ObjectPool<PooledArena>::ptr_type m_arena;
+};
+
 /**
  * @brief Create the protobuf message from a coded input stream. The stream is expected to contains first a
  * varint of length and followed by that length of bytes as the message.
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "utils/sizeclassarena.h"
+
+#include <concurrentqueue.h>
+
+#include <array>
+#include <new>
+#include <vector>
+
+namespace sstl {
+
+namespace {
+
+static_assert(SizeClassArena::kMinSize << (SizeClassArena::kNumClasses - 1) == SizeClassArena::kMaxSize);
+
+// Blocks kept per class in each thread before spilling half of them to the shared pool
+constexpr size_t kLocalCacheLimit = 256;
+// Blocks taken from the shared pool at once
+constexpr size_t kRefillBatch = 32;
+
+size_t classOf(size_t size)
+{
+    size_t cls = 0;
+    for (auto cap = SizeClassArena::kMinSize; cap < size; cap <<= 1) {
+        ++cls;
+    }
+    return cls;
+}
+
+size_t classSize(size_t cls)
+{
+    return SizeClassArena::kMinSize << cls;
+}
+
+using SharedPool = moodycamel::ConcurrentQueue<void *>;
+
+SharedPool &sharedPool(size_t cls)
+{
+    // Intentionally leaked, blocks may still be freed during static destruction
+    static auto pools = new std::array<SharedPool, SizeClassArena::kNumClasses>;
+    return (*pools)[cls];
+}
+
+struct LocalCache
+{
+    std::array<std::vector<void *>, SizeClassArena::kNumClasses> blocks;
+
+    LocalCache()
+    {
+        for (auto &b : blocks) {
+            b.reserve(kLocalCacheLimit + 1);
+        }
+    }
+
+    // Give everything back when the thread exits, so other threads can reuse it
+    ~LocalCache()
+    {
+        for (size_t cls = 0; cls != blocks.size(); ++cls) {
+            auto &b = blocks[cls];
+            if (!b.empty() && !sharedPool(cls).enqueue_bulk(b.data(), b.size())) {
+                for (auto ptr : b) {
+                    ::operator delete(ptr);
+                }
+            }
+        }
+    }
+};
+
+// The cache is reached through a trivially destructible pointer, which stays valid to read
+// while other thread local objects are destroyed. Blocks freed after the cache is gone go to
+// the shared pool directly.
+thread_local LocalCache *t_cache = nullptr;
+thread_local bool t_exiting = false;
+
+struct CacheOwner
+{
+    ~CacheOwner()
+    {
+        t_exiting = true;
+        delete t_cache;
+        t_cache = nullptr;
+    }
+};
+thread_local CacheOwner t_owner;
+
+LocalCache *localCache()
+{
+    if (!t_cache && !t_exiting) {
+        // make sure the owner is constructed, thus destructed at thread exit
+        (void) &t_owner;
+        t_cache = new LocalCache;
+    }
+    return t_cache;
+}
+
+} // namespace
+
+/*static*/ void *SizeClassArena::allocate(size_t size)
+{
+    if (size > kMaxSize) {
+        return ::operator new(size);
+    }
+
+    auto cls = classOf(size);
+    if (auto cache = localCache()) {
+        auto &blocks = cache->blocks[cls];
+        if (blocks.empty()) {
+            void *batch[kRefillBatch];
+            auto n = sharedPool(cls).try_dequeue_bulk(batch, kRefillBatch);
+            blocks.insert(blocks.end(), batch, batch + n);
+        }
+        if (!blocks.empty()) {
+            auto ptr = blocks.back();
+            blocks.pop_back();
+            return ptr;
+        }
+    } else {
+        void *ptr = nullptr;
+        if (sharedPool(cls).try_dequeue(ptr)) {
+            return ptr;
+        }
+    }
+    return ::operator new(classSize(cls));
+}
+
+/*static*/ void SizeClassArena::deallocate(void *ptr, size_t size) noexcept
+{
+    if (!ptr) {
+        return;
+    }
+    if (size > kMaxSize) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    auto cls = classOf(size);
+    auto cache = localCache();
+    if (!cache) {
+        if (!sharedPool(cls).enqueue(ptr)) {
+            ::operator delete(ptr);
+        }
+        return;
+    }
+
+    auto &blocks = cache->blocks[cls];
+    blocks.push_back(ptr);
+    if (blocks.size() > kLocalCacheLimit) {
+        // Keep the most recently freed, which are more likely to be in cache
+        auto half = blocks.size() / 2;
+        if (!sharedPool(cls).enqueue_bulk(blocks.data(), half)) {
+            for (size_t i = 0; i != half; ++i) {
+                ::operator delete(blocks[i]);
+            }
+        }
+        blocks.erase(blocks.begin(), blocks.begin() + static_cast<long>(half));
+    }
+}
+
+} // namespace sstl
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SSTL_SIZECLASSARENA_H
+#define SALUS_SSTL_SIZECLASSARENA_H
+
+#include <cstddef>
+
+namespace sstl {
+
+/**
+ * @brief Process wide allocator for small, short lived blocks that are often freed on another
+ * thread than the one allocating them, e.g. closures passed to a thread pool.
+ *
+ * Sizes are rounded up to power of two classes from kMinSize to kMaxSize, larger sizes go
+ * directly to operator new. Each thread keeps a cache of free blocks per class, and spills to
+ * or refills from a shared lock-free pool in batches, so neither path takes a lock.
+ *
+ * Blocks are aligned for any fundamental type. The size passed to deallocate must be the
+ * one passed to allocate.
+ */
+class SizeClassArena
+{
+public:
+    static constexpr size_t kMinSize = 64;
+    static constexpr size_t kMaxSize = 4096;
+    static constexpr size_t kNumClasses = 7;
+
+    static void *allocate(size_t size);
+    static void deallocate(void *ptr, size_t size) noexcept;
+
+private:
+    SizeClassArena() = delete;
+};
+
+} // namespace sstl
+
+#endif // SALUS_SSTL_SIZECLASSARENA_H
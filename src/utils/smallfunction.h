@@ -0,0 +1,210 @@
+/*
+ * Copyright 2019 Peifeng Yu <peifeng@umich.edu>
+ * 
+ * This file is part of Salus
+ * (see https://github.com/SymbioticLab/Salus).
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SALUS_SSTL_SMALLFUNCTION_H
+#define SALUS_SSTL_SMALLFUNCTION_H
+
+#include "utils/sizeclassarena.h"
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace sstl {
+
+/**
+ * @brief Move only function wrapper with small buffer optimization.
+ *
+ * Callables that fit in InlineSize bytes and are nothrow movable are stored inline. Larger
+ * ones are allocated from SizeClassArena, so unlike FixedFunction there is no hard limit on
+ * capture size, and unlike std::function the fallback doesn't hit the general purpose heap.
+ *
+ * With the default InlineSize the whole object is one cache line.
+ */
+template<typename Signature, size_t InlineSize = 48>
+class SmallFunction;
+
+template<typename R, typename... Args, size_t InlineSize>
+class SmallFunction<R(Args...), InlineSize>
+{
+    static_assert(InlineSize >= sizeof(void *), "inline storage must be able to hold a pointer");
+
+    enum class Op
+    {
+        Move,
+        Destroy,
+    };
+
+    using InvokeFn = R (*)(void *, Args &&...);
+    using ManageFn = void (*)(Op, void *, void *) noexcept;
+
+    template<typename Fn>
+    static constexpr bool fitsInline = sizeof(Fn) <= InlineSize && alignof(Fn) <= alignof(std::max_align_t)
+                                       && std::is_nothrow_move_constructible<Fn>::value;
+
+    template<typename Fn>
+    using EnableIfCallable =
+        std::enable_if_t<!std::is_same<std::decay_t<Fn>, SmallFunction>::value
+                         && std::is_invocable_r<R, std::decay_t<Fn> &, Args...>::value>;
+
+public:
+    SmallFunction() noexcept = default;
+
+    SmallFunction(std::nullptr_t) noexcept
+    {
+    }
+
+    template<typename Func, typename = EnableIfCallable<Func>>
+    SmallFunction(Func &&func)
+    {
+        using Fn = std::decay_t<Func>;
+
+        if constexpr (std::is_pointer<Fn>::value || std::is_member_pointer<Fn>::value) {
+            if (!func) {
+                return;
+            }
+        }
+
+        if constexpr (fitsInline<Fn>) {
+            new (&m_storage) Fn(std::forward<Func>(func));
+            m_invoke = &invokeInline<Fn>;
+            m_manage = &manageInline<Fn>;
+        } else {
+            static_assert(alignof(Fn) <= alignof(std::max_align_t), "over-aligned callables are not supported");
+            auto mem = SizeClassArena::allocate(sizeof(Fn));
+            try {
+                *reinterpret_cast<Fn **>(&m_storage) = new (mem) Fn(std::forward<Func>(func));
+            } catch (...) {
+                SizeClassArena::deallocate(mem, sizeof(Fn));
+                throw;
+            }
+            m_invoke = &invokeHeap<Fn>;
+            m_manage = &manageHeap<Fn>;
+        }
+    }
+
+    SmallFunction(SmallFunction &&other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    SmallFunction &operator=(SmallFunction &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    SmallFunction &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    SmallFunction(const SmallFunction &) = delete;
+    SmallFunction &operator=(const SmallFunction &) = delete;
+
+    ~SmallFunction()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_invoke != nullptr;
+    }
+
+    R operator()(Args... args)
+    {
+        if (!m_invoke) {
+            throw std::runtime_error("call of empty functor");
+        }
+        return m_invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+private:
+    void reset() noexcept
+    {
+        if (m_manage) {
+            m_manage(Op::Destroy, &m_storage, nullptr);
+        }
+        m_invoke = nullptr;
+        m_manage = nullptr;
+    }
+
+    void moveFrom(SmallFunction &other) noexcept
+    {
+        if (!other.m_manage) {
+            return;
+        }
+        other.m_manage(Op::Move, &other.m_storage, &m_storage);
+        m_invoke = other.m_invoke;
+        m_manage = other.m_manage;
+        other.m_invoke = nullptr;
+        other.m_manage = nullptr;
+    }
+
+    template<typename Fn>
+    static R invokeInline(void *storage, Args &&... args)
+    {
+        return std::invoke(*static_cast<Fn *>(storage), std::forward<Args>(args)...);
+    }
+
+    template<typename Fn>
+    static void manageInline(Op op, void *src, void *dst) noexcept
+    {
+        auto fn = static_cast<Fn *>(src);
+        if (op == Op::Move) {
+            new (dst) Fn(std::move(*fn));
+        }
+        // the moved from object is destroyed as well
+        fn->~Fn();
+    }
+
+    template<typename Fn>
+    static R invokeHeap(void *storage, Args &&... args)
+    {
+        return std::invoke(**static_cast<Fn **>(storage), std::forward<Args>(args)...);
+    }
+
+    template<typename Fn>
+    static void manageHeap(Op op, void *src, void *dst) noexcept
+    {
+        auto fn = *static_cast<Fn **>(src);
+        if (op == Op::Move) {
+            *static_cast<Fn **>(dst) = fn;
+            return;
+        }
+        fn->~Fn();
+        SizeClassArena::deallocate(fn, sizeof(Fn));
+    }
+
+    std::aligned_storage_t<InlineSize, alignof(std::max_align_t)> m_storage;
+    InvokeFn m_invoke = nullptr;
+    ManageFn m_manage = nullptr;
+};
+
+} // namespace sstl
+
+#endif // SALUS_SSTL_SMALLFUNCTION_H
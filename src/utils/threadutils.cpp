@@ -66,4 +66,12 @@ void notification::wait()
     m_notified = false;
 }
 
+bool notification::wait_for(std::chrono::nanoseconds timeout)
+{
+    auto g = with_uguard(m_mu);
+    auto notified = m_cv.wait_for(g, timeout, [this]() { return m_notified; });
+    m_notified = false;
+    return notified;
+}
+
 } // namespace sstl
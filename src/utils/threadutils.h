@@ -263,6 +263,11 @@ public:
     void notify();
     bool notified();
     void wait();
+    /**
+     * @brief Wait until notified or timeout
+     * @returns false if timed out
+     */
+    bool wait_for(std::chrono::nanoseconds timeout);
 };
 
 } // namespace sstl